@@ -282,13 +282,18 @@ struct LDSBarrierOpLowering : public ConvertOpToLLVMPattern<LDSBarrierOp> {
     bool requiresInlineAsm =
         chipset.majorVersion < 9 ||
         (chipset.majorVersion == 9 && chipset.minorVersion < 0x0a) ||
-        (chipset.majorVersion == 11);
+        (chipset.majorVersion == 11) || (chipset.majorVersion == 12);
 
     if (requiresInlineAsm) {
       auto asmDialectAttr = LLVM::AsmDialectAttr::get(rewriter.getContext(),
                                                       LLVM::AsmDialect::AD_ATT);
+      // gfx12 has a separate LDS counter and a split barrier.
       const char *asmStr =
-          ";;;WARNING: BREAKS DEBUG WATCHES\ns_waitcnt lgkmcnt(0)\ns_barrier";
+          chipset.majorVersion == 12
+              ? ";;;WARNING: BREAKS DEBUG WATCHES\ns_wait_dscnt 0x0\n"
+                "s_barrier_signal -1\ns_barrier_wait -1"
+              : ";;;WARNING: BREAKS DEBUG WATCHES\ns_waitcnt lgkmcnt(0)\n"
+                "s_barrier";
       const char *constraints = "";
       rewriter.replaceOpWithNewOp<LLVM::InlineAsmOp>(
           op,
@@ -361,10 +366,11 @@ static Value mfmaConcatIfNeeded(ConversionPatternRewriter &rewriter,
   return input;
 }
 
-/// Push an input operand. If it is a float type, nothing to do. If it is
-/// an integer type, then we need to also push its signdness (1 for signed, 0
-/// for unsigned) and we need to pack the input 16xi8 vector into a 4xi32
-/// vector. We also need to convert bfloat inputs to i16 to account for the lack
+/// Push an input operand. If it is a 16-bit float type, nothing to do. If it
+/// is an integer type, then we need to also push its signdness (1 for signed, 0
+/// for unsigned) and we need to pack the input vector into i32s, e.g. 16xi8
+/// into 4xi32. The 8-bit floats of RDNA4 are packed the same way, without a
+/// sign. We also need to convert bfloat inputs to i16 to account for the lack
 /// of bfloat support in the WMMA intrinsics themselves.
 static void wmmaPushInputOperand(ConversionPatternRewriter &rewriter,
                                  Location loc,
@@ -378,24 +384,31 @@ static void wmmaPushInputOperand(ConversionPatternRewriter &rewriter,
   if (elemType.isBF16())
     llvmInput = rewriter.create<LLVM::BitcastOp>(
         loc, vectorType.clone(rewriter.getI16Type()), llvmInput);
-  if (!elemType.isInteger(8)) {
+  bool isFp8 = elemType.isFloat8E4M3FN() || elemType.isFloat8E5M2();
+  if (!isa<IntegerType>(elemType) && !isFp8) {
     operands.push_back(llvmInput);
     return;
   }
 
-  int64_t numBytes = vectorType.getNumElements();
+  int64_t numBits =
+      vectorType.getNumElements() * elemType.getIntOrFloatBitWidth();
   Type i32 = rewriter.getI32Type();
-  VectorType vectorType32bits = VectorType::get(numBytes * 8 / 32, i32);
-  auto llvmVectorType32bits = typeConverter->convertType(vectorType32bits);
-
-  Value result = rewriter.createOrFold<LLVM::BitcastOp>(
-      loc, llvmVectorType32bits, llvmInput);
+  Type packedType = i32;
+  if (numBits > 32)
+    packedType = typeConverter->convertType(VectorType::get(numBits / 32, i32));
+
+  Value result =
+      rewriter.createOrFold<LLVM::BitcastOp>(loc, packedType, llvmInput);
+  if (isFp8) {
+    operands.push_back(result);
+    return;
+  }
 
-  // if element type is 8-bit signed or unsigned, ignore the isUnsigned flag
+  // if element type is signed or unsigned, ignore the isUnsigned flag
   bool localIsUnsigned = isUnsigned;
-  if (elemType.isUnsignedInteger(8)) {
+  if (elemType.isUnsignedInteger()) {
     localIsUnsigned = true;
-  } else if (elemType.isSignedInteger(8)) {
+  } else if (elemType.isSignedInteger()) {
     localIsUnsigned = false;
   }
   Value sign = createI1Constant(rewriter, loc, !localIsUnsigned);
@@ -585,6 +598,15 @@ static std::optional<StringRef> wmmaOpToIntrinsic(WMMAOp wmma,
     return ROCDL::wmma_bf16_16x16x16_bf16::getOperationName();
   } else if (elemSourceType.isInteger(8) && elemDestType.isInteger(32)) {
     return ROCDL::wmma_i32_16x16x16_iu8::getOperationName();
+  } else if (elemSourceType.isInteger(4) && elemDestType.isInteger(32)) {
+    return ROCDL::wmma_i32_16x16x16_iu4::getOperationName();
+  }
+  if (chipset.majorVersion < 12)
+    return std::nullopt;
+  if (elemSourceType.isFloat8E4M3FN() && elemDestType.isF32()) {
+    return ROCDL::wmma_f32_16x16x16_fp8_fp8::getOperationName();
+  } else if (elemSourceType.isFloat8E5M2() && elemDestType.isF32()) {
+    return ROCDL::wmma_f32_16x16x16_bf8_bf8::getOperationName();
   }
   return std::nullopt;
 }
@@ -646,8 +668,14 @@ struct WMMAOpLowering : public ConvertOpToLLVMPattern<WMMAOp> {
     Location loc = op.getLoc();
     Type outType = typeConverter->convertType(op.getDestD().getType());
 
-    if (chipset.majorVersion != 11)
-      return op->emitOpError("WMMA only supported on gfx11");
+    if (chipset.majorVersion != 11 && chipset.majorVersion != 12)
+      return op->emitOpError("WMMA only supported on gfx11 and gfx12");
+
+    // RDNA4 splits k between the two halves of the wave, RDNA3 duplicates it.
+    int64_t sourceLen =
+        cast<VectorType>(op.getSourceA().getType()).getNumElements();
+    if (sourceLen != (chipset.majorVersion == 12 ? 8 : 16))
+      return op->emitOpError("unexpected WMMA source length for the chipset");
 
     std::optional<StringRef> maybeIntrinsic = wmmaOpToIntrinsic(op, chipset);
 
@@ -149,8 +149,15 @@ bool isLeadingOp(Operation *op, bool trailingOnly) {
   return isAlwaysLeadingOp(op) || (!trailingOnly && isFuseableOp(op));
 }
 
+// Slices created by mhal-horizontal-fusion are trailing so that the
+// per-consumer pieces of a horizontally fused GEMM stay in its kernel along
+// with their epilogues. Other slices are left alone.
+bool isHorizontalFusionSlice(Operation *op) {
+  return isSliceOp(op) && op->hasAttr("mhal.horizontal_slice");
+}
+
 bool isTrailingOp(Operation *op) {
-  return isTransposeOp(op) || isFuseableOp(op);
+  return isTransposeOp(op) || isHorizontalFusionSlice(op) || isFuseableOp(op);
 }
 
 class TosaPartitionPass
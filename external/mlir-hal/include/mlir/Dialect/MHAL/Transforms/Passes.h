@@ -29,6 +29,8 @@ namespace mhal {
 
 #define GEN_PASS_DECL_MHALTARGETKERNELSPASS
 #define GEN_PASS_DECL_MHALINFERGRAPHPASS
+#define GEN_PASS_DECL_MHALHORIZONTALFUSIONPASS
+#define GEN_PASS_DECL_MHALHOISTKERNELCONSTANTSPASS
 #define GEN_PASS_DECL_MHALPACKAGETARGETSPASS
 #define GEN_PASS_DECL_MHALSELECTTARGETSPASS
 #define GEN_PASS_DECL_MHALBUFFERIZEPASS
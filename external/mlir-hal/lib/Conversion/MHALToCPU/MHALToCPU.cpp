@@ -10,8 +10,10 @@
 
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
 #include "mlir/Dialect/MHAL/IR/MHAL.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Interfaces/ControlFlowInterfaces.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
@@ -59,11 +61,12 @@ struct LaunchRewritePattern : public OpRewritePattern<mhal::LaunchOp> {
     if (auto func = getCalledFunc(op)) {
       // Replace the original `async.execute` with a call to outlined
       // function.
-      rw.create<func::CallOp>(loc, *func, op.getArgOperands());
+      auto call = rw.create<func::CallOp>(loc, *func, op.getArgOperands());
 
-      Value empty;
-      op->replaceAllUsesWith(ValueRange(empty));
-      op->erase();
+      // Tokens are dropped before launches are converted.
+      assert(op.getToken().use_empty());
+      op.getCallResults().replaceAllUsesWith(call.getResults());
+      rw.eraseOp(op);
 
       return success();
     }
@@ -73,20 +76,129 @@ struct LaunchRewritePattern : public OpRewritePattern<mhal::LaunchOp> {
 } // namespace
 
 //===----------------------------------------------------------------------===//
-// Remove all mhal.await ops
+// Remove all mhal.token values
 //===----------------------------------------------------------------------===//
 
-namespace {
-struct AwaitRewritePattern : public OpRewritePattern<mhal::AwaitOp> {
-  using OpRewritePattern<mhal::AwaitOp>::OpRewritePattern;
-
-  LogicalResult matchAndRewrite(mhal::AwaitOp op,
-                                PatternRewriter &rw) const override {
-    rw.eraseOp(op);
-    return success();
+// A CPU launch completes before its call returns, so every token left in the
+// IR has completed. Awaits on them are erased and the tokens are dropped
+// together with the block arguments, function arguments and function results
+// that carry them. GPU ops that still depend on one get a fresh token.
+static LogicalResult dropTokens(ModuleOp module) {
+  auto isToken = [](Type type) { return type.isa<mhal::TokenType>(); };
+
+  module.walk([](mhal::AwaitOp op) { op.erase(); });
+  module.walk([](mhal::LaunchOp op) { op.getDependenciesMutable().clear(); });
+  module.walk([&](gpu::AsyncOpInterface op) {
+    for (OpOperand &operand : op->getOpOperands()) {
+      if (!isToken(operand.get().getType()))
+        continue;
+      OpBuilder b(op);
+      operand.set(b.create<gpu::WaitOp>(op->getLoc(),
+                                        b.getType<gpu::AsyncTokenType>(),
+                                        ValueRange{})
+                      .getAsyncToken());
+    }
+  });
+
+  // Remove the tokens forwarded to block arguments, returned from functions
+  // and passed to them.
+  SmallVector<std::pair<Block *, BitVector>> blockArgs;
+  WalkResult walkResult = module.walk([&](Block *block) {
+    if (block->isEntryBlock())
+      return WalkResult::advance();
+    BitVector erase(block->getNumArguments());
+    for (BlockArgument arg : block->getArguments())
+      erase[arg.getArgNumber()] = isToken(arg.getType());
+    if (erase.none())
+      return WalkResult::advance();
+    for (auto it = block->pred_begin(), e = block->pred_end(); it != e; ++it) {
+      auto branch = dyn_cast<BranchOpInterface>((*it)->getTerminator());
+      if (!branch) {
+        (*it)->getTerminator()->emitOpError("cannot drop forwarded tokens");
+        return WalkResult::interrupt();
+      }
+      SuccessorOperands operands =
+          branch.getSuccessorOperands(it.getSuccessorIndex());
+      for (int idx = erase.find_last(); idx >= 0; idx = erase.find_prev(idx)) {
+        if (operands.isOperandProduced(idx)) {
+          branch->emitOpError("cannot drop produced tokens");
+          return WalkResult::interrupt();
+        }
+        operands.erase(idx);
+      }
+    }
+    blockArgs.emplace_back(block, std::move(erase));
+    return WalkResult::advance();
+  });
+  if (walkResult.wasInterrupted())
+    return failure();
+
+  struct FuncTokens {
+    func::FuncOp func;
+    BitVector args, results;
+    SmallVector<func::CallOp> calls;
+  };
+  SmallVector<FuncTokens> funcs;
+  walkResult = module.walk([&](func::FuncOp func) {
+    FuncTokens tokens{func, BitVector(func.getNumArguments()),
+                      BitVector(func.getNumResults()), {}};
+    for (auto [idx, type] : llvm::enumerate(func.getArgumentTypes()))
+      tokens.args[idx] = isToken(type);
+    for (auto [idx, type] : llvm::enumerate(func.getResultTypes()))
+      tokens.results[idx] = isToken(type);
+    if (tokens.args.none() && tokens.results.none())
+      return WalkResult::advance();
+
+    auto uses = SymbolTable::getSymbolUses(func, func->getParentOp());
+    if (!uses) {
+      func.emitOpError("cannot drop tokens from unknown uses");
+      return WalkResult::interrupt();
+    }
+    for (const SymbolTable::SymbolUse &use : *uses) {
+      auto call = dyn_cast<func::CallOp>(use.getUser());
+      if (!call) {
+        use.getUser()->emitOpError("cannot drop tokens from this use");
+        return WalkResult::interrupt();
+      }
+      call->eraseOperands(tokens.args);
+      tokens.calls.push_back(call);
+    }
+    func.walk([&](func::ReturnOp op) { op->eraseOperands(tokens.results); });
+    funcs.push_back(std::move(tokens));
+    return WalkResult::advance();
+  });
+  if (walkResult.wasInterrupted())
+    return failure();
+
+  walkResult = module.walk([&](Operation *op) {
+    if (llvm::any_of(op->getOperandTypes(), isToken)) {
+      op->emitOpError("uses an mhal.token that cannot be dropped");
+      return WalkResult::interrupt();
+    }
+    return WalkResult::advance();
+  });
+  if (walkResult.wasInterrupted())
+    return failure();
+
+  for (auto &[block, erase] : blockArgs)
+    block->eraseArguments(erase);
+  for (FuncTokens &tokens : funcs) {
+    tokens.func.eraseArguments(tokens.args);
+    tokens.func.eraseResults(tokens.results);
+    for (func::CallOp call : tokens.calls) {
+      OpBuilder b(call);
+      auto newCall = b.create<func::CallOp>(call.getLoc(), tokens.func,
+                                            call.getOperands());
+      auto newResults = newCall.getResults().begin();
+      for (OpResult result : call->getResults()) {
+        if (!tokens.results.test(result.getResultNumber()))
+          result.replaceAllUsesWith(*newResults++);
+      }
+      call.erase();
+    }
   }
-};
-} // namespace
+  return success();
+}
 
 //===----------------------------------------------------------------------===//
 
@@ -101,10 +213,12 @@ void ConvertMHALToCPUPass::runOnOperation() {
   auto op = getOperation();
   MLIRContext *ctx = op->getContext();
 
-  // Convert mhal.launch to func.call ops, remove all mhal.await ops
+  if (failed(dropTokens(op)))
+    return signalPassFailure();
+
+  // Convert mhal.launch to func.call ops
   RewritePatternSet patterns(ctx);
   patterns.add<LaunchRewritePattern>(ctx);
-  patterns.add<AwaitRewritePattern>(ctx);
 
   if (failed(applyPatternsAndFoldGreedily(op, std::move(patterns))))
     signalPassFailure();
@@ -15,6 +15,7 @@
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/IR/TypeUtilities.h"
 #include "mlir/Interfaces/CallInterfaces.h"
+#include "mlir/Interfaces/ControlFlowInterfaces.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
@@ -341,6 +342,128 @@ struct AwaitRewritePattern : public OpRewritePattern<mhal::AwaitOp> {
 };
 } // namespace
 
+//===----------------------------------------------------------------------===//
+// Retype tokens carried through control flow.
+//===----------------------------------------------------------------------===//
+
+// mhal-infer-graph threads tokens through loop-carried values, conditionals
+// and calls, which reach block arguments once SCF is lowered to CF, and
+// function arguments and results. After the launches feeding such a value
+// have become gpu.launch_func ops, it is retyped to !gpu.async.token.
+// Incoming tokens from launches that stay on the CPU are already complete, so
+// they are replaced by a fresh token on that edge.
+static void retypeTokenArguments(Operation *root) {
+  MLIRContext *ctx = root->getContext();
+  auto gpuTokenType = gpu::AsyncTokenType::get(ctx);
+
+  auto getIncoming = [](BlockArgument arg,
+                        SmallVectorImpl<OpOperand *> &incoming) -> bool {
+    Block *block = arg.getOwner();
+    for (auto it = block->pred_begin(), e = block->pred_end(); it != e; ++it) {
+      auto branch = dyn_cast<BranchOpInterface>((*it)->getTerminator());
+      if (!branch)
+        return false;
+      SuccessorOperands succOperands =
+          branch.getSuccessorOperands(it.getSuccessorIndex());
+      OperandRange forwarded = succOperands.getForwardedOperands();
+      unsigned produced = succOperands.getProducedOperandCount();
+      if (arg.getArgNumber() < produced)
+        return false;
+      incoming.push_back(&(*it)->getTerminator()->getOpOperand(
+          forwarded.getBeginOperandIndex() + arg.getArgNumber() - produced));
+    }
+    return true;
+  };
+
+  // Returns true if one of the incoming values is a GPU token, after giving
+  // every other edge a fresh one.
+  auto retypeIncoming = [&](ArrayRef<OpOperand *> incoming) {
+    if (llvm::none_of(incoming, [&](OpOperand *operand) {
+          return operand->get().getType() == gpuTokenType;
+        }))
+      return false;
+    for (OpOperand *operand : incoming) {
+      if (operand->get().getType() == gpuTokenType)
+        continue;
+      OpBuilder b(operand->getOwner());
+      operand->set(b.create<gpu::WaitOp>(operand->getOwner()->getLoc(),
+                                         gpuTokenType, ValueRange{})
+                       .getAsyncToken());
+    }
+    return true;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    root->walk([&](Block *block) {
+      if (block->isEntryBlock())
+        return;
+      for (BlockArgument arg : block->getArguments()) {
+        if (!arg.getType().isa<mhal::TokenType>())
+          continue;
+        SmallVector<OpOperand *> incoming;
+        if (!getIncoming(arg, incoming) || !retypeIncoming(incoming))
+          continue;
+        arg.setType(gpuTokenType);
+        changed = true;
+      }
+    });
+
+    root->walk([&](func::FuncOp func) {
+      if (func.isExternal())
+        return;
+      auto uses = SymbolTable::getSymbolUses(func, func->getParentOp());
+      if (!uses)
+        return;
+      SmallVector<func::CallOp> calls;
+      for (const SymbolTable::SymbolUse &use : *uses) {
+        auto call = dyn_cast<func::CallOp>(use.getUser());
+        if (!call)
+          return;
+        calls.push_back(call);
+      }
+      SmallVector<func::ReturnOp> returns;
+      for (Block &block : func.getBody()) {
+        if (auto returnOp = dyn_cast<func::ReturnOp>(block.getTerminator()))
+          returns.push_back(returnOp);
+      }
+
+      bool retyped = false;
+      for (BlockArgument arg : func.getArguments()) {
+        if (!arg.getType().isa<mhal::TokenType>())
+          continue;
+        SmallVector<OpOperand *> incoming;
+        for (func::CallOp call : calls)
+          incoming.push_back(&call->getOpOperand(arg.getArgNumber()));
+        if (!retypeIncoming(incoming))
+          continue;
+        arg.setType(gpuTokenType);
+        retyped = true;
+      }
+      SmallVector<Type> resultTypes(func.getResultTypes());
+      for (unsigned idx = 0, e = resultTypes.size(); idx < e; ++idx) {
+        if (!resultTypes[idx].isa<mhal::TokenType>())
+          continue;
+        SmallVector<OpOperand *> incoming;
+        for (func::ReturnOp returnOp : returns)
+          incoming.push_back(&returnOp->getOpOperand(idx));
+        if (!retypeIncoming(incoming))
+          continue;
+        resultTypes[idx] = gpuTokenType;
+        for (func::CallOp call : calls)
+          call.getResult(idx).setType(gpuTokenType);
+        retyped = true;
+      }
+      if (!retyped)
+        return;
+      func.setType(FunctionType::get(ctx, func.getBody().getArgumentTypes(),
+                                     resultTypes));
+      changed = true;
+    });
+  }
+}
+
 //===----------------------------------------------------------------------===//
 
 namespace {
@@ -363,6 +486,8 @@ void ConvertMHALToGPUPass::runOnOperation() {
       signalPassFailure();
   }
 
+  retypeTokenArguments(op);
+
   {
     // Convert mhal.await to gpu.wait if has gpu.tokens
     RewritePatternSet patterns(ctx);
@@ -71,21 +71,30 @@ void mhal::buildGraphPipeline(OpPassManager &pm,
   pm.addNestedPass<func::FuncOp>(tosa::createTosaMakeBroadcastablePass());
   pm.addNestedPass<func::FuncOp>(createCanonicalizerPass());
 
+  // merge GEMMs that share an input so they land in one kernel
+  /* mlir-opt --mhal-horizontal-fusion
+   */
+  pm.addNestedPass<func::FuncOp>(createMHALHorizontalFusionPass());
+
   SmallVector<std::string, 4> anchors{"tosa.conv2d", "tosa.depthwise_conv2d",
-                                      "tosa.matmul"};
+                                      "tosa.transpose_conv2d", "tosa.matmul"};
   tosa::TosaPartitionOptions opts;
   opts.anchorOps = anchors;
   opts.trailingOnly = true;
   pm.addPass(tosa::createTosaPartition(opts));
 
-  /* mlir-opt --duplicate-function-elimination
+  // pass inlined constants as arguments so that kernels which only differ in
+  // their constants are merged
+  /* mlir-opt --mhal-hoist-kernel-constants
+   *   --duplicate-function-elimination
    */
+  pm.addPass(createMHALHoistKernelConstantsPass());
   pm.addPass(func::createDuplicateFunctionEliminationPass());
 
   // make mhal kernel launch's
   /* mlir-opt --mhal-infer-graph
    */
-  pm.addNestedPass<func::FuncOp>(createMHALInferGraphPass());
+  pm.addPass(createMHALInferGraphPass());
 
   // clone 'kernel' funcs into __kernel_<arch> module
   /* mlir-opt --mhal-target-kernels
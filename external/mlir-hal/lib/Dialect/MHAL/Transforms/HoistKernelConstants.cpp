@@ -0,0 +1,116 @@
+//===- HoistKernelConstants.cpp - Pass kernel constants as arguments ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// After partitioning, every kernel func carries the constant tensors its ops
+// use inline. Repeated layers of a network lower to kernels that are the same
+// except for these literals (their biases, scales, masks or small weights), so
+// duplicate function elimination can't merge them and each one is compiled on
+// its own. This pass moves such constants to new trailing arguments of the
+// kernel and clones them in front of every call, leaving the kernels to be
+// merged.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MHAL/Transforms/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Support/LLVM.h"
+#include "llvm/ADT/TypeSwitch.h"
+#include "llvm/Support/Debug.h"
+
+namespace mlir {
+namespace mhal {
+#define GEN_PASS_DEF_MHALHOISTKERNELCONSTANTSPASS
+#include "mlir/Dialect/MHAL/Transforms/Passes.h.inc"
+} // namespace mhal
+} // namespace mlir
+
+#define DEBUG_TYPE "mhal-hoist-kernel-constants"
+
+using namespace mlir;
+
+namespace {
+struct MHALHoistKernelConstantsPass
+    : public mhal::impl::MHALHoistKernelConstantsPassBase<
+          MHALHoistKernelConstantsPass> {
+  using mhal::impl::MHALHoistKernelConstantsPassBase<
+      MHALHoistKernelConstantsPass>::MHALHoistKernelConstantsPassBase;
+  void runOnOperation() override;
+};
+} // namespace
+
+/// Whether `use` reads the constant as tensor data, which an argument can
+/// provide just as well, rather than as a parameter the op needs to know at
+/// compile time (transpose permutations, paddings, tables, ...).
+static bool isDataUse(OpOperand &use) {
+  Operation *user = use.getOwner();
+  unsigned idx = use.getOperandNumber();
+  return TypeSwitch<Operation *, bool>(user)
+      .Case<tosa::MatMulOp, tosa::ConcatOp, tosa::CastOp>(
+          [](auto) { return true; })
+      // Input, weights and bias.
+      .Case<tosa::Conv2DOp, tosa::Conv3DOp, tosa::DepthwiseConv2DOp,
+            tosa::TransposeConv2DOp>([&](auto) { return idx <= 2; })
+      .Case<tosa::TransposeOp, tosa::PadOp, tosa::ReshapeOp, tosa::SliceOp,
+            tosa::TileOp, tosa::ReverseOp>([&](auto) { return idx == 0; })
+      .Default([](Operation *op) {
+        return op->hasTrait<OpTrait::ResultsBroadcastableShape>();
+      });
+}
+
+void MHALHoistKernelConstantsPass::runOnOperation() {
+  ModuleOp module = getOperation();
+
+  for (auto func : module.getOps<func::FuncOp>()) {
+    if (!func->hasAttr("kernel") || func.isExternal())
+      continue;
+    std::optional<SymbolTable::UseRange> uses =
+        SymbolTable::getSymbolUses(func, module);
+    if (!uses)
+      continue;
+    SmallVector<func::CallOp> calls;
+    bool onlyCalled = llvm::all_of(*uses, [&](SymbolTable::SymbolUse use) {
+      auto call = dyn_cast<func::CallOp>(use.getUser());
+      if (call)
+        calls.push_back(call);
+      return call != nullptr;
+    });
+    if (!onlyCalled)
+      continue;
+
+    SmallVector<tosa::ConstOp> hoisted;
+    func.walk([&](tosa::ConstOp cst) {
+      ElementsAttr value = cst.getValue();
+      if (value.isSplat() || value.getNumElements() <= maxInlineElements)
+        return;
+      if (llvm::all_of(cst->getUses(), isDataUse))
+        hoisted.push_back(cst);
+    });
+    if (hoisted.empty())
+      continue;
+    LLVM_DEBUG(llvm::dbgs() << "Hoisting " << hoisted.size()
+                            << " constants out of " << func.getName() << "\n");
+
+    for (func::CallOp call : calls) {
+      OpBuilder b(call);
+      SmallVector<Value> extraOperands;
+      for (tosa::ConstOp cst : hoisted)
+        extraOperands.push_back(b.clone(*cst)->getResult(0));
+      call->insertOperands(call->getNumOperands(), extraOperands);
+    }
+    for (tosa::ConstOp cst : hoisted) {
+      unsigned argNo = func.getNumArguments();
+      func.insertArgument(argNo, cst.getType(), {}, cst.getLoc());
+      cst.replaceAllUsesWith(func.getArgument(argNo));
+      cst.erase();
+    }
+  }
+}
@@ -0,0 +1,250 @@
+//===- HorizontalFusion.cpp - Merge sibling GEMMs over a shared input -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file merges `tosa.matmul` and `tosa.conv2d` ops that read the same
+// activation with constant weights of compatible shape (Q/K/V projections,
+// gate/up projections, parallel 1x1 convolutions) into one op over the
+// concatenated output-channel dimension. Every original result is replaced by
+// a `tosa.slice` of the wide result, tagged `mhal.horizontal_slice`, which the
+// partitioner keeps in the wide op's kernel together with the epilogue that
+// consumes it.
+//
+// Only constant weights are merged: the wide weight is built at compile time.
+// Weights passed as function arguments would need a `tosa.concat` (or a
+// concatenating view) in the kernel, and concatenation has no Rock lowering,
+// so siblings with argument weights are left alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MHAL/Transforms/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinAttributes.h"
+#include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/Support/LLVM.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/TypeSwitch.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+
+namespace mlir {
+namespace mhal {
+#define GEN_PASS_DEF_MHALHORIZONTALFUSIONPASS
+#include "mlir/Dialect/MHAL/Transforms/Passes.h.inc"
+} // namespace mhal
+} // namespace mlir
+
+#define DEBUG_TYPE "mhal-horizontal-fusion"
+
+using namespace mlir;
+
+namespace {
+/// Describes how a fusable op is widened: the operand shared between
+/// siblings, the constant operands concatenated along an axis, and the axis
+/// of the result the siblings are sliced back out of.
+struct WideningInfo {
+  unsigned sharedOperand;
+  SmallVector<std::pair<unsigned, int64_t>, 2> concatOperands;
+  int64_t resultAxis;
+};
+
+struct MHALHorizontalFusionPass
+    : public mhal::impl::MHALHorizontalFusionPassBase<
+          MHALHorizontalFusionPass> {
+  void runOnOperation() override;
+};
+} // namespace
+
+static std::optional<WideningInfo> getWideningInfo(Operation *op) {
+  return TypeSwitch<Operation *, std::optional<WideningInfo>>(op)
+      // [G, M, K] x [G, K, N] -> [G, M, N]
+      .Case<tosa::MatMulOp>([](auto) {
+        return WideningInfo{0, {{1, 2}}, 2};
+      })
+      // NHWC x [O, Y, X, C] (+ [O]) -> NHWO
+      .Case<tosa::Conv2DOp>([](tosa::Conv2DOp conv)
+                                -> std::optional<WideningInfo> {
+        if (conv.getGroup().value_or(1) != 1)
+          return std::nullopt;
+        return WideningInfo{0, {{1, 0}, {2, 0}}, 3};
+      })
+      .Default([](Operation *) { return std::nullopt; });
+}
+
+static DenseElementsAttr getConstant(Value v) {
+  DenseElementsAttr attr;
+  if (!matchPattern(v, m_Constant(&attr)))
+    return {};
+  return attr;
+}
+
+/// Two ops can share a wide op if they are the same kind of op in the same
+/// block with the same attributes, and all their concatenated operands are
+/// constants that only differ in the size of the concatenation axis.
+/// Non-constant weights (e.g. function arguments) are rejected; see the file
+/// header.
+static bool areCompatible(Operation *leader, Operation *op,
+                          const WideningInfo &info) {
+  if (leader->getName() != op->getName() ||
+      leader->getBlock() != op->getBlock() ||
+      leader->getAttrDictionary() != op->getAttrDictionary())
+    return false;
+  auto leaderResType = leader->getResult(0).getType().cast<ShapedType>();
+  auto resType = op->getResult(0).getType().cast<ShapedType>();
+  if (leaderResType.getElementType() != resType.getElementType())
+    return false;
+  for (auto [idx, axis] : info.concatOperands) {
+    DenseElementsAttr lhs = getConstant(leader->getOperand(idx));
+    DenseElementsAttr rhs = getConstant(op->getOperand(idx));
+    if (!lhs || !rhs)
+      return false;
+    ShapedType lhsType = lhs.getType(), rhsType = rhs.getType();
+    // i1 is bit-packed in storage, which concatConstants() doesn't handle.
+    if (lhsType.getElementType() != rhsType.getElementType() ||
+        lhsType.getElementType().isInteger(1) ||
+        lhsType.getRank() != rhsType.getRank())
+      return false;
+    for (int64_t d = 0, e = lhsType.getRank(); d < e; ++d)
+      if (d != axis && lhsType.getDimSize(d) != rhsType.getDimSize(d))
+        return false;
+  }
+  return true;
+}
+
+/// Concatenates constant `parts` along `axis`.
+static DenseElementsAttr concatConstants(ArrayRef<DenseElementsAttr> parts,
+                                         int64_t axis) {
+  ShapedType firstType = parts.front().getType();
+  SmallVector<int64_t> shape(firstType.getShape());
+  shape[axis] = 0;
+  for (DenseElementsAttr part : parts)
+    shape[axis] += part.getType().getDimSize(axis);
+  auto type = RankedTensorType::get(shape, firstType.getElementType());
+
+  if (llvm::all_of(parts, [&](DenseElementsAttr part) {
+        return part.isSplat() && part.getSplatValue<Attribute>() ==
+                                     parts.front().getSplatValue<Attribute>();
+      }))
+    return DenseElementsAttr::get(type,
+                                  parts.front().getSplatValue<Attribute>());
+
+  // Interleave the raw storage of the parts chunk by chunk rather than going
+  // through per-element attributes, which would unique one attribute for
+  // every weight.
+  int64_t outer = 1;
+  for (int64_t d = 0; d < axis; ++d)
+    outer *= shape[d];
+  int64_t elemBytes = llvm::divideCeil(firstType.getElementTypeBitWidth(), 8);
+  std::vector<char> data;
+  data.reserve(type.getNumElements() * elemBytes);
+  for (int64_t o = 0; o < outer; ++o) {
+    for (DenseElementsAttr part : parts) {
+      ArrayRef<char> raw = part.getRawData();
+      int64_t chunk = part.getNumElements() / outer * elemBytes;
+      if (part.isSplat()) {
+        for (int64_t i = 0; i < chunk; i += elemBytes)
+          llvm::append_range(data, raw);
+      } else {
+        llvm::append_range(data, raw.slice(o * chunk, chunk));
+      }
+    }
+  }
+  return DenseElementsAttr::getFromRawBuffer(type, data);
+}
+
+/// Replaces `siblings` (in program order) by one wide op placed at the first
+/// of them, and routes each original result through a slice of it.
+static void fuseSiblings(ArrayRef<Operation *> siblings,
+                         const WideningInfo &info) {
+  Operation *first = siblings.front();
+  Location loc = first->getLoc();
+  OpBuilder b(first);
+
+  Operation *wide = b.clone(*first);
+  for (auto [idx, axis] : info.concatOperands) {
+    SmallVector<DenseElementsAttr> parts =
+        llvm::map_to_vector(siblings, [&](Operation *op) {
+          return getConstant(op->getOperand(idx));
+        });
+    DenseElementsAttr concat = concatConstants(parts, axis);
+    b.setInsertionPoint(wide);
+    Value cst = b.create<tosa::ConstOp>(loc, concat.getType(), concat);
+    wide->setOperand(idx, cst);
+  }
+
+  auto firstResType = first->getResult(0).getType().cast<ShapedType>();
+  SmallVector<int64_t> wideShape(firstResType.getShape());
+  wideShape[info.resultAxis] = 0;
+  for (Operation *op : siblings)
+    wideShape[info.resultAxis] +=
+        op->getResult(0).getType().cast<ShapedType>().getDimSize(
+            info.resultAxis);
+  wide->getResult(0).setType(
+      RankedTensorType::get(wideShape, firstResType.getElementType()));
+
+  b.setInsertionPointAfter(wide);
+  int64_t offset = 0;
+  for (Operation *op : siblings) {
+    auto resType = op->getResult(0).getType().cast<ShapedType>();
+    SmallVector<int64_t> start(resType.getRank(), 0);
+    start[info.resultAxis] = offset;
+    offset += resType.getDimSize(info.resultAxis);
+    auto slice = b.create<tosa::SliceOp>(
+        op->getLoc(), resType, wide->getResult(0),
+        b.getDenseI64ArrayAttr(start),
+        b.getDenseI64ArrayAttr(resType.getShape()));
+    // Only these slices are trailing ops for tosa-partition; slices already in
+    // the graph keep partitioning as before.
+    slice->setAttr("mhal.horizontal_slice", b.getUnitAttr());
+    op->getResult(0).replaceAllUsesWith(slice.getResult());
+
+    SmallVector<Value> oldOperands(op->getOperands());
+    op->erase();
+    for (Value operand : oldOperands)
+      if (Operation *def = operand.getDefiningOp())
+        if (operand.use_empty() && isa<tosa::ConstOp>(def))
+          def->erase();
+  }
+}
+
+void MHALHorizontalFusionPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+
+  // Bucket candidates by the operand they share, keeping program order so the
+  // wide op can be placed at the first sibling, where the shared operand
+  // already dominates and every user of a sibling still comes after it.
+  llvm::MapVector<std::pair<Value, OperationName>,
+                  SmallVector<SmallVector<Operation *>>>
+      groups;
+  func.walk([&](Operation *op) {
+    std::optional<WideningInfo> info = getWideningInfo(op);
+    if (!info)
+      return;
+    Value shared = op->getOperand(info->sharedOperand);
+    auto &candidates = groups[{shared, op->getName()}];
+    for (SmallVector<Operation *> &group : candidates) {
+      if (areCompatible(group.front(), op, *info)) {
+        group.push_back(op);
+        return;
+      }
+    }
+    candidates.push_back({op});
+  });
+
+  for (auto &[key, candidates] : groups) {
+    for (SmallVector<Operation *> &group : candidates) {
+      if (group.size() < 2)
+        continue;
+      LLVM_DEBUG(llvm::dbgs() << "Fusing " << group.size() << " siblings of "
+                              << *group.front() << "\n");
+      fuseSiblings(group, *getWideningInfo(group.front()));
+    }
+  }
+}
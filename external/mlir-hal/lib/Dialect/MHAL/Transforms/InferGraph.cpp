@@ -10,17 +10,34 @@
 // call ops to mhal.launch ops with inferred data-dependency converted to
 // explicit mhal.token based dependence graph.
 //
+// Tokens are threaded through `scf.for` iteration arguments and `scf.if`
+// results, so device values that flow around loops or out of conditionals do
+// not force a host synchronization at the region boundary. An `mhal.await` is
+// only inserted where host code actually reads a device value, before an op
+// that may write memory, and for any device work still outstanding when a
+// block is exited.
+//
+// Private host funcs that are only ever called directly are rewritten to take
+// the tokens of pending arguments as extra arguments and to return the tokens
+// of results still pending at their return. A callee is specialized for each
+// set of arguments it receives asynchronously.
+//
 //===----------------------------------------------------------------------===//
 
 #include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/MHAL/IR/MHAL.h"
 #include "mlir/Dialect/MHAL/Transforms/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/IRMapping.h"
 #include "mlir/IR/PatternMatch.h"
 #include "mlir/IR/SymbolTable.h"
+#include "mlir/Interfaces/LoopLikeInterface.h"
 #include "mlir/Support/LLVM.h"
 #include "mlir/Transforms/RegionUtils.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/TypeSwitch.h"
 
 namespace mlir {
@@ -34,66 +51,589 @@ namespace mhal {
 
 using namespace mlir;
 namespace {
+// Token bookkeeping for one block being visited.
+struct TokenScope {
+  explicit TokenScope(Block *block) : block(block) {}
+
+  Block *block;
+  // Tokens produced in this block that have not been awaited and that no
+  // later launch in this block depends on. Awaiting all of them covers every
+  // piece of device work issued from the block.
+  llvm::SetVector<Value> leaves;
+  // Tokens known to have completed at the current point of the block.
+  llvm::SmallDenseSet<Value> synced;
+};
+
 class MHALInferGraphPass
     : public mhal::impl::MHALInferGraphPassBase<MHALInferGraphPass> {
 
-  static bool isTerminator(Operation *op) {
-    return op->mightHaveTrait<OpTrait::IsTerminator>();
-  }
-  static bool hasSideEffects(Operation *op) {
-    if (auto memInterface = dyn_cast<MemoryEffectOpInterface>(op)) {
-      return !memInterface.hasNoEffect();
-    }
-    return true;
-  }
-
-  llvm::SmallDenseMap<Value, Value> res2tokens;
-  llvm::SmallDenseSet<Value> currentTokens;
-
-  // If `op` implements the AsyncOpInterface, insert a `gpu.wait async` to
-  // create a current token (unless it already exists), and 'thread' that token
-  // through the `op` so that it executes asynchronously.
-  //
-  // If `op` is a terminator or an op with side-effects, insert a `gpu.wait` to
-  // host-synchronize execution. A `!gpu.async.token` will therefore only be
-  // used inside of its block and GPU execution will always synchronize with
-  // the host at block boundaries.
-  LogicalResult visit(Operation *op) {
+  static func::FuncOp getKernelFunc(Operation *op) {
     if (auto call = dyn_cast<func::CallOp>(op)) {
       CallOpInterface callIf(call);
       if (auto *callable = callIf.resolveCallable()) {
         func::FuncOp func = dyn_cast<func::FuncOp>(callable);
         assert(func);
-        if (func->hasAttr("kernel")) {
-          // Replace call op with async version.
-          return rewriteCallOp(call, func);
-        }
+        if (func->hasAttr("kernel"))
+          return func;
       }
     }
-    // Insert host sync before operation that reads an async::value
-    for (auto operand : op->getOperands()) {
-      if (auto itoken = res2tokens.lookup(operand)) {
-        if (currentTokens.contains(itoken)) {
-          createWaitOp(op, itoken);
-          currentTokens.erase(itoken);
-        }
+    return {};
+  }
+
+  // A rewritten copy of a threadable host func.
+  struct Specialization {
+    // Arguments passed in together with their token, the tokens are appended
+    // to the arguments in this order.
+    SmallVector<unsigned> tokenArgs;
+    func::FuncOp func;
+    // (result, token result) pairs for results returned asynchronously.
+    SmallVector<std::pair<unsigned, unsigned>> threadedResults;
+    // (token result, position in `tokenArgs`) pairs for token results whose
+    // completion implies the completion of that argument.
+    SmallVector<std::pair<unsigned, unsigned>> coveredArgs;
+  };
+
+  llvm::SmallDenseMap<Value, Value> res2tokens;
+  // Tokens that a token carried out of a loop or returned from a host func
+  // call depends on.
+  llvm::DenseMap<Value, SmallVector<Value>> carriedTokenDeps;
+  SmallVector<TokenScope *> scopes;
+  // Whether a host func may write memory, computed before any rewriting.
+  llvm::DenseMap<Operation *, bool> funcWrites;
+  // Host funcs that can pass tokens across their boundary, mapped to an
+  // unmodified copy of their body to specialize from.
+  llvm::DenseMap<Operation *, func::FuncOp> threadable;
+  llvm::DenseMap<Operation *, SmallVector<std::unique_ptr<Specialization>>>
+      specializations;
+  SymbolTable *symbolTable = nullptr;
+
+  // Returns true if `op` may write or free memory that a pending launch could
+  // be reading. Ops with recursive memory effects are transparent since their
+  // regions are visited separately. Calls to host funcs are resolved through
+  // the callee summaries, so crossing a function boundary does not by itself
+  // require a host synchronization.
+  bool mayWriteMemory(Operation *op) {
+    if (getKernelFunc(op))
+      return false;
+    if (auto call = dyn_cast<CallOpInterface>(op)) {
+      auto func = dyn_cast_or_null<func::FuncOp>(call.resolveCallable());
+      if (!func || func.isExternal())
+        return true;
+      return funcMayWriteMemory(func);
+    }
+    if (op->hasTrait<OpTrait::HasRecursiveMemoryEffects>())
+      return false;
+    auto memInterface = dyn_cast<MemoryEffectOpInterface>(op);
+    if (!memInterface)
+      return true;
+    SmallVector<MemoryEffects::EffectInstance> effects;
+    memInterface.getEffects(effects);
+    return llvm::any_of(effects, [](const MemoryEffects::EffectInstance &e) {
+      return isa<MemoryEffects::Write, MemoryEffects::Free>(e.getEffect());
+    });
+  }
+
+  bool funcMayWriteMemory(func::FuncOp func) {
+    auto it = funcWrites.find(func);
+    if (it != funcWrites.end())
+      return it->second;
+    // Be conservative about recursive calls while the summary is computed.
+    funcWrites[func] = true;
+    bool writes = func
+                      .walk([&](Operation *op) {
+                        if (op != func && mayWriteMemory(op))
+                          return WalkResult::interrupt();
+                        return WalkResult::advance();
+                      })
+                      .wasInterrupted();
+    funcWrites[func] = writes;
+    return writes;
+  }
+
+  bool isSynced(Value token) const {
+    return llvm::any_of(scopes, [&](const TokenScope *scope) {
+      return scope->synced.contains(token);
+    });
+  }
+
+  // Returns the token of `value` if it is produced by device work that has
+  // not been awaited yet.
+  Value getPendingToken(Value value) const {
+    Value token = res2tokens.lookup(value);
+    if (token && !isSynced(token))
+      return token;
+    return {};
+  }
+
+  // Append the tokens that `token` directly depends on to `deps`.
+  void appendDependencies(Value token, SmallVectorImpl<Value> &deps) const {
+    if (auto launch = token.getDefiningOp<mhal::LaunchOp>())
+      llvm::append_range(deps, launch.getDependencies());
+    else
+      llvm::append_range(deps, carriedTokenDeps.lookup(token));
+  }
+
+  bool dependsOn(Value token, Value dependency) const {
+    SmallVector<Value> worklist{token};
+    llvm::SmallDenseSet<Value> visited;
+    while (!worklist.empty()) {
+      Value t = worklist.pop_back_val();
+      if (t == dependency)
+        return true;
+      if (!visited.insert(t).second)
+        continue;
+      appendDependencies(t, worklist);
+    }
+    return false;
+  }
+
+  // Awaiting a token also completes everything it depends on.
+  void markSynced(TokenScope &scope, Value token) const {
+    SmallVector<Value> worklist{token};
+    while (!worklist.empty()) {
+      Value t = worklist.pop_back_val();
+      if (!scope.synced.insert(t).second)
+        continue;
+      scope.leaves.remove(t);
+      appendDependencies(t, worklist);
+    }
+  }
+
+  // Host-synchronize on `token` before `op`. The wait is hoisted out of any
+  // loops that do not define the token, so it runs once rather than on every
+  // iteration.
+  void awaitToken(Operation *op, Value token) {
+    Operation *insertPt = op;
+    Operation *tokenScopeOp = token.getParentRegion()->getParentOp();
+    while (auto loop = dyn_cast<LoopLikeOpInterface>(insertPt->getParentOp())) {
+      if (loop->isAncestor(tokenScopeOp))
+        break;
+      insertPt = loop;
+    }
+    createWaitOp(insertPt, token);
+    for (TokenScope *scope : llvm::reverse(scopes)) {
+      if (scope->block == insertPt->getBlock()) {
+        markSynced(*scope, token);
+        break;
+      }
+    }
+  }
+
+  // Host-synchronize on all device work issued so far.
+  void awaitAll(Operation *op) {
+    for (TokenScope *scope : SmallVector<TokenScope *>(scopes)) {
+      SmallVector<Value> leaves(scope->leaves.begin(), scope->leaves.end());
+      for (Value token : leaves) {
+        if (!isSynced(token))
+          awaitToken(op, token);
+      }
+    }
+  }
+
+  // Visit all non-terminator ops of the scope's block. The terminator is
+  // handled by `finalizeBlock` once the parent op has decided which of the
+  // yielded values carry their token out of the region.
+  LogicalResult visitBlock(TokenScope &scope) {
+    scopes.push_back(&scope);
+    LogicalResult result = success();
+    for (Operation &op :
+         llvm::make_early_inc_range(scope.block->without_terminator())) {
+      if (failed(visit(&op))) {
+        result = failure();
+        break;
+      }
+    }
+    scopes.pop_back();
+    return result;
+  }
+
+  // Insert the host synchronization needed before the block's terminator.
+  // Terminator operands whose index is in `threaded` leave the block together
+  // with their token, everything else that is still pending is awaited.
+  void finalizeBlock(TokenScope &scope,
+                     const llvm::SmallDenseSet<unsigned> &threaded = {}) {
+    Operation *terminator = scope.block->getTerminator();
+    scopes.push_back(&scope);
+    llvm::SmallDenseSet<Value> threadedTokens;
+    for (OpOperand &operand : terminator->getOpOperands()) {
+      Value token = res2tokens.lookup(operand.get());
+      if (!token)
+        continue;
+      if (threaded.contains(operand.getOperandNumber()))
+        threadedTokens.insert(token);
+      else if (!isSynced(token))
+        awaitToken(terminator, token);
+    }
+    SmallVector<Value> leaves(scope.leaves.begin(), scope.leaves.end());
+    for (Value token : leaves) {
+      if (!threadedTokens.contains(token) && !isSynced(token))
+        awaitToken(terminator, token);
+    }
+    scopes.pop_back();
+  }
+
+  // Visit the regions of an op that is not known to this pass. Every block is
+  // its own scope and all of its device work completes before it is exited.
+  LogicalResult visitRegions(Operation *op) {
+    for (Region &region : op->getRegions()) {
+      for (Block &block : region) {
+        TokenScope scope(&block);
+        if (failed(visitBlock(scope)))
+          return failure();
+        finalizeBlock(scope);
+      }
+    }
+    return success();
+  }
+
+  // Insert a host sync for operands of `op` that read device results.
+  void syncOperands(Operation *op, ValueRange operands) {
+    for (Value operand : operands) {
+      if (Value token = getPendingToken(operand))
+        awaitToken(op, token);
+    }
+  }
+
+  // Thread a token through every iteration argument whose initial value is a
+  // pending device result, so that the loop body can launch on it without a
+  // host round trip and the loop result stays asynchronous.
+  LogicalResult visitForOp(scf::ForOp forOp) {
+    syncOperands(forOp, {forOp.getLowerBound(), forOp.getUpperBound(),
+                         forOp.getStep()});
+
+    unsigned numResults = forOp.getNumResults();
+    SmallVector<unsigned> threadedArgs;
+    SmallVector<Value> initTokens;
+    for (auto [idx, init] : llvm::enumerate(forOp.getInitArgs())) {
+      if (Value token = getPendingToken(init)) {
+        threadedArgs.push_back(idx);
+        initTokens.push_back(token);
+      }
+    }
+
+    if (!threadedArgs.empty()) {
+      IRRewriter rewriter(forOp.getContext());
+      auto newLoop = forOp.replaceWithAdditionalYields(
+          rewriter, initTokens, /*replaceInitOperandUsesInLoop=*/false,
+          [](OpBuilder &b, Location loc, ArrayRef<BlockArgument> newBbArgs) {
+            return SmallVector<Value>(newBbArgs);
+          });
+      if (failed(newLoop))
+        return forOp.emitOpError("failed to thread tokens through the loop");
+      forOp = cast<scf::ForOp>(newLoop->getOperation());
+    }
+
+    auto iterArgs = forOp.getRegionIterArgs();
+    for (auto [i, idx] : llvm::enumerate(threadedArgs))
+      res2tokens[iterArgs[idx]] = iterArgs[numResults + i];
+
+    TokenScope scope(forOp.getBody());
+    if (failed(visitBlock(scope)))
+      return failure();
+
+    auto yieldOp = cast<scf::YieldOp>(forOp.getBody()->getTerminator());
+    llvm::SmallDenseSet<unsigned> threaded;
+    for (auto [i, idx] : llvm::enumerate(threadedArgs)) {
+      Value tokenArg = iterArgs[numResults + i];
+      Value token = res2tokens.lookup(yieldOp.getOperand(idx));
+      if (!token)
+        continue;
+      // Every iteration's token must be reachable from the final one so that
+      // awaiting the loop result covers all iterations.
+      if (!dependsOn(token, tokenArg)) {
+        auto launch = token.getDefiningOp<mhal::LaunchOp>();
+        if (!launch || launch->getBlock() != forOp.getBody())
+          continue;
+        launch.getDependenciesMutable().append(tokenArg);
+      }
+      yieldOp->setOperand(numResults + i, token);
+      threaded.insert(idx);
+      threaded.insert(numResults + i);
+    }
+    finalizeBlock(scope, threaded);
+
+    for (auto [i, idx] : llvm::enumerate(threadedArgs)) {
+      Value token = forOp.getResult(numResults + i);
+      res2tokens[forOp.getResult(idx)] = token;
+      scopes.back()->leaves.insert(token);
+      // The loop result is the init token if the loop does not run and
+      // depends on it otherwise.
+      if (threaded.contains(idx)) {
+        carriedTokenDeps[token].push_back(initTokens[i]);
+        scopes.back()->leaves.remove(initTokens[i]);
+      }
+    }
+    return success();
+  }
+
+  // Return a token result for every `scf.if` result that is a device value in
+  // all branches.
+  LogicalResult visitIfOp(scf::IfOp ifOp) {
+    syncOperands(ifOp, ifOp.getCondition());
+
+    TokenScope thenScope(ifOp.thenBlock());
+    if (failed(visitBlock(thenScope)))
+      return failure();
+    if (ifOp.getElseRegion().empty()) {
+      finalizeBlock(thenScope);
+      return success();
+    }
+    TokenScope elseScope(ifOp.elseBlock());
+    if (failed(visitBlock(elseScope)))
+      return failure();
+
+    auto thenYield = ifOp.thenYield();
+    auto elseYield = ifOp.elseYield();
+    SmallVector<unsigned> threadedResults;
+    SmallVector<Value> thenTokens, elseTokens;
+    for (unsigned idx = 0, e = ifOp.getNumResults(); idx < e; ++idx) {
+      Value thenToken = res2tokens.lookup(thenYield.getOperand(idx));
+      Value elseToken = res2tokens.lookup(elseYield.getOperand(idx));
+      if (thenToken && elseToken) {
+        threadedResults.push_back(idx);
+        thenTokens.push_back(thenToken);
+        elseTokens.push_back(elseToken);
+      }
+    }
+
+    if (threadedResults.empty()) {
+      finalizeBlock(thenScope);
+      finalizeBlock(elseScope);
+      return success();
+    }
+
+    unsigned numResults = ifOp.getNumResults();
+    SmallVector<Type> resultTypes(ifOp.getResultTypes());
+    for (Value token : thenTokens)
+      resultTypes.push_back(token.getType());
+
+    IRRewriter rewriter(ifOp.getContext());
+    rewriter.setInsertionPoint(ifOp);
+    auto newIf = rewriter.create<scf::IfOp>(
+        ifOp.getLoc(), resultTypes, ifOp.getCondition(),
+        /*addThenBlock=*/false, /*addElseBlock=*/false);
+    rewriter.inlineRegionBefore(ifOp.getThenRegion(), newIf.getThenRegion(),
+                                newIf.getThenRegion().end());
+    rewriter.inlineRegionBefore(ifOp.getElseRegion(), newIf.getElseRegion(),
+                                newIf.getElseRegion().end());
+    thenYield.getResultsMutable().append(thenTokens);
+    elseYield.getResultsMutable().append(elseTokens);
+    rewriter.replaceOp(ifOp, newIf.getResults().take_front(numResults));
+
+    llvm::SmallDenseSet<unsigned> threaded;
+    for (auto [i, idx] : llvm::enumerate(threadedResults)) {
+      threaded.insert(idx);
+      threaded.insert(numResults + i);
+    }
+    finalizeBlock(thenScope, threaded);
+    finalizeBlock(elseScope, threaded);
+
+    for (auto [i, idx] : llvm::enumerate(threadedResults)) {
+      Value token = newIf.getResult(numResults + i);
+      res2tokens[newIf.getResult(idx)] = token;
+      scopes.back()->leaves.insert(token);
+    }
+    return success();
+  }
+
+  // A host func can pass tokens across its boundary if it is only ever called
+  // directly, so every call site can be rewritten, and is not recursive, so
+  // it can be processed while its caller is being visited.
+  void collectThreadableFuncs(ModuleOp module,
+                              ArrayRef<func::FuncOp> hostFuncs) {
+    llvm::DenseMap<Operation *, SmallVector<Operation *>> callees;
+    for (func::FuncOp func : hostFuncs) {
+      func.walk([&](func::CallOp call) {
+        CallOpInterface callIf(call);
+        if (Operation *callee = callIf.resolveCallable())
+          callees[func].push_back(callee);
+      });
+    }
+    for (func::FuncOp func : hostFuncs) {
+      if (func->getParentOp() != module || !func.isPrivate() ||
+          !func.getBody().hasOneBlock())
+        continue;
+      auto uses = SymbolTable::getSymbolUses(func, module);
+      if (!uses || llvm::any_of(*uses, [](const SymbolTable::SymbolUse &use) {
+            return !isa<func::CallOp>(use.getUser());
+          }))
+        continue;
+      SmallVector<Operation *> worklist(callees.lookup(func));
+      llvm::SmallDenseSet<Operation *> visited;
+      bool recursive = false;
+      while (!worklist.empty() && !recursive) {
+        Operation *callee = worklist.pop_back_val();
+        recursive = callee == func;
+        if (visited.insert(callee).second)
+          llvm::append_range(worklist, callees.lookup(callee));
+      }
+      if (!recursive)
+        threadable[func] = func.clone();
+    }
+  }
+
+  // Returns the copy of `callee` that receives the arguments in `tokenArgs`
+  // asynchronously, creating and rewriting it on first use. The callee itself
+  // serves the case where no argument is pending.
+  FailureOr<Specialization *> getSpecialization(func::FuncOp callee,
+                                                ArrayRef<unsigned> tokenArgs) {
+    for (auto &spec : specializations[callee]) {
+      if (ArrayRef<unsigned>(spec->tokenArgs) == tokenArgs)
+        return spec.get();
+    }
+    func::FuncOp func = callee;
+    if (!tokenArgs.empty()) {
+      func = threadable.lookup(callee).clone();
+      func.setSymName((callee.getSymName() + "_async").str());
+      symbolTable->insert(func, std::next(callee->getIterator()));
+      funcWrites[func] = funcWrites.lookup(callee);
+    }
+    auto owned = std::make_unique<Specialization>();
+    Specialization *spec = owned.get();
+    spec->tokenArgs.assign(tokenArgs.begin(), tokenArgs.end());
+    spec->func = func;
+    specializations[callee].push_back(std::move(owned));
+    if (failed(visitSpecialization(*spec)))
+      return failure();
+    return spec;
+  }
+
+  // Rewrite the body of a specialization. The tokens of its asynchronous
+  // arguments are appended as arguments, and results still pending at the
+  // return are returned together with their token instead of being awaited.
+  LogicalResult visitSpecialization(Specialization &spec) {
+    func::FuncOp func = spec.func;
+    auto tokenType = mhal::TokenType::get(func.getContext());
+    Block &entry = func.getBody().front();
+    unsigned numArgs = func.getNumArguments();
+    for (unsigned idx : spec.tokenArgs) {
+      func.insertArgument(func.getNumArguments(), tokenType, {}, func.getLoc());
+      res2tokens[entry.getArgument(idx)] = entry.getArguments().back();
+    }
+
+    // The callee does not see the state of its caller.
+    SmallVector<TokenScope *> callerScopes;
+    std::swap(scopes, callerScopes);
+    auto restoreScopes =
+        llvm::make_scope_exit([&] { std::swap(scopes, callerScopes); });
+
+    TokenScope scope(&entry);
+    if (failed(visitBlock(scope)))
+      return failure();
+
+    auto returnOp = cast<func::ReturnOp>(entry.getTerminator());
+    unsigned numResults = func.getNumResults();
+    llvm::SmallDenseSet<unsigned> threaded;
+    llvm::SetVector<Value> tokens;
+    scopes.push_back(&scope);
+    for (OpOperand &operand : returnOp->getOpOperands()) {
+      Value token = getPendingToken(operand.get());
+      if (!token)
+        continue;
+      tokens.insert(token);
+      threaded.insert(operand.getOperandNumber());
+      unsigned tokenIdx =
+          numResults + std::distance(tokens.begin(), llvm::find(tokens, token));
+      spec.threadedResults.emplace_back(operand.getOperandNumber(), tokenIdx);
+    }
+    scopes.pop_back();
+    finalizeBlock(scope, threaded);
+
+    for (auto [i, token] : llvm::enumerate(tokens)) {
+      for (unsigned pos = 0, e = spec.tokenArgs.size(); pos < e; ++pos) {
+        if (dependsOn(token, entry.getArgument(numArgs + pos)))
+          spec.coveredArgs.emplace_back(numResults + i, pos);
       }
     }
-    // Insert host synchronization before terminator or op with side effects.
-    if (isTerminator(op) || hasSideEffects(op)) {
-      for (auto token : currentTokens) {
-        createWaitOp(op, token);
+    returnOp.getOperandsMutable().append(tokens.getArrayRef());
+    for (size_t i = 0, e = tokens.size(); i < e; ++i)
+      func.insertResult(func.getNumResults(), tokenType, {});
+    return success();
+  }
+
+  // Rewrite a call to a threadable host func so that pending device values
+  // are passed in together with their token and the results the callee
+  // leaves pending come back with theirs.
+  LogicalResult visitHostCall(func::CallOp call, func::FuncOp callee) {
+    if (mayWriteMemory(call))
+      awaitAll(call);
+    SmallVector<unsigned> tokenArgs;
+    SmallVector<Value> argTokens;
+    for (auto [idx, operand] : llvm::enumerate(call.getOperands())) {
+      if (Value token = getPendingToken(operand)) {
+        tokenArgs.push_back(idx);
+        argTokens.push_back(token);
       }
-      currentTokens.clear();
     }
 
+    FailureOr<Specialization *> spec = getSpecialization(callee, tokenArgs);
+    if (failed(spec))
+      return failure();
+    if ((*spec)->func == callee && (*spec)->threadedResults.empty())
+      return success();
+
+    // The passed tokens stay leaves of the caller unless a returned token
+    // covers them, the callee does not await them.
+    OpBuilder builder(call);
+    SmallVector<Value> operands(call.getOperands());
+    llvm::append_range(operands, argTokens);
+    auto newCall =
+        builder.create<func::CallOp>(call.getLoc(), (*spec)->func, operands);
+    call->replaceAllUsesWith(
+        newCall.getResults().take_front(call.getNumResults()));
+    for (auto [idx, tokenIdx] : (*spec)->threadedResults) {
+      Value token = newCall.getResult(tokenIdx);
+      res2tokens[newCall.getResult(idx)] = token;
+      scopes.back()->leaves.insert(token);
+    }
+    for (auto [tokenIdx, pos] : (*spec)->coveredArgs) {
+      carriedTokenDeps[newCall.getResult(tokenIdx)].push_back(argTokens[pos]);
+      scopes.back()->leaves.remove(argTokens[pos]);
+    }
+    call.erase();
     return success();
   }
 
+  LogicalResult visit(Operation *op) {
+    if (auto call = dyn_cast<func::CallOp>(op)) {
+      CallOpInterface callIf(call);
+      auto callee = dyn_cast_or_null<func::FuncOp>(callIf.resolveCallable());
+      if (callee && threadable.count(callee))
+        return visitHostCall(call, callee);
+    }
+    if (auto func = getKernelFunc(op)) {
+      // Replace call op with async version.
+      return rewriteCallOp(cast<func::CallOp>(op), func);
+    }
+    if (auto forOp = dyn_cast<scf::ForOp>(op))
+      return visitForOp(forOp);
+    if (auto ifOp = dyn_cast<scf::IfOp>(op))
+      return visitIfOp(ifOp);
+
+    // Insert host sync before operation that reads an async::value
+    syncOperands(op, op->getOperands());
+    // Insert host synchronization before an op that may clobber memory.
+    if (mayWriteMemory(op))
+      awaitAll(op);
+
+    if (op->getNumRegions() == 0)
+      return success();
+    for (Region &region : op->getRegions()) {
+      for (Block &block : region) {
+        if (!block.mightHaveTerminator()) {
+          // Kernel calls in such regions stay synchronous.
+          awaitAll(op);
+          return success();
+        }
+      }
+    }
+    return visitRegions(op);
+  }
+
   // Replaces asyncOp with a clone that returns a token.
   LogicalResult rewriteCallOp(func::CallOp op, func::FuncOp func) {
     OpBuilder builder(op);
-    // builder.setInsertionPoint(op);
+    TokenScope &scope = *scopes.back();
     // Find tokens related to inputs
     SmallVector<Value, 4> tokens;
     for (auto operand : op.getOperands()) {
@@ -101,12 +641,13 @@ class MHALInferGraphPass
       if (operand.getType().isa<MemRefType>())
         return op.emitOpError("unsupported MemRefTypes");
 
-      if (auto itoken = res2tokens.lookup(operand)) {
-        tokens.push_back(itoken);
+      if (auto itoken = getPendingToken(operand)) {
+        if (!llvm::is_contained(tokens, itoken))
+          tokens.push_back(itoken);
 
         // remove tokens that are consumed, the chain will satisfy the
         // final block await
-        currentTokens.erase(itoken);
+        scope.leaves.remove(itoken);
       }
     }
 
@@ -123,7 +664,7 @@ class MHALInferGraphPass
     for (auto res : results)
       res2tokens.insert({res, token});
 
-    currentTokens.insert(token);
+    scope.leaves.insert(token);
 
     op->replaceAllUsesWith(results);
     op->erase();
@@ -143,23 +684,72 @@ class MHALInferGraphPass
   }
 
 public:
-  // Replaces synchronous call ops in the op's region with asynchronous ones and
-  // inserts the necessary synchronization (as async.await ops). Assumes
+  // Replaces synchronous call ops in host funcs with asynchronous ones and
+  // inserts the necessary synchronization (as mhal.await ops). Assumes
   // sequential execution semantics and that no asynchronous ops yet.
   void runOnOperation() override {
-    func::FuncOp func = getOperation();
-    if (!func->hasAttr("kernel")) {
-      auto walker = [this](Block *block) {
-        for (Operation &op : make_early_inc_range(*block)) {
-          if (failed(visit(&op)))
-            return WalkResult::interrupt();
-        }
-        return WalkResult::advance();
-      };
+    ModuleOp module = getOperation();
+    SymbolTable moduleSymbols(module);
+    symbolTable = &moduleSymbols;
+    SmallVector<func::FuncOp> hostFuncs;
+    module.walk([&](func::FuncOp func) {
+      if (!func->hasAttr("kernel") && !func.isExternal())
+        hostFuncs.push_back(func);
+    });
 
-      if (getOperation()->walk(walker).wasInterrupted())
-        signalPassFailure();
+    // Summarize callees before any of them are rewritten.
+    for (func::FuncOp func : hostFuncs)
+      (void)funcMayWriteMemory(func);
+    collectThreadableFuncs(module, hostFuncs);
+
+    LogicalResult result = rewriteHostFuncs(module, hostFuncs);
+    for (auto &entry : threadable)
+      entry.second.erase();
+    threadable.clear();
+    specializations.clear();
+    funcWrites.clear();
+    res2tokens.clear();
+    carriedTokenDeps.clear();
+    if (failed(result))
+      signalPassFailure();
+  }
+
+private:
+  LogicalResult rewriteHostFuncs(ModuleOp module,
+                                 ArrayRef<func::FuncOp> hostFuncs) {
+    // Threadable funcs are rewritten when their first caller reaches them.
+    for (func::FuncOp func : hostFuncs) {
+      if (threadable.count(func))
+        continue;
+      res2tokens.clear();
+      for (Block &block : func.getBody()) {
+        TokenScope scope(&block);
+        if (failed(visitBlock(scope)))
+          return failure();
+        finalizeBlock(scope);
+      }
     }
+
+    // A threadable func that is only called with pending arguments has been
+    // replaced by its specializations. Any other func that was not reached
+    // is rewritten on its own.
+    for (func::FuncOp func : hostFuncs) {
+      if (!threadable.count(func))
+        continue;
+      auto &specs = specializations[func];
+      if (llvm::any_of(specs, [&](const auto &spec) {
+            return spec->func == func;
+          }))
+        continue;
+      if (!specs.empty() && SymbolTable::symbolKnownUseEmpty(func, module)) {
+        func.erase();
+        continue;
+      }
+      res2tokens.clear();
+      if (failed(getSpecialization(func, {})))
+        return failure();
+    }
+    return success();
   }
 };
 } // namespace
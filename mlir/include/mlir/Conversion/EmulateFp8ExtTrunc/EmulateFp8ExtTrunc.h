@@ -26,9 +26,11 @@ class FlatSymbolRefAttr;
 // The arguments are functions for converting a float (fp32) to the relevant
 // type. If the attribute is `nullptr`, then that truncation pattern is
 // disabled.
-void addEmulateFp8ExtTruncPatterns(RewritePatternSet &patterns,
-                                   FlatSymbolRefAttr f8E4M3FNUZTruncFunc,
-                                   FlatSymbolRefAttr f8E5M2FNUZTruncFunc);
+void addEmulateFp8ExtTruncPatterns(
+    RewritePatternSet &patterns, FlatSymbolRefAttr f8E4M3FNUZTruncFunc,
+    FlatSymbolRefAttr f8E5M2FNUZTruncFunc,
+    FlatSymbolRefAttr f8E4M3FNTruncFunc = nullptr,
+    FlatSymbolRefAttr f8E5M2TruncFunc = nullptr);
 
 } // namespace mlir
 
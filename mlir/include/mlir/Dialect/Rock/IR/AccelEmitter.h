@@ -96,7 +96,11 @@ struct AccelEmitter {
   /// Return a wrapped view of the LDS buffer tailored for the accelerator
   /// load pattern. This is similar to wrapLDSBufferForStore, but while storing
   /// in LDS follows a similar pattern among accelerators, loading from LDS
-  /// is dependent on the type of accelerator we are targeting
+  /// is dependent on the type of accelerator we are targeting.
+  /// `doSplitKAcrossThreadsFirst` makes each thread read the k values it holds
+  /// of a k-reduction gemm output, so that output can be the other operand
+  /// from registers; the buffer must then be viewed as vectors of
+  /// MfmaEmitter::getSplitKAcrossThreadsVectorLen() elements.
   virtual Value
   wrapLDSBufferForLoad(OpBuilder &b, Location loc, Value buffer,
                        int64_t blockSize, int64_t dInCopyPerThread,
@@ -200,6 +204,11 @@ struct MfmaEmitter : public AccelEmitter {
 
   int64_t getRowGroupSize() const;
 
+  /// The length of the vectors the LDS buffer has to be viewed as when it is
+  /// wrapped with `doSplitKAcrossThreadsFirst`: the rows of a row group that
+  /// share a kpack.
+  int64_t getSplitKAcrossThreadsVectorLen() const;
+
   static bool classof(const AccelEmitter *AE) {
     return AE->getKind() == AccelEmitterKind::AEK_MFMAEmitter;
   }
@@ -254,6 +263,21 @@ private:
   // Specifc wmma parameters
   WmmaInsn wmmaInsn;
 };
+
+/// Whether the output of the first gemm of an attention, tuned with
+/// `params0`, can be the A operand of the second one, tuned with `params1`,
+/// straight from registers instead of through LDS. This needs both gemms to
+/// use k-reduction mfmas that split k into the same row groups, each thread
+/// to hold whole row groups of the k of the second gemm, and a single wave
+/// along M in the first gemm. WMMA and several M waves stay on the LDS path:
+/// WMMA spreads its output rows over the two half-waves differently from how
+/// it reads k, and each of several M waves holds only part of the rows the
+/// second gemm reduces over, so feeding them from registers would need
+/// cross-lane permutes or an exchange of partial products between waves.
+bool canBypassLDSForSecondGemm(GemmFeatures features, Type elemTypeQ,
+                               Type elemTypeK, Type elemTypeV, StringRef arch,
+                               RockAccelTuningParamAttrInterface params0,
+                               RockAccelTuningParamAttrInterface params1);
 } // namespace accel
 } // namespace rock
 } // namespace mlir
@@ -64,6 +64,11 @@ ArrayAttr getIndexArrayAttr(Builder &b, ArrayRef<int64_t> values);
 // limit the maxWaves per workgroup to be 4.
 constexpr int64_t maxWavesPerWG = 4;
 
+// Forward convolutions with fewer input channels than this (typically the
+// RGB first layer of a vision network) have their channels zero-padded up to
+// it in the implicit GEMM, so that gemmK comes in whole kpacks.
+constexpr int64_t smallChannelConvWidth = 4;
+
 } // end namespace rock
 } // end namespace mlir
 
@@ -92,6 +97,11 @@ TransformMapAttr getTransformMapAttrChecked(
     llvm::function_ref<mlir::InFlightDiagnostic()> emitError,
     MLIRContext *context, ArrayRef<TransformAttr> ops, AffineMapAttr map,
     DenseI64ArrayAttr upperBounds, DenseI64ArrayAttr lowerBounds);
+
+/// Returns the number of input channels `op` has in its implicit GEMM, which
+/// is `smallChannelConvWidth` for accelerated channels-last convolutions with
+/// fewer channels than that and the actual channel count otherwise.
+int64_t getConvGemmChannels(ConvOp op);
 } // namespace rock
 } // namespace mlir
 #endif // MLIR_ROCKOPS_OPS_H_
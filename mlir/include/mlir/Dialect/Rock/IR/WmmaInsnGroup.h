@@ -25,6 +25,10 @@ namespace rock {
 struct WmmaInsn {
   StringRef insn;
   int64_t inputLen;
+  // The number of k values each lane holds per instruction. On gfx11 both
+  // halves of the wave hold the whole of k (`kBase == inputLen`), on gfx12
+  // they split it between them.
+  int64_t kBase;
   int64_t outputLen;
   int64_t outputStride;
   int64_t mRepeats;
@@ -36,7 +40,7 @@ struct WmmaInsn {
 public:
   bool isCoherentWithK(int64_t kpack, int64_t kPerBlock);
   static FailureOr<WmmaInsn> select(Type elementTypeA, Type elementTypeB,
-                                    int64_t waveSize, int64_t mPerWave,
+                                    StringRef arch, int64_t mPerWave,
                                     int64_t nPerWave);
 };
 } // namespace rock
@@ -33,6 +33,7 @@ namespace rock {
 #define GEN_PASS_DECL_ROCKLINALGALIGNPASS
 #define GEN_PASS_DECL_ROCKTRANSFORMTOMEMREFPASS
 #define GEN_PASS_DECL_ROCKLOOPSTOCFPASS
+#define GEN_PASS_DECL_ROCKPLANLDSPASS
 #define GEN_PASS_DECL_ROCKPIPELINEPASS
 #define GEN_PASS_DECL_ROCKSUGARTOLOOPSPASS
 #define GEN_PASS_DECL_ROCKTHREADWISEGEMMLOWERINGPASS
@@ -41,6 +42,9 @@ namespace rock {
 #define GEN_PASS_DECL_ROCKPREPARELLVMPASS
 #define GEN_PASS_DECL_ROCKCHECKRESIDENCYPASS
 #define GEN_PASS_DECL_ROCKVECTORIZEFUSIONSPASS
+#define GEN_PASS_DECL_ROCKAPPROXIMATEMATHPASS
+#define GEN_PASS_DECL_ROCKSCHEDHINTSPASS
+#define GEN_PASS_DECL_ROCKLDSBARRIERELIMPASS
 
 #define GEN_PASS_REGISTRATION
 #include "mlir/Dialect/Rock/Passes.h.inc"
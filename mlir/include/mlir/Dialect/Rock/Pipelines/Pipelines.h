@@ -51,6 +51,11 @@ struct KernelOptions : public PassPipelineOptions<KernelOptions> {
   PassOptions::Option<bool> tuningFallback{
       *this, "tuningFallback",
       desc("Falls back default if invalid config is given"), init(false)};
+  PassOptions::Option<std::string> mathPrecision{
+      *this, "math-precision",
+      desc("Precision of activation functions in fusions: exact, fast or "
+           "fastest"),
+      init("exact")};
 };
 
 /// Adds the `kernel` pipeline to the `OpPassManager`.
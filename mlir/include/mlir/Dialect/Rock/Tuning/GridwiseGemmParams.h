@@ -60,12 +60,47 @@ GemmSize calculatePaddedGemmSize(const InitParams &params, GemmSize gemmSize,
 /// be added to the given dimension.
 std::optional<GemmSize> requiredPadding(Attribute params, GemmSize gemmSize);
 
+/// Split-K factors are kept below this bound, as the heuristics don't account
+/// for the cost of reducing the partial results along the split dimension.
+constexpr int64_t splitKFactorUpperBound = 32;
+
+/// Size in bytes of the workspace a split-K gemm that doesn't use atomics
+/// needs: 32-bit partial results for every split of every element of the
+/// padded C, followed by one 32-bit arrival counter per output tile.
+int64_t getSplitKWorkspaceBytes(const GemmSize &gemmSize, int64_t mPerBlock,
+                                int64_t nPerBlock, int64_t splitKFactor);
+
+/// Upper bound of getSplitKWorkspaceBytes() over all the tuning parameters of
+/// a gemm of `gemmSize`, for hosts that allocate the workspace before picking
+/// a perf config.
+int64_t getMaxSplitKWorkspaceBytes(const GemmSize &gemmSize);
+
 int64_t obtainBlockSize(int64_t waveSize, int64_t mPerBlock, int64_t nPerBlock,
                         int64_t mPerWave, int64_t nPerWave);
 
+/// The workgroup size for `params`, including any producer waves.
 int64_t obtainBlockSize(int64_t waveSize,
                         RockAccelTuningParamAttrInterface params);
 
+struct AmdArchInfo;
+
+/// Analytic estimate of how many cycles an accelerated gemm of `gemmSize`
+/// takes on `numCu` compute units when every workgroup computes an
+/// `mPerBlock` x `nPerBlock` output tile, `kPerBlock` (including kpack) at a
+/// time, split into `mPerWave` x `nPerWave` wave tiles, with `producerWaves`
+/// extra waves doing the copies into double-buffered LDS. The model accounts for
+/// padding, for how the tiles quantize onto the CUs, for the occupancy that
+/// LDS and register use allow, and for the LDS, L2 and HBM traffic the tiling
+/// implies. It is meant to rank candidate tuning parameters, not to predict
+/// absolute runtimes. Returns std::nullopt when the architecture has no
+/// performance data or a workgroup does not fit on a CU.
+std::optional<double>
+estimateAccelGemmCycles(const AmdArchInfo &archInfo, uint32_t numCu,
+                        const GemmSize &gemmSize, Type dataType,
+                        int64_t mPerBlock, int64_t nPerBlock, int64_t kPerBlock,
+                        int64_t mPerWave, int64_t nPerWave,
+                        int64_t splitKFactor = 1, int64_t producerWaves = 0);
+
 /// Store information useful for populating perf configurations
 struct PopulateParamsInfo {
   GemmSize gemmSize;
@@ -74,8 +109,11 @@ struct PopulateParamsInfo {
   Type gemmAType;
   Type gemmBType;
   KernelType kernelType;
-  int64_t batchSize;
-  uint32_t numCu;
+  int64_t batchSize = 0;
+  uint32_t numCu = 0;
+  // Whether this is a forward convolution whose few input channels are padded
+  // in gemmK, see getConvGemmChannels().
+  bool smallChannelConv = false;
 
   PopulateParamsInfo(GemmSize gemmSize, StringRef arch,
                      GemmFeatures gemmFeatures, Type gemmAType, Type gemmBType,
@@ -99,6 +137,9 @@ struct InitParamsNonAccel : InitParams, Serializable<InitParamsNonAccel> {
   int64_t gemmNPerThread;
   uint32_t blockSize;
   int64_t splitKFactor;
+  // Not part of the perf config: picked to match the dot product
+  // instructions of the target, if any. gemmKPerBlock includes it.
+  int64_t gemmKPack = 1;
 
   constexpr InitParamsNonAccel(uint32_t bSize, int64_t mPerBlock,
                                int64_t nPerBlock, int64_t kPerBlock,
@@ -113,12 +154,12 @@ struct InitParamsNonAccel : InitParams, Serializable<InitParamsNonAccel> {
 
   InitParamsNonAccel(GeneralGemmParamsAttr attr)
       : InitParams{attr.getMPerBlock(), attr.getNPerBlock(),
-                   attr.getKPerBlock()},
+                   attr.getKPerBlock() * attr.getKpack()},
         gemmMPerThread(attr.getMPerThread()),
         gemmNPerThread(attr.getNPerThread()), blockSize(attr.getBlockSize()),
-        splitKFactor(attr.getSplitKFactor()){};
+        splitKFactor(attr.getSplitKFactor()), gemmKPack(attr.getKpack()){};
 
-  int64_t getKPack() { return 1; }
+  int64_t getKPack() { return gemmKPack; }
 
   template <class Self, class F>
   static void visit(Self &&self, F f) {
@@ -138,12 +179,14 @@ struct InitParamsAccel : InitParams, Serializable<InitParamsAccel> {
                             int64_t kPerBlock, int64_t mPerWave,
                             int64_t nPerWaveOrMnPerXdl, int64_t kPack,
                             int64_t splitKFactor, bool aThreadCopyMoreGemmK,
-                            bool bThreadCopyMoreGemmKPack)
+                            bool bThreadCopyMoreGemmKPack,
+                            int64_t schedHint = 0, int64_t producerWaves = 0)
       : InitParams{mPerBlock, nPerBlock, kPerBlock}, gemmMPerWave(mPerWave),
         gemmNPerWaveOrMnPerXdl(nPerWaveOrMnPerXdl), gemmKPack(kPack),
         splitKFactor(splitKFactor),
         gemmAThreadCopyMoreGemmK(aThreadCopyMoreGemmK),
-        gemmBThreadCopyMoreGemmKPack(bThreadCopyMoreGemmKPack) {}
+        gemmBThreadCopyMoreGemmKPack(bThreadCopyMoreGemmKPack),
+        schedHint(schedHint), producerWaves(producerWaves) {}
 
   constexpr InitParamsAccel()
       : InitParamsAccel(0LL, 0LL, 0LL, 0LL, 0LL, 0LL, 1LL, false, false) {}
@@ -155,7 +198,8 @@ struct InitParamsAccel : InitParams, Serializable<InitParamsAccel> {
         gemmNPerWaveOrMnPerXdl(attr.getMnPerXdl()), gemmKPack(attr.getKpack()),
         splitKFactor(attr.getSplitKFactor()),
         gemmAThreadCopyMoreGemmK(attr.getForceUnroll()),
-        gemmBThreadCopyMoreGemmKPack(false){};
+        gemmBThreadCopyMoreGemmKPack(false), schedHint(attr.getSchedHint()),
+        producerWaves(attr.getProducerWaves()){};
 
   InitParamsAccel(WmmaGemmParamsAttr attr)
       : InitParams{attr.getMPerBlock(), attr.getNPerBlock(),
@@ -164,7 +208,8 @@ struct InitParamsAccel : InitParams, Serializable<InitParamsAccel> {
         gemmNPerWaveOrMnPerXdl(attr.getNPerWave()), gemmKPack(attr.getKpack()),
         splitKFactor(attr.getSplitKFactor()),
         gemmAThreadCopyMoreGemmK(attr.getForceUnroll()),
-        gemmBThreadCopyMoreGemmKPack(false){};
+        gemmBThreadCopyMoreGemmKPack(false), schedHint(attr.getSchedHint()),
+        producerWaves(0){};
 
   int64_t getKPack() { return gemmKPack; }
 
@@ -174,6 +219,12 @@ struct InitParamsAccel : InitParams, Serializable<InitParamsAccel> {
   int64_t splitKFactor;
   bool gemmAThreadCopyMoreGemmK;
   bool gemmBThreadCopyMoreGemmKPack;
+  // How the mainloop is scheduled, see RockSchedHintsPass. Only present in v3
+  // perf configs.
+  int64_t schedHint;
+  // Waves that only copy tiles into LDS, see XdlopsGemmParamsAttr. Only
+  // present in v4 perf configs.
+  int64_t producerWaves;
 
   template <class Self, class F>
   static void visit(Self &&self, F f) {
@@ -188,6 +239,12 @@ struct InitParamsAccel : InitParams, Serializable<InitParamsAccel> {
     }
     f(self.gemmAThreadCopyMoreGemmK);
     f(self.gemmBThreadCopyMoreGemmKPack);
+    if (self.version >= Version::V3) {
+      f(self.schedHint);
+    }
+    if (self.version >= Version::V4) {
+      f(self.producerWaves);
+    }
   }
 };
 
@@ -312,6 +369,12 @@ public:
   Attribute getGemmParamsAttr(OpBuilder &b,
                               const InitParamsNonAccel &params) const override;
 
+  // Set the kpack of `params` to the width of the target's dot product
+  // instructions for the gemm's data type, so that the threadwise gemm can
+  // use them, or to 1 if there are none.
+  void populateKPack(const PopulateParamsInfo &info,
+                     InitParamsNonAccel &params) const;
+
   LogicalResult paramsProbablyValid(OpBuilder &b,
                                     const PopulateParamsInfo &info,
                                     const InitParamsNonAccel &params) override;
@@ -347,6 +410,13 @@ public:
   virtual std::vector<InitParamsAccel>
   getTuningParameters(KernelType opType, Type dataTypeA, Type dataTypeB,
                       StringRef arch) const = 0;
+
+  // Return the heuristic tuning parameters for the problem in `info`, which
+  // are those of getTuningParameters() preceded by any that are specific to
+  // its shape class.
+  std::vector<InitParamsAccel>
+  getCandidateParameters(const PopulateParamsInfo &info) const;
+
   Attribute
   getGemmParamsAttr(OpBuilder &builder,
                     const InitParamsAccel &validParams) const override = 0;
@@ -367,6 +437,17 @@ public:
                        bool enableDPerWaveFiltering = true) = 0;
 
 protected:
+  static constexpr size_t nInitParametersSmallChannelConv = 6;
+  // Tuning parameters for forward convolutions with padded channels, whose
+  // gemmK is short and made of kpacks of 4 and whose gemmN is the whole image.
+  static const InitParamsAccel
+      initParametersSmallChannelConv[nInitParametersSmallChannelConv];
+
+  /// Return the tuning parameter attribute for `params` with all the derived
+  /// fields, such as the per-wave tile sizes, filled in.
+  RockAccelTuningParamAttrInterface
+  getDerivedParamsAttr(OpBuilder &b, const InitParamsAccel &params) const;
+
   LogicalResult populatePaddingKernelDerived(RockGemmWrapperInterface op,
                                              const InitParamsAccel &validParams,
                                              GemmSize &gemmSize,
@@ -399,6 +480,11 @@ class PopulateParamsXDL : public PopulateParamsAccel {
   static const InitParamsAccel
       initParametersForward8Bit[nInitParametersForward8Bit];
 
+  static constexpr size_t nInitParametersFp64 = 16;
+  // Tuning parameters for f64 convolutions, whose tiles must fit in LDS
+  // with 8-byte elements.
+  static const InitParamsAccel initParametersFp64[nInitParametersFp64];
+
 public:
   std::vector<InitParamsAccel>
   getTuningParameters(KernelType opType, Type dataTypeA, Type dataTypeB,
@@ -66,7 +66,8 @@ struct TuningTable {
 
 TuningTable *tuningTableCreate();
 size_t getTuningHash(ModuleOp &mod);
-LogicalResult getTuningProblemStr(ModuleOp mod, SmallVectorImpl<char> &out);
+LogicalResult getTuningProblemStr(ModuleOp mod, SmallVectorImpl<char> &out,
+                                  bool withFusion = false);
 bool tuningTableUpdate(TuningTable *perfTable, StringRef problem,
                        StringRef perfConfig, float time);
 LogicalResult tuningTableLookup(TuningTable *perfTable, ModuleOp &mod,
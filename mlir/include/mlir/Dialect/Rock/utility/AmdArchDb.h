@@ -21,25 +21,58 @@ struct AmdArchInfo {
   int64_t maxWavesPerEU;
   int64_t totalSGPRPerEU;
   int64_t totalVGPRPerEU;
+  // The registers one lane can load values into: the 256 addressable VGPRs,
+  // plus the accumulation registers on the chips (gfx90a onwards) where those
+  // share one register file with the VGPRs.
+  int64_t maxLoadVGPRPerLane;
   int64_t totalSharedMemPerCU;
   int64_t maxSharedMemPerWG; // Not always the same as SharedMemPerCU
   int64_t numEUPerCU;
   int64_t minNumCU;
   bool hasFp8ConversionInstrs;
+  // Peak figures for a representative chip of the family, used by the
+  // performance model that ranks default tuning parameters. They only need to
+  // be in the right ballpark relative to each other.
+  int64_t clockMHz;
+  int64_t accelFlopsPerClockPerCU;    // Dense 16-bit mfma/wmma, 0 if absent
+  int64_t accelF64FlopsPerClockPerCU; // f64 mfma, 0 if absent
+  int64_t hbmBandwidthGBps;
+  int64_t l2BandwidthGBps;
 
   constexpr AmdArchInfo(GemmFeatures defaultFeatures, int64_t waveSize,
                         int64_t maxWavesPerEU, int64_t totalSGPRPerEU,
-                        int64_t totalVGPRPerEU, int64_t sharedMemPerCU,
+                        int64_t totalVGPRPerEU, int64_t maxLoadVGPRPerLane,
+                        int64_t sharedMemPerCU,
                         int64_t sharedMemPerWG, int64_t numEUPerCU,
-                        int64_t minNumCU, bool hasFp8ConversionInstrs)
+                        int64_t minNumCU, bool hasFp8ConversionInstrs,
+                        int64_t clockMHz, int64_t accelFlopsPerClockPerCU,
+                        int64_t accelF64FlopsPerClockPerCU,
+                        int64_t hbmBandwidthGBps, int64_t l2BandwidthGBps)
       : defaultFeatures(defaultFeatures), waveSize(waveSize),
         maxWavesPerEU(maxWavesPerEU), totalSGPRPerEU(totalSGPRPerEU),
-        totalVGPRPerEU(totalVGPRPerEU), totalSharedMemPerCU(sharedMemPerCU),
+        totalVGPRPerEU(totalVGPRPerEU), maxLoadVGPRPerLane(maxLoadVGPRPerLane),
+        totalSharedMemPerCU(sharedMemPerCU),
         maxSharedMemPerWG(sharedMemPerWG), numEUPerCU(numEUPerCU),
-        minNumCU(minNumCU), hasFp8ConversionInstrs(hasFp8ConversionInstrs) {}
+        minNumCU(minNumCU), hasFp8ConversionInstrs(hasFp8ConversionInstrs),
+        clockMHz(clockMHz), accelFlopsPerClockPerCU(accelFlopsPerClockPerCU),
+        accelF64FlopsPerClockPerCU(accelF64FlopsPerClockPerCU),
+        hbmBandwidthGBps(hbmBandwidthGBps), l2BandwidthGBps(l2BandwidthGBps) {}
 
   /// Get the default features for the pari <arch, datatype>
   GemmFeatures getDefaultFeatures(Type dataType);
+
+  /// Get the peak dense mfma/wmma throughput, in flops per clock per CU, for
+  /// the given input data type.
+  int64_t getAccelFlopsPerClockPerCU(Type dataType) const;
+
+  /// Get the number of `inputType` values that one packed dot product
+  /// instruction multiplies and adds into an `accType` accumulator, or 1 if
+  /// there is no such instruction and the multiply-adds have to be scalar.
+  int64_t getDotProductWidth(Type inputType, Type accType) const;
+
+  /// Get the HBM and L2 bandwidth in bytes per clock.
+  double getHbmBytesPerClock() const;
+  double getL2BytesPerClock() const;
 };
 
 AmdArchInfo lookupArchInfo(StringRef arch);
@@ -0,0 +1,138 @@
+//===- approxMath.h - Fast approximations of activation functions --------===//
+//
+// Part of the rocMLIR Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Approximations of the transcendental functions that show up in fused
+// epilogues (exp, tanh, erf, sigmoid, and their GELU/SiLU compositions),
+// written once against an abstract emitter so that the same code builds IR in
+// the RockApproximateMath pass and evaluates on the host in unit tests.
+//
+// An emitter `E` provides a value type `E::Value` and the operations:
+//   cst(double), add, sub, mul, fma(a, b, c) = a * b + c, neg, abs,
+//   min, max, selectNeg(x, ifNeg, otherwise),
+//   rcp(x)          - reciprocal, allowed to be the hardware approximation,
+//   exp2(x)         - 2^x from the hardware instruction,
+//   floorNonNeg(x)  - floor of a non-negative value,
+//   ldexp(p, n)     - p * 2^n for an integral-valued n in the normal range,
+// and a `hasNativeExp2()` query telling whether `exp2` is usable for the
+// value type or must be replaced by `polyExp2`.
+//
+// Error bounds, measured on the host (ApproxMathTests.cpp) against the exact
+// functions as |approx - exact| / max(1, |exact|), excluding the (at most
+// 1 ulp) error of the hardware exp2 and rcp instructions:
+//                       f32        f16 (with polyExp2)
+//   exp (relative)      5e-6       6e-3, for |x| < 80 / results normal in f16
+//   sigmoid, silu       1e-6       2e-3
+//   tanh                1e-6       2e-3
+//   erf                 1e-6       4e-3
+//   erfAsTanh vs. erf   4e-4       2e-3
+// The f16 bounds are a few ulps of f16, most of which comes from rounding the
+// scaled argument of exp2 to f16.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_DIALECT_ROCK_UTILITY_APPROXMATH_H
+#define MLIR_DIALECT_ROCK_UTILITY_APPROXMATH_H
+
+namespace mlir {
+namespace rock {
+namespace approx {
+
+constexpr double kLog2E = 1.4426950408889634;
+/// 2 / sqrt(pi)
+constexpr double kTwoOverSqrtPi = 1.1283791670955126;
+/// 1 / sqrt(2)
+constexpr double kRSqrt2 = 0.7071067811865476;
+
+/// 2^x as 2^n * p(x - n) with n = round(x) and p a cubic minimax fit of 2^f on
+/// [-0.5, 0.5] (relative error 7.5e-5), for types without a usable hardware
+/// exp2. `x` is clamped to [lo, hi], with `lo` integral and `hi` at most half
+/// past an integer, and 2^lo and 2^floor(hi) must be normal numbers.
+template <typename E>
+typename E::Value polyExp2(E &e, typename E::Value x, double lo, double hi) {
+  x = e.min(e.max(x, e.cst(lo)), e.cst(hi));
+  // Shift to non-negative values so that floor is a truncation.
+  typename E::Value n =
+      e.add(e.floorNonNeg(e.add(x, e.cst(0.5 - lo))), e.cst(lo));
+  // x = hi = 15.5 would round to 2^16, which is infinite in f16: round it
+  // down instead, which keeps x - n within [-0.5, 0.5].
+  n = e.min(n, e.cst(static_cast<double>(static_cast<long long>(hi))));
+  typename E::Value f = e.sub(x, n);
+  typename E::Value p = e.cst(0.055171533213000376);
+  p = e.fma(p, f, e.cst(0.2426111119362109));
+  p = e.fma(p, f, e.cst(0.6932610105481484));
+  p = e.fma(p, f, e.cst(0.9999280748030432));
+  return e.ldexp(p, n);
+}
+
+/// 2^x, from the hardware when possible.
+template <typename E> typename E::Value exp2(E &e, typename E::Value x) {
+  if (e.hasNativeExp2())
+    return e.exp2(x);
+  // The f16 range: 2^-14 is the smallest normal and 2^15 * sqrt(2) still fits.
+  return polyExp2(e, x, -14.0, 15.5);
+}
+
+/// e^x = 2^(x * log2(e)).
+template <typename E> typename E::Value exp(E &e, typename E::Value x) {
+  return exp2(e, e.mul(x, e.cst(kLog2E)));
+}
+
+/// 1 / (1 + e^-x).
+template <typename E> typename E::Value sigmoid(E &e, typename E::Value x) {
+  typename E::Value expNeg = exp2(e, e.mul(x, e.cst(-kLog2E)));
+  return e.rcp(e.add(expNeg, e.cst(1.0)));
+}
+
+/// x * sigmoid(x) without materializing the sigmoid.
+template <typename E> typename E::Value silu(E &e, typename E::Value x) {
+  return e.mul(x, sigmoid(e, x));
+}
+
+/// tanh(|x|) = 1 - 2 / (e^(2|x|) + 1), which saturates correctly when the
+/// exponential overflows, with the sign of x put back.
+template <typename E> typename E::Value tanh(E &e, typename E::Value x) {
+  typename E::Value a = e.abs(x);
+  typename E::Value exp2a = exp2(e, e.mul(a, e.cst(2.0 * kLog2E)));
+  typename E::Value t =
+      e.fma(e.cst(-2.0), e.rcp(e.add(exp2a, e.cst(1.0))), e.cst(1.0));
+  return e.selectNeg(x, e.neg(t), t);
+}
+
+/// Abramowitz and Stegun 7.1.26: erf(a) = 1 - q(t) * e^(-a^2) with
+/// t = 1 / (1 + p * a), for a = |x| (absolute error 1.5e-7).
+template <typename E> typename E::Value erf(E &e, typename E::Value x) {
+  typename E::Value a = e.abs(x);
+  typename E::Value t = e.rcp(e.fma(a, e.cst(0.3275911), e.cst(1.0)));
+  typename E::Value q = e.cst(1.061405429);
+  q = e.fma(q, t, e.cst(-1.453152027));
+  q = e.fma(q, t, e.cst(1.421413741));
+  q = e.fma(q, t, e.cst(-0.284496736));
+  q = e.fma(q, t, e.cst(0.254829592));
+  q = e.mul(q, t);
+  typename E::Value expNegSq = exp2(e, e.mul(e.mul(a, a), e.cst(-kLog2E)));
+  typename E::Value y = e.fma(e.neg(q), expNegSq, e.cst(1.0));
+  return e.selectNeg(x, e.neg(y), y);
+}
+
+/// The erf inside GELU, x * 0.5 * (1 + erf(x / sqrt(2))), replaced by its
+/// tanh form: with z = x / sqrt(2),
+///   erf(z) ~ tanh(sqrt(2 / pi) * (x + 0.044715 * x^3))
+///          = tanh(2 / sqrt(pi) * (z + 0.08943 * z^3)).
+template <typename E> typename E::Value erfAsTanh(E &e, typename E::Value z) {
+  typename E::Value z2 = e.mul(z, z);
+  typename E::Value inner =
+      e.mul(e.mul(z, e.fma(z2, e.cst(2.0 * 0.044715), e.cst(1.0))),
+            e.cst(kTwoOverSqrtPi));
+  return tanh(e, inner);
+}
+
+} // namespace approx
+} // namespace rock
+} // namespace mlir
+
+#endif // MLIR_DIALECT_ROCK_UTILITY_APPROXMATH_H
@@ -39,6 +39,68 @@ Type getFlattenedType(Type type);
 Value getAsTensor(OpBuilder &builder, Location loc, mlir::Value value,
                   bool isWritable = false);
 
+/// Emits the Philox4x32-10 counter-based random number generator on the four
+/// i32 words of `counter` with the two i32 words of `key`, returning its four
+/// i32 outputs.
+SmallVector<Value, 4> createPhilox4x32Op(OpBuilder &b, Location loc,
+                                         ArrayRef<Value> counter,
+                                         ArrayRef<Value> key);
+
+/// Returns an i1 that is true when the element with the (index-typed) linear
+/// index `linearIdx` is kept by dropout with probability `rate`. `seed` and
+/// `offset` are the i64 key and upper counter half of the Philox stream, so
+/// the GPU kernels and the host reference agree on every element.
+Value createDropoutKeepOp(OpBuilder &b, Location loc, Value seed,
+                          Value offset, Value linearIdx, double rate);
+
+/// Applies dropout with probability `rate` to the float `value`, the element
+/// at the linear index `linearIdx`: returns zero if it is dropped according to
+/// createDropoutKeepOp() and `value / (1 - rate)` if it is kept.
+Value createDropoutOp(OpBuilder &b, Location loc, Value value, Value seed,
+                      Value offset, Value linearIdx, double rate);
+
+/// Returns the sequence b of a variable-length batch that token `pos` belongs
+/// to, that is seqOffsets[b] <= pos < seqOffsets[b + 1], given that it is one
+/// of the sequences [firstSeq, lastSeq]. `seqOffsets` is the i32 memref of
+/// cumulative sequence lengths.
+Value createFindSequenceOp(OpBuilder &b, Location loc, Value seqOffsets,
+                           Value pos, Value firstSeq, Value lastSeq);
+
+/// Loads the query and key ranges of sequence `seq` of a variable-length
+/// batch, as {qBegin, qEnd, kBegin, kEnd}.
+SmallVector<Value, 4> createLoadSeqBoundsOps(OpBuilder &b, Location loc,
+                                             Value seqOffsetsQ,
+                                             Value seqOffsetsK, Value seq);
+
+/// The part of a variable-length batch a query tile works on: the first
+/// and last sequence its rows belong to, the bounds of the first sequence
+/// (see createLoadSeqBoundsOps()), and the KV tiles [mBegin, mEnd) that hold
+/// the keys of those sequences.
+struct VarlenTileRange {
+  Value firstSeq;
+  Value lastSeq;
+  SmallVector<Value, 4> firstSeqBounds;
+  Value mBegin;
+  Value mEnd;
+};
+
+/// Computes the VarlenTileRange of the query rows
+/// [nBlock * nPerBlock, (nBlock + 1) * nPerBlock) of a batch of `seqLenQ`
+/// packed query tokens, in KV tiles of `mPerBlock` keys.
+VarlenTileRange createVarlenTileRangeOps(OpBuilder &b, Location loc,
+                                         Value seqOffsetsQ, Value seqOffsetsK,
+                                         Value nBlock, int64_t nPerBlock,
+                                         int64_t mPerBlock, int64_t seqLenQ);
+
+/// Returns an i1 that is true when query `q` and key `k` of the tile `range`
+/// belong to different sequences, together with the bounds of the sequence
+/// of `q`. `seqBounds` are the bounds of the sequence of the previous element
+/// and are only looked up again if `q` lies outside of them.
+std::pair<Value, SmallVector<Value, 4>>
+createVarlenMaskOp(OpBuilder &b, Location loc, Value seqOffsetsQ,
+                   Value seqOffsetsK, const VarlenTileRange &range,
+                   ValueRange seqBounds, Value q, Value k);
+
 } // namespace rock
 } // namespace mlir
 
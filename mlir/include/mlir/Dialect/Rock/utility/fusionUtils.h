@@ -24,7 +24,8 @@ namespace rock {
 // Checks whether a function contains any `linalg::GenericOp` which
 // reads or writes to the output of any `Operation` implementing
 // `RockGemmWrapperInterface`. The result of this test can be ignored
-// if the Data Parallel GEMM scheme is used.
+// if the Data Parallel GEMM scheme is used. GEMMs that have a split-K
+// workspace are always legal to fuse into.
 LogicalResult testFusionLegality(func::FuncOp func);
 
 // This is an overload of the `testFusionLegality` which is more convenient
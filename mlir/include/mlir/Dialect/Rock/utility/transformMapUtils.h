@@ -176,10 +176,13 @@ LogicalResult makeLinalgGenericWithIdentityAffMaps(PatternRewriter &rw,
                                                    linalg::GenericOp laOp);
 
 // This function will take an input TransformMapAttr and invert the
-// shapes and transforms.
+// shapes and transforms. If `padSlices` is set, a slice is inverted into
+// padding over the sliced-away region, which is only an inverse on the
+// in-bounds coordinates: writes into the padding are dropped and reads from it
+// return zero.
 TransformMapAttr invertTransformMap(OpBuilder &b,
                                     TransformMapAttr originalTransformMap,
-                                    Location loc);
+                                    Location loc, bool padSlices = false);
 
 TransformMapAttr
 transformCollapseShape(OpBuilder &b, Location loc, ArrayRef<int64_t> inpShape,
@@ -136,7 +136,7 @@ MLIR_CAPI_EXPORTED size_t mlirRockTuningGetKey(MlirModule module, char *buf,
                                                size_t bufLen) {
   auto mod = unwrap(module);
   SmallString<ROCMLIR_TUNING_KEY_BUFSZ> perfStr;
-  if (failed(rock::getTuningProblemStr(mod, perfStr)))
+  if (failed(rock::getTuningProblemStr(mod, perfStr, /*withFusion=*/true)))
     return (size_t)(-1);
   strncpy(buf, perfStr.c_str(), bufLen);
   return perfStr.size();
@@ -31,6 +31,8 @@
 #include "llvm/ADT/TypeSwitch.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <cmath>
+
 namespace mlir {
 #define GEN_PASS_DEF_EMULATEFP8EXTTRUNCPASS
 #include "mlir/Conversion/RocMLIRPasses.h.inc"
@@ -59,13 +61,20 @@ struct Fp8ExtToTableLookupPattern final : public OpConversionPattern<ExtFOp> {
 struct Fp8TruncToCallPattern final : public OpConversionPattern<TruncFOp> {
   FlatSymbolRefAttr f8E4M3FNUZFunc;
   FlatSymbolRefAttr f8E5M2FNUZFunc;
+  FlatSymbolRefAttr f8E4M3FNFunc;
+  FlatSymbolRefAttr f8E5M2Func;
 
   // The functions are optional - if they aren't provided for a type (the null
   // attribute is sent in) the pattern will not apply.
   Fp8TruncToCallPattern(MLIRContext *ctx, FlatSymbolRefAttr f8E4M3FNUZFunc,
-                        FlatSymbolRefAttr f8E5M2FNUZFunc)
+                        FlatSymbolRefAttr f8E5M2FNUZFunc,
+                        FlatSymbolRefAttr f8E4M3FNFunc,
+                        FlatSymbolRefAttr f8E5M2Func)
       : OpConversionPattern<TruncFOp>::OpConversionPattern(ctx),
-        f8E4M3FNUZFunc(f8E4M3FNUZFunc), f8E5M2FNUZFunc(f8E5M2FNUZFunc) {}
+        f8E4M3FNUZFunc(f8E4M3FNUZFunc), f8E5M2FNUZFunc(f8E5M2FNUZFunc),
+        f8E4M3FNFunc(f8E4M3FNFunc), f8E5M2Func(f8E5M2Func) {}
+
+  FlatSymbolRefAttr getFuncFor(Type outElemType) const;
 
   LogicalResult match(TruncFOp op) const override;
   void rewrite(TruncFOp op, OpAdaptor adaptor,
@@ -188,6 +197,24 @@ void Fp8ExtToTableLookupPattern::rewrite(
   return rewriter.replaceOp(op, ret);
 }
 
+/// Inserts an empty private function from f32 to `outType` into `module`
+/// for one of the truncation functions below.
+static func::FuncOp createTruncFunction(Location loc, FloatType outType,
+                                        Operation *module) {
+  SmallString<32> funcName;
+  llvm::raw_svector_ostream funcNameGen(funcName);
+  funcNameGen << "_rocmlir_trunc_f32_to_" << outType;
+  auto func = func::FuncOp::create(
+      loc, funcName,
+      FunctionType::get(loc.getContext(), {Float32Type::get(loc.getContext())},
+                        {outType}));
+  SymbolTable symtab(module);
+  symtab.insert(func);
+  symtab.setSymbolVisibility(func, SymbolTable::Visibility::Private);
+  func.addEntryBlock();
+  return func;
+}
+
 /// Creates a function that trunctates input floats to the 8-bit `ooutTYpe`,
 /// where `outType` is one of the NANOO float types (f8E4M3FNUZ or f8E5M2FNUZ),
 /// and inserts it into `module`, returning a reference to the inserted
@@ -206,26 +233,10 @@ void Fp8ExtToTableLookupPattern::rewrite(
 static FlatSymbolRefAttr makeFp8TruncFunction(Location loc, FloatType outType,
                                               Operation *module) {
   ImplicitLocOpBuilder b(loc, loc.getContext());
-  SymbolTable symtab(module);
-
-  SmallString<32> funcName;
-  (Twine("_rocmlir_trunc_f32_to_") +
-   (TypeSwitch<FloatType, StringRef>(outType)
-        .Case<Float8E4M3FNUZType>(
-            [](auto ignored) -> StringRef { return "f8E4M3FNUZ"; })
-        .Case<Float8E5M2FNUZType>(
-            [](auto ignored) -> StringRef { return "f8E5M2FNUZ"; })
-        .Default([](auto ignored) -> StringRef { return "unknownERROR"; })))
-      .toVector(funcName);
-  auto func = func::FuncOp::create(
-      loc, funcName, b.getFunctionType({b.getF32Type()}, {outType}));
-  StringAttr realFuncName = symtab.insert(func);
-  auto symbolRef = FlatSymbolRefAttr::get(realFuncName);
-  symtab.setSymbolVisibility(func, SymbolTable::Visibility::Private);
-
-  Block *entry = func.addEntryBlock();
-  b.setInsertionPointToStart(entry);
-  Value in = entry->getArgument(0);
+  func::FuncOp func = createTruncFunction(loc, outType, module);
+  auto symbolRef = FlatSymbolRefAttr::get(func.getSymNameAttr());
+  b.setInsertionPointToStart(&func.front());
+  Value in = func.getArgument(0);
 
   Type i32 = b.getI32Type();
   Type i8 = b.getI8Type();
@@ -365,15 +376,106 @@ static FlatSymbolRefAttr makeFp8TruncFunction(Location loc, FloatType outType,
   return symbolRef;
 }
 
+/// Creates a function that truncates input floats to the 8-bit `outType`,
+/// where `outType` is one of the OCP float types (f8E4M3FN or f8E5M2), and
+/// inserts it into `module`, returning a reference to the inserted function.
+///
+/// Like the NANOO truncation, this saturates finite values to the range of
+/// `outType`. It rounds to nearest even, and keeps denormals and negative
+/// zero, which these types can represent. Infinities become the infinity of
+/// f8E5M2 or the NaN of f8E4M3FN.
+static FlatSymbolRefAttr makeOcpFp8TruncFunction(Location loc,
+                                                 FloatType outType,
+                                                 Operation *module) {
+  ImplicitLocOpBuilder b(loc, loc.getContext());
+  func::FuncOp func = createTruncFunction(loc, outType, module);
+  auto symbolRef = FlatSymbolRefAttr::get(func.getSymNameAttr());
+  b.setInsertionPointToStart(&func.front());
+  Value in = func.getArgument(0);
+
+  Type i32 = b.getI32Type();
+  Type f32 = b.getF32Type();
+  auto i32Const = [&](uint32_t value) -> Value {
+    return b.createOrFold<ConstantOp>(i32, b.getI32IntegerAttr(value));
+  };
+  auto f32Bits = [](APFloat value) -> uint32_t {
+    bool losesInfo = false;
+    value.convert(APFloat::IEEEsingle(), APFloat::rmNearestTiesToEven,
+                  &losesInfo);
+    return value.bitcastToAPInt().getZExtValue();
+  };
+  const llvm::fltSemantics &outSem = outType.getFloatSemantics();
+  int32_t mBits = APFloat::semanticsPrecision(outSem) - 1;
+  int32_t minExp = APFloat::semanticsMinExponent(outSem);
+  uint32_t nanBits = APFloat::getQNaN(outSem).bitcastToAPInt().getZExtValue();
+  uint32_t infBits =
+      outType.isFloat8E5M2()
+          ? APFloat::getInf(outSem).bitcastToAPInt().getZExtValue()
+          : nanBits;
+
+  Value bits = b.create<BitcastOp>(i32, in);
+  Value sign = b.create<AndIOp>(b.create<ShRUIOp>(bits, i32Const(24)),
+                                i32Const(0x80));
+  Value abs = b.create<AndIOp>(bits, i32Const(0x7fffffff));
+  Value isNan =
+      b.create<CmpIOp>(CmpIPredicate::ugt, abs, i32Const(0x7f800000));
+  Value isInf = b.create<CmpIOp>(CmpIPredicate::eq, abs, i32Const(0x7f800000));
+  // Non-negative floats order like their bits.
+  Value clamped = b.create<MinUIOp>(
+      abs, i32Const(f32Bits(APFloat::getLargest(outSem))));
+
+  // Denormals are a multiple of the smallest one, which scaling by its
+  // inverse and adding 2^23 rounds to the nearest even integer in the low
+  // mantissa bits.
+  Value scaled = b.create<MulFOp>(
+      b.create<BitcastOp>(f32, clamped),
+      b.create<ConstantFloatOp>(APFloat(std::ldexp(1.0f, mBits - minExp)),
+                                b.getF32Type()));
+  Value shifted = b.create<AddFOp>(
+      scaled, b.create<ConstantFloatOp>(APFloat(std::ldexp(1.0f, 23)),
+                                        b.getF32Type()));
+  Value denormal = b.create<AndIOp>(b.create<BitcastOp>(i32, shifted),
+                                    i32Const((1u << 23) - 1));
+
+  // Normal values round to nearest even by adding just under half of the
+  // dropped mantissa, plus the lowest kept bit, and then get the exponent
+  // bias of `outType`.
+  uint32_t dropped = 23 - mBits;
+  Value lowestKept = b.create<AndIOp>(
+      b.create<ShRUIOp>(clamped, i32Const(dropped)), i32Const(1));
+  Value rounded = b.create<AddIOp>(
+      b.create<AddIOp>(clamped, i32Const((1u << (dropped - 1)) - 1)),
+      lowestKept);
+  Value normal = b.create<SubIOp>(
+      b.create<ShRUIOp>(rounded, i32Const(dropped)),
+      i32Const(static_cast<uint32_t>(127 - (1 - minExp)) << mBits));
+
+  Value isDenormal = b.create<CmpIOp>(
+      CmpIPredicate::ult, clamped,
+      i32Const(f32Bits(APFloat::getSmallestNormalized(outSem))));
+  Value magnitude = b.create<SelectOp>(isDenormal, denormal, normal);
+  magnitude = b.create<SelectOp>(isInf, i32Const(infBits), magnitude);
+  magnitude = b.create<SelectOp>(isNan, i32Const(nanBits), magnitude);
+  Value result = b.create<TruncIOp>(b.getI8Type(),
+                                    b.create<OrIOp>(magnitude, sign));
+  b.create<func::ReturnOp>(b.create<BitcastOp>(outType, result).getResult());
+  return symbolRef;
+}
+
+FlatSymbolRefAttr Fp8TruncToCallPattern::getFuncFor(Type outElemType) const {
+  return TypeSwitch<Type, FlatSymbolRefAttr>(outElemType)
+      .Case<Float8E4M3FNUZType>([&](auto ignored) { return f8E4M3FNUZFunc; })
+      .Case<Float8E5M2FNUZType>([&](auto ignored) { return f8E5M2FNUZFunc; })
+      .Case<Float8E4M3FNType>([&](auto ignored) { return f8E4M3FNFunc; })
+      .Case<Float8E5M2Type>([&](auto ignored) { return f8E5M2Func; })
+      .Default([](auto ignored) { return nullptr; });
+}
+
 LogicalResult Fp8TruncToCallPattern::match(TruncFOp op) const {
   if (failed(canBeConverted(op.getResult().getType())))
     return failure();
   Type resType = getElementTypeOrSelf(op.getOut().getType());
-  if (resType.isFloat8E4M3FN() && !f8E4M3FNUZFunc)
-    return failure();
-  if (resType.isFloat8E5M2FNUZ() && !f8E5M2FNUZFunc)
-    return failure();
-  return success();
+  return success(getFuncFor(resType) != nullptr);
 }
 
 static Type cloneOrReplace(Type t, Type newElementType) {
@@ -391,12 +493,7 @@ void Fp8TruncToCallPattern::rewrite(TruncFOp op, OpAdaptor adaptor,
   Type outType = op.getOut().getType();
   FloatType outElemType = cast<FloatType>(getElementTypeOrSelf(outType));
 
-  FlatSymbolRefAttr func = TypeSwitch<Type, FlatSymbolRefAttr>(outElemType)
-                               .Case<Float8E4M3FNUZType>(
-                                   [&](auto ignored) { return f8E4M3FNUZFunc; })
-                               .Case<Float8E5M2FNUZType>(
-                                   [&](auto ignored) { return f8E5M2FNUZFunc; })
-                               .Default([](auto ignored) { return nullptr; });
+  FlatSymbolRefAttr func = getFuncFor(outElemType);
 
   auto oneToOut = [&](Value f32) -> Value {
     auto call = rewriter.create<func::CallOp>(loc, func, outElemType, f32);
@@ -433,10 +530,12 @@ void Fp8TruncToCallPattern::rewrite(TruncFOp op, OpAdaptor adaptor,
 
 void mlir::addEmulateFp8ExtTruncPatterns(
     RewritePatternSet &patterns, FlatSymbolRefAttr f8E4M3FNUZTruncFunc,
-    FlatSymbolRefAttr f8E5M2FNUZTruncFunc) {
+    FlatSymbolRefAttr f8E5M2FNUZTruncFunc, FlatSymbolRefAttr f8E4M3FNTruncFunc,
+    FlatSymbolRefAttr f8E5M2TruncFunc) {
   patterns.add<Fp8ExtToTableLookupPattern>(patterns.getContext());
   patterns.add<Fp8TruncToCallPattern>(patterns.getContext(),
-                                      f8E4M3FNUZTruncFunc, f8E5M2FNUZTruncFunc);
+                                      f8E4M3FNUZTruncFunc, f8E5M2FNUZTruncFunc,
+                                      f8E4M3FNTruncFunc, f8E5M2TruncFunc);
 }
 
 void EmulateFp8ExtTruncPass::runOnOperation() {
@@ -460,13 +559,20 @@ void EmulateFp8ExtTruncPass::runOnOperation() {
 
   FlatSymbolRefAttr f8E4M3FNUZTruncFunc = nullptr;
   FlatSymbolRefAttr f8E5M2FNUZTruncFunc = nullptr;
-  SmallVector<Location> f8E4M3FNUZLocs, f8E5M2FNUZLocs;
+  FlatSymbolRefAttr f8E4M3FNTruncFunc = nullptr;
+  FlatSymbolRefAttr f8E5M2TruncFunc = nullptr;
+  SmallVector<Location> f8E4M3FNUZLocs, f8E5M2FNUZLocs, f8E4M3FNLocs,
+      f8E5M2Locs;
   op->walk([&](TruncFOp op) {
     Type outElemType = getElementTypeOrSelf(op.getOut().getType());
     if (outElemType.isFloat8E4M3FNUZ())
       f8E4M3FNUZLocs.push_back(op->getLoc());
     else if (outElemType.isFloat8E5M2FNUZ())
       f8E5M2FNUZLocs.push_back(op->getLoc());
+    else if (outElemType.isFloat8E4M3FN())
+      f8E4M3FNLocs.push_back(op->getLoc());
+    else if (outElemType.isFloat8E5M2())
+      f8E5M2Locs.push_back(op->getLoc());
   });
 
   if (!f8E4M3FNUZLocs.empty()) {
@@ -478,9 +584,19 @@ void EmulateFp8ExtTruncPass::runOnOperation() {
         FusedLoc::get(ctx, f8E5M2FNUZLocs), Float8E5M2FNUZType::get(ctx), op);
   }
 
+  if (!f8E4M3FNLocs.empty()) {
+    f8E4M3FNTruncFunc = makeOcpFp8TruncFunction(
+        FusedLoc::get(ctx, f8E4M3FNLocs), Float8E4M3FNType::get(ctx), op);
+  }
+  if (!f8E5M2Locs.empty()) {
+    f8E5M2TruncFunc = makeOcpFp8TruncFunction(
+        FusedLoc::get(ctx, f8E5M2Locs), Float8E5M2Type::get(ctx), op);
+  }
+
   RewritePatternSet rewrites(ctx);
   addEmulateFp8ExtTruncPatterns(rewrites, f8E4M3FNUZTruncFunc,
-                                f8E5M2FNUZTruncFunc);
+                                f8E5M2FNUZTruncFunc, f8E4M3FNTruncFunc,
+                                f8E5M2TruncFunc);
   if (failed(applyPartialConversion(op, target, std::move(rewrites))))
     return signalPassFailure();
 }
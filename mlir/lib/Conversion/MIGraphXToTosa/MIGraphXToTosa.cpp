@@ -191,6 +191,15 @@ struct ConvConverter final : public OpConversionPattern<ConvType> {
                   ConversionPatternRewriter &rewriter) const override;
 };
 
+struct DeconvConverter final
+    : public OpConversionPattern<migraphx::DeconvolutionOp> {
+  using OpConversionPattern<migraphx::DeconvolutionOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(migraphx::DeconvolutionOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final;
+};
+
 template <typename DotType>
 struct DotConverter final : public OpConversionPattern<DotType> {
   using OpConversionPattern<DotType>::OpConversionPattern;
@@ -370,6 +379,72 @@ LogicalResult ConvConverter<ConvType>::matchAndRewrite(
   return success();
 }
 
+LogicalResult DeconvConverter::matchAndRewrite(
+    migraphx::DeconvolutionOp op, OpAdaptor adaptor,
+    ConversionPatternRewriter &rewriter) const {
+  Location loc = op->getLoc();
+  auto outputTy = cast<MIXRShapedType>(op.getOutput().getType());
+  ArrayRef<int64_t> outShape = outputTy.getShape();
+  if (outShape.size() != 4)
+    return op->emitError("Only 2-D deconvolution has been implemented.");
+
+  // NCHW -> NHWC for the data, and [C, K, Y, X] -> [K, Y, X, C] for the
+  // filter, which is what tosa.transpose_conv2d expects. In a grouped
+  // deconvolution, K is the number of output channels per group.
+  Value input = getTransposeOp(loc, adaptor.getInput(), rewriter, {0, 2, 3, 1});
+  Value filter =
+      getTransposeOp(loc, adaptor.getFilter(), rewriter, {1, 2, 3, 0});
+  ArrayRef<int64_t> inShape = cast<ShapedType>(input.getType()).getShape();
+  ArrayRef<int64_t> filterShape =
+      cast<ShapedType>(filter.getType()).getShape();
+
+  // The result of a transposed convolution is
+  //   (in - 1) * stride - pad_low - pad_high + dilation * (filter - 1) + 1
+  // long in each spatial dimension, and TOSA describes the pads as negative
+  // output paddings. MIGraphX carries output padding in the result type
+  // instead, so take the high pads from there.
+  ArrayAttr padAttr = op.getPadding();
+  ArrayAttr strideAttr = op.getStride();
+  ArrayAttr dilationAttr = op.getDilation();
+  SmallVector<int64_t> outPads, strides, dilations;
+  for (int64_t i = 0; i < 2; ++i) {
+    int64_t stride = cast<IntegerAttr>(strideAttr[i]).getInt();
+    int64_t dilation = cast<IntegerAttr>(dilationAttr[i]).getInt();
+    int64_t padLow = cast<IntegerAttr>(padAttr[i]).getInt();
+    int64_t padHigh = (inShape[i + 1] - 1) * stride +
+                      dilation * (filterShape[i + 1] - 1) + 1 -
+                      outShape[i + 2] - padLow;
+    outPads.push_back(-padLow);
+    outPads.push_back(-padHigh);
+    strides.push_back(stride);
+    dilations.push_back(dilation);
+  }
+
+  SmallVector<int64_t> newShape{outShape[0], outShape[2], outShape[3],
+                                outShape[1]};
+  auto newOutTy = RankedTensorType::get(newShape, outputTy.getElementType());
+  auto top = rewriter.create<tosa::TransposeConv2DOp>(
+      loc, newOutTy, input, filter,
+      getZeroTensor(loc, outputTy.getElementType(), outShape[1], rewriter),
+      rewriter.getDenseI64ArrayAttr(outPads),
+      rewriter.getDenseI64ArrayAttr(strides),
+      rewriter.getDenseI64ArrayAttr(newShape));
+  // TOSA has no dilated transposed convolution, so carry the dilation along
+  // for tosa-to-rock the same way the layouts are carried.
+  if (llvm::any_of(dilations, [](int64_t d) { return d != 1; }))
+    top->setAttr("dilation", rewriter.getDenseI64ArrayAttr(dilations));
+  // Nor does it have groups, which are carried the same way as for
+  // convolutions.
+  if (op.getGroup() != 1)
+    top->setAttr("group", rewriter.getI64IntegerAttr(op.getGroup()));
+  if (auto attr = op->getAttrOfType<StringAttr>("perf_config"))
+    top->setAttr("perf_config", attr);
+
+  rewriter.replaceOp(op, getTransposeOp(loc, top.getResult(), rewriter,
+                                        {0, 3, 1, 2}));
+  return success();
+}
+
 template <typename DotType>
 LogicalResult DotConverter<DotType>::matchAndRewrite(
     DotType op, OpAdaptor adaptor, ConversionPatternRewriter &rewriter) const {
@@ -1228,9 +1303,10 @@ void migraphx::populateMIGraphXToTosaConversionPatterns(
     RewritePatternSet &patterns, TypeConverter &typeConverter) {
   patterns.add<
       ConvConverter<ConvolutionOp>, ConvConverter<QuantConvolutionOp>,
-      DotConverter<DotOp>, DotConverter<QuantDotOp>, BroadcastConverter,
-      MultiBroadcastConverter, TransposeConverter, ReshapeConverter,
-      SliceConverter, ReduceMeanConverter, TrivialConverter<AddOp, tosa::AddOp>,
+      DeconvConverter, DotConverter<DotOp>, DotConverter<QuantDotOp>,
+      BroadcastConverter, MultiBroadcastConverter, TransposeConverter,
+      ReshapeConverter, SliceConverter, ReduceMeanConverter,
+      TrivialConverter<AddOp, tosa::AddOp>,
       TrivialConverter<SubOp, tosa::SubOp>,
       TrivialConverter<PowOp, tosa::PowOp>, DivConverter, MulConverter,
       TrivialConverter<AbsOp, tosa::AbsOp>,
@@ -122,6 +122,59 @@ struct MIIdRewritePattern : public OpRewritePattern<Tmi> {
   }
 };
 
+/// Calls the AMDGPU intrinsic `name` on i32 constants. The scheduling
+/// intrinsics have no ROCDL ops, so they are emitted as generic intrinsic
+/// calls, which survive the GPU to ROCDL lowering untouched.
+static void createI32IntrinsicCall(PatternRewriter &b, Location loc,
+                                   StringRef name, ArrayRef<int32_t> args) {
+  SmallVector<Value, 3> operands;
+  for (int32_t arg : args)
+    operands.push_back(b.create<LLVM::ConstantOp>(loc, b.getI32Type(),
+                                                  b.getI32IntegerAttr(arg)));
+  b.create<LLVM::CallIntrinsicOp>(
+      loc, /*results=*/Type(), b.getStringAttr(name), operands,
+      LLVM::FastmathFlagsAttr::get(b.getContext(), LLVM::FastmathFlags::none));
+}
+
+struct SchedGroupBarrierRewritePattern
+    : public OpRewritePattern<rock::SchedGroupBarrierOp> {
+  using OpRewritePattern<rock::SchedGroupBarrierOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(rock::SchedGroupBarrierOp op,
+                                PatternRewriter &b) const override {
+    createI32IntrinsicCall(
+        b, op.getLoc(), "llvm.amdgcn.sched.group.barrier",
+        {static_cast<int32_t>(op.getMask()), static_cast<int32_t>(op.getSize()),
+         static_cast<int32_t>(op.getSyncId())});
+    b.eraseOp(op);
+    return success();
+  }
+};
+
+struct IglpOptRewritePattern : public OpRewritePattern<rock::IglpOptOp> {
+  using OpRewritePattern<rock::IglpOptOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(rock::IglpOptOp op,
+                                PatternRewriter &b) const override {
+    createI32IntrinsicCall(b, op.getLoc(), "llvm.amdgcn.iglp.opt",
+                           {static_cast<int32_t>(op.getVariant())});
+    b.eraseOp(op);
+    return success();
+  }
+};
+
+struct WaveBarrierRewritePattern
+    : public OpRewritePattern<rock::WaveBarrierOp> {
+  using OpRewritePattern<rock::WaveBarrierOp>::OpRewritePattern;
+
+  LogicalResult matchAndRewrite(rock::WaveBarrierOp op,
+                                PatternRewriter &b) const override {
+    createI32IntrinsicCall(b, op.getLoc(), "llvm.amdgcn.wave.barrier", {});
+    b.eraseOp(op);
+    return success();
+  }
+};
+
 struct WorkgroupIdRewritePattern
     : public OpRewritePattern<rock::WorkgroupIdOp> {
   using OpRewritePattern<rock::WorkgroupIdOp>::OpRewritePattern;
@@ -352,7 +405,8 @@ void LowerRockOpsToGPUPass::runOnOperation() {
     patterns.add<MIGPUAllocRewritePattern,
                  MIOpRewritePattern<rock::WorkgroupBarrierOp, gpu::BarrierOp>,
                  MIOpRewritePattern<rock::LDSBarrierOp, amdgpu::LDSBarrierOp>,
-                 WorkgroupIdRewritePattern,
+                 SchedGroupBarrierRewritePattern, IglpOptRewritePattern,
+                 WaveBarrierRewritePattern, WorkgroupIdRewritePattern,
                  MIIdRewritePattern<rock::WorkitemIdOp, gpu::ThreadIdOp>,
                  MIOpRewritePattern<func::ReturnOp, gpu::ReturnOp>>(ctx);
 
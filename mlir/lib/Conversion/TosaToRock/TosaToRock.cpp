@@ -21,6 +21,7 @@
 #include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Dialect/Rock/utility/builderUtils.h"
 #include "mlir/Dialect/Rock/utility/loweringUtils.h"
+#include "mlir/Dialect/Rock/utility/math.h"
 #include "mlir/Dialect/Tensor/IR/Tensor.h"
 #include "mlir/Dialect/Tosa/IR/TosaOps.h"
 #include "mlir/Dialect/Utils/StructuredOpsUtils.h"
@@ -142,14 +143,16 @@ getArchAttributes(Operation *op, Type inputType) {
   return {arch, num_cu, features};
 }
 
-static FailureOr<rock::ConvOp>
+template <typename RockConvOpT>
+static FailureOr<RockConvOpT>
 makeRockConv(ConversionPatternRewriter &rw, Operation *op, Value input,
              Value filter, Value output, DenseI64ArrayAttr pad,
              DenseI64ArrayAttr stride, DenseI64ArrayAttr dilation,
-             int64_t group) {
+             int64_t group, StringRef defaultFilterLayout = "kyxc",
+             ArrayRef<NamedAttribute> extraAttrs = {}) {
   Location loc = op->getLoc();
 
-  SmallString<8> filterLayout("kyxc");
+  SmallString<8> filterLayout(defaultFilterLayout);
   if (auto attr = op->getAttrOfType<StringAttr>("filter_layout"))
     filterLayout = attr.getValue();
   else if (filter.getType().template cast<ShapedType>().getRank() > 4)
@@ -170,20 +173,32 @@ makeRockConv(ConversionPatternRewriter &rw, Operation *op, Value input,
   auto inputExp = expandTensor(rw, op, input, inputLayout, "c", group);
   auto filterExp = expandTensor(rw, op, filter, filterLayout, "k", group);
   auto outputExp = expandTensor(rw, op, output, outputLayout, "k", group);
+  if (!inputExp || !filterExp || !outputExp)
+    return failure();
 
   StringAttr arch;
   std::optional<uint32_t> num_cu;
   rock::GemmFeatures features;
   std::tie(arch, num_cu, features) = getArchAttributes(op, input.getType());
 
-  IntegerAttr numCUAttr =
-      num_cu.has_value() ? rw.getI32IntegerAttr(num_cu.value()) : nullptr;
-  auto cop = rw.create<rock::ConvOp>(
-      loc, outputExp.getType(), filterExp, inputExp, outputExp, arch,
-      rw.getAttr<rock::GemmFeaturesAttr>(features),
-      /*blockSize=*/nullptr, /*gridSize=*/nullptr, rw.getIndexArrayAttr(pad),
-      rw.getIndexArrayAttr(stride), rw.getIndexArrayAttr(dilation),
-      /*params=*/nullptr, numCUAttr);
+  SmallVector<NamedAttribute> attrs{
+      rw.getNamedAttr("arch", arch),
+      rw.getNamedAttr("features",
+                      rw.getAttr<rock::GemmFeaturesAttr>(features)),
+      rw.getNamedAttr("padding", rw.getIndexArrayAttr(pad)),
+      rw.getNamedAttr("strides", rw.getIndexArrayAttr(stride)),
+      rw.getNamedAttr("dilations", rw.getIndexArrayAttr(dilation))};
+  if (num_cu.has_value())
+    attrs.push_back(
+        rw.getNamedAttr("numCU", rw.getI32IntegerAttr(num_cu.value())));
+  llvm::append_range(attrs, extraAttrs);
+  // Backward data writes its result into the convolution's input.
+  Type resultType = std::is_same<RockConvOpT, rock::ConvBwdDataOp>::value
+                        ? inputExp.getType()
+                        : outputExp.getType();
+  auto cop = rw.create<RockConvOpT>(loc, resultType,
+                                    ValueRange{filterExp, inputExp, outputExp},
+                                    attrs);
 
   // specify layout attributes
   SmallVector<StringAttr, 5> filterLayoutSpec;
@@ -214,6 +229,42 @@ makeRockConv(ConversionPatternRewriter &rw, Operation *op, Value input,
   return cop;
 }
 
+/// Adds the bias operand (operand 2) of the TOSA convolution `op` to its
+/// lowered `result`, unless the bias is a constant zero.
+static FailureOr<Value> addConvBias(ConversionPatternRewriter &rw,
+                                    Operation *op, Value result, Value bias) {
+  if (isConstantZero(op->getOperand(2)))
+    return result;
+
+  // non-zero bias, replace with tosa.add w/ broadcast
+  auto biasType = bias.getType().template cast<ShapedType>();
+  if (!biasType.hasStaticShape())
+    return failure();
+
+  Location loc = op->getLoc();
+  Type resultType = op->getResult(0).getType();
+  int64_t nDims = resultType.cast<ShapedType>().getRank();
+  SmallVector<int64_t> biasShape;
+  for (int i = 0; i < nDims - 1; i++)
+    biasShape.push_back(1);
+  biasShape.push_back(biasType.getShape()[0]);
+  auto newType = RankedTensorType::get(biasShape, biasType.getElementType());
+
+  // [[0, 1, 2, 3]]
+  ReassociationExprs exprs;
+  for (int i = 0; i < nDims; i++)
+    exprs.push_back(getAffineDimExpr(i, op->getContext()));
+  SmallVector<ReassociationExprs, 1> reassociations;
+  reassociations.push_back(exprs);
+
+  auto biasExpand =
+      rw.create<tensor::ExpandShapeOp>(loc, newType, bias, reassociations);
+
+  return rw
+      .create<tosa::AddOp>(loc, resultType, ValueRange{result, biasExpand})
+      .getResult();
+}
+
 template <typename OpT>
 class ConvConverter final : public OpConversionPattern<OpT> {
 public:
@@ -223,7 +274,6 @@ public:
                                 ConversionPatternRewriter &rw) const final {
     auto operands = adaptor.getOperands();
     auto loc = op->getLoc();
-    auto *context = op->getContext();
     auto input = operands[0];
     auto filter = operands[1];
     auto bias = operands[2];
@@ -235,45 +285,92 @@ public:
     int64_t group = 1;
     if (auto attr = op->template getAttrOfType<IntegerAttr>("group"))
       group = attr.getInt(); // Use op.getGroup() when all OpT have it.
-    FailureOr<rock::ConvOp> rockConv =
-        makeRockConv(rw, op, input, filter, output, op.getPadAttr(),
-                     op.getStrideAttr(), op.getDilationAttr(), group);
+    FailureOr<rock::ConvOp> rockConv = makeRockConv<rock::ConvOp>(
+        rw, op, input, filter, output, op.getPadAttr(), op.getStrideAttr(),
+        op.getDilationAttr(), group);
     if (failed(rockConv))
       return failure();
 
     Value result = rw.create<rock::TensorUntransformCastOp>(
         loc, outputType, rockConv->getResult(), rockConv->getOutput());
-    // test for zero bias, and ignore
-    if (!isConstantZero(op.getOperand(2))) {
-      // non-zero bias, replace with tosa.add w/ broadcast
-      auto biasType = bias.getType().template cast<ShapedType>();
-      if (!biasType.hasStaticShape())
-        return failure();
+    FailureOr<Value> biased = addConvBias(rw, op, result, bias);
+    if (failed(biased))
+      return failure();
+    rw.replaceOp(op, *biased);
 
-      int64_t nDims = input.getType().template cast<ShapedType>().getRank();
-      SmallVector<int64_t> biasShape;
-      for (int i = 0; i < nDims - 1; i++)
-        biasShape.push_back(1);
-      biasShape.push_back(biasType.getShape()[0]);
-      auto newType =
-          RankedTensorType::get(biasShape, biasType.getElementType());
-
-      // [[0, 1, 2, 3]]
-      ReassociationExprs exprs;
-      for (int i = 0; i < nDims; i++)
-        exprs.push_back(getAffineDimExpr(i, context));
-      SmallVector<ReassociationExprs, 1> reassociations;
-      reassociations.push_back(exprs);
-
-      auto biasExpand =
-          rw.create<tensor::ExpandShapeOp>(loc, newType, bias, reassociations);
-
-      result = rw.create<tosa::AddOp>(loc, op.getType(),
-                                      ValueRange{result, biasExpand});
+    return success();
+  }
+};
+
+/// Lowers a transposed convolution to the backward data convolution of the
+/// forward convolution it transposes: the TOSA input is the convolution's
+/// output, and the TOSA result is the convolution's input.
+class TransposeConvConverter final
+    : public OpConversionPattern<tosa::TransposeConv2DOp> {
+public:
+  using OpConversionPattern<tosa::TransposeConv2DOp>::OpConversionPattern;
+
+  LogicalResult matchAndRewrite(tosa::TransposeConv2DOp op,
+                                tosa::TransposeConv2DOp::Adaptor adaptor,
+                                ConversionPatternRewriter &rw) const final {
+    Location loc = op->getLoc();
+    auto outputType = op.getType().cast<RankedTensorType>();
+    Value input = adaptor.getInput();
+    Value filter = adaptor.getFilter();
+
+    SmallVector<int64_t, 2> dilations{1, 1};
+    if (auto attr = op->getAttrOfType<DenseI64ArrayAttr>("dilation"))
+      dilations.assign(attr.asArrayRef().begin(), attr.asArrayRef().end());
+    ArrayRef<int64_t> strides = op.getStride();
+    ArrayRef<int64_t> outPad = op.getOutPad();
+
+    // A strided transposed convolution is split into one backward data
+    // kernel per stride phase. A fused graph gets exactly one launch, so
+    // those kernels are batched into one gemm. Each phase then writes all of
+    // its outputs, zeros included, which leaves no output untouched as long
+    // as the phases cover every residue, that is when stride and dilation
+    // are coprime. Otherwise a zero-initialization kernel would be needed.
+    for (auto [stride, dilation] : llvm::zip(strides, dilations))
+      if (math_util::gcd(stride, dilation) != 1)
+        return rw.notifyMatchFailure(
+            op, "transposed convolution needs a zero-initialization kernel");
+
+    SmallVector<int64_t, 4> pads;
+    for (int64_t i = 0; i < 2; ++i) {
+      int64_t padLow = -outPad[2 * i];
+      int64_t padHigh = -outPad[2 * i + 1];
+      // Output padding past the last input row gets no contribution, and
+      // the convolution this transposes rounds it away.
+      if (padHigh < 0 && padHigh > -strides[i])
+        padHigh = 0;
+      if (padLow < 0 || padHigh < 0)
+        return rw.notifyMatchFailure(
+            op, "transposed convolution extends past its full result");
+      pads.push_back(padLow);
+      pads.push_back(padHigh);
     }
 
-    rw.replaceOp(op, result);
+    int64_t group = 1;
+    if (auto attr = op->getAttrOfType<IntegerAttr>("group"))
+      group = attr.getInt();
+    Value output =
+        rw.create<bufferization::AllocTensorOp>(loc, outputType, ValueRange{});
+    FailureOr<rock::ConvBwdDataOp> rockConv =
+        makeRockConv<rock::ConvBwdDataOp>(
+            rw, op, output, filter, input, rw.getDenseI64ArrayAttr(pads),
+            op.getStrideAttr(), rw.getDenseI64ArrayAttr(dilations), group,
+            "cyxk",
+            {rw.getNamedAttr("kernelId", rw.getIndexAttr(0)),
+             rw.getNamedAttr("batchKernels", rw.getUnitAttr())});
+    if (failed(rockConv))
+      return failure();
 
+    Value result = rw.create<rock::TensorUntransformCastOp>(
+        loc, outputType, rockConv->getResult(), rockConv->getInput());
+    FailureOr<Value> biased = addConvBias(rw, op, result, adaptor.getBias());
+    if (failed(biased))
+      return failure();
+    rw.replaceOp(op, *biased);
     return success();
   }
 };
@@ -372,8 +469,9 @@ public:
     IntegerAttr numCUAttr =
         num_cu.has_value() ? rw.getI32IntegerAttr(num_cu.value()) : nullptr;
     auto rockGemm = rw.create<rock::GemmOp>(
-        loc, outputType, brA, brB, output, transposeA, transposeB, transposeC,
-        arch, numCUAttr, rw.getAttr<rock::GemmFeaturesAttr>(features),
+        loc, outputType, brA, brB, output, /*workspace=*/nullptr, transposeA,
+        transposeB, transposeC, arch, numCUAttr,
+        rw.getAttr<rock::GemmFeaturesAttr>(features),
         rw.getAttr<rock::StoreMethodAttr>(rock::StoreMethod::Set),
         /*blockSize=*/nullptr, /*gridSize=*/nullptr,
         /*params=*/nullptr);
@@ -404,26 +502,26 @@ static void permuteLayout(Operation *op, const char *attrKey,
   op->setAttr(attrKey, StringAttr::get(op->getContext(), layout));
 }
 
-struct TransposeRewritePattern : public OpRewritePattern<tosa::TransposeOp> {
-  using OpRewritePattern<tosa::TransposeOp>::OpRewritePattern;
-
-  LogicalResult getTransposeDims(Value v, SmallVector<int32_t> &perms) const {
-    Operation *cval = v.getDefiningOp();
-    if (isa<arith::ConstantOp>(cval) || isa<tosa::ConstOp>(cval)) {
-      auto cattr = cval->getAttr("value").cast<DenseElementsAttr>();
-      auto vals = cattr.tryGetValues<int32_t>();
-      if (succeeded(vals)) {
-        perms.assign((*vals).begin(), (*vals).end());
-        return success();
-      }
-      auto vals64 = cattr.tryGetValues<int64_t>();
-      if (succeeded(vals64)) {
-        perms.assign((*vals64).begin(), (*vals64).end());
-        return success();
-      }
+static LogicalResult getTransposeDims(Value v, SmallVector<int32_t> &perms) {
+  Operation *cval = v.getDefiningOp();
+  if (isa_and_nonnull<arith::ConstantOp, tosa::ConstOp>(cval)) {
+    auto cattr = cval->getAttr("value").cast<DenseElementsAttr>();
+    auto vals = cattr.tryGetValues<int32_t>();
+    if (succeeded(vals)) {
+      perms.assign((*vals).begin(), (*vals).end());
+      return success();
+    }
+    auto vals64 = cattr.tryGetValues<int64_t>();
+    if (succeeded(vals64)) {
+      perms.assign((*vals64).begin(), (*vals64).end());
+      return success();
     }
-    return failure();
   }
+  return failure();
+}
+
+struct TransposeRewritePattern : public OpRewritePattern<tosa::TransposeOp> {
+  using OpRewritePattern<tosa::TransposeOp>::OpRewritePattern;
 
   void setTranspose(Operation *op, StringRef name, bool isNonTrivial) const {
     bool currentValue = false;
@@ -947,7 +1045,183 @@ struct AttentionRewritePattern : public OpRewritePattern<tosa::MatMulOp> {
     return {res, failure()};
   }
 
+  bool hasTranspose(tosa::MatMulOp op, StringRef name) const {
+    auto attr = op->getAttrOfType<BoolAttr>(name);
+    return attr && attr.getValue();
+  }
+
+  // The layout change that exported graphs put between an attention operand
+  // or result and the [G, M, N] tensor the matmul sees, most often the head
+  // split [B, S, H * D] -> [B, S, H, D] -> [B, H, S, D] -> [B * H, S, D],
+  // described as a view of `source`: each dim i of `source` is split into the
+  // dims split[i] of `splitShape`, these are permuted so that dim j comes from
+  // dim perm[j], and the dims in merge[k] are merged into dim k of the view.
+  // `ops` holds the reshapes and the transpose, from the matmul side out.
+  struct HeadLayout {
+    Value source;
+    SmallVector<ReassociationIndices> split;
+    SmallVector<int64_t> splitShape;
+    SmallVector<int32_t> perm;
+    SmallVector<ReassociationIndices> merge;
+    SmallVector<Operation *> ops;
+  };
+
+  static SmallVector<ReassociationIndices> identityGroups(int64_t rank) {
+    SmallVector<ReassociationIndices> groups;
+    for (int64_t i = 0; i < rank; ++i)
+      groups.push_back({i});
+    return groups;
+  }
+
+  // Match `operand` = collapse?(transpose(expand?(source))).
+  FailureOr<HeadLayout> matchOperandLayout(Value operand) const {
+    HeadLayout layout;
+    Value val = operand;
+    layout.merge =
+        identityGroups(val.getType().cast<RankedTensorType>().getRank());
+    if (auto collapse = val.getDefiningOp<tensor::CollapseShapeOp>()) {
+      layout.merge = collapse.getReassociationIndices();
+      layout.ops.push_back(collapse);
+      val = collapse.getSrc();
+    }
+    auto transpose = val.getDefiningOp<tosa::TransposeOp>();
+    if (!transpose ||
+        failed(getTransposeDims(transpose.getPerms(), layout.perm)))
+      return failure();
+    layout.ops.push_back(transpose);
+    val = transpose.getInput1();
+    auto splitType = val.getType().cast<RankedTensorType>();
+    if (!splitType.hasStaticShape())
+      return failure();
+    layout.splitShape = llvm::to_vector(splitType.getShape());
+    layout.split = identityGroups(splitType.getRank());
+    if (auto expand = val.getDefiningOp<tensor::ExpandShapeOp>()) {
+      layout.split = expand.getReassociationIndices();
+      layout.ops.push_back(expand);
+      val = expand.getSrc();
+    }
+    layout.source = val;
+    return layout;
+  }
+
+  // Match collapse?(transpose(expand?(result))) where each op is the only user
+  // of the one before. The view describes `result` in terms of the final
+  // value, so the transpose is inverted and the reshapes swap roles.
+  FailureOr<HeadLayout> matchResultLayout(Value result) const {
+    auto getOnlyUser = [](Value val) -> Operation * {
+      return val.hasOneUse() ? *val.getUsers().begin() : nullptr;
+    };
+    HeadLayout layout;
+    Value val = result;
+    layout.merge =
+        identityGroups(val.getType().cast<RankedTensorType>().getRank());
+    if (auto expand =
+            dyn_cast_or_null<tensor::ExpandShapeOp>(getOnlyUser(val))) {
+      layout.merge = expand.getReassociationIndices();
+      layout.ops.push_back(expand);
+      val = expand.getResult();
+    }
+    auto transpose = dyn_cast_or_null<tosa::TransposeOp>(getOnlyUser(val));
+    SmallVector<int32_t> perm;
+    if (!transpose || failed(getTransposeDims(transpose.getPerms(), perm)))
+      return failure();
+    layout.ops.push_back(transpose);
+    val = transpose.getOutput();
+    auto splitType = val.getType().cast<RankedTensorType>();
+    if (!splitType.hasStaticShape())
+      return failure();
+    layout.splitShape = llvm::to_vector(splitType.getShape());
+    layout.perm.resize(perm.size());
+    for (auto [i, p] : llvm::enumerate(perm))
+      layout.perm[p] = i;
+    layout.split = identityGroups(splitType.getRank());
+    if (auto collapse =
+            dyn_cast_or_null<tensor::CollapseShapeOp>(getOnlyUser(val))) {
+      layout.split = collapse.getReassociationIndices();
+      layout.ops.push_back(collapse);
+      val = collapse.getResult();
+    }
+    layout.source = val;
+    return layout;
+  }
+
+  // Express `layout` on the attention: a transpose of the last two dims
+  // toggles `transposed`, anything else becomes rock.transform views of the
+  // source.
+  Value applyLayout(OpBuilder &b, Location loc, const HeadLayout &layout,
+                    bool &transposed) const {
+    auto isSingleton = [](const ReassociationIndices &group) {
+      return group.size() == 1;
+    };
+    bool isPermutationOnly = llvm::all_of(layout.split, isSingleton) &&
+                             llvm::all_of(layout.merge, isSingleton);
+    int64_t rank = layout.perm.size();
+    bool keepsBatch = true;
+    for (int64_t i = 0; i < rank - 2; ++i)
+      keepsBatch &= layout.perm[i] == i;
+    if (isPermutationOnly && keepsBatch) {
+      transposed ^= layout.perm[rank - 1] == rank - 2;
+      return layout.source;
+    }
+
+    Value view = layout.source;
+    SmallVector<SmallString<8>> splitNames;
+    for (int64_t i = 0; i < rank; ++i)
+      ("s" + Twine(i)).toVector(splitNames.emplace_back());
+    SmallVector<StringRef> splitNameRefs(splitNames.begin(), splitNames.end());
+
+    if (!llvm::all_of(layout.split, isSingleton)) {
+      auto sourceType = view.getType().cast<RankedTensorType>();
+      rock::BottomUpTMBuilder splitDims(b, sourceType.getShape(), loc);
+      for (auto [lowerDim, group] : llvm::enumerate(layout.split)) {
+        SmallVector<StringRef> names;
+        SmallVector<uint32_t> dims;
+        SmallVector<int64_t> lengths;
+        for (int64_t d : group) {
+          names.push_back(splitNameRefs[d]);
+          dims.push_back(d);
+          lengths.push_back(layout.splitShape[d]);
+        }
+        StringRef lowerName = splitDims.startName(lowerDim);
+        if (group.size() == 1)
+          splitDims.passThrough(names, dims, {lowerName});
+        else
+          splitDims.unmerge(names, dims, lowerName, lengths);
+      }
+      view = b.create<rock::TransformOp>(loc, view, splitDims.get());
+    }
+
+    rock::BottomUpTMBuilder mergeDims(b, splitNameRefs, layout.splitShape,
+                                      loc);
+    for (auto [upperDim, group] : llvm::enumerate(layout.merge)) {
+      SmallVector<StringRef> lowerNames;
+      for (int64_t d : group)
+        lowerNames.push_back(splitNameRefs[layout.perm[d]]);
+      SmallString<8> upperName;
+      ("m" + Twine(upperDim)).toVector(upperName);
+      if (lowerNames.size() == 1)
+        mergeDims.passThrough({upperName}, {static_cast<uint32_t>(upperDim)},
+                              lowerNames);
+      else
+        mergeDims.merge(upperName, upperDim, lowerNames);
+    }
+    return b.create<rock::TransformOp>(loc, view, mergeDims.get());
+  }
+
+  // Read `operand` from the tensor before any transpose and head split that
+  // produce it.
+  Value foldOperandLayout(OpBuilder &b, Location loc, Value operand,
+                          bool &transposed) const {
+    FailureOr<HeadLayout> layout = matchOperandLayout(operand);
+    if (failed(layout))
+      return operand;
+    return applyLayout(b, loc, *layout, transposed);
+  }
+
   LogicalResult match(tosa::MatMulOp op) const override {
+    // The softmax has to be the untransposed left operand.
+    if (hasTranspose(op, "transpose_a"))
+      return failure();
     FailureOr<std::pair<Value, bool>> softmaxInputResult =
         maybeSoftmax(op.getA());
     if (failed(softmaxInputResult)) {
@@ -982,9 +1256,6 @@ struct AttentionRewritePattern : public OpRewritePattern<tosa::MatMulOp> {
     Location loc = op.getLoc();
     Value softmaxInput;
     std::tie(softmaxInput, std::ignore) = maybeSoftmax(op.getA()).value();
-    auto outputType = op.getType().template cast<RankedTensorType>();
-    Value output = rewriter.create<bufferization::AllocTensorOp>(
-        loc, outputType, ValueRange{});
     StringAttr arch;
     std::optional<uint32_t> numCu;
     rock::GemmFeatures features;
@@ -996,18 +1267,56 @@ struct AttentionRewritePattern : public OpRewritePattern<tosa::MatMulOp> {
         softmaxInput, rewriter, nullptr, elemwiseOtherArgs);
     // This is guranteed by the matcher
     tosa::MatMulOp firstMatMulOp = maybeFirstMatMul.value();
+
+    // Transposes that were already folded into the matmuls.
+    Value queries = firstMatMulOp.getA();
+    Value keys = firstMatMulOp.getB();
+    bool qTransposed = hasTranspose(firstMatMulOp, "transpose_a");
+    bool kTransposed = hasTranspose(firstMatMulOp, "transpose_b");
+    if (hasTranspose(firstMatMulOp, "transpose_c")) {
+      // (A * B)^T = B^T * A^T
+      std::swap(queries, keys);
+      std::tie(qTransposed, kTransposed) =
+          std::make_tuple(!kTransposed, !qTransposed);
+    }
+    bool vTransposed = hasTranspose(op, "transpose_b");
+    bool oTransposed = hasTranspose(op, "transpose_c");
+
+    // Transposes and head splits that are still around the operands.
+    queries = foldOperandLayout(rewriter, loc, queries, qTransposed);
+    keys = foldOperandLayout(rewriter, loc, keys, kTransposed);
+    Value values = foldOperandLayout(rewriter, loc, op.getB(), vTransposed);
+
+    // And around the result: write straight into the final layout.
+    Operation *replaced = op;
+    auto outputType = op.getType().template cast<RankedTensorType>();
+    FailureOr<HeadLayout> resultLayout = matchResultLayout(op.getC());
+    if (succeeded(resultLayout)) {
+      replaced = resultLayout->ops.back();
+      outputType = resultLayout->source.getType().cast<RankedTensorType>();
+    }
+    Value output = rewriter.create<bufferization::AllocTensorOp>(
+        loc, outputType, ValueRange{});
+    Value out = output;
+    if (succeeded(resultLayout)) {
+      resultLayout->source = output;
+      out = applyLayout(rewriter, loc, *resultLayout, oTransposed);
+    }
+
+    auto toUnitAttr = [&](bool flag) -> UnitAttr {
+      return flag ? rewriter.getUnitAttr() : nullptr;
+    };
     IntegerAttr numCUAttr =
         numCu.has_value() ? rewriter.getI32IntegerAttr(numCu.value()) : nullptr;
     rock::AttentionOp attnOp = rewriter.create<rock::AttentionOp>(
-        loc, outputType, firstMatMulOp.getA(), firstMatMulOp.getB(), op.getB(),
-        elemwiseOtherArgs, output,
-        // TODO(implement transpose fusion support here)
-        /*qTransposed=*/nullptr,
-        /*kTransposed=*/nullptr,
-        /*vTransposed=*/nullptr,
-        /*oTransposed=*/nullptr, arch,
+        loc, out.getType(), queries, keys, values, elemwiseOtherArgs,
+        /*dropoutSeed=*/nullptr, /*seqOffsetsQ=*/nullptr,
+        /*seqOffsetsK=*/nullptr, out, toUnitAttr(qTransposed),
+        toUnitAttr(kTransposed), toUnitAttr(vTransposed),
+        toUnitAttr(oTransposed), arch,
         rewriter.getAttr<rock::GemmFeaturesAttr>(features), numCUAttr,
-        /*params0=*/nullptr, /*params1=*/nullptr);
+        /*dropoutRate=*/nullptr, /*params0=*/nullptr, /*params1=*/nullptr,
+        /*pipelineKVLoop=*/nullptr);
 
     Block *preSoftmaxElemwiseBlock = &attnOp.getPreSoftmaxBody().emplaceBlock();
     FailureOr<tosa::MatMulOp> maybeMatMul;
@@ -1028,7 +1337,17 @@ struct AttentionRewritePattern : public OpRewritePattern<tosa::MatMulOp> {
       rewriter.create<memref::CopyOp>(loc, resMemref, outMemref);
       rewriter.create<rock::YieldOp>(loc);
     }
-    rewriter.replaceOp(op, attnOp.getResult());
+    Value result = attnOp.getResult();
+    if (out != output)
+      result = rewriter.create<rock::TensorUntransformCastOp>(
+          loc, outputType, result, out);
+    rewriter.replaceOp(replaced, result);
+    if (replaced != op) {
+      for (Operation *layoutOp : llvm::reverse(resultLayout->ops))
+        if (layoutOp != replaced)
+          rewriter.eraseOp(layoutOp);
+      rewriter.eraseOp(op);
+    }
   }
 };
 
@@ -1164,8 +1483,8 @@ public:
 void tosa::populateTosaToRockConversionPatterns(MLIRContext *context,
                                                 RewritePatternSet &patterns) {
   patterns.add<ConvConverter<tosa::Conv2DOp>, ConvConverter<tosa::Conv3DOp>,
-               MatMulConverter, ReduceSumConverter, ReduceMaxConverter>(
-      context);
+               TransposeConvConverter, MatMulConverter, ReduceSumConverter,
+               ReduceMaxConverter>(context);
 }
 
 void tosa::populateTosaToRockTensorConversionPatterns(
@@ -53,7 +53,8 @@ public:
     target.addLegalDialect<rock::RockDialect, tosa::TosaDialect,
                            tensor::TensorDialect,
                            bufferization::BufferizationDialect>();
-    target.addIllegalOp<tosa::Conv2DOp, tosa::Conv3DOp, tosa::MatMulOp,
+    target.addIllegalOp<tosa::Conv2DOp, tosa::Conv3DOp,
+                        tosa::TransposeConv2DOp, tosa::MatMulOp,
                         tosa::ReduceSumOp, tosa::ReduceMaxOp>();
 
     mlir::tosa::populateTosaToRockConversionPatterns(func->getContext(),
@@ -147,6 +147,7 @@ LogicalResult ConvGenerator::hasValidDimension() const {
   }
 
   static const llvm::StringMap<size_t> typeWidths{
+      {"f64", sizeof(double)},    {"fp64", sizeof(double)},
       {"f32", sizeof(float)},     {"fp32", sizeof(float)},
       {"fp16", sizeof(uint16_t)}, {"f16", sizeof(uint16_t)},
       {"bf16", sizeof(uint16_t)}, {"i8", sizeof(int8_t)},
@@ -251,10 +252,10 @@ LogicalResult ConvGenerator::hasValidChip() const {
   if (sscanf(config.chip.c_str(), "gfx%x", &chipHexNumber) != 1)
     return failure();
 
-  constexpr size_t NUM_SUPPORTED_CHIPS = 12;
+  constexpr size_t NUM_SUPPORTED_CHIPS = 14;
   static const unsigned int supportedChips[NUM_SUPPORTED_CHIPS] = {
-      0x900, 0x906,  0x908,  0x90a,  0x940,  0x941,
-      0x942, 0x1030, 0x1100, 0x1101, 0x1102, 0x1103};
+      0x900,  0x906,  0x908,  0x90a,  0x940,  0x941,  0x942,
+      0x1030, 0x1100, 0x1101, 0x1102, 0x1103, 0x1200, 0x1201};
   const unsigned int *ptr;
   ptr = std::find(supportedChips, supportedChips + NUM_SUPPORTED_CHIPS,
                   chipHexNumber);
@@ -266,9 +267,9 @@ LogicalResult ConvGenerator::hasValidChip() const {
       (chipHexNumber != 0x908 && chipHexNumber != 0x90a))
     return failure();
 
-  // WMMA is only supported on gfx11xx
+  // WMMA is only supported on gfx11xx and gfx12xx
   if (bitEnumContainsAll(config.features, GemmFeatures::wmma) &&
-      (chipHexNumber > 0x1103))
+      (chipHexNumber < 0x1100))
     return failure();
   return success();
 }
@@ -343,6 +344,8 @@ int ConvGenerator::getBwdDataKernelCount() const {
 static Type strToType(StringRef dataTypeStr, OpBuilder &builder) {
   std::optional<Type> type =
       llvm::StringSwitch<std::optional<Type>>(dataTypeStr)
+          .Case("f64", builder.getF64Type())
+          .Case("fp64", builder.getF64Type())
           .Case("f32", builder.getF32Type())
           .Case("fp32", builder.getF32Type())
           .Case("f16", builder.getF16Type())
@@ -556,6 +559,8 @@ LogicalResult ConvGenerator::parseConvConfig(OpBuilder &builder,
   }
 
   auto canonicalizeDataType = [](const std::string &type) {
+    if (type == "fp64")
+      return std::string("f64");
     if (type == "fp32")
       return std::string("f32");
     if (type == "fp16")
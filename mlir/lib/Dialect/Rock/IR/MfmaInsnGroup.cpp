@@ -32,6 +32,10 @@ auto getMfmaInsnInfoMap = []() -> const llvm::StringMap<MfmaInsnInfo> & {
       {ROCDL::mfma_f32_4x4x1f32::getOperationName(),
        {MfmaTypeId::Fp32TyId, 4, 1, 16}},
 
+      // fp64
+      {ROCDL::mfma_f64_16x16x4f64::getOperationName(),
+       {MfmaTypeId::Fp64TyId, 16, 4, 1}},
+
       // fp16
       {ROCDL::mfma_f32_32x32x4f16::getOperationName(),
        {MfmaTypeId::Fp16TyId, 32, 4, 2}},
@@ -119,7 +123,9 @@ static MfmaInsnAttr deriveAttr(MfmaInsnInfo info) {
   int64_t nInputsToMfma = (mfmaNonKDim * blocksMfma * k) / waveSize;
   int64_t nOutputsOfMfma = (mfmaNonKDim * mfmaNonKDim * blocksMfma) / waveSize;
 
-  constexpr int64_t rowGroupSize = 4;
+  // The double-precision MFMAs return one row per output item, each taking
+  // a pair of VGPRs, instead of groups of four.
+  int64_t rowGroupSize = info.type == MfmaTypeId::Fp64TyId ? 1 : 4;
   // The number of rows in each MFMA output item (usually a VGPR, except in
   // the case of double-precision). Note, a "row" is a complete output row of
   // one of blocks produced by the MFMA.
@@ -321,6 +327,8 @@ auto getMfmaInsnGroupAttrMapPreGfx940Int8 = []() {
 };
 
 // New I8 and all Float8
+// The sparse smfmac instructions are not listed: they need a 2:4-compressed
+// operand and its index metadata, which rock.gemm has no way to express.
 auto getMfmaInsnGroupAttrMapGfx940Plus = []() {
   using amdgpu::MFMAPermB;
   static MfmaInsnGroupMap
@@ -407,6 +415,28 @@ auto getMfmaInsnGroupAttrMapGfx940Plus = []() {
   return groupAttrMap;
 };
 
+// gfx908 has no double-precision MFMAs, and the 4x4x4 one isn't used since it
+// only has 4 blocks, which doesn't fit how broadcasts are modeled here.
+auto getMfmaInsnGroupAttrMapGfx90aPlusFp64 = []() -> const MfmaInsnGroupMap & {
+  static MfmaInsnGroupMap
+      // f64
+      groupAttrMap{{{MfmaTypeId::Fp64TyId, 64, 64},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}},
+                   {{MfmaTypeId::Fp64TyId, 64, 32},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}},
+                   {{MfmaTypeId::Fp64TyId, 32, 64},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}},
+                   {{MfmaTypeId::Fp64TyId, 64, 16},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}},
+                   {{MfmaTypeId::Fp64TyId, 16, 64},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}},
+                   {{MfmaTypeId::Fp64TyId, 32, 32},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}},
+                   {{MfmaTypeId::Fp64TyId, 16, 16},
+                    {ROCDL::mfma_f64_16x16x4f64::getOperationName()}}};
+  return groupAttrMap;
+};
+
 FailureOr<MfmaInsn> MfmaInsn::select(StringRef mfmaInsn) {
   auto mfmaInsnAttrMap = getMfmaInsnAttrMap();
   auto it = mfmaInsnAttrMap.find(mfmaInsn);
@@ -430,6 +460,8 @@ VectorType MfmaInsn::getRetType(Type elementType) {
   Type vectorElem;
   if (elementType.isa<IntegerType>())
     vectorElem = b.getI32Type();
+  else if (elementType.isF64())
+    vectorElem = b.getF64Type();
   else
     vectorElem = b.getF32Type();
   return VectorType::get({attr.nOutputsOfMfma}, vectorElem);
@@ -471,6 +503,9 @@ static MfmaTypeId convertTypesToId(Type dataTypeA, Type dataTypeB) {
   if (dataTypeA.isF32() && dataTypeB.isF32()) {
     return MfmaTypeId::Fp32TyId;
   }
+  if (dataTypeA.isF64() && dataTypeB.isF64()) {
+    return MfmaTypeId::Fp64TyId;
+  }
   if (dataTypeA.isF16() && dataTypeB.isF16()) {
     return MfmaTypeId::Fp16TyId;
   }
@@ -532,6 +567,8 @@ FailureOr<MfmaInsnGroup> MfmaInsnGroup::select(Type elementTypeA,
   };
   bool hasOldBf16 = arch.contains("gfx908");
   bool isPreGfx940 = arch.contains("gfx908") || arch.contains("gfx90a");
+  if (elementTypeA.isF64() && !hasOldBf16)
+    selectFrom(getMfmaInsnGroupAttrMapGfx90aPlusFp64());
   if (elementTypeA.isBF16())
     selectFrom(hasOldBf16 ? getMfmaInsnGroupAttrMapGfx908Bf16()
                           : getMfmaInsnGroupAttrMapGfx90aPlusBf16());
@@ -574,7 +611,7 @@ Type MfmaInsnGroup::getArgTypeA() { return insn.getArgTypeFor(elementTypeA); }
 
 Type MfmaInsnGroup::getArgTypeB() { return insn.getArgTypeFor(elementTypeB); }
 
-/// Note: Since this only returns i32 or f32, we don't need to do anything
+/// Note: Since this only returns i32, f32 or f64, we don't need to do anything
 /// particularly clever here.
 VectorType MfmaInsnGroup::getRetType() { return insn.getRetType(elementTypeA); }
 
@@ -523,11 +523,18 @@ static LogicalResult verifyGemmTypes(Operation *op, GemmFeatures features,
                                      Type elemTypeA, Type elemTypeB,
                                      Type elemTypeC) {
   if (bitEnumContainsAll(features, GemmFeatures::wmma)) {
-    if (!(elemTypeA.isF16() || elemTypeA.isBF16() || elemTypeA.isInteger(8))) {
+    if (!(elemTypeA.isF16() || elemTypeA.isBF16() || elemTypeA.isInteger(8) ||
+          elemTypeA.isFloat8E4M3FN() || elemTypeA.isFloat8E5M2())) {
       return op->emitOpError(
-          "Wmma gridwise supports only F16/BF16/int8 data types");
+          "Wmma gridwise supports only F16/BF16/int8/OCP fp8 data types");
     }
   }
+  if (bitEnumContainsAll(features, GemmFeatures::mfma) &&
+      (elemTypeA.isF64() || elemTypeB.isF64()) &&
+      !(elemTypeA.isF64() && elemTypeB.isF64() && elemTypeC.isF64())) {
+    return op->emitOpError(
+        "Mfma gridwise supports f64 only when A, B and C are all f64");
+  }
   if (elemTypeA.isa<FloatType>() && !elemTypeC.isa<FloatType>()) {
     return op->emitOpError("floating-point input type ")
            << elemTypeA
@@ -594,7 +601,11 @@ static LogicalResult verifyConvOp(RockConvInterface convOp) {
 
 LogicalResult ConvOp::verify() { return verifyConvOp(*this); }
 
-LogicalResult ConvBwdDataOp::verify() { return verifyConvOp(*this); }
+LogicalResult ConvBwdDataOp::verify() {
+  if (getBatchKernels() && getKernelId().getSExtValue() != 0)
+    return emitOpError("batched backward data kernels must have kernel ID 0");
+  return verifyConvOp(*this);
+}
 
 LogicalResult ConvBwdWeightOp::verify() { return verifyConvOp(*this); }
 
@@ -644,9 +655,28 @@ OpOperand *ConvBwdWeightOp::getOutArgument() {
 
 GemmSize ConvOp::getGemmSize() {
   auto sizes = ConvolutionDims::fromOp(*this);
+  sizes.c = getConvGemmChannels(*this);
   return GemmSize::fromConvolution(ConvOpType::Fwd, sizes);
 }
 
+int64_t mlir::rock::getConvGemmChannels(ConvOp op) {
+  int64_t c = ConvolutionDims::fromOp(op).c;
+  if (c >= smallChannelConvWidth ||
+      !bitEnumContainsAny(op.getFeatures(),
+                          GemmFeatures::mfma | GemmFeatures::wmma))
+    return c;
+  // Padding only pays off when the channels are innermost in both tensors, as
+  // gemmK is then (y, x, c) with whole kpacks of channels.
+  auto filterLayout = op->getAttrOfType<ArrayAttr>("filter_layout");
+  auto inputLayout = op->getAttrOfType<ArrayAttr>("input_layout");
+  if (!filterLayout || !inputLayout || filterLayout.empty() ||
+      inputLayout.empty() ||
+      cast<StringAttr>(filterLayout.getValue().back()).getValue() != "c" ||
+      cast<StringAttr>(inputLayout.getValue().back()).getValue() != "ci")
+    return c;
+  return smallChannelConvWidth;
+}
+
 GemmSize ConvBwdDataOp::getGemmSize() {
   auto sizes = ConvolutionDims::fromOp(*this);
   auto padding = extractFromIntegerArrayAttr<int64_t>(this->getPadding());
@@ -692,6 +722,21 @@ GemmSize ConvBwdDataOp::getGemmSize() {
   for (const auto &[right, left] : zip(iTildaRight, iTildaLeft))
     tildaSlice.push_back(right - left);
 
+  int64_t n = sizes.n;
+  for (auto ts : tildaSlice)
+    n *= ts;
+
+  // All the kernels at once, each padded to the longest filter slice.
+  if (getBatchKernels()) {
+    int64_t g = sizes.g;
+    int64_t k = sizes.k;
+    for (const auto &[fil, tilda] : zip(sizes.fil, filTilda)) {
+      g *= tilda;
+      k *= math_util::integer_divide_ceil(fil, tilda);
+    }
+    return GemmSize(g, sizes.c, k, n);
+  }
+
   SmallVector<int64_t, 3> iTilda;
   SmallVector<int64_t, 3> iDotSlice;
   int64_t product = 1;
@@ -720,9 +765,6 @@ GemmSize ConvBwdDataOp::getGemmSize() {
   int64_t k = sizes.k;
   for (auto ds : iDotSlice)
     k *= ds;
-  int64_t n = sizes.n;
-  for (auto ts : tildaSlice)
-    n *= ts;
 
   return GemmSize(g, m, k, n);
 }
@@ -884,7 +926,9 @@ static LogicalResult verifyGridwiseGemm(GridOp op) {
     return failure();
   if (aElem.isInteger(8) && !(cElem.isInteger(32) || cElem.isInteger(8)))
     return op.emitOpError("i8 input requires i32 or i8 output");
-  if ((aElem.isFloat8E4M3FNUZ() || aElem.isFloat8E5M2FNUZ()) && !cElem.isF32())
+  if ((aElem.isFloat8E4M3FNUZ() || aElem.isFloat8E5M2FNUZ() ||
+       aElem.isFloat8E4M3FN() || aElem.isFloat8E5M2()) &&
+      !cElem.isF32())
     return op.emitOpError("8-bit float input requires f32 output");
 
   ArrayRef<int64_t> aShape = aType.getShape(), bShape = bType.getShape(),
@@ -2012,6 +2056,35 @@ LogicalResult AttentionOp::verify() {
   if (keyN != valueK) {
     return emitError("reduction dimensions of second gemm do not match");
   }
+
+  if (getDropoutSeed() && !getDropoutRate().has_value())
+    return emitError("dropout seed given without a dropout rate");
+  if (getDropoutRate().has_value()) {
+    if (!getDropoutSeed())
+      return emitError("dropout rate given without a dropout seed");
+    float rate = getDropoutRate()->convertToFloat();
+    if (rate < 0.0f || rate >= 1.0f)
+      return emitError("dropout rate must be in [0, 1)");
+    ShapedType seedType = getDropoutSeed().getType().cast<ShapedType>();
+    if (seedType.getShape() != ArrayRef<int64_t>{2})
+      return emitError("dropout seed must hold exactly a seed and an offset");
+  }
+
+  if (static_cast<bool>(getSeqOffsetsQ()) !=
+      static_cast<bool>(getSeqOffsetsK()))
+    return emitError("variable-length attention needs both query and key "
+                     "sequence offsets");
+  if (getSeqOffsetsQ()) {
+    ShapedType offsetsQType = getSeqOffsetsQ().getType().cast<ShapedType>();
+    ShapedType offsetsKType = getSeqOffsetsK().getType().cast<ShapedType>();
+    if (offsetsQType.getRank() != 1 || offsetsKType.getRank() != 1)
+      return emitError("sequence offsets must be one-dimensional");
+    if (offsetsQType.getShape() != offsetsKType.getShape())
+      return emitError("query and key sequence offsets must describe the "
+                       "same number of sequences");
+    if (offsetsQType.getDimSize(0) < 2)
+      return emitError("sequence offsets must hold at least one sequence");
+  }
   return success();
 }
 
@@ -2038,15 +2111,16 @@ AttnPerfConfigAttr AttnPerfConfigAttr::get(StringAttr perfConfigStrAttr) {
   if (!llvm::to_integer(token.slice(1, StringRef::npos), version)) {
     return {};
   }
-  if (version != 1) {
+  if (version != 1 && version != 2) {
     return {};
   }
-  SmallVector<StringRef, 8> tokens;
+  // v2 appends the KV loop pipelining flag.
+  SmallVector<StringRef, 9> tokens;
   rest.split(tokens, ',');
-  if (tokens.size() != 8) {
+  if (tokens.size() != (version == 1 ? 8 : 9)) {
     return {};
   }
-  SmallVector<int64_t, 8> params;
+  SmallVector<int64_t, 9> params;
   llvm::transform(tokens, std::back_inserter(params), [](StringRef s) {
     int param;
     llvm::to_integer(s, param);
@@ -2060,7 +2134,9 @@ AttnPerfConfigAttr AttnPerfConfigAttr::get(StringAttr perfConfigStrAttr) {
                                  /*mPerWave=*/params[4],
                                  /*mnPerXdl*/ params[5],
                                  /*kpack=*/params[6],
-                                 /*forceUnroll=*/params[7] == 1);
+                                 /*forceUnroll=*/params[7] == 1,
+                                 /*pipelineKVLoop=*/version == 2 &&
+                                     params[8] == 1);
 }
 
 //===-----------------------------------------------------===//
@@ -32,27 +32,41 @@ bool WmmaInsn::isCoherentWithK(int64_t kpack, int64_t kPerBlock) {
                << inputLen << "\n");
     return false;
   }
+  // Each group of lanes sharing a row takes its own slice of kPerBlock.
+  int64_t kSplit = inputLen / kBase;
+  if (kPerBlock % kSplit != 0 || (kPerBlock / kSplit * kpack) % kBase != 0) {
+    LLVM_DEBUG(llvm::dbgs() << "kPerBlock can't be split across " << kSplit
+                            << " lane groups in multiples of " << kBase
+                            << "\n");
+    return false;
+  }
   return true;
 }
 
 FailureOr<WmmaInsn> WmmaInsn::select(mlir::Type elementTypeA,
-                                     mlir::Type elementTypeB, int64_t waveSize,
+                                     mlir::Type elementTypeB, StringRef arch,
                                      int64_t mPerWave, int64_t nPerWave) {
   LLVM_DEBUG(llvm::dbgs() << "Invoke Wmma group selection:\n"
                           << "elementTypeA: " << elementTypeA << "\n"
                           << "elementTypeB: " << elementTypeB << "\n"
+                          << "arch: " << arch << "\n"
                           << "mPerWave: " << mPerWave << "\n"
                           << "nPerWave: " << nPerWave << "\n");
 
   if (elementTypeA != elementTypeB)
     return failure();
 
-  if (waveSize != 32)
+  // On gfx11, lanes i and i + 16 hold the same row of A (column of B) and
+  // interleave their rows of the result. On gfx12, they each hold half of k
+  // and a contiguous half of the result column. Both run 32-lane waves.
+  bool isGfx12 = arch.contains("gfx12");
+  if (!isGfx12 && !arch.contains("gfx11"))
     return failure();
 
   int64_t inputLen = 16;
+  int64_t kBase = isGfx12 ? 8 : 16;
   int64_t outLen = 8;
-  int64_t outStride = 2;
+  int64_t outStride = isGfx12 ? 1 : 2;
 
   if (mPerWave % inputLen != 0)
     return failure();
@@ -62,8 +76,8 @@ FailureOr<WmmaInsn> WmmaInsn::select(mlir::Type elementTypeA,
   int64_t mRepeats = mPerWave / inputLen;
   int64_t nRepeats = nPerWave / inputLen;
 
-  VectorType argTypeA = VectorType::get({inputLen}, elementTypeA);
-  VectorType argTypeB = VectorType::get({inputLen}, elementTypeB);
+  VectorType argTypeA = VectorType::get({kBase}, elementTypeA);
+  VectorType argTypeB = VectorType::get({kBase}, elementTypeB);
   VectorType retType = VectorType::get({outLen}, getRetType(elementTypeA));
 
   StringRef insn;
@@ -73,10 +87,15 @@ FailureOr<WmmaInsn> WmmaInsn::select(mlir::Type elementTypeA,
     insn = ROCDL::wmma_f32_16x16x16_bf16::getOperationName();
   } else if (elementTypeA.isInteger(8)) {
     insn = ROCDL::wmma_i32_16x16x16_iu8::getOperationName();
+  } else if (elementTypeA.isFloat8E4M3FN() && isGfx12) {
+    insn = ROCDL::wmma_f32_16x16x16_fp8_fp8::getOperationName();
+  } else if (elementTypeA.isFloat8E5M2() && isGfx12) {
+    insn = ROCDL::wmma_f32_16x16x16_bf8_bf8::getOperationName();
   } else {
     return failure();
   }
 
-  return WmmaInsn{insn,     inputLen, outLen,   outStride, mRepeats,
-                  nRepeats, argTypeA, argTypeB, retType};
+  return WmmaInsn{insn,      inputLen, kBase,    outLen,
+                  outStride, mRepeats, nRepeats, argTypeA,
+                  argTypeB,  retType};
 }
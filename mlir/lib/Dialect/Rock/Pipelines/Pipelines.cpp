@@ -43,7 +43,6 @@
 #include "mlir/Conversion/RocMLIRPasses.h"
 #include "mlir/Dialect/Bufferization/Transforms/OneShotAnalysis.h"
 #include "mlir/Dialect/Rock/Passes.h"
-#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Pass/PassRegistry.h"
 #include "mlir/Transforms/Passes.h"
@@ -145,12 +144,15 @@ void rock::buildKernelPipeline(OpPassManager &pm,
     if (options.enableFusion) {
       // align linalg tiling
       /* rocmlir-opt --rock-linalg-align --canonicalize
-       * --convert-linalg-to-affine-loops
+       * --convert-linalg-to-affine-loops --rock-approximate-math
+       * --rock-vectorize-fusions
        */
       funcPm.addPass(rock::createRockLinalgAlignPass());
       funcPm.addPass(rock::createRockPipelinePass());
       funcPm.addPass(createCanonicalizerPass());
       funcPm.addPass(createConvertLinalgToAffineLoopsPass());
+      funcPm.addPass(rock::createRockApproximateMathPass(
+          rock::RockApproximateMathPassOptions{options.mathPrecision}));
       funcPm.addPass(rock::createRockVectorizeFusionsPass());
     }
     // rock lowering for reductions
@@ -160,18 +162,23 @@ void rock::buildKernelPipeline(OpPassManager &pm,
 
     // rock lowering (block to thread)
     /* rocmlir-opt --rock-lowering-blockwise-gemm-to-threadwise
-     *   --canonicalize --rock-threadwise-gemm-lowering
+     *   --canonicalize --rock-threadwise-gemm-lowering --rock-sched-hints
      *   --rock-analyze-memory-use --rock-sugar-to-loops --rock-clean-math
      *   --math-legalize-to-f32 --rock-buffer-load-merge
-     *   --rock-transform-to-memref --rock-loops-to-cf --convert-rock-to-gpu
+     *   --rock-transform-to-memref --rock-lds-barrier-elim --rock-plan-lds
+     *   --rock-loops-to-cf
+     *   --convert-rock-to-gpu
      */
     funcPm.addPass(rock::createRockThreadwiseGemmLoweringPass());
+    funcPm.addPass(rock::createRockSchedHintsPass());
     funcPm.addPass(rock::createRockAnalyzeMemoryUsePass());
     funcPm.addPass(rock::createRockSugarToLoopsPass());
     funcPm.addPass(rock::createRockCleanMathPass());
     funcPm.addPass(math::createMathLegalizeToF32());
     funcPm.addPass(rock::createRockBufferLoadMergePass());
     funcPm.addPass(rock::createRockTransformToMemrefPass());
+    funcPm.addPass(rock::createRockLDSBarrierElimPass());
+    funcPm.addPass(rock::createRockPlanLDSPass());
     funcPm.addPass(rock::createRockLoopsToCfPass());
     pm.addPass(createConvertRockToGPUPass());
   }
@@ -190,7 +197,6 @@ void rock::buildBackendPipeline(OpPassManager &pm,
    *   "--gpu-to-hsaco=triple=$triple chip=$chip features=$features opt-level=3"
    */
   pm.addPass(createStripDebugInfoPass());
-  AmdArchInfo archInfo = lookupArchInfo(options.chip);
   auto &gpuPm = pm.nest<gpu::GPUModuleOp>();
   gpuPm.addPass(amdgpu::createAmdgpuEmulateAtomicsPass({options.chip}));
   arith::ArithEmulateUnsupportedFloatsOptions floatEmuOpts;
@@ -204,8 +210,10 @@ void rock::buildBackendPipeline(OpPassManager &pm,
   arithOptions.allowPackedF16Rtz = true;
   arithOptions.saturateFP8Truncf = true;
   gpuPm.addPass(createArithToAMDGPUConversionPass(arithOptions));
-  if (!archInfo.hasFp8ConversionInstrs)
-    gpuPm.addPass(createEmulateFp8ExtTruncPass());
+  // ArithToAMDGPU only lowers the FNUZ fp8 conversions, and only on gfx94x,
+  // so whatever it leaves (including the OCP fp8 conversions of gfx12) is
+  // emulated.
+  gpuPm.addPass(createEmulateFp8ExtTruncPass());
   gpuPm.addPass(memref::createExpandStridedMetadataPass());
   // We need to lower affine again, because the expand strided metadata pass
   // adds back affine.apply for memref.subview
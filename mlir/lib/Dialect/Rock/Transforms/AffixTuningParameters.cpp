@@ -221,7 +221,8 @@ deriveGemm1TuningParams(OpBuilder &builder, AttentionOp op,
                                            gemm0TuningParams.getMPerBlock()),
         gemm0XdlDerivedParams.getNPerWave(),
         gemm0XdlDerivedParams.getMnPerXdl(), 1,
-        gemm0XdlDerivedParams.getForceUnroll());
+        gemm0XdlDerivedParams.getForceUnroll(), /*schedHint=*/0,
+        /*producerWaves=*/0);
   }
   return WmmaGemmParamsAttr::get(
       builder.getContext(), gemm0TuningParams.getMPerBlock() / gemm1KPack,
@@ -229,7 +230,8 @@ deriveGemm1TuningParams(OpBuilder &builder, AttentionOp op,
       gemm0TuningParams.getKpack(),
       gemm0TuningParams.getMPerWave() *
           (attnPerfConfig.getMPerBlockG1() / gemm0TuningParams.getMPerBlock()),
-      gemmNPerWaveOrMnPerXdl, 1, gemm0TuningParams.getForceUnroll());
+      gemmNPerWaveOrMnPerXdl, 1, gemm0TuningParams.getForceUnroll(),
+      /*schedHint=*/0);
 }
 
 void AffixTuningParameters::affixTuningParametersImpl(AttentionOp op) {
@@ -266,14 +268,16 @@ void AffixTuningParameters::affixTuningParametersImpl(AttentionOp op) {
         builder.getContext(), attnPerfConfig.getKpackPerBlock(),
         attnPerfConfig.getMPerBlockG0(), attnPerfConfig.getNPerBlockG0(),
         attnPerfConfig.getKpack(), attnPerfConfig.getMPerWave(),
-        attnPerfConfig.getMnPerXdl(), 1, attnPerfConfig.getForceUnroll());
+        attnPerfConfig.getMnPerXdl(), 1, attnPerfConfig.getForceUnroll(),
+        /*schedHint=*/0, /*producerWaves=*/0);
     accelParams0 = XdlopsGemmDerivedParamsAttr::get(xdlopsParams0);
   } else {
     accelParams0 = WmmaGemmParamsAttr::get(
         builder.getContext(), attnPerfConfig.getKpackPerBlock(),
         attnPerfConfig.getMPerBlockG0(), attnPerfConfig.getNPerBlockG0(),
         attnPerfConfig.getKpack(), attnPerfConfig.getMPerWave(),
-        attnPerfConfig.getMnPerXdl(), 1, attnPerfConfig.getForceUnroll());
+        attnPerfConfig.getMnPerXdl(), 1, attnPerfConfig.getForceUnroll(),
+        /*schedHint=*/0);
   }
   op.setParams0Attr(accelParams0);
   if (attnPerfConfig.getMPerBlockG0() > attnPerfConfig.getMPerBlockG1()) {
@@ -285,6 +289,7 @@ void AffixTuningParameters::affixTuningParametersImpl(AttentionOp op) {
   RockAccelTuningParamAttrInterface accelParams1 =
       deriveGemm1TuningParams(builder, op, attnPerfConfig);
   op.setParams1Attr(accelParams1);
+  op.setPipelineKVLoop(attnPerfConfig.getPipelineKVLoop());
   int64_t waveSize = rock::lookupArchInfo(op.getArchAttr()).waveSize;
   int64_t blockSize = waveSize * accelParams0.getNPerBlock() *
                       accelParams0.getMPerBlock() /
@@ -20,6 +20,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/GPU/IR/GPUDialect.h"
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
@@ -40,6 +41,7 @@
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Rewrite/FrozenRewritePatternSet.h"
 #include "mlir/Rewrite/PatternApplicator.h"
+#include "mlir/Support/MathExtras.h"
 #include "mlir/Support/LogicalResult.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "mlir/Transforms/GreedyPatternRewriteDriver.h"
@@ -395,6 +397,10 @@ void LinalgAlignRewriter::notifyMatchFailure(
 
 /// Fusion
 
+/// Set on stores that were redirected into one slice of the tile they write,
+/// see guardSlicedStores().
+static constexpr StringLiteral slicedTileAttrName = "rock.sliced_tile";
+
 static Value applyViewsOnDest(LinalgAlignRewriter &rewriter, Location loc,
                               Value dest, ArrayRef<TransformMapAttr> views) {
   for (TransformMapAttr trMap : llvm::reverse(views)) {
@@ -539,6 +545,52 @@ traceToWriter(Value startVal,
   return result;
 }
 
+/// Like traceToWriter(), but for a `startVal` that views only part of the
+/// buffer the writer fills, such as one slice of a horizontally fused gemm.
+/// The writer is found from the underlying buffer, and the views from that
+/// buffer to `startVal` are inverted, with slices becoming padding, so that
+/// the writes can be redirected into a buffer shaped like `startVal`.
+static Operation *traceToWriterThroughSlices(
+    Value startVal, SmallVectorImpl<TransformMapAttr> &writerToStartValViews) {
+  SmallVector<TransformOp> chain;
+  Value base = startVal;
+  while (auto trOp = base.getDefiningOp<TransformOp>()) {
+    chain.push_back(trOp);
+    base = trOp.getViewSource();
+  }
+  bool hasSlice = llvm::any_of(chain, [](TransformOp trOp) {
+    return llvm::any_of(trOp.getTransform().getOps(), [](TransformAttr t) {
+      return t.getType() == TransformType::Slice;
+    });
+  });
+  if (!hasSlice)
+    return nullptr;
+
+  OpBuilder b(startVal.getContext());
+  SmallVector<TransformMapAttr> inverses;
+  for (TransformOp trOp : llvm::reverse(chain)) {
+    TransformMapAttr inverse = invertTransformMap(b, trOp.getTransform(),
+                                                  trOp.getLoc(),
+                                                  /*padSlices=*/true);
+    if (!inverse) {
+      LLVM_DEBUG(llvm::dbgs() << "Can't invert " << trOp << "\n");
+      return nullptr;
+    }
+    inverses.push_back(inverse);
+  }
+
+  size_t numViews = writerToStartValViews.size();
+  Operation *writer = traceToWriter(base, writerToStartValViews);
+  if (!writer) {
+    writerToStartValViews.truncate(numViews);
+    return nullptr;
+  }
+  // Views are applied to the destination last to first, so the inverse of
+  // the view closest to `startVal` has to come last.
+  llvm::append_range(writerToStartValViews, inverses);
+  return writer;
+}
+
 static Value makeRegs(LinalgAlignRewriter &b, MemRefType::Builder &mrb,
                       Location loc, Type srcType) {
   auto srcMemType = cast<MemRefType>(srcType);
@@ -652,7 +704,9 @@ makeExtraInputTile(LinalgAlignRewriter &b, TiledOp tiledOp, Value src,
 
 static Value findThreadwiseWrite(
     linalg::GenericOp laGeneric, ThreadwiseWriteAllOp &twWriteOp,
-    SmallVectorImpl<TransformMapAttr> &globalCoordsToGenericViews) {
+    SmallVectorImpl<TransformMapAttr> &globalCoordsToGenericViews,
+    bool &throughSlices) {
+  throughSlices = false;
   for (auto input : laGeneric.getInputs()) {
     if (auto twop = dyn_cast_if_present<ThreadwiseWriteAllOp>(
             traceToWriter(input, globalCoordsToGenericViews))) {
@@ -660,6 +714,14 @@ static Value findThreadwiseWrite(
       return input;
     }
   }
+  for (auto input : laGeneric.getInputs()) {
+    if (auto twop = dyn_cast_if_present<ThreadwiseWriteAllOp>(
+            traceToWriterThroughSlices(input, globalCoordsToGenericViews))) {
+      twWriteOp = twop;
+      throughSlices = true;
+      return input;
+    }
+  }
 
   LLVM_DEBUG(llvm::dbgs() << "No input is leading to a global store.\n");
   return Value();
@@ -822,8 +884,9 @@ LAGenericRewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
   // 1.1. Find the (implicit) gemm output, if it exists.
   ThreadwiseWriteAllOp gemmStoreOp;
   SmallVector<TransformMapAttr> globalCoordsToGenericViews;
-  Value laGenericArgLeadingToTile =
-      findThreadwiseWrite(laGeneric, gemmStoreOp, globalCoordsToGenericViews);
+  bool throughSlices = false;
+  Value laGenericArgLeadingToTile = findThreadwiseWrite(
+      laGeneric, gemmStoreOp, globalCoordsToGenericViews, throughSlices);
 
   if (gemmStoreOp) {
     if (gemmStoreOp.getStoreMethod() != rock::StoreMethod::Set) {
@@ -929,6 +992,8 @@ LAGenericRewritePattern::matchAndRewrite(linalg::GenericOp laGeneric,
   // on top of the eliminated temporary to the generic's output.
   out = applyViewsOnDest(b, loc, out, globalCoordsToGenericViews);
   gemmStoreOp.getDestMutable().assign(out);
+  if (throughSlices)
+    gemmStoreOp->setAttr(slicedTileAttrName, b.getUnitAttr());
   return success();
 }
 
@@ -941,26 +1006,29 @@ MemcpyRewritePattern::matchAndRewrite(memref::CopyOp copy,
 
   Operation *gemmStoreOp = nullptr;
   SmallVector<TransformMapAttr> views;
-  if (auto allocOp = src.getDefiningOp<memref::AllocOp>()) {
-    if (auto twop = dyn_cast_if_present<ThreadwiseWriteAllOp>(
-            traceToWriter(src, views))) {
-      // We check the input leading to GEMM store has the current memref
-      // copy, that is being rewritten, as the unique reader. This is because if
-      // it is the unique reader, the previous memref does not need to be
-      // maintained anymore and we can directly write into the target of the
-      // memref copy.
-      bool isUniqueReader;
-      LogicalResult checkResult =
-          checkUniqueReader(src.getDefiningOp(), copy, isUniqueReader);
-      if (checkResult.failed()) {
-        return checkResult;
-      }
-      if (!isUniqueReader) {
-        gemmStoreOp =
-            static_cast<ThreadwiseWriteAllOp>(b.clone(*twop.getOperation()));
-      } else {
-        gemmStoreOp = twop;
-      }
+  Operation *writer = nullptr;
+  bool throughSlices = !src.getDefiningOp<memref::AllocOp>();
+  if (throughSlices)
+    writer = traceToWriterThroughSlices(src, views);
+  else
+    writer = traceToWriter(src, views);
+  if (auto twop = dyn_cast_if_present<ThreadwiseWriteAllOp>(writer)) {
+    // We check the input leading to GEMM store has the current memref
+    // copy, that is being rewritten, as the unique reader. This is because if
+    // it is the unique reader, the previous memref does not need to be
+    // maintained anymore and we can directly write into the target of the
+    // memref copy.
+    bool isUniqueReader;
+    LogicalResult checkResult =
+        checkUniqueReader(src.getDefiningOp(), copy, isUniqueReader);
+    if (checkResult.failed()) {
+      return checkResult;
+    }
+    if (!isUniqueReader) {
+      gemmStoreOp =
+          static_cast<ThreadwiseWriteAllOp>(b.clone(*twop.getOperation()));
+    } else {
+      gemmStoreOp = twop;
     }
   }
 
@@ -973,6 +1041,8 @@ MemcpyRewritePattern::matchAndRewrite(memref::CopyOp copy,
       target = cast<TypedValue<BaseMemRefType>>(
           applyViewsOnDest(b, loc, target, views));
       twWriteAllOp.getDestMutable().assign(target);
+      if (throughSlices)
+        twWriteAllOp->setAttr(slicedTileAttrName, b.getUnitAttr());
 
       b.eraseOp(copy);
       return success();
@@ -1055,6 +1125,230 @@ ReduceRewritePattern::matchAndRewrite(rock::ReduceOp reduceOp,
   return success();
 }
 
+//===----------------------------------------------------------------------===//
+// Restricting sliced epilogues to their slice
+//===----------------------------------------------------------------------===//
+
+using Interval = std::pair<int64_t, int64_t>;
+
+/// Returns the range of `expr` when each dimension `d` ranges over
+/// `dimRanges[d]`, or std::nullopt for expressions this doesn't handle.
+static std::optional<Interval> getRange(AffineExpr expr,
+                                        ArrayRef<Interval> dimRanges) {
+  if (auto cst = dyn_cast<AffineConstantExpr>(expr))
+    return Interval{cst.getValue(), cst.getValue()};
+  if (auto dim = dyn_cast<AffineDimExpr>(expr))
+    return dimRanges[dim.getPosition()];
+  auto binary = dyn_cast<AffineBinaryOpExpr>(expr);
+  if (!binary)
+    return std::nullopt;
+  std::optional<Interval> lhs = getRange(binary.getLHS(), dimRanges);
+  std::optional<Interval> rhs = getRange(binary.getRHS(), dimRanges);
+  if (!lhs || !rhs)
+    return std::nullopt;
+  if (expr.getKind() == AffineExprKind::Add)
+    return Interval{lhs->first + rhs->first, lhs->second + rhs->second};
+  if (expr.getKind() == AffineExprKind::Mul && lhs->first == lhs->second)
+    std::swap(lhs, rhs);
+  // Everything else is only affine with a constant right-hand side.
+  if (rhs->first != rhs->second)
+    return std::nullopt;
+  auto [lo, hi] = *lhs;
+  int64_t c = rhs->first;
+  switch (expr.getKind()) {
+  case AffineExprKind::Mul:
+    return c >= 0 ? Interval{lo * c, hi * c} : Interval{hi * c, lo * c};
+  case AffineExprKind::FloorDiv:
+    if (c <= 0)
+      return std::nullopt;
+    return Interval{floorDiv(lo, c), floorDiv(hi, c)};
+  case AffineExprKind::CeilDiv:
+    if (c <= 0)
+      return std::nullopt;
+    return Interval{ceilDiv(lo, c), ceilDiv(hi, c)};
+  case AffineExprKind::Mod:
+    if (c <= 0)
+      return std::nullopt;
+    if (floorDiv(lo, c) == floorDiv(hi, c))
+      return Interval{mod(lo, c), mod(hi, c)};
+    return Interval{0, c - 1};
+  default:
+    return std::nullopt;
+  }
+}
+
+namespace {
+/// A coordinate, as a function of the store's iteration space, that is only
+/// written where it lies in [0, bound).
+struct SliceBound {
+  AffineExpr coord;
+  int64_t bound;
+};
+} // namespace
+
+/// Finds the padded coordinates along `maps` (iteration space to buffer) for
+/// which each workgroup's part of the tile is either entirely in bounds or
+/// entirely out of bounds, and which rule out at least one workgroup. Whether
+/// a workgroup writes anything at all is then decided by checking one of its
+/// elements against these bounds.
+static LogicalResult
+getUniformSliceBounds(ArrayRef<TransformMapAttr> maps,
+                      SmallVectorImpl<SliceBound> &result) {
+  // Past this many workgroups, don't try to prove anything.
+  constexpr int64_t maxEnumeratedBlocks = 1 << 16;
+  if (maps.empty() || llvm::any_of(maps, [](TransformMapAttr map) {
+        return !map.getMap();
+      }))
+    return failure();
+
+  // Dimensions named *_block select the workgroup, the rest (tid, iter, ...)
+  // are iterated within it.
+  TransformMapAttr top = maps.front();
+  ArrayRef<int64_t> upperBounds = top.getUpperBounds().asArrayRef();
+  SmallVector<StringRef> names(upperBounds.size());
+  for (TransformAttr t : top.getOps())
+    for (auto [name, dim] : llvm::zip(t.getUpperNames(), t.getUpperDims()))
+      names[dim] = name;
+  SmallVector<Interval> dimRanges;
+  SmallVector<unsigned> blockDims;
+  int64_t numBlocks = 1;
+  for (auto [dim, bound] : llvm::enumerate(upperBounds)) {
+    dimRanges.push_back({0, bound - 1});
+    if (names[dim].ends_with("_block")) {
+      blockDims.push_back(dim);
+      numBlocks *= bound;
+    }
+  }
+  if (blockDims.empty() || numBlocks > maxEnumeratedBlocks)
+    return failure();
+
+  for (auto [k, map] : llvm::enumerate(maps)) {
+    ArrayRef<int64_t> lowerBounds = map.getLowerBounds().asArrayRef();
+    AffineMap toLower;
+    for (TransformAttr t : map.getOps()) {
+      if (t.getType() != TransformType::Pad)
+        continue;
+      if (!toLower)
+        toLower = composeTransforms(maps.take_front(k + 1));
+      for (uint32_t d : t.getLowerDims()) {
+        AffineExpr coord = toLower.getResult(d);
+        bool uniform = true, someOutside = false;
+        SmallVector<Interval> ranges(dimRanges);
+        for (int64_t block = 0; block < numBlocks && uniform; ++block) {
+          int64_t rest = block;
+          for (unsigned dim : llvm::reverse(blockDims)) {
+            int64_t idx = rest % upperBounds[dim];
+            rest /= upperBounds[dim];
+            ranges[dim] = {idx, idx};
+          }
+          std::optional<Interval> range = getRange(coord, ranges);
+          if (!range) {
+            uniform = false;
+            break;
+          }
+          bool inside = range->first >= 0 && range->second < lowerBounds[d];
+          bool outside = range->second < 0 || range->first >= lowerBounds[d];
+          uniform = inside || outside;
+          someOutside |= outside;
+        }
+        if (uniform && someOutside)
+          result.push_back({coord, lowerBounds[d]});
+      }
+    }
+  }
+  return success(!result.empty());
+}
+
+/// A store redirected into one slice of the tile it writes (see
+/// traceToWriterThroughSlices()) runs, along with the epilogue feeding it, on
+/// every workgroup of the wide gemm, and the padding only masks the writes.
+/// When the slice boundaries fall between workgroups, wrap the store and the
+/// register-only epilogue ops that feed it in an `scf.if` so that workgroups
+/// outside the slice skip it entirely. Otherwise, leave the (correct) padded
+/// store alone.
+static void guardSlicedStore(ThreadwiseWriteAllOp store) {
+  SmallVector<TransformMapAttr> maps;
+  for (Attribute view : store.getExtraViews())
+    maps.push_back(cast<TransformMapAttr>(view));
+  untransform(store.getDest(), maps);
+  if (maps.empty() || maps.front().getUpperBounds().size() !=
+                          store.getExtraIndices().size() + 1)
+    return;
+  SmallVector<SliceBound> bounds;
+  if (failed(getUniformSliceBounds(maps, bounds))) {
+    LLVM_DEBUG(llvm::dbgs() << "Can't restrict " << store
+                            << " to workgroups in its slice\n");
+    return;
+  }
+
+  // The epilogue is the store and the generics and reads that fill registers
+  // nothing else uses.
+  Block *block = store->getBlock();
+  llvm::SmallPtrSet<Operation *, 8> epilogue;
+  epilogue.insert(store);
+  SmallVector<Value> worklist{store.getSource()};
+  while (!worklist.empty()) {
+    Value regs = worklist.pop_back_val();
+    if (!regs.getDefiningOp<GpuAllocOp>())
+      continue;
+    SmallVector<Operation *> others;
+    for (Operation *user : regs.getUsers())
+      if (!epilogue.contains(user))
+        others.push_back(user);
+    if (others.size() != 1 || others[0]->getBlock() != block ||
+        !others[0]->isBeforeInBlock(store))
+      continue;
+    if (auto generic = dyn_cast<linalg::GenericOp>(others[0])) {
+      if (!llvm::is_contained(generic.getOutputs(), regs))
+        continue;
+      epilogue.insert(generic);
+      llvm::append_range(worklist, generic.getInputs());
+    } else if (auto read = dyn_cast<ThreadwiseReadIntoOp>(others[0])) {
+      if (read.getDest() == regs)
+        epilogue.insert(read);
+    }
+  }
+
+  // The epilogue is sunk to the store, which is only sound if nothing in
+  // between touches memory.
+  Operation *first = store;
+  for (Operation *op : epilogue)
+    if (op->isBeforeInBlock(first))
+      first = op;
+  SmallVector<Operation *> toMove;
+  for (Operation &op : llvm::make_range(first->getIterator(),
+                                        std::next(store->getIterator()))) {
+    if (epilogue.contains(&op))
+      toMove.push_back(&op);
+    else if (!isMemoryEffectFree(&op) && !isa<GpuAllocOp>(op))
+      return;
+  }
+
+  OpBuilder b(store);
+  Location loc = store.getLoc();
+  SmallVector<Value> coords(store.getExtraIndices());
+  Value zero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  coords.push_back(zero);
+  Value inSlice;
+  for (const SliceBound &sliceBound : bounds) {
+    Value coord = b.createOrFold<affine::AffineApplyOp>(
+        loc, AffineMap::get(coords.size(), 0, sliceBound.coord), coords);
+    Value bound = b.createOrFold<arith::ConstantIndexOp>(loc, sliceBound.bound);
+    Value cond = b.createOrFold<arith::AndIOp>(
+        loc,
+        b.createOrFold<arith::CmpIOp>(loc, arith::CmpIPredicate::sge, coord,
+                                      zero),
+        b.createOrFold<arith::CmpIOp>(loc, arith::CmpIPredicate::slt, coord,
+                                      bound));
+    inSlice =
+        inSlice ? b.createOrFold<arith::AndIOp>(loc, inSlice, cond) : cond;
+  }
+  auto ifOp = b.create<scf::IfOp>(loc, inSlice, /*withElseRegion=*/false);
+  Operation *yield = ifOp.thenBlock()->getTerminator();
+  for (Operation *op : toMove)
+    op->moveBefore(yield);
+}
+
 void RockLinalgAlignPass::runOnOperation() {
   MLIRContext *ctx = &getContext();
   func::FuncOp func = getOperation();
@@ -1068,4 +1362,12 @@ void RockLinalgAlignPass::runOnOperation() {
     if (failed(applyAlignPatterns(func, std::move(patterns))))
       return signalPassFailure();
   }
+
+  SmallVector<ThreadwiseWriteAllOp> slicedStores;
+  func.walk([&](ThreadwiseWriteAllOp store) {
+    if (store->removeAttr(slicedTileAttrName))
+      slicedStores.push_back(store);
+  });
+  for (ThreadwiseWriteAllOp store : slicedStores)
+    guardSlicedStore(store);
 }
@@ -0,0 +1,308 @@
+//===- ApproximateMath.cpp - Fast activation functions in fusions --------===//
+//
+// Part of the rocMLIR Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Fused epilogues get their transcendental functions from TOSA as math.exp,
+// math.tanh and math.erf, with sigmoid spelled 1 / (1 + exp(-x)). Left alone,
+// f16 and bf16 ones are widened to f32 and lowered to library calls that are
+// accurate to an ulp and cost tens of instructions each. This pass replaces
+// them with the approximations of approxMath.h, built on the hardware exp2 and
+// reciprocal, at a precision tier selected per kernel.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Rock/utility/approxMath.h"
+#include "mlir/Dialect/Rock/utility/builderUtils.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/IR/PatternMatch.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/Debug.h"
+
+#include <cmath>
+
+namespace mlir {
+namespace rock {
+#define GEN_PASS_DEF_ROCKAPPROXIMATEMATHPASS
+#include "mlir/Dialect/Rock/Passes.h.inc"
+} // namespace rock
+} // namespace mlir
+
+#define DEBUG_TYPE "rock-approximate-math"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+namespace {
+enum class MathPrecision { Exact, Fast, Fastest };
+
+struct RockApproximateMathPass
+    : public rock::impl::RockApproximateMathPassBase<
+          RockApproximateMathPass> {
+  using rock::impl::RockApproximateMathPassBase<
+      RockApproximateMathPass>::RockApproximateMathPassBase;
+  void runOnOperation() override;
+};
+
+/// Emits the operations approxMath.h is written against as arith and math
+/// ops on `type`, an f32 or f16 scalar or vector.
+class ArithEmitter {
+public:
+  using Value = mlir::Value;
+
+  ArithEmitter(OpBuilder &b, Location loc, Type type)
+      : b(b), loc(loc), type(type), elemType(getElementTypeOrSelf(type)) {
+    bool isF16 = elemType.isF16();
+    Type intElemType = b.getIntegerType(isF16 ? 16 : 32);
+    intType = type.isa<VectorType>()
+                  ? VectorType::get(type.cast<VectorType>().getShape(),
+                                    intElemType)
+                  : intElemType;
+    mantissaBits = isF16 ? 10 : 23;
+    exponentBias = isF16 ? 15 : 127;
+  }
+
+  bool hasNativeExp2() const { return elemType.isF32(); }
+
+  Value cst(double v) {
+    return createConstantFloatOp(b, loc, type, elemType, v);
+  }
+  Value add(Value x, Value y) { return b.create<arith::AddFOp>(loc, x, y); }
+  Value sub(Value x, Value y) { return b.create<arith::SubFOp>(loc, x, y); }
+  Value mul(Value x, Value y) { return b.create<arith::MulFOp>(loc, x, y); }
+  Value fma(Value x, Value y, Value z) {
+    return b.create<math::FmaOp>(loc, x, y, z);
+  }
+  Value neg(Value x) { return b.create<arith::NegFOp>(loc, x); }
+  // Not math.absf, which would be widened to f32 for f16.
+  Value abs(Value x) { return max(x, neg(x)); }
+  Value min(Value x, Value y) { return b.create<arith::MinNumFOp>(loc, x, y); }
+  Value max(Value x, Value y) { return b.create<arith::MaxNumFOp>(loc, x, y); }
+  Value selectNeg(Value x, Value ifNeg, Value otherwise) {
+    Value isNeg = b.create<arith::CmpFOp>(loc, arith::CmpFPredicate::OLT, x,
+                                          cst(0.0));
+    return b.create<arith::SelectOp>(loc, isNeg, ifNeg, otherwise);
+  }
+  // `arcp` lets the backend use the reciprocal instruction instead of a
+  // correctly rounded division.
+  Value rcp(Value x) {
+    return b.create<arith::DivFOp>(loc, cst(1.0), x,
+                                   arith::FastMathFlags::arcp |
+                                       arith::FastMathFlags::afn);
+  }
+  Value exp2(Value x) {
+    return b.create<math::Exp2Op>(loc, x, arith::FastMathFlags::afn);
+  }
+  Value floorNonNeg(Value x) {
+    Value asInt = b.create<arith::FPToSIOp>(loc, intType, x);
+    return b.create<arith::SIToFPOp>(loc, type, asInt);
+  }
+  Value ldexp(Value p, Value n) {
+    Value exponent = b.create<arith::AddIOp>(
+        loc, b.create<arith::FPToSIOp>(loc, intType, n),
+        createConstantIntOp(b, loc, intType, getElementTypeOrSelf(intType),
+                            exponentBias));
+    Value bits = b.create<arith::ShLIOp>(
+        loc, exponent,
+        createConstantIntOp(b, loc, intType, getElementTypeOrSelf(intType),
+                            mantissaBits));
+    return mul(p, b.create<arith::BitcastOp>(loc, type, bits));
+  }
+
+private:
+  OpBuilder &b;
+  Location loc;
+  Type type;
+  Type elemType;
+  Type intType;
+  int64_t mantissaBits;
+  int64_t exponentBias;
+};
+} // end namespace
+
+static std::optional<MathPrecision> parsePrecision(StringRef name) {
+  return llvm::StringSwitch<std::optional<MathPrecision>>(name)
+      .Case("exact", MathPrecision::Exact)
+      .Case("fast", MathPrecision::Fast)
+      .Case("fastest", MathPrecision::Fastest)
+      .Default(std::nullopt);
+}
+
+static bool isFloatConstant(Value v, double expected) {
+  FloatAttr attr;
+  if (!matchPattern(v, m_Constant(&attr)))
+    return false;
+  double actual = attr.getValueAsDouble();
+  return std::abs(actual - expected) <= 1e-3 * std::abs(expected);
+}
+
+/// Returns x if `v` is the TOSA expansion of sigmoid(x),
+/// 1 / (1 + exp(-x)), with the addition in either order.
+static Value matchSigmoid(Value v) {
+  auto div = v.getDefiningOp<arith::DivFOp>();
+  if (!div || !isFloatConstant(div.getLhs(), 1.0))
+    return nullptr;
+  auto add = div.getRhs().getDefiningOp<arith::AddFOp>();
+  if (!add)
+    return nullptr;
+  Value expVal = add.getLhs();
+  if (!isFloatConstant(add.getRhs(), 1.0)) {
+    if (!isFloatConstant(expVal, 1.0))
+      return nullptr;
+    expVal = add.getRhs();
+  }
+  auto exp = expVal.getDefiningOp<math::ExpOp>();
+  if (!exp)
+    return nullptr;
+  auto neg = exp.getOperand().getDefiningOp<arith::NegFOp>();
+  if (!neg)
+    return nullptr;
+  return neg.getOperand();
+}
+
+/// Returns x if `v` is x / sqrt(2) or x * (1 / sqrt(2)), the argument of the
+/// erf in GELU.
+static Value matchGeluErfArg(Value v) {
+  if (auto mul = v.getDefiningOp<arith::MulFOp>()) {
+    if (isFloatConstant(mul.getRhs(), approx::kRSqrt2))
+      return mul.getLhs();
+    if (isFloatConstant(mul.getLhs(), approx::kRSqrt2))
+      return mul.getRhs();
+  }
+  if (auto div = v.getDefiningOp<arith::DivFOp>())
+    if (isFloatConstant(div.getRhs(), 1.0 / approx::kRSqrt2))
+      return div.getLhs();
+  return nullptr;
+}
+
+/// Erases `op` and, transitively, the operations feeding it that have no
+/// other users.
+static void eraseDeadTree(RewriterBase &b, Operation *op) {
+  llvm::SetVector<Operation *> worklist;
+  worklist.insert(op);
+  while (!worklist.empty()) {
+    Operation *dead = worklist.pop_back_val();
+    SmallVector<Value> operands(dead->getOperands());
+    b.eraseOp(dead);
+    for (Value operand : operands) {
+      Operation *def = operand.getDefiningOp();
+      if (def && def->use_empty() && isPure(def))
+        worklist.insert(def);
+    }
+  }
+}
+
+/// The type to evaluate an approximation on `type` in, or null if `type` isn't
+/// a float type the approximations support. Only the fastest tier keeps f16 in
+/// f16; bf16 has no native arithmetic to speak of and always goes to f32.
+static Type getComputeType(Type type, MathPrecision precision) {
+  Type elemType = getElementTypeOrSelf(type);
+  if (!elemType.isF32() && !elemType.isF16() && !elemType.isBF16())
+    return nullptr;
+  Type computeElemType = elemType;
+  if (!elemType.isF16() || precision != MathPrecision::Fastest)
+    computeElemType = FloatType::getF32(type.getContext());
+  if (auto vecType = type.dyn_cast<VectorType>())
+    return vecType.clone(computeElemType);
+  return computeElemType;
+}
+
+/// Replaces `op` by `emit(x)` evaluated in the compute type of the
+/// tier, converting from and to the type of `x` around it.
+static void
+replaceWithApproximation(RewriterBase &b, Operation *op, Value x,
+                         MathPrecision precision,
+                         function_ref<Value(ArithEmitter &, Value)> emit) {
+  Type type = x.getType();
+  Type computeType = getComputeType(type, precision);
+  if (!computeType)
+    return;
+  Location loc = op->getLoc();
+  b.setInsertionPoint(op);
+  if (computeType != type)
+    x = b.create<arith::ExtFOp>(loc, computeType, x);
+  ArithEmitter emitter(b, loc, computeType);
+  Value result = emit(emitter, x);
+  if (computeType != type)
+    result = b.create<arith::TruncFOp>(loc, type, result);
+  Value oldResult = op->getResult(0);
+  b.replaceAllUsesWith(oldResult, result);
+  eraseDeadTree(b, op);
+}
+
+void RockApproximateMathPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  std::optional<MathPrecision> maybePrecision = parsePrecision(precision);
+  if (auto attr = func->getAttrOfType<StringAttr>("rock.math_precision"))
+    maybePrecision = parsePrecision(attr.getValue());
+  if (!maybePrecision) {
+    func.emitOpError("unknown math precision, expected exact, fast or fastest");
+    return signalPassFailure();
+  }
+  MathPrecision prec = *maybePrecision;
+  if (prec == MathPrecision::Exact)
+    return;
+  IRRewriter b(func.getContext());
+
+  // Compositions go first, while their parts are still recognizable: SiLU,
+  // then the sigmoids, which use up their exp, then the remaining functions.
+  // Each round erases what it matched, so collect the next one afterwards.
+  SmallVector<arith::MulFOp> silus;
+  func.walk([&](arith::MulFOp mul) {
+    if (matchSigmoid(mul.getRhs()) == mul.getLhs() ||
+        matchSigmoid(mul.getLhs()) == mul.getRhs())
+      silus.push_back(mul);
+  });
+  for (arith::MulFOp mul : silus) {
+    Value input = matchSigmoid(mul.getRhs()) == mul.getLhs() ? mul.getLhs()
+                                                              : mul.getRhs();
+    replaceWithApproximation(b, mul, input, prec, [](ArithEmitter &e, Value x) {
+      return approx::silu(e, x);
+    });
+  }
+
+  SmallVector<arith::DivFOp> sigmoids;
+  func.walk([&](arith::DivFOp div) {
+    if (matchSigmoid(div))
+      sigmoids.push_back(div);
+  });
+  for (arith::DivFOp div : sigmoids)
+    replaceWithApproximation(
+        b, div, matchSigmoid(div), prec,
+        [](ArithEmitter &e, Value x) { return approx::sigmoid(e, x); });
+
+  SmallVector<Operation *> functions;
+  func.walk([&](Operation *op) {
+    if (isa<math::ExpOp, math::TanhOp, math::ErfOp>(op))
+      functions.push_back(op);
+  });
+  for (Operation *op : functions) {
+    Value input = op->getOperand(0);
+    if (isa<math::ExpOp>(op)) {
+      replaceWithApproximation(
+          b, op, input, prec,
+          [](ArithEmitter &e, Value x) { return approx::exp(e, x); });
+    } else if (isa<math::TanhOp>(op)) {
+      replaceWithApproximation(
+          b, op, input, prec,
+          [](ArithEmitter &e, Value x) { return approx::tanh(e, x); });
+    } else if (prec == MathPrecision::Fastest && matchGeluErfArg(input)) {
+      replaceWithApproximation(
+          b, op, input, prec,
+          [](ArithEmitter &e, Value z) { return approx::erfAsTanh(e, z); });
+    } else {
+      replaceWithApproximation(
+          b, op, input, prec,
+          [](ArithEmitter &e, Value x) { return approx::erf(e, x); });
+    }
+  }
+}
@@ -305,16 +305,29 @@ struct BlockwiseGemmRewritePattern
     int64_t threadANumRegisters = kPerThread * mC * kPack;
     int64_t threadBNumRegisters = kPerThread * nC * kPack;
 
+    // The threadwise gemm uses dot product instructions on the inputs as they
+    // are when kpack has been chosen for them, so only widen the inputs to the
+    // accumulator type for scalar multiply-adds.
+    Type registerType = elementType;
+    Type ldsTypeA = blockAType.getElementType();
+    FailureOr<StringAttr> maybeArch = getArch(op);
+    if (succeeded(maybeArch) && ldsTypeA == blockBType.getElementType()) {
+      int64_t dotWidth = lookupArchInfo(maybeArch->getValue())
+                             .getDotProductWidth(ldsTypeA, elementType);
+      if (dotWidth > 1 && kPack % dotWidth == 0)
+        registerType = ldsTypeA;
+    }
+
     // Alloc register for thread_a and thread_b.
     auto privateMemoryAddressSpace = b.getAttr<gpu::AddressSpaceAttr>(
         gpu::GPUDialect::getPrivateAddressSpace());
     auto threadARegisterMemRefType =
-        MemRefType::get(threadANumRegisters, elementType, AffineMap{},
+        MemRefType::get(threadANumRegisters, registerType, AffineMap{},
                         privateMemoryAddressSpace);
     auto threadAAllocOp = b.create<GpuAllocOp>(loc, threadARegisterMemRefType);
 
     auto threadBRegisterMemRefType =
-        MemRefType::get(threadBNumRegisters, elementType, AffineMap{},
+        MemRefType::get(threadBNumRegisters, registerType, AffineMap{},
                         privateMemoryAddressSpace);
     auto threadBAllocOp = b.create<GpuAllocOp>(loc, threadBRegisterMemRefType);
 
@@ -355,7 +368,7 @@ struct BlockwiseGemmRewritePattern
       b.setInsertionPointToStart(copyALoop.getBody());
       Value aCopy = b.create<memref::LoadOp>(
           loc, matrixA, copyALoop.getLowerCoords(/*domain=*/0));
-      Value aCast = createTypeConversionOp(b, loc, aCopy, elementType);
+      Value aCast = createTypeConversionOp(b, loc, aCopy, registerType);
       b.create<memref::StoreOp>(loc, aCast, threadAAllocOp,
                                 copyALoop.getLowerCoords(/*domain=*/1));
     }
@@ -372,7 +385,7 @@ struct BlockwiseGemmRewritePattern
       b.setInsertionPointToStart(copyBLoop.getBody());
       Value bCopy = b.create<memref::LoadOp>(
           loc, matrixB, copyBLoop.getLowerCoords(/*domain=*/0));
-      Value bCast = createTypeConversionOp(b, loc, bCopy, elementType);
+      Value bCast = createTypeConversionOp(b, loc, bCopy, registerType);
       b.create<memref::StoreOp>(loc, bCast, threadBAllocOp,
                                 copyBLoop.getLowerCoords(/*domain=*/1));
     }
@@ -1,4 +1,4 @@
-//===- BufferLoadMerge.cpp - merge identical loads from read-only buffers -===//
+//===- BufferLoadMerge.cpp - merge and coalesce loads from buffers -------===//
 //
 // Part of the rocMLIR Project, under the Apache License v2.0 with LLVM
 // Exceptions. See https://llvm.org/LICENSE.txt for license information.
@@ -12,16 +12,37 @@
 // It assumes that each buffer is accessed through exactly one memref value
 // which is true in our generated code but not true in general.
 //
+// It then coalesces runs of narrow accesses to consecutive elements of the
+// same row into one wide (up to 16 byte) access. Such runs are left behind by
+// unrolling when the vectorization of a copy was limited by a transform
+// (padding, a merge that wraps around, a broadcast in a fused input). This
+// applies to loads from read-only buffers and to loads and stores of LDS.
+// A run is only merged when its start is provably aligned to its width, so the
+// wide access never straddles a row or the end of a bounds-checked buffer.
+//
 //===----------------------------------------------------------------------===//
 
 #include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
 #include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Rock/utility/builderUtils.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/Matchers.h"
 #include "mlir/IR/Visitors.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Support/LogicalResult.h"
 #include "mlir/Transforms/Passes.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/TypeSwitch.h"
+#include "llvm/Support/Debug.h"
+
+#include <numeric>
 
 #define DEBUG_TYPE "rock-buffer-load-merge"
 
@@ -61,6 +82,351 @@ struct SimpleOperationInfo : public llvm::DenseMapInfo<Operation *> {
 };
 } // end namespace
 
+//===----------------------------------------------------------------------===//
+// Coalescing of adjacent accesses.
+//===----------------------------------------------------------------------===//
+
+namespace {
+enum class AccessKind { BufferLoad, LDSLoad, LDSStore };
+
+/// A load or store of `len` consecutive elements of the last dimension of a
+/// memref, at `base + offset` in that dimension. `base` is null when the index
+/// is a constant.
+struct Access {
+  Operation *op;
+  AccessKind kind;
+  Value memref;
+  ValueRange indices;
+  Value base;
+  int64_t offset;
+  int64_t len;
+};
+
+/// Accesses that can be merged differ only in the constant part of their last
+/// index.
+struct AccessGroup {
+  SmallVector<Access> members;
+
+  bool accepts(const Access &access) const {
+    const Access &first = members.front();
+    if (access.kind != first.kind || access.memref != first.memref ||
+        access.base != first.base ||
+        access.indices.drop_back() != first.indices.drop_back())
+      return false;
+    if (auto load = dyn_cast<amdgpu::RawBufferLoadOp>(access.op)) {
+      auto firstLoad = cast<amdgpu::RawBufferLoadOp>(first.op);
+      return load.getBoundsCheck() == firstLoad.getBoundsCheck() &&
+             load.getIndexOffsetAttr() == firstLoad.getIndexOffsetAttr() &&
+             load.getSgprOffset() == firstLoad.getSgprOffset();
+    }
+    return isNontemporal(access.op) == isNontemporal(first.op);
+  }
+
+  static bool isNontemporal(Operation *op) {
+    return TypeSwitch<Operation *, bool>(op)
+        .Case<vector::LoadOp, vector::StoreOp, memref::LoadOp,
+              memref::StoreOp>([](auto access) {
+          return access.getNontemporal();
+        })
+        .Default([](Operation *) { return false; });
+  }
+};
+} // end namespace
+
+static bool isWorkgroupMemRef(Value buffer) {
+  auto memSpace = cast<MemRefType>(buffer.getType())
+                      .getMemorySpace()
+                      .dyn_cast_or_null<gpu::AddressSpaceAttr>();
+  return memSpace &&
+         memSpace.getValue() == gpu::GPUDialect::getWorkgroupAddressSpace();
+}
+
+/// Splits an index into a value and a constant offset, looking through
+/// additions of constants.
+static std::pair<Value, int64_t> splitConstantOffset(Value index) {
+  APInt cst;
+  if (matchPattern(index, m_ConstantInt(&cst)))
+    return {nullptr, cst.getSExtValue()};
+  if (auto add = index.getDefiningOp<arith::AddIOp>()) {
+    for (auto [lhs, rhs] : {std::make_pair(add.getLhs(), add.getRhs()),
+                            std::make_pair(add.getRhs(), add.getLhs())}) {
+      if (!matchPattern(rhs, m_ConstantInt(&cst)))
+        continue;
+      auto [base, offset] = splitConstantOffset(lhs);
+      return {base, offset + cst.getSExtValue()};
+    }
+  }
+  return {index, 0};
+}
+
+/// Returns a number `index` is known to be a multiple of.
+static int64_t getKnownDivisor(Value index, DenseMap<Value, int64_t> &cache,
+                               int64_t depth = 0) {
+  // Large enough for any alignment we care about, small enough not to overflow
+  // when multiplied.
+  constexpr int64_t kAnyMultiple = int64_t(1) << 20;
+  if (!index)
+    return kAnyMultiple;
+  auto cached = cache.find(index);
+  if (cached != cache.end())
+    return cached->second;
+  if (depth > 8)
+    return 1;
+
+  auto divisorOf = [&](Value v) { return getKnownDivisor(v, cache, depth + 1); };
+  int64_t result = 1;
+  APInt cst;
+  Operation *def = index.getDefiningOp();
+  if (matchPattern(index, m_ConstantInt(&cst))) {
+    int64_t value = std::abs(cst.getSExtValue());
+    result = value == 0 ? kAnyMultiple : std::min(value, kAnyMultiple);
+  } else if (isa_and_nonnull<arith::AddIOp, arith::SubIOp>(def)) {
+    result = std::gcd(divisorOf(def->getOperand(0)),
+                      divisorOf(def->getOperand(1)));
+  } else if (isa_and_nonnull<arith::MulIOp>(def)) {
+    result = std::min(divisorOf(def->getOperand(0)) *
+                          divisorOf(def->getOperand(1)),
+                      kAnyMultiple);
+  } else if (auto shl = dyn_cast_or_null<arith::ShLIOp>(def)) {
+    if (matchPattern(shl.getRhs(), m_ConstantInt(&cst)) &&
+        cst.getZExtValue() < 20)
+      result = std::min(divisorOf(shl.getLhs()) << cst.getZExtValue(),
+                        kAnyMultiple);
+  } else if (auto select = dyn_cast_or_null<arith::SelectOp>(def)) {
+    result = std::gcd(divisorOf(select.getTrueValue()),
+                      divisorOf(select.getFalseValue()));
+  } else if (isa_and_nonnull<arith::IndexCastOp, arith::IndexCastUIOp,
+                             arith::ExtUIOp, arith::ExtSIOp>(def)) {
+    result = divisorOf(def->getOperand(0));
+  }
+  cache[index] = result;
+  return result;
+}
+
+static std::optional<Access> matchAccess(Operation *op,
+                                         function_ref<bool(Value)> isReadOnly) {
+  auto make = [&](AccessKind kind, Value memref, ValueRange indices,
+                  Type accessType) -> std::optional<Access> {
+    auto memrefType = cast<MemRefType>(memref.getType());
+    if (indices.empty() || !memrefType.getLayout().isIdentity())
+      return std::nullopt;
+    int64_t len = 1;
+    if (auto vecType = dyn_cast<VectorType>(accessType)) {
+      if (vecType.getRank() != 1)
+        return std::nullopt;
+      len = vecType.getNumElements();
+    }
+    auto [base, offset] = splitConstantOffset(indices.back());
+    return Access{op, kind, memref, indices, base, offset, len};
+  };
+
+  if (auto load = dyn_cast<amdgpu::RawBufferLoadOp>(op)) {
+    // Extra offsets would move the start of a wide load off its alignment.
+    if (!isReadOnly(load.getMemref()) || load.getIndexOffset() ||
+        load.getSgprOffset())
+      return std::nullopt;
+    return make(AccessKind::BufferLoad, load.getMemref(), load.getIndices(),
+                load.getType());
+  }
+  if (auto load = dyn_cast<vector::LoadOp>(op))
+    if (isWorkgroupMemRef(load.getBase()))
+      return make(AccessKind::LDSLoad, load.getBase(), load.getIndices(),
+                  load.getType());
+  if (auto load = dyn_cast<memref::LoadOp>(op))
+    if (isWorkgroupMemRef(load.getMemref()))
+      return make(AccessKind::LDSLoad, load.getMemref(), load.getIndices(),
+                  load.getType());
+  if (auto store = dyn_cast<vector::StoreOp>(op))
+    if (isWorkgroupMemRef(store.getBase()))
+      return make(AccessKind::LDSStore, store.getBase(), store.getIndices(),
+                  store.getValueToStore().getType());
+  if (auto store = dyn_cast<memref::StoreOp>(op))
+    if (isWorkgroupMemRef(store.getMemref()))
+      return make(AccessKind::LDSStore, store.getMemref(), store.getIndices(),
+                  store.getValueToStore().getType());
+  return std::nullopt;
+}
+
+/// Whether the wide access type `vector<width x elementType>` exists for the
+/// given kind of access.
+static bool isLegalWidth(AccessKind kind, Type elementType, int64_t width) {
+  int64_t bitWidth = elementType.getIntOrFloatBitWidth();
+  if (!llvm::isPowerOf2_64(width) || width * bitWidth > 128)
+    return false;
+  if (kind != AccessKind::BufferLoad)
+    return true;
+  // The vector types amdgpu.raw_buffer_load accepts.
+  if (elementType.isF32() || elementType.isInteger(32))
+    return width <= 4;
+  return (bitWidth == 16 && isa<FloatType>(elementType)) || bitWidth == 8;
+}
+
+/// Whether `op` may touch LDS in a way that stops loads (if `forStores` is
+/// false) or stores (if it is true) of LDS from being moved across it.
+static bool blocksLDSAccesses(Operation *op, bool forStores) {
+  if (isMemoryEffectFree(op))
+    return false;
+  auto effectsOp = dyn_cast<MemoryEffectOpInterface>(op);
+  if (!effectsOp) {
+    if (!op->hasTrait<OpTrait::HasRecursiveMemoryEffects>())
+      return true;
+    for (Region &region : op->getRegions())
+      for (Operation &nested : region.getOps())
+        if (blocksLDSAccesses(&nested, forStores))
+          return true;
+    return false;
+  }
+  SmallVector<MemoryEffects::EffectInstance> effects;
+  effectsOp.getEffects(effects);
+  for (const MemoryEffects::EffectInstance &effect : effects) {
+    bool conflicts = isa<MemoryEffects::Write>(effect.getEffect()) ||
+                     (forStores && isa<MemoryEffects::Read>(effect.getEffect()));
+    if (!conflicts)
+      continue;
+    Value value = effect.getValue();
+    if (!value || !isa<MemRefType>(value.getType()) || isWorkgroupMemRef(value))
+      return true;
+  }
+  return false;
+}
+
+/// Whether all of `values` are available before `point`.
+static bool dominatesPoint(ValueRange values, Operation *point) {
+  return llvm::all_of(values, [&](Value v) {
+    Operation *def = v.getDefiningOp();
+    if (!def || def->getBlock() != point->getBlock())
+      return true;
+    return def->isBeforeInBlock(point);
+  });
+}
+
+/// Replaces `run`, which covers [offset, offset + width) of its group, by one
+/// access of `vector<width x elementType>`.
+static void mergeRun(ArrayRef<Access> run, int64_t width) {
+  const Access &leader = run.front();
+  Type elementType =
+      cast<MemRefType>(leader.memref.getType()).getElementType();
+  auto wideType = VectorType::get({width}, elementType);
+  Location loc = leader.op->getLoc();
+
+  if (leader.kind == AccessKind::LDSStore) {
+    Operation *last = llvm::max_element(run, [](const Access &a,
+                                                const Access &b) {
+                        return a.op->isBeforeInBlock(b.op);
+                      })->op;
+    OpBuilder b(last);
+    Value wide = createZeroConstantOp(b, loc, wideType);
+    for (const Access &access : run) {
+      Value data = access.op->getOperand(0);
+      int64_t pos = access.offset - leader.offset;
+      if (isa<VectorType>(data.getType()))
+        wide = b.create<vector::InsertStridedSliceOp>(loc, data, wide,
+                                                      ArrayRef<int64_t>{pos},
+                                                      ArrayRef<int64_t>{1});
+      else
+        wide = b.create<vector::InsertOp>(loc, data, wide, pos);
+    }
+    b.create<vector::StoreOp>(loc, wide, leader.memref, leader.indices,
+                              AccessGroup::isNontemporal(leader.op));
+    for (const Access &access : run)
+      access.op->erase();
+    return;
+  }
+
+  Operation *first = llvm::min_element(run, [](const Access &a,
+                                               const Access &b) {
+                       return a.op->isBeforeInBlock(b.op);
+                     })->op;
+  OpBuilder b(first);
+  Value wide;
+  if (auto load = dyn_cast<amdgpu::RawBufferLoadOp>(leader.op))
+    wide = b.create<amdgpu::RawBufferLoadOp>(
+        loc, wideType, load.getMemref(), load.getIndices(),
+        load.getBoundsCheck(), load.getIndexOffsetAttr(), load.getSgprOffset());
+  else
+    wide = b.create<vector::LoadOp>(loc, wideType, leader.memref,
+                                    leader.indices,
+                                    AccessGroup::isNontemporal(leader.op));
+  for (const Access &access : run) {
+    int64_t pos = access.offset - leader.offset;
+    Value part;
+    if (auto vecType = dyn_cast<VectorType>(access.op->getResult(0).getType()))
+      part = b.create<vector::ExtractStridedSliceOp>(
+          loc, wide, ArrayRef<int64_t>{pos},
+          ArrayRef<int64_t>{vecType.getNumElements()}, ArrayRef<int64_t>{1});
+    else
+      part = b.create<vector::ExtractOp>(loc, wide, pos);
+    access.op->getResult(0).replaceAllUsesWith(part);
+    access.op->erase();
+  }
+}
+
+/// Merges the runs of consecutive accesses in `group` whose start is aligned
+/// to their width. Returns the number of accesses that were removed.
+static int64_t coalesceGroup(AccessGroup &group,
+                             DenseMap<Value, int64_t> &divisorCache) {
+  SmallVector<Access> &members = group.members;
+  if (members.size() < 2)
+    return 0;
+  llvm::stable_sort(members, [](const Access &a, const Access &b) {
+    return a.offset < b.offset;
+  });
+  const Access &any = members.front();
+  auto memrefType = cast<MemRefType>(any.memref.getType());
+  Type elementType = memrefType.getElementType();
+  int64_t rowLen = memrefType.getShape().back();
+  if (ShapedType::isDynamic(rowLen))
+    return 0;
+  int64_t baseDivisor = getKnownDivisor(any.base, divisorCache);
+
+  int64_t removed = 0;
+  for (size_t i = 0; i < members.size();) {
+    // Try the widest run starting at members[i] first.
+    size_t runEnd = i + 1;
+    int64_t runWidth = 0;
+    for (int64_t width = 128 / elementType.getIntOrFloatBitWidth();
+         width > members[i].len; width /= 2) {
+      if (!isLegalWidth(any.kind, elementType, width) ||
+          members[i].offset % width != 0 || baseDivisor % width != 0 ||
+          rowLen % width != 0)
+        continue;
+      int64_t covered = members[i].offset;
+      size_t j = i;
+      while (j < members.size() && members[j].offset == covered &&
+             covered + members[j].len <= members[i].offset + width) {
+        covered += members[j].len;
+        ++j;
+      }
+      if (covered != members[i].offset + width)
+        continue;
+      // Loads are hoisted to the first member of the run, so the index of
+      // the run's start must already be available there.
+      if (any.kind != AccessKind::LDSStore) {
+        Operation *first = members[i].op;
+        for (size_t k = i; k < j; ++k)
+          if (members[k].op->isBeforeInBlock(first))
+            first = members[k].op;
+        if (!dominatesPoint(members[i].indices, first))
+          continue;
+      }
+      runEnd = j;
+      runWidth = width;
+      break;
+    }
+    if (runWidth == 0) {
+      ++i;
+      continue;
+    }
+    LLVM_DEBUG(llvm::dbgs() << "Merging " << runEnd - i << " accesses into "
+                            << runWidth << " elements: " << *members[i].op
+                            << "\n");
+    mergeRun(ArrayRef<Access>(members).slice(i, runEnd - i), runWidth);
+    removed += runEnd - i - 1;
+    i = runEnd;
+  }
+  return removed;
+}
+
 namespace {
 // This is modelled after the CSE pass upstream, except we get to be a lot
 // simpler because we don't have to even try and handle the case of an IR that's
@@ -86,6 +452,75 @@ struct RockBufferLoadMergePass final
     return true;
   }
 
+  /// Coalesces the accesses in `block` and the blocks nested in it.
+  void coalesceAccesses(Block &block,
+                        llvm::DenseMap<Value, bool> &isMergeableCache,
+                        DenseMap<Value, int64_t> &divisorCache) {
+    using GroupMap = llvm::MapVector<std::pair<Value, Value>,
+                                     SmallVector<AccessGroup, 1>>;
+    GroupMap bufferLoads, ldsLoads;
+    // Stores are sunk to the last store of their run, so only one run of them
+    // is open at a time, to keep the order of stores that may overlap.
+    std::optional<AccessGroup> ldsStores;
+    auto flush = [&](GroupMap &groups) {
+      for (auto &[key, list] : groups)
+        for (AccessGroup &group : list)
+          coalesceGroup(group, divisorCache);
+      groups.clear();
+    };
+    auto flushStores = [&]() {
+      if (ldsStores)
+        coalesceGroup(*ldsStores, divisorCache);
+      ldsStores.reset();
+    };
+    auto isReadOnly = [&](Value buffer) {
+      return isMergeable(buffer, isMergeableCache);
+    };
+
+    for (Operation &op : llvm::make_early_inc_range(block)) {
+      for (Region &region : op.getRegions())
+        for (Block &nested : region)
+          coalesceAccesses(nested, isMergeableCache, divisorCache);
+
+      std::optional<Access> access = matchAccess(&op, isReadOnly);
+      bool isLDSLoad = access && access->kind == AccessKind::LDSLoad;
+      bool isLDSStore = access && access->kind == AccessKind::LDSStore;
+      if (isLDSStore) {
+        bool overlaps =
+            ldsStores &&
+            llvm::any_of(ldsStores->members, [&](const Access &other) {
+              return other.offset < access->offset + access->len &&
+                     access->offset < other.offset + other.len;
+            });
+        if (ldsStores && (overlaps || !ldsStores->accepts(*access)))
+          flushStores();
+        if (ldsStores)
+          ldsStores->members.push_back(*access);
+        else
+          ldsStores = AccessGroup{{*access}};
+      } else if (access) {
+        GroupMap &groups = isLDSLoad ? ldsLoads : bufferLoads;
+        auto &list = groups[{access->memref, access->base}];
+        auto group = llvm::find_if(list, [&](const AccessGroup &g) {
+          return g.accepts(*access);
+        });
+        if (group != list.end())
+          group->members.push_back(*access);
+        else
+          list.push_back(AccessGroup{{*access}});
+      }
+      // LDS accesses can't be moved across something that may write LDS (or,
+      // for stores, read it), which includes barriers.
+      if (!isLDSLoad && blocksLDSAccesses(&op, /*forStores=*/false))
+        flush(ldsLoads);
+      if (!isLDSStore && blocksLDSAccesses(&op, /*forStores=*/true))
+        flushStores();
+    }
+    flush(bufferLoads);
+    flush(ldsLoads);
+    flushStores();
+  }
+
   void runOnOperation() override {
     MapTy equivalentOps;
     llvm::DenseMap<Value, bool> isMergeableCache;
@@ -106,6 +541,10 @@ struct RockBufferLoadMergePass final
     for (Operation *dead : toRemove) {
       dead->erase();
     }
+
+    DenseMap<Value, int64_t> divisorCache;
+    for (Block &block : op.getBody())
+      coalesceAccesses(block, isMergeableCache, divisorCache);
   }
 };
 } // end namespace
@@ -748,10 +748,10 @@ LogicalResult backwardWeightAtomicAdd(ConvBwdWeightOp op, PatternRewriter &b) {
   auto storeMethod = b.getAttr<StoreMethodAttr>(StoreMethod::AtomicAdd);
   b.create<GemmOp>(
       loc, getResultType(op, gemmFilter), gemmOutput, gemmInput, gemmFilter,
-      /*aTransposed=*/b.getUnitAttr(), /*bTransposed=*/nullptr,
-      /*cTransposed=*/nullptr, op.getArchAttr(), op.getNumCUAttr(),
-      op.getFeaturesAttr(), storeMethod, op.getDerivedBlockSizeAttr(),
-      op.getGridSizeAttr(), op.getParamsAttr());
+      /*workspace=*/nullptr, /*aTransposed=*/b.getUnitAttr(),
+      /*bTransposed=*/nullptr, /*cTransposed=*/nullptr, op.getArchAttr(),
+      op.getNumCUAttr(), op.getFeaturesAttr(), storeMethod,
+      op.getDerivedBlockSizeAttr(), op.getGridSizeAttr(), op.getParamsAttr());
 
   // Finally, erase the original Conv op.
   b.eraseOp(op);
@@ -855,6 +855,18 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
     iDotSlice.push_back(math_util::integer_divide_ceil(
         convDims.fil[i] - iTilda[i], filTilda[i]));
 
+  // The slices of the tilda and dot dimensions this kernel works on. When the
+  // kernels are batched, each one gets its own slice of gemmG, and all of
+  // them take filDots taps, with the taps past the end of the filter reading
+  // as zeros.
+  bool batchKernels = op.getBatchKernels();
+  SmallVector<int64_t, 3> tildaBegin, tildaEnd, dotEnd;
+  for (size_t i = 0; i < convDims.fil.size(); i++) {
+    tildaBegin.push_back(batchKernels ? 0 : iTilda[i]);
+    tildaEnd.push_back(batchKernels ? filTilda[i] : iTilda[i] + 1);
+    dotEnd.push_back(batchKernels ? filDots[i] : iDotSlice[i]);
+  }
+
   // backward data only, it's igemm v4r1 algo
   // c is input channels , k is output channels
   // n is batch , yDotSlice,xDotSlice computed in above
@@ -862,6 +874,22 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
   Value gemmFilter, gemmInput, gemmOutput;
   // Transform filter tensor.
   {
+    Value filter = op.getFilter();
+    if (batchKernels) {
+      BottomUpTMBuilder padFilterTransform(b, filterNames, filterShape, loc);
+      padFilterTransform.passThrough({"g", "k", "c"});
+      SmallVector<StringRef, 3> spatialNames;
+      SmallVector<int64_t, 6> padParams;
+      for (size_t i = 0; i < convDims.fil.size(); i++) {
+        spatialNames.push_back(b.getStringAttr(Twine(i)));
+        padParams.push_back(0);
+        padParams.push_back(filDots[i] * filTilda[i] - convDims.fil[i]);
+      }
+      padFilterTransform.pad(spatialNames, padParams);
+      filter = b.create<TransformOp>(loc, filter, padFilterTransform.get());
+      filterShape = filter.getType().cast<ShapedType>().getShape();
+    }
+
     // Embed y/x into {y/x}dot and {y/x}tilda (Why the
     // particular embed coefficients is in a presentation somewhere)
     llvm::StringMap<SmallVector<StringRef, 2>> expansions;
@@ -888,7 +916,7 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
 
     TransformMapAttr embedTransformAttr = embedTransform.get();
     Value embeddedFilter =
-        b.create<TransformOp>(loc, op.getFilter(), embedTransformAttr);
+        b.create<TransformOp>(loc, filter, embedTransformAttr);
 
     // Take slices in the ydot, ytilda, xdot, and xtilda dimensions
     // to reflect which kernel we're performing
@@ -901,17 +929,14 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
       uppers.push_back(b.getStringAttr(Twine(i) + "dotslice"));
       lowers.push_back(b.getStringAttr(Twine(i) + "dot"));
     }
-    sliceTransform.slice(uppers, lowers, {0, 0}, iDotSlice);
+    sliceTransform.slice(uppers, lowers, {0, 0}, dotEnd);
     uppers.clear();
     lowers.clear();
     for (size_t i = 0; i < convDims.fil.size(); i++) {
       uppers.push_back(b.getStringAttr(Twine(i) + "tildaslice"));
       lowers.push_back(b.getStringAttr(Twine(i) + "tilda"));
     }
-    llvm::SmallVector<int64_t, 3> iTildasPlusOne;
-    for (size_t i = 0; i < convDims.fil.size(); i++)
-      iTildasPlusOne.push_back(iTilda[i] + 1);
-    sliceTransform.slice(uppers, lowers, iTilda, iTildasPlusOne);
+    sliceTransform.slice(uppers, lowers, tildaBegin, tildaEnd);
 
     TransformMapAttr sliceTransformAttr = sliceTransform.get();
     Value slicedFilter =
@@ -919,10 +944,20 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
 
     // Set up gemm by passing g -> gemmG, merging
     // [k, ydotslice, xdotslice] to gemmK, and [c, ytildaslice, xtildaslice]
-    // to gemmM
+    // to gemmM. Batched kernels merge the tilda slices into gemmG instead.
     auto gemmFilterTransform =
         BottomUpTMBuilder::above(sliceTransform, sliceTransformAttr);
-    gemmFilterTransform.passThrough({"gemmG"}, {0}, {"g"});
+    SmallVector<StringRef, 3> tildaSlices;
+    for (size_t i = 0; i < convDims.fil.size(); i++)
+      tildaSlices.push_back(b.getStringAttr(Twine(i) + "tildaslice"));
+    if (batchKernels) {
+      lowers.clear();
+      lowers.push_back("g");
+      lowers.append(tildaSlices);
+      gemmFilterTransform.merge("gemmG", 0, lowers);
+    } else {
+      gemmFilterTransform.passThrough({"gemmG"}, {0}, {"g"});
+    }
     lowers.clear();
     lowers.push_back("k");
     for (size_t i = 0; i < convDims.fil.size(); i++)
@@ -930,8 +965,8 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
     gemmFilterTransform.merge("gemmK", 1, lowers);
     lowers.clear();
     lowers.push_back("c");
-    for (size_t i = 0; i < convDims.fil.size(); i++)
-      lowers.push_back(b.getStringAttr(Twine(i) + "tildaslice"));
+    if (!batchKernels)
+      lowers.append(tildaSlices);
     gemmFilterTransform.merge("gemmM", 2, lowers);
 
     TransformMapAttr gemmFilterTransformAttr = gemmFilterTransform.get();
@@ -996,10 +1031,7 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
       uppers.push_back(b.getStringAttr(Twine(i) + "slice"));
       lowers.push_back(b.getStringAttr(Twine(i) + "ftilda"));
     }
-    llvm::SmallVector<int64_t, 3> iTildasPlusOne;
-    for (size_t i = 0; i < convDims.fil.size(); i++)
-      iTildasPlusOne.push_back(iTilda[i] + 1);
-    sliceTransform.slice(uppers, lowers, iTilda, iTildasPlusOne);
+    sliceTransform.slice(uppers, lowers, tildaBegin, tildaEnd);
     uppers.clear();
     lowers.clear();
     for (size_t i = 0; i < convDims.fil.size(); i++) {
@@ -1013,14 +1045,25 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
         b.create<TransformOp>(loc, tildaEmbedded, sliceTransformAttr);
 
     // C plus the length 1 slices (yslice and xslice) become the gemmM
-    // dimension G, N, and the h and w slices become gemmN
+    // dimension G, N, and the h and w slices become gemmN. Batched kernels
+    // merge the y and x slices into gemmG instead.
     auto gemmTransform =
         BottomUpTMBuilder::above(sliceTransform, sliceTransformAttr);
-    gemmTransform.passThrough({"gemmG"}, {0}, {"gi"});
+    SmallVector<StringRef, 3> tildaSlices;
+    for (size_t i = 0; i < convDims.fil.size(); i++)
+      tildaSlices.push_back(b.getStringAttr(Twine(i) + "slice"));
+    if (batchKernels) {
+      lowers.clear();
+      lowers.push_back("gi");
+      lowers.append(tildaSlices);
+      gemmTransform.merge("gemmG", 0, lowers);
+    } else {
+      gemmTransform.passThrough({"gemmG"}, {0}, {"gi"});
+    }
     lowers.clear();
     lowers.push_back("ci");
-    for (size_t i = 0; i < convDims.fil.size(); i++)
-      lowers.push_back(b.getStringAttr(Twine(i) + "slice"));
+    if (!batchKernels)
+      lowers.append(tildaSlices);
     gemmTransform.merge("gemmM", 1, lowers);
     lowers.clear();
     lowers.push_back("ni");
@@ -1070,7 +1113,7 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
       uppers.push_back(b.getStringAttr(Twine(i) + "slice"));
       lowers.push_back(b.getStringAttr(Twine(i) + "dot"));
     }
-    sliceTransform.slice(uppers, lowers, {0, 0}, iDotSlice);
+    sliceTransform.slice(uppers, lowers, {0, 0}, dotEnd);
     lowers.clear();
     uppers.clear();
     for (size_t i = 0; i < convDims.out.size(); i++) {
@@ -1078,6 +1121,15 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
       lowers.push_back(b.getStringAttr(Twine(i) + "tilda"));
     }
     sliceTransform.slice(uppers, lowers, iTildaLeft, iTildaRight);
+    // The output is the same for every batched kernel.
+    SmallVector<StringRef, 3> phases;
+    if (batchKernels) {
+      uint32_t nextDim = embedTransformAttr.getUpperBounds().size();
+      for (size_t i = 0; i < convDims.out.size(); i++) {
+        phases.push_back(b.getStringAttr(Twine(i) + "phase"));
+        sliceTransform.addDim(phases.back(), nextDim++, filTilda[i]);
+      }
+    }
 
     TransformMapAttr sliceTransformAttr = sliceTransform.get();
     Value sliced = b.create<TransformOp>(loc, embedded, sliceTransformAttr);
@@ -1085,7 +1137,14 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
     // Merge k, yslice, and xslice to gemmK and n, hslice, and wslice to gemmN
     auto gemmOutputTransform =
         BottomUpTMBuilder::above(sliceTransform, sliceTransformAttr);
-    gemmOutputTransform.passThrough({"gemmG"}, {0}, {"go"});
+    if (batchKernels) {
+      lowers.clear();
+      lowers.push_back("go");
+      lowers.append(phases);
+      gemmOutputTransform.merge("gemmG", 0, lowers);
+    } else {
+      gemmOutputTransform.passThrough({"gemmG"}, {0}, {"go"});
+    }
     lowers.clear();
     lowers.push_back("ko");
     for (size_t i = 0; i < convDims.out.size(); i++)
@@ -1105,10 +1164,10 @@ LogicalResult backwardData(ConvBwdDataOp op, PatternRewriter &b) {
   auto storeMethod = b.getAttr<StoreMethodAttr>(StoreMethod::Set);
   auto gemm = b.create<GemmOp>(
       loc, getResultType(op, gemmInput), gemmFilter, gemmOutput, gemmInput,
-      /*aTransposed=*/b.getUnitAttr(), /*bTransposed=*/nullptr,
-      /*cTransposed=*/nullptr, op.getArchAttr(), op.getNumCUAttr(),
-      op.getFeaturesAttr(), storeMethod, op.getDerivedBlockSizeAttr(),
-      op.getGridSizeAttr(), op.getParamsAttr());
+      /*workspace=*/nullptr, /*aTransposed=*/b.getUnitAttr(),
+      /*bTransposed=*/nullptr, /*cTransposed=*/nullptr, op.getArchAttr(),
+      op.getNumCUAttr(), op.getFeaturesAttr(), storeMethod,
+      op.getDerivedBlockSizeAttr(), op.getGridSizeAttr(), op.getParamsAttr());
   // Bounced along for debugging purposes, not used below
   gemm->setAttr("kernelId", kernelIdAttr);
 
@@ -1152,6 +1211,12 @@ struct ConvRewritePattern : public OpRewritePattern<T> {
     auto strides = ctx.getStrideVal();
     ConvolutionDims convDims = ctx.getConvDims();
 
+    // Forward convolutions with very few channels get them zero-padded in both
+    // the filter and the input, see getConvGemmChannels().
+    int64_t extraChannels = 0;
+    if (auto fwdOp = dyn_cast<ConvOp>(op.getOperation()))
+      extraChannels = getConvGemmChannels(fwdOp) - convDims.c;
+
     llvm::SmallVector<StringRef, 5> filterNames, inputNames, outputNames;
     if (failed(getConvDimNames(op, filterNames, inputNames, outputNames))) {
       return failure();
@@ -1193,7 +1258,18 @@ struct ConvRewritePattern : public OpRewritePattern<T> {
       if (name != "g" && name != "k")
         filterNonKDims.push_back(name);
 
-    BottomUpTMBuilder filterTransform(b, filterNames, filterShape, loc);
+    Value filter = op.getFilter();
+    if (extraChannels > 0) {
+      BottomUpTMBuilder padFilterTransform(b, filterNames, filterShape, loc);
+      for (StringRef name : filterNames)
+        if (name != "c")
+          padFilterTransform.passThrough(name);
+      padFilterTransform.pad("c", "c", 0, extraChannels);
+      filter = b.create<TransformOp>(loc, filter, padFilterTransform.get());
+    }
+
+    BottomUpTMBuilder filterTransform(
+        b, filterNames, cast<ShapedType>(filter.getType()).getShape(), loc);
     filterTransform.passThrough({"gemmG"}, {0}, {"g"});
     switch (convOpType) {
     case ConvOpType::Fwd:
@@ -1210,21 +1286,24 @@ struct ConvRewritePattern : public OpRewritePattern<T> {
     }
 
     TransformMapAttr filterTransformAttr = filterTransform.get();
-    Value gemmFilter =
-        b.create<TransformOp>(loc, op.getFilter(), filterTransformAttr);
+    Value gemmFilter = b.create<TransformOp>(loc, filter, filterTransformAttr);
 
     // Transform input tensor.
     // Input tensor step 1: padded input.
 
     // set layout attribute.
     // Padded input tensor transformation:
-    // - Pass through ni, gi, and ci, not renaming them
+    // - Pass through ni, gi, and ci, not renaming them, but zero-padding ci
+    // to match the filter if needed
     // - Pad hi and wi as specified in padding attributes, renaming them to
     // 0ipad and 1ipad
     BottomUpTMBuilder padInputTransform(b, inputNames, inputShape, loc);
     padInputTransform.passThrough("ni");
     padInputTransform.passThrough("gi");
-    padInputTransform.passThrough("ci");
+    if (extraChannels > 0)
+      padInputTransform.pad("ci", "ci", 0, extraChannels);
+    else
+      padInputTransform.passThrough("ci");
 
     llvm::SmallVector<uint32_t, 2> padOutDims;
     llvm::SmallVector<StringRef, 2> outs;
@@ -1366,6 +1445,7 @@ struct ConvRewritePattern : public OpRewritePattern<T> {
     // Emit rock.gemm op.
     auto storeMethod = b.getAttr<StoreMethodAttr>(StoreMethod::Set);
     b.create<GemmOp>(loc, getResultType(op, gemmC), gemmA, gemmB, gemmC,
+                     /*workspace=*/nullptr,
                      /*aTransposed=*/b.getUnitAttr(), /*bTransposed=*/nullptr,
                      /*cTransposed=*/nullptr, op.getArchAttr(),
                      op.getNumCUAttr(), op.getFeaturesAttr(), storeMethod,
@@ -197,9 +197,9 @@ struct FoldBroadcast : public OpRewritePattern<rock::GemmOp> {
 
     // Create the new GemmOp
     auto gemm = rw.create<rock::GemmOp>(
-        op.getLoc(), newC.getType(), newA, newB, newC, op.getATransposed(),
-        op.getBTransposed(), op.getCTransposed(), op.getArch(),
-        op.getNumCUAttr(), op.getFeatures(), op.getStoreMethod(),
+        op.getLoc(), newC.getType(), newA, newB, newC, op.getWorkspace(),
+        op.getATransposed(), op.getBTransposed(), op.getCTransposed(),
+        op.getArch(), op.getNumCUAttr(), op.getFeatures(), op.getStoreMethod(),
         op.getDerivedBlockSizeAttr(), op.getGridSizeAttr(), op.getParamsAttr());
 
     // Remove dummy transforms from the gemm output and use it to replace the
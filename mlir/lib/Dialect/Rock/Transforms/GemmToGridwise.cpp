@@ -73,7 +73,8 @@ struct GemmRewritePattern : public OpConversionPattern<GemmOp> {
 
   std::tuple<Value, Value, Value>
   arrangeSplitKTransform(OpBuilder &builder, GemmOp op, Location loc,
-                         int64_t splitKFactor, Value a, Value b, Value c) const;
+                         int64_t splitKFactor, bool useAtomics, Value a,
+                         Value b, Value c) const;
 };
 
 struct AttentionRewritePattern : public OpConversionPattern<AttentionOp> {
@@ -174,22 +175,41 @@ GemmRewritePattern::matchAndRewrite(GemmOp op, GemmOpAdaptor adaptor,
   b = normalizeMatrix(b, rw, loc, op.getBTransposed(), "gemmK", "gemmN");
   c = normalizeMatrix(c, rw, loc, op.getCTransposed(), "gemmM", "gemmN");
 
+  bool isAccel = rock::isAccel(op.getFeatures());
+  Value workspace = adaptor.getWorkspace();
   const int64_t splitKFactor = op.getParams()->getSplitKFactor();
+  // With a workspace, split-K partial results are reduced by the last
+  // workgroup to finish each tile instead of with atomics.
+  const bool useAtomics = !workspace;
   if (splitKFactor > 1) {
     const auto isAllowedTypeC =
         elemTypeC == rw.getF32Type() || elemTypeC == rw.getF16Type();
 
-    if (!bitEnumContainsAll(op.getFeatures(), GemmFeatures::atomic_add)) {
+    if (!useAtomics && !isAccel) {
+      return op.emitError("Split-K `GemmOp` with a workspace requires an "
+                          "accelerated gemm");
+    }
+
+    if (!useAtomics && elemTypeC.getIntOrFloatBitWidth() > 32) {
+      return op.emitError("Split-K `GemmOp` with a workspace supports only "
+                          "element types of up to 32 bits");
+    }
+
+    if (useAtomics &&
+        !bitEnumContainsAll(op.getFeatures(), GemmFeatures::atomic_add)) {
       return op.emitError(
           "Split-K `GemmOp` requires support of `atomic_add` hardware feature");
     }
 
-    if (!isAllowedTypeC) {
+    if (useAtomics && !isAllowedTypeC) {
       return op.emitError(
           "Split-K `GemmOp` currently supports only f32/f16 element types");
     }
     std::tie(a, b, c) =
-        arrangeSplitKTransform(rw, op, loc, splitKFactor, a, b, c);
+        arrangeSplitKTransform(rw, op, loc, splitKFactor, useAtomics, a, b, c);
+  } else {
+    // The workspace is only needed to reduce split-K partial results.
+    workspace = nullptr;
   }
 
   aShape = a.getType().cast<MemRefType>().getShape();
@@ -206,6 +226,20 @@ GemmRewritePattern::matchAndRewrite(GemmOp op, GemmOpAdaptor adaptor,
   b = padMatrix(b, rw, loc, "gemmK", extraPad.k, "gemmN", extraPad.n);
   c = padMatrix(c, rw, loc, "gemmM", extraPad.m, "gemmN", extraPad.n);
 
+  if (workspace) {
+    auto accelParams = params.cast<RockAccelTuningParamAttrInterface>();
+    GemmSize unsplitSize(size.g / splitKFactor, size.m + extraPad.m, size.k,
+                         size.n + extraPad.n);
+    int64_t requiredBytes = getSplitKWorkspaceBytes(
+        unsplitSize, accelParams.getMPerBlock(), accelParams.getNPerBlock(),
+        splitKFactor);
+    int64_t workspaceBytes =
+        workspace.getType().cast<MemRefType>().getNumElements();
+    if (workspaceBytes < requiredBytes)
+      return op.emitOpError("split-K workspace has ")
+             << workspaceBytes << " bytes but needs " << requiredBytes;
+  }
+
   if (failed(computeGridSize(rw, op, a, b))) {
     return op.emitError("failed to compute the grid size of `GemmOp`");
   }
@@ -217,8 +251,6 @@ GemmRewritePattern::matchAndRewrite(GemmOp op, GemmOpAdaptor adaptor,
     numCUAttr = rw.getI32IntegerAttr(minNumCU);
   }
 
-  bool isAccel = rock::isAccel(op.getFeatures());
-
   if (isAccel && !blockSize)
     return op.emitOpError("block size must be set at lowering");
   IntegerAttr gridSize = op.getGridSizeAttr();
@@ -228,7 +260,7 @@ GemmRewritePattern::matchAndRewrite(GemmOp op, GemmOpAdaptor adaptor,
   auto accumulator = getAccumulator(a, b, c, rw, loc);
   if (isAccel) {
     rw.create<GridwiseGemmAccelOp>(
-        loc, a, b, accumulator, op.getArchAttr(), numCUAttr,
+        loc, a, b, accumulator, workspace, op.getArchAttr(), numCUAttr,
         op.getFeaturesAttr(), op.getStoreMethodAttr(), blockSize, gridSize,
         params.cast<RockAccelTuningParamAttrInterface>());
   } else {
@@ -267,25 +299,34 @@ GemmRewritePattern::matchAndRewrite(GemmOp op, GemmOpAdaptor adaptor,
 std::tuple<Value, Value, Value>
 GemmRewritePattern::arrangeSplitKTransform(OpBuilder &builder, GemmOp op,
                                            Location loc, int64_t splitKFactor,
-                                           Value a, Value b, Value c) const {
-  // adjust the store method
-  auto storeMethod =
-      builder.getAttr<rock::StoreMethodAttr>(rock::StoreMethod::AtomicAdd);
-  op.setStoreMethodAttr(storeMethod);
-
-  // set the prefill attribute
+                                           bool useAtomics, Value a, Value b,
+                                           Value c) const {
   auto func = llvm::cast<func::FuncOp>(op->getParentOp());
   auto attrName = mhal::PrefillAttr::getMnemonic();
-  auto elementType = c.getType().cast<MemRefType>().getElementType();
-  Attribute zero;
-  if (llvm::isa<FloatType>(elementType)) {
-    zero = builder.getFloatAttr(elementType, 0.0);
-  } else {
-    assert(llvm::isa<IntegerType>(elementType) &&
-           "expecting `int` element type");
-    zero = builder.getIntegerAttr(elementType, 0);
+  if (useAtomics) {
+    // adjust the store method
+    auto storeMethod =
+        builder.getAttr<rock::StoreMethodAttr>(rock::StoreMethod::AtomicAdd);
+    op.setStoreMethodAttr(storeMethod);
+
+    // set the prefill attribute
+    auto elementType = c.getType().cast<MemRefType>().getElementType();
+    Attribute zero;
+    if (llvm::isa<FloatType>(elementType)) {
+      zero = builder.getFloatAttr(elementType, 0.0);
+    } else {
+      assert(llvm::isa<IntegerType>(elementType) &&
+             "expecting `int` element type");
+      zero = builder.getIntegerAttr(elementType, 0);
+    }
+    func.setArgAttrs(2, builder.getNamedAttr(attrName, zero));
+  } else if (auto arg = dyn_cast<BlockArgument>(op.getWorkspace())) {
+    // The arrival counters in the workspace must start at zero. Every launch
+    // resets them, so this only matters for the first one.
+    func.setArgAttrs(arg.getArgNumber(),
+                     builder.getNamedAttr(attrName,
+                                          builder.getI8IntegerAttr(0)));
   }
-  func.setArgAttrs(2, builder.getNamedAttr(attrName, zero));
 
   const int64_t origK = a.getType().cast<MemRefType>().getShape()[1];
   const int64_t kPad =
@@ -514,10 +555,12 @@ AttentionRewritePattern::matchAndRewrite(AttentionOp op,
     prePadG0NAttr = rw.getIndexAttr(gemm0Size.n);
   }
   auto newOp = rw.create<GridwiseAttentionAccelOp>(
-      loc, queries, keys, values, adaptor.getPreSoftmaxElemWiseInputs(), out,
-      op.getArchAttr(), op.getFeaturesAttr(), blockSizeAttr, gridSizeAttr,
-      /*disableQBypassLDS=*/nullptr, prePadG0MAttr, prePadG0NAttr, params0,
-      params1);
+      loc, queries, keys, values, adaptor.getPreSoftmaxElemWiseInputs(),
+      adaptor.getDropoutSeed(), adaptor.getSeqOffsetsQ(),
+      adaptor.getSeqOffsetsK(), out, op.getArchAttr(), op.getFeaturesAttr(),
+      blockSizeAttr, gridSizeAttr,
+      /*disableQBypassLDS=*/nullptr, prePadG0MAttr, prePadG0NAttr,
+      op.getDropoutRateAttr(), params0, params1, op.getPipelineKVLoopAttr());
   bool linalgOpFound = false;
   op.getPreSoftmaxBody().walk(
       [&](linalg::GenericOp genOp) { linalgOpFound = true; });
@@ -33,6 +33,7 @@
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/Func/IR/FuncOps.h"
 #include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "mlir/Dialect/Math/IR/Math.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
@@ -253,6 +254,152 @@ Value gpuAlloc(OpBuilder &b, Location loc, int64_t bufferDim, Type elementType,
   return viewBufferAs(b, buffer, elementType);
 }
 
+/// Reduces the partial results of a split-K gemm through its workspace
+/// instead of with atomics. Each workgroup stores its partial result for its
+/// tile and counts itself as arrived on the tile's counter, and the last one to
+/// arrive adds up the partial results of the other splits and writes C.
+/// `partialC` holds the accumulators of this thread, which are only converted
+/// to the element type of C once the splits have been added up.
+static void emitSplitKReduction(PatternRewriter &b, Location loc,
+                                GridwiseGemmAccelOp op, Value partialC,
+                                ArrayAttr idToMatrixCMaps, Value gBlock,
+                                Value mBlock, Value nBlock, Value tid,
+                                int64_t mBlocks, int64_t nBlocks,
+                                bool forceUnroll, bool useIndexDiffs) {
+  MemRefType cType = op.getC().getType();
+  Type destType = cType.getElementType();
+  Type elemType = partialC.getType().cast<MemRefType>().getElementType();
+  assert(elemType.getIntOrFloatBitWidth() == 32 &&
+         "split-K workspaces hold 32-bit partial results");
+  Type i32 = b.getI32Type();
+  int64_t splitKFactor = op.getParams().getSplitKFactor();
+  int64_t numTiles = cType.getShape()[0] / splitKFactor * mBlocks * nBlocks;
+
+  // The workspace holds 32-bit partial results for every split, followed by
+  // the arrival counter of every output tile (see getSplitKWorkspaceBytes()).
+  Value zero = b.createOrFold<ConstantIndexOp>(loc, 0);
+  Value one = b.createOrFold<ConstantIndexOp>(loc, 1);
+  Value partials = b.create<memref::ViewOp>(
+      loc, MemRefType::get(cType.getShape(), elemType), op.getWorkspace(),
+      zero, /*sizes=*/ValueRange{});
+  Value counters = b.create<memref::ViewOp>(
+      loc, MemRefType::get({numTiles}, i32), op.getWorkspace(),
+      b.createOrFold<ConstantIndexOp>(
+          loc, getByteWidth(elemType) * cType.getNumElements()),
+      /*sizes=*/ValueRange{});
+  Value wrappedPartials = transform(b, partials, idToMatrixCMaps);
+
+  b.create<ThreadwiseWriteAllOp>(
+      loc, partialC, partials, idToMatrixCMaps,
+      /*extraIndices=*/ValueRange{gBlock, mBlock, nBlock, tid},
+      op.getFeatures(), StoreMethod::Set, forceUnroll, useIndexDiffs);
+  // Every thread's partial result must be visible to the whole device before
+  // the workgroup counts as arrived.
+  b.create<LLVM::FenceOp>(loc, LLVM::AtomicOrdering::release, "agent");
+  b.create<WorkgroupBarrierOp>(loc);
+
+  Value splitKConst = b.createOrFold<ConstantIndexOp>(loc, splitKFactor);
+  Value group = b.create<arith::DivUIOp>(loc, gBlock, splitKConst);
+  Value split = b.create<arith::RemUIOp>(loc, gBlock, splitKConst);
+  Value tile = b.create<arith::AddIOp>(
+      loc,
+      b.create<arith::MulIOp>(
+          loc,
+          b.create<arith::AddIOp>(
+              loc,
+              b.create<arith::MulIOp>(
+                  loc, group, b.createOrFold<ConstantIndexOp>(loc, mBlocks)),
+              mBlock),
+          b.createOrFold<ConstantIndexOp>(loc, nBlocks)),
+      nBlock);
+
+  Value isLeader =
+      b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::eq, tid, zero);
+  Value arrivedCell = gpuAlloc(b, loc, 1, i32, AddressSpace::Workgroup);
+  auto countIf = b.create<scf::IfOp>(loc, isLeader, /*withElseRegion=*/false);
+  {
+    PatternRewriter::InsertionGuard guard(b);
+    b.setInsertionPointToStart(countIf.thenBlock());
+    Value arrived = b.create<memref::AtomicRMWOp>(
+        loc, arith::AtomicRMWKind::addi,
+        b.createOrFold<arith::ConstantIntOp>(loc, 1, 32), counters, tile);
+    b.create<memref::StoreOp>(loc, arrived, arrivedCell, zero);
+  }
+  b.create<WorkgroupBarrierOp>(loc);
+  Value arrived = b.create<memref::LoadOp>(loc, arrivedCell, zero);
+  Value isLast = b.create<arith::CmpIOp>(
+      loc, arith::CmpIPredicate::eq, arrived,
+      b.createOrFold<arith::ConstantIntOp>(loc, splitKFactor - 1, 32));
+
+  auto finalizeIf = b.create<scf::IfOp>(loc, isLast, /*withElseRegion=*/false);
+  PatternRewriter::InsertionGuard guard(b);
+  b.setInsertionPointToStart(finalizeIf.thenBlock());
+  b.create<LLVM::FenceOp>(loc, LLVM::AtomicOrdering::acquire, "agent");
+
+  int64_t numElements = partialC.getType().cast<MemRefType>().getNumElements();
+  Value otherC = gpuAlloc(b, loc, numElements, elemType, AddressSpace::Private);
+  auto splitLoop = b.create<scf::ForOp>(loc, zero, splitKConst, one);
+  {
+    PatternRewriter::InsertionGuard guard(b);
+    b.setInsertionPointToStart(splitLoop.getBody());
+    Value otherSplit = splitLoop.getInductionVar();
+    Value isOther = b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ne,
+                                            otherSplit, split);
+    auto readIf = b.create<scf::IfOp>(loc, isOther, /*withElseRegion=*/false);
+    b.setInsertionPointToStart(readIf.thenBlock());
+    Value otherGBlock = b.create<arith::AddIOp>(
+        loc, b.create<arith::MulIOp>(loc, group, splitKConst), otherSplit);
+    b.create<ThreadwiseReadIntoOp>(
+        loc, wrappedPartials, otherC, /*extraViews=*/b.getArrayAttr({}),
+        /*extraIndices=*/ValueRange{otherGBlock, mBlock, nBlock, tid},
+        forceUnroll, useIndexDiffs);
+    auto addLoop = b.create<affine::AffineForOp>(loc, 0, numElements, 1);
+    if (forceUnroll)
+      addLoop->setAttr("forceUnroll", b.getUnitAttr());
+    b.setInsertionPointToStart(addLoop.getBody());
+    Value i = addLoop.getInductionVar();
+    Value mine = b.create<memref::LoadOp>(loc, partialC, i);
+    Value other = b.create<memref::LoadOp>(loc, otherC, i);
+    Value sum = elemType.isa<FloatType>()
+                    ? b.create<arith::AddFOp>(loc, mine, other).getResult()
+                    : b.create<arith::AddIOp>(loc, mine, other).getResult();
+    b.create<memref::StoreOp>(loc, sum, partialC, i);
+  }
+
+  Value finalC = partialC;
+  if (destType != elemType) {
+    finalC = gpuAlloc(b, loc, numElements, destType, AddressSpace::Private);
+    auto convertLoop = b.create<affine::AffineForOp>(loc, 0, numElements, 1);
+    if (forceUnroll)
+      convertLoop->setAttr("forceUnroll", b.getUnitAttr());
+    PatternRewriter::InsertionGuard guard(b);
+    b.setInsertionPointToStart(convertLoop.getBody());
+    Value i = convertLoop.getInductionVar();
+    Value acc = b.create<memref::LoadOp>(loc, partialC, i);
+    b.create<memref::StoreOp>(
+        loc, createTypeConversionOp(b, loc, acc, destType), finalC, i);
+  }
+  b.create<ThreadwiseWriteAllOp>(
+      loc, finalC, op.getC(), idToMatrixCMaps,
+      /*extraIndices=*/ValueRange{gBlock, mBlock, nBlock, tid},
+      op.getFeatures(), op.getStoreMethod(), forceUnroll, useIndexDiffs);
+  // Leave the counter zeroed for the next launch.
+  auto resetIf = b.create<scf::IfOp>(loc, isLeader, /*withElseRegion=*/false);
+  b.setInsertionPointToStart(resetIf.thenBlock());
+  b.create<memref::StoreOp>(
+      loc, b.createOrFold<arith::ConstantIntOp>(loc, 0, 32), counters, tile);
+}
+
+/// The mainloop schedule that the tuning parameters ask for, which
+/// RockSchedHintsPass reads back from the kernel function.
+static int64_t getSchedHint(RockAccelTuningParamAttrInterface params) {
+  if (auto xdlopsParams = dyn_cast<XdlopsGemmDerivedParamsAttr>(params))
+    return xdlopsParams.getSchedHint();
+  if (auto wmmaParams = dyn_cast<WmmaGemmParamsAttr>(params))
+    return wmmaParams.getSchedHint();
+  return 0;
+}
+
 //===----------------------------------------------------------------------===//
 // GridwiseGemm lowering.
 //===----------------------------------------------------------------------===//
@@ -742,7 +889,8 @@ struct GridwiseAttentionAccelRewritePattern
       RegsAsMatrixSubTiles toLDSViews, Value storeBuffer,
       Value ldsTileByteBuffer, int64_t kpacksPerBlock, StringRef nonKDimName,
       int64_t kPerBlock, int64_t dPerBlock, int64_t copyKPerThread,
-      int64_t copyDPerThread, bool forceUnroll) const {
+      int64_t copyDPerThread, bool forceUnroll,
+      Block *ldsStoreBlock = nullptr) const {
     Type elemType = regBuffer.getType().cast<MemRefType>().getElementType();
     ArrayAttr storeBufferViews =
         invertTransforms(rewriter, loc, toLDSViews.threadSubTile);
@@ -753,6 +901,10 @@ struct GridwiseAttentionAccelRewritePattern
     rewriter.create<ThreadwiseCopyOp>(loc, regBuffer, ValueRange{},
                                       viewStoreBuffer, ValueRange{}, false,
                                       false);
+    // A pipelined caller writes LDS in a stage of its own.
+    PatternRewriter::InsertionGuard guard(rewriter);
+    if (ldsStoreBlock)
+      rewriter.setInsertionPoint(ldsStoreBlock->getTerminator());
     Type ldsReadType = vectorTypeOrSelf(elemType, kpack);
     FailureOr<Value> maybeWrappedLds = wrapLDSBufferForStore(
         rewriter, loc, ldsTileByteBuffer, ldsReadType, kpacksPerBlock,
@@ -773,7 +925,9 @@ struct GridwiseAttentionAccelRewritePattern
   }
 
   // This function will process a tile of gemm input into LDS buffer
-  // in a way it could be fed to blockwise_gemm_accel op
+  // in a way it could be fed to blockwise_gemm_accel op. If `ldsStoreBlock`
+  // is set, the store to LDS is emitted at its end rather than after the
+  // global read.
   LogicalResult loadAndStoreGemmInputTile(
       Location loc, Value in, Value kIter,
       rock::layout::GridCoordinates gridCoords, Value fromGlobalRegBuffer,
@@ -782,7 +936,8 @@ struct GridwiseAttentionAccelRewritePattern
       uint32_t blockSize, uint32_t gridSize, ArrayRef<StringRef> bidGridOrder,
       ArrayRef<int64_t> bidGridLengths, bool forceUnroll,
       PatternRewriter &rewriter, const accel::AccelEmitter &accelEmitter,
-      std::optional<int64_t> forceKPerThread = std::nullopt) const {
+      std::optional<int64_t> forceKPerThread = std::nullopt,
+      Block *ldsStoreBlock = nullptr) const {
 
     MemRefType destBufferType = destBuffer.getType().cast<MemRefType>();
     mlir::gpu::AddressSpace destBufferAddrSpace =
@@ -865,7 +1020,8 @@ struct GridwiseAttentionAccelRewritePattern
       LogicalResult storeGemmTileStatus = storeGemmInputTile(
           rewriter, loc, kpack, viewLoadBuffer, maybeLdsStoreViews.value(),
           toLDSRegBuffer, destBuffer, kpacksPerBlock, nonKDimName, kPerBlock,
-          dPerBlock, copyKPerThread, copyDPerThread, forceUnroll);
+          dPerBlock, copyKPerThread, copyDPerThread, forceUnroll,
+          ldsStoreBlock);
       if (failed(storeGemmTileStatus)) {
         return failure();
       }
@@ -1420,6 +1576,114 @@ struct GridwiseAttentionAccelRewritePattern
     }
   }
 
+  // In a variable-length batch, masks out the scores of query/key pairs from
+  // different sequences. Masked scores get the lowest finite value rather
+  // than -inf: a KV tile may hold no key of a row's sequence at all, and
+  // exp2(-inf - -inf) would turn the running row statistics into NaNs.
+  // Whatever such a tile adds to a row is scaled away by
+  // exp2(lowest - max) = 0 once the row meets a key of its own sequence.
+  //
+  // The bounds of the sequence the last element belonged to are carried
+  // through the (unrolled) loop, and only looked up again when a row of
+  // another sequence comes up, so a tile that lies within one sequence
+  // never loads them in the KV loop.
+  void createVarlenMask(PatternRewriter &rewriter, Location loc,
+                        layout::GridCoordinates gridCoords,
+                        Value gemm0OutBuffer,
+                        RegsAsMatrixSubTiles gemm0OutSubTileViews,
+                        GridwiseAttentionAccelOp op,
+                        const VarlenTileRange &range) const {
+    MemRefType gemm0OutBufferType = gemm0OutBuffer.getType().cast<MemRefType>();
+    auto elemType = gemm0OutBufferType.getElementType().cast<FloatType>();
+    Value lowestTyped = rewriter.create<arith::ConstantOp>(
+        loc, rewriter.getFloatAttr(
+                 elemType, APFloat::getLargest(elemType.getFloatSemantics(),
+                                               /*Negative=*/true)));
+    auto tid = rewriter.create<WorkitemIdOp>(loc, rewriter.getIndexType());
+    int64_t elementsInThreadBuffer = gemm0OutBufferType.getNumElements();
+    Value zero = rewriter.createOrFold<ConstantIndexOp>(loc, 0);
+    auto loop = rewriter.create<TransformingForOp>(
+        loc,
+        ArrayRef<ValueRange>{{gridCoords.g_block, gridCoords.m_block,
+                              gridCoords.n_block, tid, zero},
+                             {zero, zero, zero, zero, zero}},
+        ArrayRef<Attribute>{gemm0OutSubTileViews.gridSubTile,
+                            rewriter.getArrayAttr({})},
+        /*bounds=*/ArrayRef<int64_t>{1, 1, 1, 1, elementsInThreadBuffer},
+        /*strides=*/ArrayRef<int64_t>{1, 1, 1, 1, 1},
+        /*useIndexDiffs=*/true, /*forceUnroll=*/true, range.firstSeqBounds);
+    {
+      OpBuilder::InsertionGuard guard(rewriter);
+      rewriter.setInsertionPointToStart(loop.getBody());
+
+      Block::BlockArgListType gqk = loop.getLowerCoords(0);
+      Block::BlockArgListType regCoords = loop.getLowerCoords(1);
+      Block::BlockArgListType seqBounds = loop.getIterArgs();
+      auto [outOfSeq, qSeqBounds] = createVarlenMaskOp(
+          rewriter, loc, op.getSeqOffsetsQ(), op.getSeqOffsetsK(), range,
+          seqBounds, gqk[1], gqk[2]);
+      // Padding is already -inf and is left alone.
+      Value isMasked =
+          rewriter.create<arith::AndIOp>(loc, loop.getValidity(0), outOfSeq);
+      scf::IfOp ifb = rewriter.create<scf::IfOp>(loc, isMasked,
+                                                 /*withElseRegion=*/false);
+      {
+        OpBuilder thenb = ifb.getThenBodyBuilder();
+        thenb.create<InBoundsStoreOp>(loc, lowestTyped, gemm0OutBuffer,
+                                      ValueRange{regCoords[4]});
+      }
+      rewriter.create<rock::YieldOp>(loc, qSeqBounds);
+    }
+  }
+
+  // Applies dropout to the (unnormalized) softmax probabilities held in
+  // `probBuffer`: every element is either zeroed or scaled by 1 / (1 - rate),
+  // depending on a Philox draw whose counter is the element's linear index in
+  // the unpadded [G, seqQ, seqK] probability matrix. Since the row sums
+  // have already been accumulated from the undropped values, the final
+  // normalization by those sums matches dropout applied after the softmax.
+  void createDropout(PatternRewriter &rewriter, Location loc,
+                     layout::GridCoordinates gridCoords, Value probBuffer,
+                     RegsAsMatrixSubTiles probSubTileViews, Value seed,
+                     Value offset, int64_t seqQ, int64_t seqK,
+                     double rate) const {
+    MemRefType probBufferType = probBuffer.getType().cast<MemRefType>();
+    Type elemType = probBufferType.getElementType();
+    auto tid = rewriter.create<WorkitemIdOp>(loc, rewriter.getIndexType());
+    int64_t elementsInThreadBuffer = probBufferType.getNumElements();
+    Value zero = rewriter.createOrFold<ConstantIndexOp>(loc, 0);
+    auto loop = rewriter.create<TransformingForOp>(
+        loc,
+        ArrayRef<ValueRange>{{gridCoords.g_block, gridCoords.m_block,
+                              gridCoords.n_block, tid, zero},
+                             {zero, zero, zero, zero, zero}},
+        ArrayRef<Attribute>{probSubTileViews.gridSubTile,
+                            rewriter.getArrayAttr({})},
+        /*bounds=*/ArrayRef<int64_t>{1, 1, 1, 1, elementsInThreadBuffer},
+        /*strides=*/ArrayRef<int64_t>{1, 1, 1, 1, 1},
+        /*useIndexDiffs=*/true, /*forceUnroll=*/true);
+    {
+      OpBuilder::InsertionGuard guard(rewriter);
+      rewriter.setInsertionPointToStart(loop.getBody());
+
+      Block::BlockArgListType gqk = loop.getLowerCoords(0);
+      Block::BlockArgListType regCoords = loop.getLowerCoords(1);
+      AffineExpr g, q, k;
+      bindDims(rewriter.getContext(), g, q, k);
+      Value linearIdx = rewriter.createOrFold<affine::AffineApplyOp>(
+          loc,
+          AffineMap::get(3, 0, (g * seqQ + q) * seqK + k,
+                         rewriter.getContext()),
+          ValueRange{gqk[0], gqk[1], gqk[2]});
+      Value prob = rewriter.create<InBoundsLoadOp>(
+          loc, elemType, probBuffer, ValueRange{regCoords[4]});
+      Value dropped = createDropoutOp(rewriter, loc, prob, seed, offset,
+                                      linearIdx, rate);
+      rewriter.create<InBoundsStoreOp>(loc, dropped, probBuffer,
+                                       ValueRange{regCoords[4]});
+    }
+  }
+
   template <typename ElementwiseOpType>
   void postProcessFirstGemmSplat(PatternRewriter &rewriter, Location loc,
                                  layout::GridCoordinates gridCoords,
@@ -1583,33 +1847,11 @@ struct GridwiseAttentionAccelRewritePattern
     Type elemTypeQ =
         op.getQueries().getType().cast<MemRefType>().getElementType();
     Type elemTypeK = op.getKeys().getType().cast<MemRefType>().getElementType();
-    StringRef arch = op.getArch();
-    RockAccelTuningParamAttrInterface gemm0TuningParams = op.getParams0();
-    auto accelEmitterPtrGemm0 = accel::AccelEmitter::select(
-        op.getFeatures(), elemTypeQ, elemTypeK, arch, gemm0TuningParams);
-    if (auto mfmaEmitter =
-            dyn_cast<accel::MfmaEmitter>(accelEmitterPtrGemm0.get())) {
-      if (!mfmaEmitter->isKReduction()) {
-        return false;
-      }
-      int64_t mWaves =
-          gemm0TuningParams.getMPerBlock() / gemm0TuningParams.getMPerWave();
-      if (mWaves != 1) {
-        return false;
-      }
-      // TODO: explore if this could be relaxed
-      // Right now, the way we load thins from
-      // LDS for the other operand distributes
-      // kPack set of values from K dim. Therefore
-      // to match with the MFMA output the Kpack
-      // has to match rowGroupSize if we are to
-      // avoid LDS for the current operand.
-      if (gemm0TuningParams.getKpack() != mfmaEmitter->getRowGroupSize()) {
-        return false;
-      }
-      return true;
-    }
-    return false;
+    Type elemTypeV =
+        op.getValues().getType().cast<MemRefType>().getElementType();
+    return accel::canBypassLDSForSecondGemm(op.getFeatures(), elemTypeQ,
+                                            elemTypeK, elemTypeV, op.getArch(),
+                                            op.getParams0(), op.getParams1());
   }
 
   /// check whether the op can bypass LDS when loading
@@ -1626,6 +1868,28 @@ struct GridwiseAttentionAccelRewritePattern
     return enableQLDSBypass && (gemm0K == gemm0KPerBlock);
   }
 
+  /// Check whether the KV loop can be software pipelined as requested by
+  /// the perf config. The stages of the pipeline have to be straight-line
+  /// code at the top level of the loop, so the K tile must be the whole head
+  /// dimension of Q (no loop over gemm0 K) and the V tile the whole head
+  /// dimension of the output (no loop over gemm1 M). The pipeliner also
+  /// needs a constant trip count of more than one tile.
+  bool canPipelineKVLoop(GridwiseAttentionAccelOp op) const {
+    if (!op.getPipelineKVLoop() || op.getSeqOffsetsQ())
+      return false;
+    int64_t gemm0K = op.getQueries().getType().getShape()[1];
+    int64_t gemm0M = op.getKeys().getType().getShape()[2];
+    // The output is read transposed, see transposeAttnOperand().
+    int64_t gemm1M = op.getOut().getType().getShape()[2];
+    RockAccelTuningParamAttrInterface gemm0TuningParams = op.getParams0();
+    RockAccelTuningParamAttrInterface gemm1TuningParams = op.getParams1();
+    int64_t gemm0KPerBlock =
+        gemm0TuningParams.getKpack() * gemm0TuningParams.getKpackPerBlock();
+    return gemm0K == gemm0KPerBlock &&
+           gemm1M == gemm1TuningParams.getMPerBlock() &&
+           gemm0M > gemm0TuningParams.getMPerBlock();
+  }
+
   TransformMapAttr getFlatToMiterMap(PatternRewriter &rewriter, int64_t gBlocks,
                                      int64_t mIterLen, int64_t nBlocks,
                                      int64_t blockSize,
@@ -1756,14 +2020,36 @@ struct GridwiseAttentionAccelRewritePattern
     Value ldsByteBufferQ = sharedBuffersGemmsB[0];
     Value ldsReductionWorkspaceByteBuffer = sharedBuffersGemmsB[1];
     Value gemm1LDSByteBufferB = sharedBuffersGemmsB[2];
-    auto [sharedBuffersGemmsA, ldsSizeA] = createSharedLDSByteBufferRefs(
-        rewriter, loc,
-        {gemm0KPerBlock * gemm0MPerBlock, gemm1KPerBlock * gemm1MPerBlock},
-        {elemTypeK, elemTypeV});
-    Value ldsByteBufferK = sharedBuffersGemmsA[0];
-    Value ldsByteBufferV = sharedBuffersGemmsA[1];
     const int64_t maxLdsSize =
         rock::lookupArchInfo(op.getArch()).maxSharedMemPerWG;
+    int64_t ldsByteBufferKSize =
+        gemm0KPerBlock * gemm0MPerBlock * getByteWidth(elemTypeK);
+    int64_t ldsByteBufferVSize =
+        gemm1KPerBlock * gemm1MPerBlock * getByteWidth(elemTypeV);
+    // The pipelined KV loop writes the K and the V tile in the same stage, so
+    // they can't share LDS. Each gets a raw allocation, which is also what
+    // RockPipeline needs to track and multibuffer them.
+    bool doPipelineKVLoop =
+        canPipelineKVLoop(op) &&
+        ldsSizeB + ldsByteBufferKSize + ldsByteBufferVSize <= maxLdsSize;
+    Value ldsByteBufferK, ldsByteBufferV;
+    int64_t ldsSizeA;
+    if (doPipelineKVLoop) {
+      LLVM_DEBUG(llvm::dbgs() << "rock.attention: pipelining the KV loop\n");
+      ldsByteBufferK = createLDSByteBuffer(
+          rewriter, loc, gemm0KPerBlock * gemm0MPerBlock, elemTypeK);
+      ldsByteBufferV = createLDSByteBuffer(
+          rewriter, loc, gemm1KPerBlock * gemm1MPerBlock, elemTypeV);
+      ldsSizeA = ldsByteBufferKSize + ldsByteBufferVSize;
+    } else {
+      SmallVector<Value> sharedBuffersGemmsA;
+      std::tie(sharedBuffersGemmsA, ldsSizeA) = createSharedLDSByteBufferRefs(
+          rewriter, loc,
+          {gemm0KPerBlock * gemm0MPerBlock, gemm1KPerBlock * gemm1MPerBlock},
+          {elemTypeK, elemTypeV});
+      ldsByteBufferK = sharedBuffersGemmsA[0];
+      ldsByteBufferV = sharedBuffersGemmsA[1];
+    }
     if (ldsSizeB + ldsSizeA > maxLdsSize) {
       return op.emitError() << "totalLDSSize (" << ldsSizeB + ldsSizeA
                             << ") exceeds " << maxLdsSize << "KB\n";
@@ -1936,23 +2222,139 @@ struct GridwiseAttentionAccelRewritePattern
       }
     }
 
+    // The dropout seed and offset are uniform across the kernel, so read
+    // them once ahead of the KV loop.
+    Value dropoutSeed, dropoutOffset;
+    if (op.getDropoutSeed()) {
+      Value seedIdx = rewriter.createOrFold<ConstantIndexOp>(loc, 0);
+      Value offsetIdx = rewriter.createOrFold<ConstantIndexOp>(loc, 1);
+      dropoutSeed = rewriter.create<memref::LoadOp>(loc, op.getDropoutSeed(),
+                                                    ValueRange{seedIdx});
+      dropoutOffset = rewriter.create<memref::LoadOp>(
+          loc, op.getDropoutSeed(), ValueRange{offsetIdx});
+    }
+
+    // In a variable-length batch, the KV loop of a query tile only visits
+    // the KV tiles that hold keys of the sequences the tile's rows are in.
+    bool isVarlen = static_cast<bool>(op.getSeqOffsetsQ());
+    std::optional<VarlenTileRange> varlenRange;
+    Value mIterationsGemm0Val =
+        rewriter.createOrFold<arith::ConstantIndexOp>(loc, gemm0MBlocks);
+    if (isVarlen) {
+      Value zero = rewriter.createOrFold<ConstantIndexOp>(loc, 0);
+      Value nBlock =
+          layout::makeGxNGridLayout(rewriter, loc, bid, zero, gemm0NBlocks)
+              .n_block;
+      int64_t seqLenQ = op.getPrePadG0N().has_value()
+                            ? op.getPrePadG0N()->getSExtValue()
+                            : gemm0N;
+      varlenRange = createVarlenTileRangeOps(
+          rewriter, loc, op.getSeqOffsetsQ(), op.getSeqOffsetsK(), nBlock,
+          gemm0NPerBlock, gemm0MPerBlock, seqLenQ);
+      mIterationsGemm0Val = rewriter.create<arith::SubIOp>(
+          loc, varlenRange->mEnd, varlenRange->mBegin);
+    }
+
     bool isReverseGrid = succeeded(rock::getReverseGrid(op));
-    affine::AffineForOp mLoopOp =
-        rewriter.create<affine::AffineForOp>(loc, 0, gemm0MBlocks, 1);
-    {
-      PatternRewriter::InsertionGuard guard(rewriter);
-      rewriter.setInsertionPointToStart(mLoopOp.getBody());
-      int64_t kIterationsGemm0 = gemm0K / gemm0KPerBlock;
-      Value kIterationsGemm0Val =
-          rewriter.createOrFold<arith::ConstantIndexOp>(loc, kIterationsGemm0);
-      Value mIterationsGemm0Val =
-          rewriter.createOrFold<arith::ConstantIndexOp>(loc, gemm0MBlocks);
-      Value mLoopIV = mLoopOp.getInductionVar();
+    Block *mLoopBody;
+    Value mLoopInductionVar;
+    if (doPipelineKVLoop) {
+      // The pipeliner only handles scf.for, and RockPipeline turns the
+      // stages below into a schedule with an initiation interval of 2.
+      Value zero = rewriter.createOrFold<ConstantIndexOp>(loc, 0);
+      Value one = rewriter.createOrFold<ConstantIndexOp>(loc, 1);
+      auto mLoopOp =
+          rewriter.create<scf::ForOp>(loc, zero, mIterationsGemm0Val, one);
+      mLoopOp->setAttr(PipelineAttr::getMnemonic(),
+                       rock::PipelineAttr::get(rewriter.getContext(), 2));
+      mLoopBody = mLoopOp.getBody();
+      mLoopInductionVar = mLoopOp.getInductionVar();
+    } else {
+      affine::AffineForOp mLoopOp;
+      if (isVarlen)
+        mLoopOp = rewriter.create<affine::AffineForOp>(
+            loc, /*lbOperands=*/ValueRange{}, rewriter.getConstantAffineMap(0),
+            /*ubOperands=*/ValueRange{mIterationsGemm0Val},
+            AffineMap::get(0, 1, rewriter.getAffineSymbolExpr(0)));
+      else
+        mLoopOp =
+            rewriter.create<affine::AffineForOp>(loc, 0, gemm0MBlocks, 1);
+      mLoopBody = mLoopOp.getBody();
+      mLoopInductionVar = mLoopOp.getInductionVar();
+    }
+    // The KV tile visited by the current iteration. A stage can't see values
+    // defined in another one, so each stage computes it for itself.
+    auto getKVTileIndex = [&]() -> Value {
+      Value mLoopIV = mLoopInductionVar;
       if (isReverseGrid) {
         AffineMap reverseMap = rock::getIdxReversalMap(rewriter);
         mLoopIV = rewriter.createOrFold<affine::AffineApplyOp>(
             loc, reverseMap, ValueRange{mLoopIV, mIterationsGemm0Val});
       }
+      if (isVarlen)
+        mLoopIV =
+            rewriter.create<arith::AddIOp>(loc, mLoopIV, varlenRange->mBegin);
+      return mLoopIV;
+    };
+    {
+      PatternRewriter::InsertionGuard guard(rewriter);
+      rewriter.setInsertionPointToStart(mLoopBody);
+      if (doPipelineKVLoop) {
+        // Read the K and V tiles of the iteration from global memory in one
+        // stage and write them to LDS in the next, so that the reads of the
+        // next tiles are issued before the GEMMs and softmax of the current
+        // ones. The barriers between the stages come from RockPipeline.
+        auto globalReadStage = rewriter.create<StageOp>(loc, "GlobalRead");
+        rewriter.setInsertionPointToStart(
+            &globalReadStage.getRegion().emplaceBlock());
+        rewriter.create<rock::YieldOp>(loc);
+        rewriter.setInsertionPointAfter(globalReadStage);
+        auto ldsWriteStage = rewriter.create<StageOp>(loc, "LDSWrite");
+        rewriter.setInsertionPointToStart(
+            &ldsWriteStage.getRegion().emplaceBlock());
+        Block *ldsWriteBlock = rewriter.getInsertionBlock();
+        rewriter.create<rock::YieldOp>(loc);
+
+        rewriter.setInsertionPoint(
+            globalReadStage.getRegion().front().getTerminator());
+        Value kvTile = getKVTileIndex();
+        Value zero = rewriter.createOrFold<ConstantIndexOp>(loc, 0);
+        layout::GridCoordinates gridCoordsGemm0 =
+            layout::makeGxNGridLayout(rewriter, loc, bid, kvTile, gemm0NBlocks);
+        LogicalResult statusLoadKTile = loadAndStoreGemmInputTile(
+            loc, inK, /*kIter=*/zero, gridCoordsGemm0, fromGlobalRegBufferK,
+            toLDSRegBufferK, ldsByteBufferK, "m", gemm0kpack,
+            gemm0KpacksPerBlock, gemm0MPerBlock, blockSize, gridSize,
+            bidGridOrder, gemm0BidGridLengths, forceUnroll, rewriter,
+            *accelEmitterPtrGemm0.get(), /*forceKPerThread=*/std::nullopt,
+            ldsWriteBlock);
+        if (failed(statusLoadKTile)) {
+          return failure();
+        }
+        layout::GridCoordinates gridCoordsGemm1 =
+            layout::makeGxNGridLayout(rewriter, loc, bid, zero, gemm1NBlocks);
+        LogicalResult statusLoadVTile = loadAndStoreGemmInputTile(
+            loc, inV, /*kIter=*/kvTile, gridCoordsGemm1, fromGlobalRegBufferV,
+            toLDSRegBufferV, ldsByteBufferV, "m", gemm1kpack,
+            gemm1KpacksPerBlock, gemm1MPerBlock, blockSize, gridSize,
+            bidGridOrder, gemm1BidGridLengths, forceUnroll, rewriter,
+            *accelEmitterPtrGemm1.get(), /*forceKPerThread=*/std::nullopt,
+            ldsWriteBlock);
+        if (failed(statusLoadVTile)) {
+          return failure();
+        }
+
+        // Everything else in the iteration is in the last stage.
+        rewriter.setInsertionPointAfter(ldsWriteStage);
+        auto computeStage = rewriter.create<StageOp>(loc, "Compute");
+        rewriter.setInsertionPointToStart(
+            &computeStage.getRegion().emplaceBlock());
+        rewriter.setInsertionPoint(rewriter.create<rock::YieldOp>(loc));
+      }
+      int64_t kIterationsGemm0 = gemm0K / gemm0KPerBlock;
+      Value kIterationsGemm0Val =
+          rewriter.createOrFold<arith::ConstantIndexOp>(loc, kIterationsGemm0);
+      Value mLoopIV = getKVTileIndex();
       zeroAccBuffer(rewriter, loc, accRegBufferGemm0);
       layout::GridCoordinates gridCoordsGemm0 =
           layout::makeGxNGridLayout(rewriter, loc, bid, mLoopIV, gemm0NBlocks);
@@ -1988,19 +2390,22 @@ struct GridwiseAttentionAccelRewritePattern
               viewBufferAs(rewriter, ldsByteBufferQ,
                            vectorTypeOrSelf(elemTypeQ, gemm0kpack));
         }
-        LogicalResult statusLoadKTile = loadAndStoreGemmInputTile(
-            loc, inK, kLoopIV, gridCoordsGemm0, fromGlobalRegBufferK,
-            toLDSRegBufferK, ldsByteBufferK, "m", gemm0kpack,
-            gemm0KpacksPerBlock, gemm0MPerBlock, blockSize, gridSize,
-            bidGridOrder, gemm0BidGridLengths, forceUnroll, rewriter,
-            *accelEmitterPtrGemm0.get());
-        if (failed(statusLoadKTile)) {
-          return failure();
+        // When pipelined, the K tile is already in LDS.
+        if (!doPipelineKVLoop) {
+          LogicalResult statusLoadKTile = loadAndStoreGemmInputTile(
+              loc, inK, kLoopIV, gridCoordsGemm0, fromGlobalRegBufferK,
+              toLDSRegBufferK, ldsByteBufferK, "m", gemm0kpack,
+              gemm0KpacksPerBlock, gemm0MPerBlock, blockSize, gridSize,
+              bidGridOrder, gemm0BidGridLengths, forceUnroll, rewriter,
+              *accelEmitterPtrGemm0.get());
+          if (failed(statusLoadKTile)) {
+            return failure();
+          }
+          // LDS barrier.
+          rewriter.create<LDSBarrierOp>(loc);
         }
         TypedValue<MemRefType> ldsTileBufferK = viewBufferAs(
             rewriter, ldsByteBufferK, vectorTypeOrSelf(elemTypeK, gemm0kpack));
-        // LDS barrier.
-        rewriter.create<LDSBarrierOp>(loc);
         // if gemm0K is equal to gemm0KPerBlock, the Q tile
         // is already prefetched into regs. See above.
         if (gemm0K != gemm0KPerBlock) {
@@ -2103,6 +2508,10 @@ struct GridwiseAttentionAccelRewritePattern
                                      gemm0OutBuffer,
                                      gemm0OutSubTileViewsTrUnPadded);
       }
+      if (isVarlen) {
+        createVarlenMask(rewriter, loc, gridCoordsGemm0, gemm0OutBuffer,
+                         gemm0OutSubTileViewsTrUnPadded, op, *varlenRange);
+      }
 
       APInt reductionAxis = APInt(64, 1);
       APInt nrDimPerThread = APInt(64, gemm0MPerBlock / gemm0MPerThread);
@@ -2155,6 +2564,13 @@ struct GridwiseAttentionAccelRewritePattern
                    gemm0MaxThreadwiseView, sumRowBuffer, maxRowBuffer,
                    expMaxDiffRowBuffer);
 
+      if (FloatAttr dropoutRate = op.getDropoutRateAttr()) {
+        createDropout(rewriter, loc, gridCoordsGemm0, gemm0OutBufferExp,
+                      gemm0OutSubTileViewsTrUnPadded, dropoutSeed,
+                      dropoutOffset, prePadG0N, prePadG0M,
+                      dropoutRate.getValueAsDouble());
+      }
+
       // Emit blockwise GEMM 1.
       {
         if (elemTypeV != elemTypeQxK) {
@@ -2211,21 +2627,32 @@ struct GridwiseAttentionAccelRewritePattern
           auto gridCoordsGemm1 = layout::makeGxNGridLayout(
               rewriter, loc, bid, g1MLoopIndVar, gemm1NBlocks);
 
-          LogicalResult statusLoadVTile = loadAndStoreGemmInputTile(
-              loc, inV,
-              /*kIter=*/mLoopIV, gridCoordsGemm1, fromGlobalRegBufferV,
-              toLDSRegBufferV, ldsByteBufferV, "m", gemm1kpack,
-              gemm1KpacksPerBlock, gemm1MPerBlock, blockSize, gridSize,
-              bidGridOrder, gemm1BidGridLengths, forceUnroll, rewriter,
-              *accelEmitterPtrGemm1.get());
-          if (failed(statusLoadVTile)) {
-            return failure();
+          // When pipelined, the V tile is already in LDS.
+          if (!doPipelineKVLoop) {
+            LogicalResult statusLoadVTile = loadAndStoreGemmInputTile(
+                loc, inV,
+                /*kIter=*/mLoopIV, gridCoordsGemm1, fromGlobalRegBufferV,
+                toLDSRegBufferV, ldsByteBufferV, "m", gemm1kpack,
+                gemm1KpacksPerBlock, gemm1MPerBlock, blockSize, gridSize,
+                bidGridOrder, gemm1BidGridLengths, forceUnroll, rewriter,
+                *accelEmitterPtrGemm1.get());
+            if (failed(statusLoadVTile)) {
+              return failure();
+            }
           }
-          TypedValue<MemRefType> ldsTileBufferV =
-              viewBufferAs(rewriter, ldsByteBufferV,
-                           vectorTypeOrSelf(elemTypeV, gemm1kpack));
-          // LDS barrier.
-          rewriter.create<LDSBarrierOp>(loc);
+          // Without the LDS for P, V is read in the runs of rows of P that
+          // each thread holds, which can be shorter than a kpack.
+          int64_t vLoadLen =
+              doBypassLDSSecondGemm
+                  ? cast<accel::MfmaEmitter>(accelEmitterPtrGemm1.get())
+                        ->getSplitKAcrossThreadsVectorLen()
+                  : gemm1kpack;
+          TypedValue<MemRefType> ldsTileBufferV = viewBufferAs(
+              rewriter, ldsByteBufferV, vectorTypeOrSelf(elemTypeV, vLoadLen));
+          // LDS barrier. Besides the V tile, it covers the store of the
+          // gemm0 output to LDS above.
+          if (!doPipelineKVLoop || !doBypassLDSSecondGemm)
+            rewriter.create<LDSBarrierOp>(loc);
           // Emit GEMM 1.
           Value wrappedLDSBufferForLoadA =
               accelEmitterPtrGemm1->wrapLDSBufferForLoad(
@@ -2441,17 +2868,30 @@ struct GridwiseGemmAccelRewritePattern
 
     int64_t kPerBlock = kpacksPerBlock * kpack;
 
+    // With producer waves, the workgroup starts with the waves of the MFMA
+    // layout, which only run the blockwise GEMM, and ends with the producer
+    // waves, which do all the copies from global memory to LDS.
+    int64_t producerWaves = 0;
+    if (auto xdlopsParams = dyn_cast<XdlopsGemmDerivedParamsAttr>(tuningParams))
+      producerWaves = xdlopsParams.getProducerWaves();
+    bool isWaveSpecialized = producerWaves > 0;
+    int64_t producerThreads = producerWaves * lookupArchInfo(arch).waveSize;
+    int64_t gemmBlockSize = blockSize - producerThreads;
+    int64_t copyBlockSize = isWaveSpecialized ? producerThreads : blockSize;
+    if (isWaveSpecialized && op.getWorkspace())
+      return op.emitOpError("producer waves can't be used with split-K");
+
     int64_t aVectorLen = 0;
     int64_t bVectorLen = 0;
     GemmDimension aVectorDim;
     GemmDimension bVectorDim;
 
-    if (!isValidBlockSize(blockSize, kPerBlock, mPerBlock, nPerBlock)) {
+    if (!isValidBlockSize(copyBlockSize, kPerBlock, mPerBlock, nPerBlock)) {
       return emitError(loc) << "Block size too large, rejecting as invalid.\n";
     }
 
-    int64_t aCopyPerThread = (kPerBlock * mPerBlock) / blockSize;
-    int64_t bCopyPerThread = (kPerBlock * nPerBlock) / blockSize;
+    int64_t aCopyPerThread = (kPerBlock * mPerBlock) / copyBlockSize;
+    int64_t bCopyPerThread = (kPerBlock * nPerBlock) / copyBlockSize;
 
     int64_t aCopyKpacksPerThread =
         math_util::integer_divide_ceil(aCopyPerThread, kpack);
@@ -2505,7 +2945,7 @@ struct GridwiseGemmAccelRewritePattern
     SmallVector<int64_t, 3> bidGridLengths = {G, mBlocks, nBlocks};
     SmallVector<StringRef, 3> bidGridOrder = {"g_block", "m_block", "n_block"};
     FailureOr<RegsAsMatrixSubTiles> maybeABufferViews = getLoadRegsAsTileViews(
-        b, loc, op.getA(), "m", bidGridOrder, bidGridLengths, blockSize,
+        b, loc, op.getA(), "m", bidGridOrder, bidGridLengths, copyBlockSize,
         kPerBlock, mPerBlock, aCopyKPerThread, copyMPerThread,
         aVectorDim == GemmDimension::K);
     if (failed(maybeABufferViews)) {
@@ -2513,7 +2953,7 @@ struct GridwiseGemmAccelRewritePattern
     }
     Value wrappedA = transform(b, op.getA(), maybeABufferViews->gridSubTile);
     FailureOr<RegsAsMatrixSubTiles> maybeBBufferViews = getLoadRegsAsTileViews(
-        b, loc, op.getB(), "n", bidGridOrder, bidGridLengths, blockSize,
+        b, loc, op.getB(), "n", bidGridOrder, bidGridLengths, copyBlockSize,
         kPerBlock, nPerBlock, bCopyKPerThread, copyNPerThread,
         bVectorDim == GemmDimension::K);
     if (failed(maybeBBufferViews)) {
@@ -2577,7 +3017,7 @@ struct GridwiseGemmAccelRewritePattern
     // such re-arranged register buffer
     FailureOr<RegsAsMatrixSubTiles> maybeALdsStoreViews =
         getPackedRegsAsTileViews(
-            b, loc, op.getA(), "m", bidGridOrder, bidGridLengths, blockSize,
+            b, loc, op.getA(), "m", bidGridOrder, bidGridLengths, copyBlockSize,
             kPerBlock, mPerBlock, aCopyKPerThread, copyMPerThread, kpack,
             isKContiguousDimA, doSwapThreadIterSubDimsForM);
     if (failed(maybeALdsStoreViews)) {
@@ -2594,7 +3034,7 @@ struct GridwiseGemmAccelRewritePattern
     // such re-arranged register buffer
     FailureOr<RegsAsMatrixSubTiles> maybeBLdsStoreViews =
         getPackedRegsAsTileViews(
-            b, loc, op.getB(), "n", bidGridOrder, bidGridLengths, blockSize,
+            b, loc, op.getB(), "n", bidGridOrder, bidGridLengths, copyBlockSize,
             kPerBlock, nPerBlock, bCopyKPerThread, copyNPerThread, kpack,
             isKContiguousDimB, doSwapThreadIterSubDimsForN);
     if (failed(maybeBLdsStoreViews)) {
@@ -2651,7 +3091,10 @@ struct GridwiseGemmAccelRewritePattern
         kpacksPerBlock * nPerBlock * kpack * getByteWidth(elementTypeB);
     LLVM_DEBUG(llvm::dbgs() << "LDS block sizes (bytes): " << ldsBlockASize
                             << " " << ldsBlockBSize << "\n");
-    if (failed(checkLDSSize(op, ldsBlockASize, ldsBlockBSize)))
+    // Producer waves fill one tile while the MFMA waves read the other.
+    int64_t numLdsTiles = isWaveSpecialized ? 2 : 1;
+    if (failed(checkLDSSize(op, numLdsTiles * ldsBlockASize,
+                            numLdsTiles * ldsBlockBSize)))
       return op.emitOpError("requires too much LDS");
 
     // Allocate LDS.
@@ -2660,36 +3103,58 @@ struct GridwiseGemmAccelRewritePattern
     auto ldsMemRefAType =
         MemRefType::get({ldsBlockASize}, b.getI8Type(), AffineMap{},
                         workgroupMemoryAddressSpace);
-    auto ldsByteBufferA = b.create<GpuAllocOp>(loc, ldsMemRefAType);
     auto ldsMemRefBType =
         MemRefType::get({ldsBlockBSize}, b.getI8Type(), AffineMap{},
                         workgroupMemoryAddressSpace);
-    auto ldsByteBufferB = b.create<GpuAllocOp>(loc, ldsMemRefBType);
-
     Type ldsReadTypeA = vectorTypeOrSelf(elementTypeA, kpack);
-    FailureOr<Value> maybeWrappedLdsA = wrapLDSBufferForStore(
-        b, loc, ldsByteBufferA, ldsReadTypeA, kpacksPerBlock, "m", mPerBlock,
-        aCopyKPerThread, copyMPerThread, rotateMWithK);
-    if (failed(maybeWrappedLdsA))
-      return maybeWrappedLdsA;
-    // This is KxD view of the flat LDS buffer
-    Value wrappedLdsA = std::move(*maybeWrappedLdsA);
-    // This will produce a (tid, iter) --> flat LDS view
-    wrappedLdsA = transform(b, wrappedLdsA, maybeALdsStoreViews->blockSubTile);
-
     Type ldsReadTypeB = vectorTypeOrSelf(elementTypeB, kpack);
-    FailureOr<Value> maybeWrappedLdsB = wrapLDSBufferForStore(
-        b, loc, ldsByteBufferB, ldsReadTypeB, kpacksPerBlock, "n", nPerBlock,
-        bCopyKPerThread, copyNPerThread, rotateNWithK);
-    if (failed(maybeWrappedLdsB))
-      return maybeWrappedLdsB;
-    // This is KxD view of the flat LDS buffer
-    Value wrappedLdsB = std::move(*maybeWrappedLdsB);
-    // This will produce a (tid, iter) --> flat LDS view
-    wrappedLdsB = transform(b, wrappedLdsB, maybeBLdsStoreViews->blockSubTile);
 
-    Value ldsViewForGemmA = viewBufferAs(b, ldsByteBufferA, ldsReadTypeA);
-    Value ldsViewForGemmB = viewBufferAs(b, ldsByteBufferB, ldsReadTypeB);
+    // The (tid, iter) views the copies store through and the views the
+    // blockwise GEMM reads from, for one LDS tile of A and B.
+    struct LdsTile {
+      Value storeA, storeB, gemmA, gemmB;
+    };
+    auto allocLdsTile = [&]() -> FailureOr<LdsTile> {
+      auto ldsByteBufferA = b.create<GpuAllocOp>(loc, ldsMemRefAType);
+      auto ldsByteBufferB = b.create<GpuAllocOp>(loc, ldsMemRefBType);
+
+      FailureOr<Value> maybeWrappedLdsA = wrapLDSBufferForStore(
+          b, loc, ldsByteBufferA, ldsReadTypeA, kpacksPerBlock, "m", mPerBlock,
+          aCopyKPerThread, copyMPerThread, rotateMWithK);
+      if (failed(maybeWrappedLdsA))
+        return failure();
+      // This is KxD view of the flat LDS buffer
+      Value wrappedLdsA = std::move(*maybeWrappedLdsA);
+      // This will produce a (tid, iter) --> flat LDS view
+      wrappedLdsA =
+          transform(b, wrappedLdsA, maybeALdsStoreViews->blockSubTile);
+
+      FailureOr<Value> maybeWrappedLdsB = wrapLDSBufferForStore(
+          b, loc, ldsByteBufferB, ldsReadTypeB, kpacksPerBlock, "n", nPerBlock,
+          bCopyKPerThread, copyNPerThread, rotateNWithK);
+      if (failed(maybeWrappedLdsB))
+        return failure();
+      // This is KxD view of the flat LDS buffer
+      Value wrappedLdsB = std::move(*maybeWrappedLdsB);
+      // This will produce a (tid, iter) --> flat LDS view
+      wrappedLdsB =
+          transform(b, wrappedLdsB, maybeBLdsStoreViews->blockSubTile);
+
+      return LdsTile{wrappedLdsA, wrappedLdsB,
+                     viewBufferAs(b, ldsByteBufferA, ldsReadTypeA),
+                     viewBufferAs(b, ldsByteBufferB, ldsReadTypeB)};
+    };
+    SmallVector<LdsTile, 2> ldsTiles;
+    for (int64_t i = 0; i < numLdsTiles; ++i) {
+      FailureOr<LdsTile> maybeTile = allocLdsTile();
+      if (failed(maybeTile))
+        return failure();
+      ldsTiles.push_back(*maybeTile);
+    }
+    Value wrappedLdsA = ldsTiles[0].storeA;
+    Value wrappedLdsB = ldsTiles[0].storeB;
+    Value ldsViewForGemmA = ldsTiles[0].gemmA;
+    Value ldsViewForGemmB = ldsTiles[0].gemmB;
     int64_t nOutputVectors = nResultVectors * mRepeats * nRepeats;
 
     // Logic to setup buffers for blockwise_gemm_accel.
@@ -2708,14 +3173,125 @@ struct GridwiseGemmAccelRewritePattern
     Value step = b.create<ConstantIndexOp>(loc, 1);
     BlockwiseGemmAccelOp blockwiseGemmAccelOp;
 
-    auto loopOp = b.create<scf::ForOp>(loc, zeroConstantOp, nIterations, step);
-    loopOp->setAttr(PipelineAttr::getMnemonic(),
-                    rock::PipelineAttr::get(b.getContext(), 2));
-    {
+    // Pipelining replaces the loop, so the schedule goes on the function.
+    if (int64_t schedHint = getSchedHint(tuningParams))
+      op->getParentOfType<func::FuncOp>()->setAttr(
+          "rock.sched_hint", b.getI64IntegerAttr(schedHint));
+    bool isReverseGrid = succeeded(rock::getReverseGrid(op));
+    Value isProducer;
+    if (isWaveSpecialized) {
+      // Producer waves copy tile i + 1 into one LDS buffer while the MFMA
+      // waves run the GEMM on tile i out of the other one. A workgroup
+      // barrier after every tile hands the buffers over, and the loop is
+      // unrolled by two so that the buffer each role uses stays static.
+      Value consumerThreads = b.create<ConstantIndexOp>(loc, gemmBlockSize);
+      isProducer = b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::uge,
+                                           tid, consumerThreads);
+      Value copyTid = b.create<arith::SubIOp>(loc, tid, consumerThreads);
+      int64_t numTiles = K / kPerBlock;
+
+      auto emitCopy = [&](Value tile, const LdsTile &dest) {
+        Value kIter = tile;
+        if (isReverseGrid) {
+          AffineMap reverseMap = rock::getIdxReversalMap(b);
+          kIter = b.createOrFold<affine::AffineApplyOp>(
+              loc, reverseMap, ValueRange{tile, nIterations});
+        }
+        b.create<ThreadwiseReadIntoOp>(
+            loc, wrappedA, loadBufferA, /*extraViews=*/b.getArrayAttr({}),
+            /*extraIndices=*/
+            ValueRange{kIter, gridCoords.g_block, gridCoords.m_block,
+                       gridCoords.n_block, copyTid},
+            true, true);
+        b.create<ThreadwiseReadIntoOp>(
+            loc, wrappedB, loadBufferB, /*extraViews=*/b.getArrayAttr({}),
+            /*extraIndices=*/
+            ValueRange{kIter, gridCoords.g_block, gridCoords.m_block,
+                       gridCoords.n_block, copyTid},
+            true, true);
+        b.create<ThreadwiseCopyOp>(loc, viewLoadBufferA, ValueRange{},
+                                   viewStoreBufferA, ValueRange{}, false,
+                                   false);
+        b.create<ThreadwiseCopyOp>(loc, viewLoadBufferB, ValueRange{},
+                                   viewStoreBufferB, ValueRange{}, false,
+                                   false);
+        b.create<ThreadwiseWriteAllOp>(loc, storeBufferA, dest.storeA,
+                                       /*extraViews=*/b.getArrayAttr({}),
+                                       /*extraIndices=*/ValueRange{copyTid},
+                                       op.getFeatures(), StoreMethod::Set,
+                                       /*forceUnroll=*/forceUnroll,
+                                       /*useIndexDiffs=*/true);
+        b.create<ThreadwiseWriteAllOp>(loc, storeBufferB, dest.storeB,
+                                       /*extraViews=*/b.getArrayAttr({}),
+                                       /*extraIndices=*/ValueRange{copyTid},
+                                       op.getFeatures(), StoreMethod::Set,
+                                       /*forceUnroll=*/forceUnroll,
+                                       /*useIndexDiffs=*/true);
+      };
+      auto emitGemm = [&](const LdsTile &src) {
+        blockwiseGemmAccelOp = b.create<BlockwiseGemmAccelOp>(
+            loc, src.gemmA, src.gemmB, b.getI32IntegerAttr(copyMPerThread),
+            b.getI32IntegerAttr(copyNPerThread),
+            (rotateMWithK ? b.getUnitAttr() : nullptr),
+            (rotateNWithK ? b.getUnitAttr() : nullptr), arrayA, arrayB,
+            regCAllocOp, op.getArchAttr(), op.getFeaturesAttr(),
+            b.getI32IntegerAttr(gemmBlockSize), op.getParamsAttr());
+      };
+      // Runs the GEMM on `tile` out of `cur` while the next tile, if there
+      // is one, is copied into `next`.
+      auto emitStep = [&](Value tile, const LdsTile &cur, const LdsTile &next,
+                          bool hasNext) {
+        auto roleIf = b.create<scf::IfOp>(loc, isProducer,
+                                          /*withElseRegion=*/true);
+        {
+          PatternRewriter::InsertionGuard guard(b);
+          b.setInsertionPointToStart(roleIf.thenBlock());
+          if (hasNext) {
+            Value nextTile = b.create<arith::AddIOp>(loc, tile, step);
+            emitCopy(nextTile, next);
+          }
+          b.setInsertionPointToStart(roleIf.elseBlock());
+          emitGemm(cur);
+        }
+        b.create<LDSBarrierOp>(loc);
+      };
+
+      auto prologue = b.create<scf::IfOp>(loc, isProducer,
+                                          /*withElseRegion=*/false);
+      {
+        PatternRewriter::InsertionGuard guard(b);
+        b.setInsertionPointToStart(prologue.thenBlock());
+        emitCopy(zeroConstantOp, ldsTiles[0]);
+      }
+      b.create<LDSBarrierOp>(loc);
+
+      // Tile t lives in LDS tile t % 2. The loop covers the pairs of tiles
+      // that both have a successor to copy, the rest are peeled.
+      int64_t numPairs = (numTiles - 1) / 2;
+      if (numPairs > 0) {
+        Value two = b.create<ConstantIndexOp>(loc, 2);
+        Value pairsEnd = b.create<ConstantIndexOp>(loc, 2 * numPairs);
+        auto loopOp = b.create<scf::ForOp>(loc, zeroConstantOp, pairsEnd, two);
+        PatternRewriter::InsertionGuard guard(b);
+        b.setInsertionPointToStart(loopOp.getBody());
+        Value tile = loopOp.getInductionVar();
+        emitStep(tile, ldsTiles[0], ldsTiles[1], /*hasNext=*/true);
+        Value oddTile = b.create<arith::AddIOp>(loc, tile, step);
+        emitStep(oddTile, ldsTiles[1], ldsTiles[0], /*hasNext=*/true);
+      }
+      for (int64_t t = 2 * numPairs; t < numTiles; ++t) {
+        Value tile = b.create<ConstantIndexOp>(loc, t);
+        emitStep(tile, ldsTiles[t % 2], ldsTiles[(t + 1) % 2],
+                 /*hasNext=*/t + 1 < numTiles);
+      }
+    } else {
+      auto loopOp =
+          b.create<scf::ForOp>(loc, zeroConstantOp, nIterations, step);
+      loopOp->setAttr(PipelineAttr::getMnemonic(),
+                      rock::PipelineAttr::get(b.getContext(), 2));
       PatternRewriter::InsertionGuard guard(b);
       b.setInsertionPointToStart(loopOp.getBody());
       Value iv = loopOp.getInductionVar();
-      bool isReverseGrid = succeeded(rock::getReverseGrid(op));
       // Purpose of reversing the grid is to exploit
       // (if any) temporal locality between producers
       // and consumers of data between kernels.
@@ -2784,26 +3360,47 @@ struct GridwiseGemmAccelRewritePattern
             (rotateMWithK ? b.getUnitAttr() : nullptr),
             (rotateNWithK ? b.getUnitAttr() : nullptr), arrayA, arrayB,
             regCAllocOp, op.getArchAttr(), op.getFeaturesAttr(),
-            op.getBlockSizeAttr(), op.getParamsAttr());
+            b.getI32IntegerAttr(gemmBlockSize), op.getParamsAttr());
         b.create<rock::YieldOp>(loc);
       }
     }
 
     // Matrix C write out logic.
-    Value convertedC = gpuAlloc(b, loc, numOutputVectorElements, destType,
-                                AddressSpace::Private);
-
+    // Only the MFMA waves hold results.
+    if (isWaveSpecialized) {
+      auto consumerIf = b.create<scf::IfOp>(loc, isProducer,
+                                            /*withElseRegion=*/true);
+      b.setInsertionPointToStart(consumerIf.elseBlock());
+    }
     ArrayAttr idToMatrixCMaps =
         accelEmitterPtr
-            ->computeOutputTransforms(b, loc, M, N, blockSize, bidGridLengths,
+            ->computeOutputTransforms(b, loc, M, N, gemmBlockSize,
+                                      bidGridLengths,
                                       copyMPerThread, copyNPerThread,
                                       doSwapThreadIterSubDimsForM,
                                       doSwapThreadIterSubDimsForN)
             .gridSubTile;
 
+    if (op.getWorkspace()) {
+      // Split-K partial results are stored and added up in the accumulator
+      // type, so only flatten the accumulator vectors here.
+      Value accC =
+          gpuAlloc(b, loc, numOutputVectorElements,
+                   accVectorType.getElementType(), AddressSpace::Private);
+      accelEmitterPtr->computeOutputConversion(b, loc, regCAllocOp, accC,
+                                               forceUnroll);
+      emitSplitKReduction(b, loc, op, accC, idToMatrixCMaps,
+                          gridCoords.g_block, gridCoords.m_block,
+                          gridCoords.n_block, tid, mBlocks, nBlocks,
+                          forceUnroll, useIndexDiffs);
+      b.eraseOp(op);
+      return success();
+    }
+
+    Value convertedC = gpuAlloc(b, loc, numOutputVectorElements, destType,
+                                AddressSpace::Private);
     accelEmitterPtr->computeOutputConversion(b, loc, regCAllocOp, convertedC,
                                              forceUnroll);
-
     b.create<ThreadwiseWriteAllOp>(
         loc, convertedC, op.getC(), idToMatrixCMaps,
         /*extraIndices=*/
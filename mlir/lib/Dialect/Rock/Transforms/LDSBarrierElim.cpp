@@ -0,0 +1,211 @@
+//===- LDSBarrierElim.cpp - Remove redundant LDS barriers ----------------===//
+//
+// Part of the rocMLIR Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The gridwise and blockwise lowerings put a `rock.lds_barrier` around every
+// phase that may touch LDS, without knowing what the neighbouring phases do.
+// Some of these barriers end up ordering nothing: two barriers with no LDS
+// access between them, or phases on either side of a barrier that use
+// different buffers. Each barrier stalls every wave of the workgroup, so this
+// pass removes the ones whose surrounding accesses can't conflict.
+//
+// For a barrier, the accesses that may run after the previous workgroup
+// barrier and before it, and those between it and the next workgroup barrier,
+// are collected as the set of workgroup buffers they read or write, walking
+// out of nested regions and around loop back edges. If no buffer is written
+// on one side and accessed on the other, the barrier is dropped. Barriers are
+// visited in order and each decision sees the barriers removed before it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
+#include "mlir/Dialect/Rock/utility/loweringUtils.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/Interfaces/LoopLikeInterface.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "llvm/Support/Debug.h"
+
+namespace mlir {
+namespace rock {
+#define GEN_PASS_DEF_ROCKLDSBARRIERELIMPASS
+#include "mlir/Dialect/Rock/Passes.h.inc"
+} // namespace rock
+} // namespace mlir
+
+#define DEBUG_TYPE "rock-lds-barrier-elim"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+namespace {
+struct RockLDSBarrierElimPass
+    : public rock::impl::RockLDSBarrierElimPassBase<RockLDSBarrierElimPass> {
+  using rock::impl::RockLDSBarrierElimPassBase<
+      RockLDSBarrierElimPass>::RockLDSBarrierElimPassBase;
+  void runOnOperation() override;
+};
+
+enum AccessKind : uint8_t { Read = 1, Write = 2 };
+
+/// The workgroup buffers a stretch of code may access, and how. Accesses
+/// through a buffer whose allocation can't be found are recorded under a
+/// null allocation, which overlaps every buffer.
+struct Footprint {
+  DenseMap<Operation *, uint8_t> accesses;
+
+  void add(Operation *alloc, uint8_t kind) { accesses[alloc] |= kind; }
+
+  /// Whether an access on one side may race with one on the other.
+  bool conflictsWith(const Footprint &other) const {
+    for (auto [allocA, kindA] : accesses)
+      for (auto [allocB, kindB] : other.accesses)
+        if ((allocA == allocB || !allocA || !allocB) &&
+            ((kindA | kindB) & AccessKind::Write))
+          return true;
+    return false;
+  }
+};
+} // end namespace
+
+static bool isBarrier(Operation *op) {
+  return isa<LDSBarrierOp, WorkgroupBarrierOp, gpu::BarrierOp,
+             amdgpu::LDSBarrierOp>(op);
+}
+
+static bool isWorkgroupMemRef(Value value) {
+  auto type = dyn_cast<MemRefType>(value.getType());
+  if (!type)
+    return false;
+  auto memSpace =
+      type.getMemorySpace().dyn_cast_or_null<gpu::AddressSpaceAttr>();
+  return memSpace &&
+         memSpace.getValue() == gpu::GPUDialect::getWorkgroupAddressSpace();
+}
+
+/// Records the accesses `op` itself makes to workgroup buffers. An operand
+/// the op doesn't declare an effect on is taken to be read and written.
+static void addAccesses(Operation *op, Footprint &footprint) {
+  if (isMemoryEffectFree(op))
+    return;
+  for (Value operand : op->getOperands()) {
+    if (!isWorkgroupMemRef(operand))
+      continue;
+    uint8_t kind = 0;
+    if (hasEffect<MemoryEffects::Read>(op, operand))
+      kind |= AccessKind::Read;
+    if (hasEffect<MemoryEffects::Write>(op, operand))
+      kind |= AccessKind::Write;
+    if (!kind)
+      kind = AccessKind::Read | AccessKind::Write;
+    FailureOr<GpuAllocOp> alloc = findGpuAlloc(operand);
+    footprint.add(succeeded(alloc) ? alloc->getOperation() : nullptr, kind);
+  }
+}
+
+/// Adds the accesses of the ops from `from` up to, but not including, `to`
+/// (or the end of the block if `to` is null), walking forward or backward
+/// through the block. Returns true if a workgroup barrier stopped the walk.
+static bool scan(Operation *from, Operation *to, bool forward,
+                 Footprint &footprint) {
+  for (Operation *op = from; op && op != to;
+       op = forward ? op->getNextNode() : op->getPrevNode()) {
+    if (isBarrier(op))
+      return true;
+    op->walk([&](Operation *nested) { addAccesses(nested, footprint); });
+  }
+  return false;
+}
+
+/// Collects the accesses that may run between `barrier` and the next (or,
+/// if `forward` is unset, the previous) workgroup barrier. A barrier nested in
+/// an op doesn't stop the walk, since the op may not run it.
+static void collectWindow(Operation *barrier, bool forward,
+                          Footprint &footprint) {
+  Operation *op = barrier;
+  while (true) {
+    Operation *start = forward ? op->getNextNode() : op->getPrevNode();
+    if (start && scan(start, /*to=*/nullptr, forward, footprint))
+      return;
+    Block *block = op->getBlock();
+    Operation *parent = block->getParentOp();
+    if (isa<func::FuncOp>(parent))
+      return;
+    if (isa<scf::ForOp, affine::AffineForOp>(parent)) {
+      // The window continues into the neighbouring iteration, up to and
+      // including the op holding the barrier, unless that is the barrier.
+      // This may be the last (or first) iteration, so the window also goes on
+      // past the loop whether or not the wrap-around meets a barrier.
+      Operation *wrapStart = forward ? &block->front() : &block->back();
+      Operation *wrapEnd = op;
+      if (op != barrier)
+        wrapEnd = forward ? op->getNextNode() : op->getPrevNode();
+      scan(wrapStart, wrapEnd, forward, footprint);
+    } else if (isa<LoopLikeOpInterface>(parent)) {
+      // Other loops may run their regions in any order.
+      footprint.add(nullptr, AccessKind::Read | AccessKind::Write);
+      return;
+    }
+    op = parent;
+  }
+}
+
+void RockLDSBarrierElimPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  if (!func->hasAttr("kernel"))
+    return;
+
+  SmallVector<LDSBarrierOp> barriers;
+  func.walk([&](LDSBarrierOp barrier) { barriers.push_back(barrier); });
+
+  int64_t removed = 0;
+  SmallVector<LDSBarrierOp> kept;
+  for (LDSBarrierOp barrier : barriers) {
+    Footprint before, after;
+    collectWindow(barrier, /*forward=*/false, before);
+    collectWindow(barrier, /*forward=*/true, after);
+    if (before.conflictsWith(after)) {
+      kept.push_back(barrier);
+      continue;
+    }
+    LLVM_DEBUG(llvm::dbgs() << "Removing barrier at " << barrier.getLoc()
+                            << "\n");
+    barrier.erase();
+    ++removed;
+  }
+
+  // The LDS accesses of a single wave complete in order, so its barriers
+  // only need to stop the compiler from reordering them.
+  int64_t downgraded = 0;
+  auto blockSize = func->getAttrOfType<IntegerAttr>("block_size");
+  FailureOr<StringAttr> arch = getArch(func);
+  if (blockSize && succeeded(arch) &&
+      blockSize.getInt() <= lookupArchInfo(*arch).waveSize) {
+    for (LDSBarrierOp barrier : kept) {
+      OpBuilder b(barrier);
+      b.create<WaveBarrierOp>(barrier.getLoc());
+      barrier.erase();
+      ++downgraded;
+    }
+  }
+
+  numRemoved += removed;
+  numDowngraded += downgraded;
+  LLVM_DEBUG(llvm::dbgs() << func.getName() << ": removed " << removed
+                          << " and downgraded " << downgraded << " of "
+                          << barriers.size() << " LDS barriers\n");
+  if (emitRemarks)
+    func.emitRemark() << "removed " << removed << " and downgraded "
+                      << downgraded << " of " << barriers.size()
+                      << " LDS barriers";
+}
@@ -0,0 +1,335 @@
+//===- PlanLDS.cpp - pack workgroup allocations into one LDS arena -------===//
+//
+// Part of the rocMLIR Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// Copyright (c) 2024 Advanced Micro Devices INc.
+//===----------------------------------------------------------------------===//
+//
+// Every workgroup-space `rock.alloc` becomes its own LDS attribution when
+// lowered to the GPU dialect, so a kernel's LDS footprint is the sum of all
+// of its buffers, even when some of them are never live at the same time
+// (the LDS tiles of a GEMM and the workspace of its reduction epilogue, or
+// the buffers of two GEMMs in an attention kernel).
+//
+// This pass computes a live range for each workgroup buffer and assigns every
+// buffer an offset into one shared byte arena, such that two buffers only
+// overlap if one is dead before the other is first touched and a workgroup
+// barrier separates the two. The original allocations are replaced by
+// `memref.view`s into the arena, whose size is the peak LDS usage of the
+// kernel and is recorded as `rock.lds_bytes` on the kernel.
+//
+// Live ranges are spans of operations in the buffer's scope: the body of the
+// innermost `scf.for` that contains every access to the buffer, or the
+// kernel's body. A buffer is only scoped to a loop body if the first access
+// to it in that body writes it, that is, if it holds no data from one
+// iteration to the next; Rock kernels fill an LDS buffer completely before
+// reading it. Only barriers directly in a scope separate live ranges, since
+// barriers nested in a conditional or an inner loop may not run, and in a
+// loop body a barrier is also needed between the later buffer and the next
+// iteration's use of the earlier one.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/Passes.h"
+
+#include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/utility/builderUtils.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "llvm/Support/Debug.h"
+
+#include <limits>
+
+namespace mlir {
+namespace rock {
+#define GEN_PASS_DEF_ROCKPLANLDSPASS
+#include "mlir/Dialect/Rock/Passes.h.inc"
+} // namespace rock
+} // namespace mlir
+
+#define DEBUG_TYPE "rock-plan-lds"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+namespace {
+struct RockPlanLDSPass final
+    : public rock::impl::RockPlanLDSPassBase<RockPlanLDSPass> {
+  void runOnOperation() final;
+};
+
+/// A workgroup buffer, the span of operations [start, end] in its scope during
+/// which it is live, and the byte offset it was assigned in the arena.
+struct LDSBuffer {
+  GpuAllocOp alloc;
+  int64_t sizeBytes;
+  Block *scope;
+  int64_t start;
+  int64_t end;
+  int64_t offset = -1;
+};
+
+/// The position of each operation in a scope, and the number of barriers
+/// directly in the scope before each position.
+struct ScopeInfo {
+  DenseMap<Operation *, int64_t> index;
+  SmallVector<int64_t> barriersBefore;
+};
+} // end namespace
+
+// Matches the alignment RockToGPU gives to each LDS attribution.
+static constexpr int64_t kLDSAlignment = 64;
+
+static bool isWorkgroupAlloc(GpuAllocOp alloc) {
+  auto memSpace = alloc.getOutput()
+                      .getType()
+                      .getMemorySpace()
+                      .dyn_cast_or_null<gpu::AddressSpaceAttr>();
+  return memSpace &&
+         memSpace.getValue() == gpu::GPUDialect::getWorkgroupAddressSpace();
+}
+
+// Wave barriers only replace LDS barriers in single-wave workgroups, where
+// they order the whole workgroup.
+static bool isBarrier(Operation *op) {
+  return isa<LDSBarrierOp, WaveBarrierOp, WorkgroupBarrierOp, gpu::BarrierOp,
+             amdgpu::LDSBarrierOp>(op);
+}
+
+/// Returns true if `op` writes `buffer` and doesn't read it.
+static bool onlyWrites(Operation *op, Value buffer) {
+  auto iface = dyn_cast<MemoryEffectOpInterface>(op);
+  if (!iface)
+    return false;
+  SmallVector<MemoryEffects::EffectInstance> effects;
+  iface.getEffectsOnValue(buffer, effects);
+  return !effects.empty() &&
+         llvm::all_of(effects, [](const MemoryEffects::EffectInstance &e) {
+           return isa<MemoryEffects::Write>(e.getEffect());
+         });
+}
+
+/// Returns the scope enclosing `block`: the body of the closest enclosing
+/// `scf.for`, or the kernel's `body`.
+static Block *getParentScope(Block *block, Block &body) {
+  do {
+    block = block->getParentOp()->getBlock();
+  } while (block != &body && !isa<scf::ForOp>(block->getParentOp()));
+  return block;
+}
+
+/// Returns the innermost scope that contains `scope` and `other`.
+static Block *getCommonScope(Block *scope, Block *other, Block &body) {
+  while (scope != &body && scope != other &&
+         !scope->findAncestorOpInBlock(*other->getParentOp()))
+    scope = getParentScope(scope, body);
+  return scope;
+}
+
+static const ScopeInfo &getScopeInfo(Block *scope,
+                                     DenseMap<Block *, ScopeInfo> &infos) {
+  auto [it, inserted] = infos.try_emplace(scope);
+  ScopeInfo &info = it->second;
+  if (inserted) {
+    info.barriersBefore.push_back(0);
+    for (auto [idx, op] : llvm::enumerate(*scope)) {
+      info.index[&op] = idx;
+      info.barriersBefore.push_back(info.barriersBefore.back() +
+                                    (isBarrier(&op) ? 1 : 0));
+    }
+  }
+  return info;
+}
+
+/// Finds the scope and live range of `alloc`, following the buffer through
+/// every op that returns a memref derived from it. Ops without memory effects
+/// only create views and don't count as accesses.
+static LDSBuffer analyzeBuffer(GpuAllocOp alloc, int64_t sizeBytes,
+                               Block &body,
+                               DenseMap<Block *, ScopeInfo> &infos) {
+  SmallVector<std::pair<Operation *, Value>> accesses;
+  SmallVector<Value> worklist = {alloc.getOutput()};
+  DenseSet<Value> visited;
+  while (!worklist.empty()) {
+    Value buffer = worklist.pop_back_val();
+    if (!visited.insert(buffer).second)
+      continue;
+    for (Operation *user : buffer.getUsers()) {
+      if (!isMemoryEffectFree(user))
+        accesses.push_back({user, buffer});
+      for (Value result : user->getResults())
+        if (isa<MemRefType>(result.getType()))
+          worklist.push_back(result);
+    }
+  }
+  if (accesses.empty()) {
+    int64_t idx = getScopeInfo(&body, infos).index.lookup(
+        body.findAncestorOpInBlock(*alloc));
+    return {alloc, sizeBytes, &body, idx, idx};
+  }
+
+  Block *scope = accesses.front().first->getBlock();
+  for (auto [op, buffer] : accesses)
+    while (!scope->findAncestorOpInBlock(*op))
+      scope = scope->getParentOp()->getBlock();
+  if (scope != &body && !isa<scf::ForOp>(scope->getParentOp()))
+    scope = getParentScope(scope, body);
+
+  while (true) {
+    const ScopeInfo &info = getScopeInfo(scope, infos);
+    int64_t start = std::numeric_limits<int64_t>::max();
+    int64_t end = std::numeric_limits<int64_t>::min();
+    for (auto [op, buffer] : accesses) {
+      int64_t idx = info.index.lookup(scope->findAncestorOpInBlock(*op));
+      start = std::min(start, idx);
+      end = std::max(end, idx);
+    }
+    if (scope == &body)
+      return {alloc, sizeBytes, scope, start, end};
+    // In a loop body, the buffer must be overwritten before it's read in each
+    // iteration, otherwise it's live around the back edge.
+    bool writtenFirst = llvm::all_of(accesses, [&](auto access) {
+      auto [op, buffer] = access;
+      Operation *ancestor = scope->findAncestorOpInBlock(*op);
+      return info.index.lookup(ancestor) != start ||
+             (ancestor == op && onlyWrites(op, buffer));
+    });
+    if (writtenFirst)
+      return {alloc, sizeBytes, scope, start, end};
+    scope = getParentScope(scope, body);
+  }
+}
+
+void RockPlanLDSPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  if (!func->hasAttr("kernel") || !func.getBody().hasOneBlock())
+    return;
+  Block &body = func.getBody().front();
+
+  DenseMap<Block *, ScopeInfo> infos;
+  SmallVector<LDSBuffer> buffers;
+  int64_t totalBytes = 0;
+  WalkResult walkRes = func.walk([&](GpuAllocOp alloc) {
+    if (!isWorkgroupAlloc(alloc))
+      return WalkResult::advance();
+    MemRefType type = alloc.getOutput().getType();
+    if (!type.hasStaticShape() || !type.getLayout().isIdentity())
+      return WalkResult::interrupt();
+    int64_t sizeBytes =
+        type.getNumElements() * getByteWidth(type.getElementType());
+    buffers.push_back(analyzeBuffer(alloc, sizeBytes, body, infos));
+    totalBytes += llvm::alignTo(sizeBytes, kLDSAlignment);
+    return WalkResult::advance();
+  });
+  if (walkRes.wasInterrupted()) {
+    LLVM_DEBUG(llvm::dbgs() << "Found an LDS buffer that can't be placed in an "
+                               "arena, leaving allocations as they are\n");
+    return;
+  }
+  if (buffers.size() < 2)
+    return;
+
+  // `a` can share memory with a later `b` if a barrier runs after the last
+  // access to `a` and before the first access to `b`, in the innermost scope
+  // containing both. A buffer scoped to a loop nested in that scope is live
+  // for the whole loop.
+  auto separated = [&](const LDSBuffer &a, const LDSBuffer &b) {
+    Block *scope = getCommonScope(a.scope, b.scope, body);
+    const ScopeInfo &info = getScopeInfo(scope, infos);
+    auto getRange = [&](const LDSBuffer &buf) -> std::pair<int64_t, int64_t> {
+      if (buf.scope == scope)
+        return {buf.start, buf.end};
+      int64_t idx = info.index.lookup(
+          scope->findAncestorOpInBlock(*buf.scope->getParentOp()));
+      return {idx, idx};
+    };
+    auto [aStart, aEnd] = getRange(a);
+    auto [bStart, bEnd] = getRange(b);
+    auto barriersIn = [&](int64_t from, int64_t to) {
+      return info.barriersBefore[to] - info.barriersBefore[from];
+    };
+    if (aEnd >= bStart || barriersIn(aEnd + 1, bStart) == 0)
+      return false;
+    // In a loop body, `b` is followed by the next iteration's `a`.
+    int64_t numOps = info.barriersBefore.size() - 1;
+    return scope == &body ||
+           barriersIn(bEnd + 1, numOps) + barriersIn(0, aStart) > 0;
+  };
+  auto interferes = [&](const LDSBuffer &a, const LDSBuffer &b) {
+    return !separated(a, b) && !separated(b, a);
+  };
+
+  // Place the largest buffers first, each at the lowest aligned offset that
+  // doesn't overlap a buffer it interferes with.
+  SmallVector<LDSBuffer *> order =
+      llvm::map_to_vector(buffers, [](LDSBuffer &buf) { return &buf; });
+  llvm::stable_sort(order, [](const LDSBuffer *a, const LDSBuffer *b) {
+    return a->sizeBytes > b->sizeBytes;
+  });
+  int64_t arenaBytes = 0;
+  SmallVector<LDSBuffer *> placed;
+  for (LDSBuffer *buf : order) {
+    SmallVector<LDSBuffer *> conflicts;
+    for (LDSBuffer *other : placed)
+      if (interferes(*buf, *other))
+        conflicts.push_back(other);
+    llvm::sort(conflicts, [](const LDSBuffer *a, const LDSBuffer *b) {
+      return a->offset < b->offset;
+    });
+    int64_t offset = 0;
+    for (LDSBuffer *other : conflicts) {
+      if (offset + buf->sizeBytes <= other->offset)
+        break;
+      int64_t otherEnd = llvm::alignTo(other->offset + other->sizeBytes,
+                                       kLDSAlignment);
+      offset = std::max(offset, otherEnd);
+    }
+    buf->offset = offset;
+    arenaBytes = std::max(arenaBytes, offset + buf->sizeBytes);
+    placed.push_back(buf);
+  }
+  arenaBytes = llvm::alignTo(arenaBytes, kLDSAlignment);
+
+  LLVM_DEBUG({
+    llvm::dbgs() << "LDS plan for " << func.getName() << ": " << arenaBytes
+                 << " bytes instead of " << totalBytes << "\n";
+    for (const LDSBuffer &buf : buffers)
+      llvm::dbgs() << "  [" << buf.offset << ", "
+                   << buf.offset + buf.sizeBytes << ") live over ["
+                   << buf.start << ", " << buf.end << "]"
+                   << (buf.scope == &body ? "" : " of a loop body") << ": "
+                   << buf.alloc
+                   << "\n";
+  });
+  // Keep separate allocations when nothing can be reused, so as not to hide
+  // the fact that the buffers don't alias from LLVM for no benefit.
+  if (arenaBytes >= totalBytes)
+    return;
+
+  OpBuilder b(&getContext());
+  b.setInsertionPointToStart(&body);
+  auto arenaType = MemRefType::get(
+      {arenaBytes}, b.getI8Type(), AffineMap{},
+      b.getAttr<gpu::AddressSpaceAttr>(
+          gpu::GPUDialect::getWorkgroupAddressSpace()));
+  Value arena = b.create<GpuAllocOp>(func.getLoc(), arenaType);
+  for (LDSBuffer &buf : buffers) {
+    b.setInsertionPoint(buf.alloc);
+    Location loc = buf.alloc.getLoc();
+    Value offset = b.createOrFold<arith::ConstantIndexOp>(loc, buf.offset);
+    Value view = b.create<memref::ViewOp>(loc, buf.alloc.getOutput().getType(),
+                                          arena, offset,
+                                          /*dynamic dim sizes=*/ValueRange{});
+    buf.alloc.getOutput().replaceAllUsesWith(view);
+    buf.alloc.erase();
+  }
+  func->setAttr("rock.lds_bytes", b.getI64IntegerAttr(arenaBytes));
+}
@@ -0,0 +1,336 @@
+//===- SchedHints.cpp - Scheduling directives for GEMM mainloops ---------===//
+//
+// Part of the rocMLIR Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The mainloop of a GEMM reaches the backend as a straight run of global
+// loads, LDS reads and writes and MFMA or WMMA instructions, which the AMDGPU
+// scheduler orders by its own latency model. It tends to cluster the memory
+// operations ahead of the matrix ones, leaving the matrix core idle while
+// they issue. This pass counts the instructions of one iteration of the
+// mainloop and, depending on the kernel's tuning parameters, either asks the
+// backend for an explicit interleaving of them through sched_group_barrier
+// directives or selects one of its built-in iglp_opt strategies.
+//
+// The backend schedules each run of instructions between two barriers on its
+// own, so the interleaving is worked out for every such region of the
+// mainloop. Mainloops whose matrix instructions aren't straight-line code
+// once the loops marked for unrolling are unrolled (because they sit in a
+// conditional or in a loop that stays rolled) are left alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
+#include "mlir/Dialect/Affine/Analysis/LoopAnalysis.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
+#include "mlir/IR/Builders.h"
+#include "llvm/ADT/TypeSwitch.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+
+namespace mlir {
+namespace rock {
+#define GEN_PASS_DEF_ROCKSCHEDHINTSPASS
+#include "mlir/Dialect/Rock/Passes.h.inc"
+} // namespace rock
+} // namespace mlir
+
+#define DEBUG_TYPE "rock-sched-hints"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+namespace {
+/// The values of the `schedHint` tuning parameter.
+enum class SchedHint : int64_t {
+  None = 0,
+  Interleave = 1,
+  IglpOpt0 = 2,
+  IglpOpt1 = 3
+};
+
+/// Instruction kinds of the sched_group_barrier mask.
+constexpr uint32_t kMatrixMask = 0x8;
+constexpr uint32_t kVmemReadMask = 0x20;
+constexpr uint32_t kVmemWriteMask = 0x40;
+constexpr uint32_t kDsReadMask = 0x100;
+constexpr uint32_t kDsWriteMask = 0x200;
+
+/// The widest DS and buffer accesses move 16 bytes.
+constexpr int64_t kMaxAccessBytes = 16;
+
+struct InstructionCounts {
+  int64_t matrix = 0;
+  int64_t dsRead = 0;
+  int64_t dsWrite = 0;
+  int64_t vmemRead = 0;
+  int64_t vmemWrite = 0;
+};
+
+struct RockSchedHintsPass
+    : public rock::impl::RockSchedHintsPassBase<RockSchedHintsPass> {
+  void runOnOperation() override;
+};
+} // end namespace
+
+static bool isWorkgroupMemRef(Value buffer) {
+  auto memSpace = cast<MemRefType>(buffer.getType())
+                      .getMemorySpace()
+                      .dyn_cast_or_null<gpu::AddressSpaceAttr>();
+  return memSpace &&
+         memSpace.getValue() == gpu::GPUDialect::getWorkgroupAddressSpace();
+}
+
+/// The number of memory instructions needed to move `numElements` values of
+/// `elemType`.
+static int64_t getNumAccesses(Type elemType, int64_t numElements) {
+  int64_t bytes =
+      llvm::divideCeil(elemType.getIntOrFloatBitWidth() * numElements, 8);
+  return std::max<int64_t>(1, llvm::divideCeil(bytes, kMaxAccessBytes));
+}
+
+static int64_t getNumAccesses(Type type) {
+  if (auto vecType = dyn_cast<VectorType>(type))
+    return getNumAccesses(vecType.getElementType(), vecType.getNumElements());
+  return getNumAccesses(type, 1);
+}
+
+/// How many times the body of `op` runs, if `op` is a loop with constant
+/// bounds, and 1 otherwise.
+static int64_t getTripCount(Operation *op) {
+  return TypeSwitch<Operation *, int64_t>(op)
+      .Case([](affine::AffineForOp loop) {
+        return affine::getConstantTripCount(loop).value_or(1);
+      })
+      .Case([](scf::ForOp loop) -> int64_t {
+        std::optional<int64_t> lb = getConstantIntValue(loop.getLowerBound());
+        std::optional<int64_t> ub = getConstantIntValue(loop.getUpperBound());
+        std::optional<int64_t> step = getConstantIntValue(loop.getStep());
+        if (!lb || !ub || !step || *step <= 0 || *ub <= *lb)
+          return 1;
+        return llvm::divideCeil(*ub - *lb, *step);
+      })
+      .Case([](TransformingForOp loop) {
+        int64_t count = 1;
+        for (auto [bound, stride] :
+             llvm::zip(loop.getBounds().getAsRange<IntegerAttr>(),
+                       loop.getStrides().getAsRange<IntegerAttr>()))
+          count *= llvm::divideCeil(bound.getInt(), stride.getInt());
+        return count;
+      })
+      .Default([](Operation *) { return 1; });
+}
+
+static bool isMatrixOp(Operation *op) {
+  return isa<amdgpu::MFMAOp, amdgpu::WMMAOp>(op);
+}
+
+static bool isBarrier(Operation *op) {
+  return isa<LDSBarrierOp, WorkgroupBarrierOp, gpu::BarrierOp,
+             amdgpu::LDSBarrierOp>(op);
+}
+
+/// Whether the body of `op` ends up inline with the ops around it by the
+/// time the backend schedules the mainloop: `op` is a loop marked for
+/// unrolling or a pipeline stage.
+static bool isInlinedRegion(Operation *op) {
+  if (auto loop = dyn_cast<affine::AffineForOp>(op))
+    return loop->hasAttr("forceUnroll");
+  if (auto loop = dyn_cast<TransformingForOp>(op))
+    return loop.getForceUnroll();
+  return isa<StageOp>(op);
+}
+
+/// Adds the instructions `op` executes, `multiplier` times, to `counts`.
+/// Fails if `op` holds matrix instructions or barriers that won't be
+/// straight-line code in the region being counted.
+static LogicalResult countInstructions(Operation &op, int64_t multiplier,
+                                       InstructionCounts &counts) {
+  TypeSwitch<Operation *>(&op)
+      .Case<amdgpu::MFMAOp, amdgpu::WMMAOp>(
+          [&](auto) { counts.matrix += multiplier; })
+      .Case([&](GlobalLoadOp load) {
+        counts.vmemRead += multiplier * getNumAccesses(load.getType());
+      })
+      .Case([&](GlobalStoreOp store) {
+        counts.vmemWrite +=
+            multiplier *
+            getNumAccesses(store.getSource().getType().getElementType(),
+                           store.getLength().getSExtValue());
+      })
+      .Case<InBoundsLoadOp, memref::LoadOp>([&](auto load) {
+        if (isWorkgroupMemRef(load->getOperand(0)))
+          counts.dsRead += multiplier * getNumAccesses(load.getType());
+      })
+      .Case<InBoundsStoreOp, memref::StoreOp>([&](auto store) {
+        if (isWorkgroupMemRef(store->getOperand(1)))
+          counts.dsWrite +=
+              multiplier * getNumAccesses(store->getOperand(0).getType());
+      });
+  if (op.getNumRegions() == 0)
+    return success();
+
+  // The body of a loop that stays rolled, or of a conditional, ends up in
+  // other basic blocks than the ops around it, so it can't hold matrix
+  // instructions or barriers. The memory operations of rolled loops are left
+  // out, while those of conditionals are counted, as the conditionals that
+  // guard loads and stores mostly fold away.
+  if (!isInlinedRegion(&op)) {
+    WalkResult result = op.walk([](Operation *inner) {
+      return isMatrixOp(inner) || isBarrier(inner) ? WalkResult::interrupt()
+                                                   : WalkResult::advance();
+    });
+    if (result.wasInterrupted())
+      return failure();
+    if (!isa<scf::IfOp>(op))
+      return success();
+  }
+  int64_t innerMultiplier = multiplier * getTripCount(&op);
+  for (Region &region : op.getRegions())
+    for (Block &inner : region)
+      for (Operation &innerOp : inner) {
+        if (isBarrier(&innerOp))
+          return failure();
+        if (failed(countInstructions(innerOp, innerMultiplier, counts)))
+          return failure();
+      }
+  return success();
+}
+
+/// Whether `loop` is a mainloop: it runs matrix instructions, and none of
+/// them is inside a loop nested in it that would be a mainloop instead.
+static bool isMainloop(scf::ForOp loop) {
+  bool hasMatrixOps = false;
+  WalkResult result = loop.getBody()->walk([&](Operation *op) {
+    if (!isMatrixOp(op))
+      return WalkResult::advance();
+    if (op->getParentOfType<scf::ForOp>() != loop)
+      return WalkResult::interrupt();
+    hasMatrixOps = true;
+    return WalkResult::advance();
+  });
+  return hasMatrixOps && !result.wasInterrupted();
+}
+
+using RegionCounts = SmallVector<std::pair<InstructionCounts, Operation *>>;
+
+/// Splits the instructions of `block` at its barriers, looking into pipeline
+/// stages, adding them to `counts` and closing a region in `regions` at every
+/// barrier.
+static LogicalResult countRegionInstructions(Block &block,
+                                             InstructionCounts &counts,
+                                             RegionCounts &regions) {
+  for (Operation &op : block.without_terminator()) {
+    if (isBarrier(&op)) {
+      regions.emplace_back(counts, &op);
+      counts = InstructionCounts();
+    } else if (auto stage = dyn_cast<StageOp>(op)) {
+      if (failed(countRegionInstructions(stage.getRegion().front(), counts,
+                                         regions)))
+        return failure();
+    } else if (failed(countInstructions(op, /*multiplier=*/1, counts))) {
+      return failure();
+    }
+  }
+  return success();
+}
+
+/// The instructions of each region of the body of `loop` that the backend
+/// schedules on its own, that is, between two barriers, along with the op
+/// that ends the region. Fails if the matrix instructions of `loop` aren't
+/// straight-line code.
+static FailureOr<RegionCounts> countRegionInstructions(scf::ForOp loop) {
+  RegionCounts regions;
+  InstructionCounts counts;
+  if (failed(countRegionInstructions(*loop.getBody(), counts, regions)))
+    return failure();
+  regions.emplace_back(counts, loop.getBody()->getTerminator());
+  return regions;
+}
+
+/// Splits `total` operations among `numSlots` as evenly as possible and
+/// returns the share of slot `i`. The extra operations go to the early slots
+/// if `frontLoad` is set and to the late ones otherwise.
+static int64_t getShare(int64_t total, int64_t numSlots, int64_t i,
+                        bool frontLoad) {
+  if (frontLoad)
+    return llvm::divideCeil(total * (i + 1), numSlots) -
+           llvm::divideCeil(total * i, numSlots);
+  return total * (i + 1) / numSlots - total * i / numSlots;
+}
+
+/// Asks for each matrix instruction to be preceded by its share of the
+/// memory operations. The DS reads come first, since the matrix
+/// instructions of the iteration wait for them, and the DS writes last,
+/// since they wait for the global loads of the previous iteration.
+static void emitInterleaving(OpBuilder &b, Location loc,
+                             const InstructionCounts &counts) {
+  auto group = [&](uint32_t mask, int64_t size) {
+    if (size > 0)
+      b.create<SchedGroupBarrierOp>(loc, mask, static_cast<uint32_t>(size),
+                                    /*syncId=*/0);
+  };
+  int64_t numSlots = counts.matrix;
+  for (int64_t i = 0; i < numSlots; ++i) {
+    group(kDsReadMask, getShare(counts.dsRead, numSlots, i, true));
+    group(kVmemReadMask, getShare(counts.vmemRead, numSlots, i, false));
+    group(kDsWriteMask, getShare(counts.dsWrite, numSlots, i, false));
+    group(kMatrixMask, 1);
+  }
+  group(kVmemWriteMask, counts.vmemWrite);
+}
+
+void RockSchedHintsPass::runOnOperation() {
+  func::FuncOp func = getOperation();
+  auto hintAttr = func->getAttrOfType<IntegerAttr>("rock.sched_hint");
+  if (!hintAttr)
+    return;
+  auto hint = static_cast<SchedHint>(hintAttr.getInt());
+  if (hint == SchedHint::None)
+    return;
+  if (hint != SchedHint::Interleave && hint != SchedHint::IglpOpt0 &&
+      hint != SchedHint::IglpOpt1) {
+    func.emitError("unknown scheduling hint ") << hintAttr.getInt();
+    return signalPassFailure();
+  }
+
+  func.walk([&](scf::ForOp loop) {
+    if (!isMainloop(loop))
+      return;
+    Location loc = loop.getLoc();
+    FailureOr<RegionCounts> regions = countRegionInstructions(loop);
+    if (failed(regions)) {
+      LLVM_DEBUG(llvm::dbgs() << "Mainloop at " << loc
+                              << " isn't straight-line code, no hints\n");
+      return;
+    }
+    OpBuilder b(loop.getContext());
+    if (hint != SchedHint::Interleave) {
+      b.setInsertionPointToStart(loop.getBody());
+      b.create<IglpOptOp>(loc, hint == SchedHint::IglpOpt0 ? 0 : 1);
+      return;
+    }
+    for (auto [counts, end] : *regions) {
+      LLVM_DEBUG(llvm::dbgs()
+                 << "Mainloop region at " << loc << ": " << counts.matrix
+                 << " matrix, " << counts.dsRead << " DS read, "
+                 << counts.dsWrite << " DS write, " << counts.vmemRead
+                 << " VMEM read, " << counts.vmemWrite << " VMEM write\n");
+      // Without matrix instructions there is nothing to interleave with.
+      if (counts.matrix == 0)
+        continue;
+      b.setInsertionPoint(end);
+      emitInterleaving(b, loc, counts);
+    }
+  });
+}
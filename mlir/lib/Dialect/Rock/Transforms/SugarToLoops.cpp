@@ -18,10 +18,12 @@
 #include "mlir/Dialect/Rock/IR/Rock.h"
 #include "mlir/Dialect/Rock/IR/RockTypes.h"
 #include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Dialect/Rock/utility/builderUtils.h"
 #include "mlir/Dialect/Rock/utility/loweringUtils.h"
 #include "mlir/Dialect/Rock/utility/transformMapUtils.h"
 
+#include "mlir/Analysis/SliceAnalysis.h"
 #include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Affine/LoopUtils.h"
@@ -1430,6 +1432,146 @@ struct InBoundsStoreRewritePattern : public OpRewritePattern<InBoundsStoreOp> {
   }
 };
 
+//===----------------------------------------------------------------------===//
+// Register-pressure-aware unrolling.
+//===----------------------------------------------------------------------===//
+
+static int64_t getNumDwords(Type type) {
+  Type elemType = getElementTypeOrSelf(type);
+  if (!elemType.isIntOrFloat())
+    return 1;
+  int64_t numElems = 1;
+  if (auto shaped = dyn_cast<ShapedType>(type))
+    numElems = shaped.getNumElements();
+  return llvm::divideCeil(numElems * elemType.getIntOrFloatBitWidth(), 32);
+}
+
+static bool isPrivateMemRef(Value buffer) {
+  auto memSpace = cast<MemRefType>(buffer.getType())
+                      .getMemorySpace()
+                      .dyn_cast_or_null<gpu::AddressSpaceAttr>();
+  return memSpace &&
+         memSpace.getValue() == gpu::GPUDialect::getPrivateAddressSpace();
+}
+
+/// Returns the VGPRs per lane left over once the register tiles (the private
+/// allocations) of `func` are placed, or std::nullopt if the target isn't
+/// known.
+static std::optional<int64_t> getFreeVGPRs(func::FuncOp func) {
+  FailureOr<StringAttr> arch = rock::getArch(func);
+  if (failed(arch))
+    return std::nullopt;
+  AmdArchInfo archInfo = rock::lookupArchInfo(arch->getValue());
+  int64_t budget = archInfo.maxLoadVGPRPerLane;
+  func.walk([&](GpuAllocOp alloc) {
+    MemRefType type = alloc.getOutput().getType();
+    if (isPrivateMemRef(alloc.getOutput()) && type.hasStaticShape())
+      budget -= getNumDwords(type);
+  });
+  return budget;
+}
+
+/// The backend hoists the loads of an unrolled loop above their uses, so every
+/// value one iteration loads from global or LDS memory is live at once across
+/// the unrolled body.
+static int64_t getLoadedDwordsPerIteration(affine::AffineForOp loop) {
+  int64_t dwords = 0;
+  loop.getBody()->walk([&](Operation *op) {
+    Value source;
+    if (auto load = dyn_cast<amdgpu::RawBufferLoadOp>(op))
+      source = load.getMemref();
+    else if (auto load = dyn_cast<vector::LoadOp>(op))
+      source = load.getBase();
+    else if (auto load = dyn_cast<memref::LoadOp>(op))
+      source = load.getMemref();
+    else
+      return;
+    if (!isPrivateMemRef(source))
+      dwords += getNumDwords(op->getResult(0).getType());
+  });
+  return dwords;
+}
+
+/// Whether `loop`'s induction variable feeds the indices of a register tile.
+/// Such a loop has to be fully unrolled, as indexing private memory
+/// dynamically sends the whole tile to scratch.
+static bool indexesRegisters(affine::AffineForOp loop) {
+  SetVector<Operation *> slice;
+  getForwardSlice(loop.getInductionVar(), &slice);
+  return llvm::any_of(slice, [](Operation *op) {
+    if (auto load = dyn_cast<memref::LoadOp>(op))
+      return isPrivateMemRef(load.getMemref());
+    if (auto store = dyn_cast<memref::StoreOp>(op))
+      return isPrivateMemRef(store.getMemref());
+    if (auto load = dyn_cast<vector::LoadOp>(op))
+      return isPrivateMemRef(load.getBase());
+    if (auto store = dyn_cast<vector::StoreOp>(op))
+      return isPrivateMemRef(store.getBase());
+    return false;
+  });
+}
+
+/// Collects the loops marked for unrolling that are perfectly nested under
+/// `outer`, outermost first.
+static SmallVector<affine::AffineForOp>
+getUnrollNest(affine::AffineForOp outer) {
+  SmallVector<affine::AffineForOp> nest{outer};
+  while (true) {
+    auto inner = nest.back().getBody()->getOps<affine::AffineForOp>();
+    if (!llvm::hasSingleElement(inner) ||
+        !(*inner.begin())->hasAttr("forceUnroll"))
+      break;
+    nest.push_back(*inner.begin());
+  }
+  return nest;
+}
+
+/// Unrolls `nest` from the innermost loop outwards for as long as the values
+/// loaded by the unrolled body fit in `freeVGPRs`. The first loop that doesn't
+/// fit is unrolled by the largest factor of its trip count that does, and the
+/// loops around it stay rolled. Loops that index registers are always fully
+/// unrolled, even around a loop that stays rolled.
+static LogicalResult unrollNest(ArrayRef<affine::AffineForOp> nest,
+                                std::optional<int64_t> freeVGPRs) {
+  int64_t dwordsPerIter = getLoadedDwordsPerIteration(nest.back());
+  int64_t unrolledIters = 1;
+  bool rolled = false;
+  for (affine::AffineForOp loop : llvm::reverse(nest)) {
+    loop->removeAttr("forceUnroll");
+    std::optional<uint64_t> tripCount = affine::getConstantTripCount(loop);
+    int64_t trips = tripCount.value_or(1);
+    if (indexesRegisters(loop)) {
+      unrolledIters *= trips;
+      if (failed(affine::loopUnrollFull(loop)))
+        return failure();
+      continue;
+    }
+    if (rolled)
+      continue;
+    bool fits = !freeVGPRs || dwordsPerIter == 0 ||
+                unrolledIters * trips * dwordsPerIter <= *freeVGPRs;
+    if (fits || !tripCount) {
+      unrolledIters *= trips;
+      if (failed(affine::loopUnrollFull(loop)))
+        return failure();
+      continue;
+    }
+    int64_t factor = trips - 1;
+    while (factor > 1 &&
+           (trips % factor != 0 ||
+            unrolledIters * factor * dwordsPerIter > *freeVGPRs))
+      --factor;
+    LLVM_DEBUG(llvm::dbgs()
+               << "Unrolling by " << factor << " instead of " << trips
+               << ": " << dwordsPerIter << " loaded VGPRs per iteration, "
+               << *freeVGPRs << " free\n");
+    if (factor > 1 && failed(affine::loopUnrollByFactor(loop, factor)))
+      return failure();
+    rolled = true;
+  }
+  return success();
+}
+
 void RockSugarToLoopsPass::runOnOperation() {
   MLIRContext *ctx = &getContext();
   func::FuncOp op = getOperation();
@@ -1473,6 +1615,20 @@ void RockSugarToLoopsPass::runOnOperation() {
   // 1) You can't use loop unrolling from within a pattern rewriter
   // 2) If we make it a seperate pass, canonicizers might remove the
   // forceUnroll attribute we've used
+  std::optional<int64_t> freeVGPRs = getFreeVGPRs(op);
+  SmallVector<SmallVector<affine::AffineForOp>> nests;
+  op.walk<WalkOrder::PreOrder>([&](affine::AffineForOp loop) {
+    if (!loop->hasAttr("forceUnroll"))
+      return WalkResult::advance();
+    nests.push_back(getUnrollNest(loop));
+    return WalkResult::skip();
+  });
+  for (ArrayRef<affine::AffineForOp> nest : nests)
+    if (failed(unrollNest(nest, freeVGPRs)))
+      return signalPassFailure();
+
+  // Loops that weren't in the nests above (because they sit under a loop
+  // that stays rolled, for example) still get fully unrolled.
   WalkResult unrollResult =
       op.walk<WalkOrder::PostOrder>([](affine::AffineForOp loop) -> WalkResult {
         Attribute forceUnrollAttr = loop->getAttr("forceUnroll");
@@ -24,11 +24,14 @@
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/ROCDLDialect.h"
 #include "mlir/Dialect/Rock/IR/Rock.h"
 #include "mlir/Dialect/Rock/IR/RockTypes.h"
 #include "mlir/Dialect/Rock/IR/TransformMapBuilder.h"
 #include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Dialect/Rock/utility/builderUtils.h"
+#include "mlir/Dialect/Rock/utility/loweringUtils.h"
 #include "mlir/Dialect/Rock/utility/math.h"
 #include "mlir/Dialect/Rock/utility/transformMapUtils.h"
 
@@ -92,6 +95,40 @@ struct ThreadwiseReadIntoRewritePattern
 //===----------------------------------------------------------------------===//
 // ThreadwiseGemm lowering.
 //===----------------------------------------------------------------------===//
+/// Emit the packed dot product `c + sum(a[i] * b[i])` for the vectors `a` and
+/// `b`, whose lengths match the dot product width of the target.
+static Value emitDotProduct(OpBuilder &b, Location loc, const AmdArchInfo &info,
+                            Value a, Value bVal, Value c) {
+  Type elementType = a.getType().cast<VectorType>().getElementType();
+  Type accType = c.getType();
+  Value clamp = b.create<arith::ConstantIntOp>(loc, false, b.getI1Type());
+  if (elementType.isF16())
+    return b.create<ROCDL::fdot2>(loc, accType, ValueRange{a, bVal, c, clamp});
+  if (elementType.isBF16())
+    return b.create<ROCDL::fdot2_f32_bf16>(loc, accType,
+                                          ValueRange{a, bVal, c, clamp});
+
+  // The integer dot products take their inputs packed into an i32.
+  assert(elementType.isInteger(8) && "unexpected dot product input type");
+  auto packedType = VectorType::get(1, b.getI32Type());
+  Value zero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  auto pack = [&](Value v) -> Value {
+    Value packed = b.create<vector::BitCastOp>(loc, packedType, v);
+    return b.create<vector::ExtractElementOp>(loc, packed, zero);
+  };
+  Value aPacked = pack(a), bPacked = pack(bVal);
+  // RDNA3 replaced the signed dot product with one that takes the signedness
+  // of each input as an immediate.
+  if (bitEnumContainsAll(info.defaultFeatures, GemmFeatures::wmma)) {
+    Value isSigned = b.create<arith::ConstantIntOp>(loc, true, b.getI1Type());
+    return b.create<ROCDL::sudot4>(
+        loc, accType,
+        ValueRange{isSigned, aPacked, isSigned, bPacked, c, clamp});
+  }
+  return b.create<ROCDL::sdot4>(loc, accType,
+                                ValueRange{aPacked, bPacked, c, clamp});
+}
+
 struct ThreadwiseGemmRewritePattern
     : public OpConversionPattern<ThreadwiseGemmOp> {
   using OpConversionPattern<ThreadwiseGemmOp>::OpConversionPattern;
@@ -105,15 +142,27 @@ struct ThreadwiseGemmRewritePattern
     Value gemmC = adaptor.getMatrixC();
     auto gemmAType = gemmA.getType().cast<MemRefType>();
     Type dataType = gemmAType.getElementType();
+    Type accType = gemmC.getType().cast<MemRefType>().getElementType();
 
     ArrayRef<int64_t> aShape = gemmAType.getShape();
     int64_t k = aShape[0];
     int64_t m = aShape[1];
     int64_t kPack = aShape[2];
     int64_t n = gemmB.getType().cast<MemRefType>().getShape()[1];
-    // Note for future: when we use dot products, we should increase this to
-    // the number of elements supported by the relevant dot product.
+    // Inputs narrower than the accumulator are left that way for the dot
+    // product instructions, which consume this many of them at once.
     int64_t loadKpackLen = 1;
+    std::optional<AmdArchInfo> archInfo;
+    if (dataType != accType) {
+      FailureOr<StringAttr> maybeArch = getArch(op);
+      if (failed(maybeArch))
+        return op.emitOpError("need an arch to use dot product instructions");
+      archInfo = lookupArchInfo(maybeArch->getValue());
+      loadKpackLen = archInfo->getDotProductWidth(dataType, accType);
+      if (loadKpackLen == 1)
+        return op.emitOpError("no dot product instruction accumulates ")
+               << dataType << " into " << accType;
+    }
     LLVM_DEBUG(llvm::dbgs() << "Threadwise gemm:\n"
                             << "k = " << k << "\n"
                             << "m = " << m << "\n"
@@ -158,8 +207,7 @@ struct ThreadwiseGemmRewritePattern
     auto gemmLoop = b.replaceOpWithNewOp<TransformingForOp>(
         op, ArrayRef<ValueRange>{startCoords, startCoords, startCoords},
         ArrayRef<Attribute>{aTransforms, bTransforms, cTransforms}, dimensions,
-        /*strides=*/std::nullopt, /*forceUnroll=*/true,
-        /*useIndexDiffs=*/false);
+        strides, /*forceUnroll=*/true, /*useIndexDiffs=*/false);
 
     {
       OpBuilder::InsertionGuard guard(b);
@@ -173,11 +221,13 @@ struct ThreadwiseGemmRewritePattern
           loc, abType, bufferB, gemmLoop.getLowerCoords(/*domain=*/1),
           /*inBounds=*/ArrayRef<bool>(true));
       ValueRange cCoords = gemmLoop.getLowerCoords(/*domain=*/2);
-      Value cVal = b.create<InBoundsLoadOp>(loc, dataType, bufferC, cCoords);
+      Value cVal = b.create<InBoundsLoadOp>(loc, accType, bufferC, cCoords);
 
-      Value cVector = b.create<vector::SplatOp>(loc, abType, cVal);
       Value result;
-      if (dataType.isa<IntegerType>()) {
+      if (archInfo) {
+        result = emitDotProduct(b, loc, *archInfo, aVal, bVal, cVal);
+      } else if (dataType.isa<IntegerType>()) {
+        Value cVector = b.create<vector::SplatOp>(loc, abType, cVal);
         Value mul = b.create<MulIOp>(loc, aVal, bVal);
         result = b.create<AddIOp>(loc, mul, cVector);
         if (abType.getNumElements() != 1)
@@ -185,6 +235,7 @@ struct ThreadwiseGemmRewritePattern
               "Shouldn't've gone down the scalar code path (int)");
         result = b.create<vector::ExtractElementOp>(loc, result, zeroConst);
       } else if (dataType.isa<FloatType>()) {
+        Value cVector = b.create<vector::SplatOp>(loc, abType, cVal);
         result = b.create<vector::FMAOp>(loc, aVal, bVal, cVector);
         if (abType.getNumElements() != 1)
           return op.emitOpError(
@@ -799,7 +850,8 @@ void RockThreadwiseGemmLoweringPass::runOnOperation() {
   target.addIllegalOp<rock::ThreadwiseGemmOp, rock::ThreadwiseAccelGemmOp>();
   target.addLegalDialect<amdgpu::AMDGPUDialect, arith::ArithDialect,
                          rock::RockDialect, affine::AffineDialect,
-                         memref::MemRefDialect, vector::VectorDialect>();
+                         memref::MemRefDialect, vector::VectorDialect,
+                         ROCDL::ROCDLDialect>();
   target.addLegalOp<gpu::PrintfOp>();
 
   RewritePatternSet patterns(ctx);
@@ -16,7 +16,9 @@
 // limitations under the License.
 //===----------------------------------------------------------------------===//
 
+#include "mlir/Analysis/FlatLinearValueConstraints.h"
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Affine/LoopUtils.h"
 #include "mlir/Dialect/Affine/Utils.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/Arith/Transforms/Passes.h"
@@ -26,9 +28,13 @@
 #include "mlir/Dialect/Rock/IR/Rock.h"
 #include "mlir/Dialect/Rock/Passes.h"
 #include "mlir/Dialect/Rock/utility/math.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/IRMapping.h"
 #include "mlir/IR/Visitors.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
 #include "mlir/Pass/PassManager.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "mlir/Transforms/Passes.h"
 
 namespace mlir {
@@ -62,10 +68,183 @@ struct RockVectorizeFusionsPass
 };
 } // end namespace
 
+static bool isElementwiseMath(Operation &op) {
+  return isa<arith::ArithDialect, math::MathDialect>(op.getDialect());
+}
+
+/// Whether `op` can be executed unconditionally once its `scf.if` is
+/// converted to a select. Divisions are only speculatable when their divisor
+/// is known not to be zero (or -1 for signed divisions).
+static bool isSpeculatableMath(Operation &op) {
+  return isElementwiseMath(op) && mlir::isSpeculatable(&op);
+}
+
+/// Replaces an `scf.if` in an elementwise loop by straight-line code, so that
+/// masked epilogues (padding checks, clamps written as branches) can be
+/// vectorized. Branches that only compute values become `arith.select`s of
+/// both sides, and a branch that only guards a store to registers becomes a
+/// store of the selected value.
+static LogicalResult ifConvert(RewriterBase &b, scf::IfOp ifOp) {
+  auto isSpeculatableBody = [](Block *block) {
+    return llvm::all_of(block->without_terminator(), isSpeculatableMath);
+  };
+  Location loc = ifOp.getLoc();
+  Value cond = ifOp.getCondition();
+
+  if (ifOp.getNumResults() > 0) {
+    if (!ifOp.elseBlock() || !isSpeculatableBody(ifOp.thenBlock()) ||
+        !isSpeculatableBody(ifOp.elseBlock()))
+      return failure();
+    b.setInsertionPoint(ifOp);
+    IRMapping mapping;
+    for (Block *block : {ifOp.thenBlock(), ifOp.elseBlock()})
+      for (Operation &op : block->without_terminator())
+        b.clone(op, mapping);
+    SmallVector<Value> selected;
+    for (auto [thenVal, elseVal] : llvm::zip(ifOp.thenYield().getOperands(),
+                                             ifOp.elseYield().getOperands()))
+      selected.push_back(b.create<arith::SelectOp>(
+          loc, cond, mapping.lookupOrDefault(thenVal),
+          mapping.lookupOrDefault(elseVal)));
+    b.replaceOp(ifOp, selected);
+    return success();
+  }
+
+  if (ifOp.elseBlock() && !ifOp.elseBlock()->without_terminator().empty())
+    return failure();
+  Block *thenBlock = ifOp.thenBlock();
+  auto store = dyn_cast<affine::AffineStoreOp>(
+      thenBlock->getTerminator()->getPrevNode());
+  if (!store || getAddressSpace(store.getMemref()) != AddressSpace::Private ||
+      !llvm::all_of(llvm::make_range(thenBlock->begin(), store->getIterator()),
+                    isSpeculatableMath))
+    return failure();
+  // The store's indices must be available outside the branch.
+  if (llvm::any_of(store.getMapOperands(), [&](Value v) {
+        return ifOp->isAncestor(v.getParentBlock()->getParentOp());
+      }))
+    return failure();
+  b.setInsertionPoint(ifOp);
+  IRMapping mapping;
+  for (Operation &op :
+       llvm::make_range(thenBlock->begin(), store->getIterator()))
+    b.clone(op, mapping);
+  Value old = b.create<affine::AffineLoadOp>(
+      loc, store.getMemref(), store.getAffineMap(), store.getMapOperands());
+  Value selected = b.create<arith::SelectOp>(
+      loc, cond, mapping.lookupOrDefault(store.getValueToStore()), old);
+  b.create<affine::AffineStoreOp>(loc, selected, store.getMemref(),
+                                  store.getAffineMap(), store.getMapOperands());
+  b.eraseOp(ifOp);
+  return success();
+}
+
+/// Whether the body of `loop` only moves values between memory and
+/// elementwise math, which is what the vectorizer can handle.
+static bool hasElementwiseBody(affine::AffineForOp loop) {
+  return llvm::all_of(loop.getBody()->getOperations(), [](Operation &op) {
+    return isa<affine::AffineLoadOp, affine::AffineStoreOp,
+               affine::AffineYieldOp>(op) ||
+           isElementwiseMath(op);
+  });
+}
+
+/// Collapses a perfect nest of constant-bound, unit-step loops with an
+/// elementwise body into one loop, when every access in the body either stays
+/// put across the nest or walks a 1-D buffer contiguously across all of it,
+/// as a row-major 2-D register sub-tile does. The collapsed loop is then
+/// vectorized like any other.
+static void collapseContiguousNest(affine::AffineForOp outer) {
+  SmallVector<affine::AffineForOp> nest;
+  affine::getPerfectlyNestedLoops(nest, outer);
+  if (nest.size() < 2 || !hasElementwiseBody(nest.back()))
+    return;
+  DenseMap<Value, int64_t> strides;
+  int64_t stride = 1;
+  for (affine::AffineForOp loop : llvm::reverse(nest)) {
+    if (!loop.hasConstantBounds() || loop.getConstantLowerBound() != 0 ||
+        loop.getStepAsInt() != 1)
+      return;
+    strides[loop.getInductionVar()] = stride;
+    stride *= loop.getConstantUpperBound();
+  }
+
+  auto isContiguous = [&](MemRefType type, AffineMap map,
+                          ValueRange operands) {
+    if (type.getRank() != 1)
+      return false;
+    SmallVector<int64_t> coeffs;
+    if (failed(getFlattenedAffineExpr(map.getResult(0), map.getNumDims(),
+                                      map.getNumSymbols(), &coeffs)))
+      return false;
+    // Divisions and remainders of the indices show up as extra local terms,
+    // and break contiguity.
+    ArrayRef<int64_t> localCoeffs =
+        ArrayRef<int64_t>(coeffs).slice(operands.size()).drop_back();
+    if (llvm::any_of(localCoeffs, [](int64_t c) { return c != 0; }))
+      return false;
+    DenseMap<Value, int64_t> ivCoeffs;
+    Operation *outerOp = nest.front();
+    for (auto [operand, coeff] : llvm::zip(operands, coeffs)) {
+      if (strides.contains(operand))
+        ivCoeffs[operand] += coeff;
+      else if (outerOp->isAncestor(operand.getParentBlock()->getParentOp()))
+        return false;
+    }
+    bool invariant = llvm::all_of(ivCoeffs, [](auto &entry) {
+      return entry.second == 0;
+    });
+    bool walksNest = ivCoeffs.size() == strides.size() &&
+                     llvm::all_of(ivCoeffs, [&](auto &entry) {
+                       return entry.second == strides.lookup(entry.first);
+                     });
+    return invariant || walksNest;
+  };
+  for (Operation &op : nest.back().getBody()->getOperations()) {
+    if (auto load = dyn_cast<affine::AffineLoadOp>(op)) {
+      if (!isContiguous(load.getMemRefType(), load.getAffineMap(),
+                        load.getMapOperands()))
+        return;
+    } else if (auto store = dyn_cast<affine::AffineStoreOp>(op)) {
+      if (!isContiguous(store.getMemRefType(), store.getAffineMap(),
+                        store.getMapOperands()))
+        return;
+    }
+  }
+
+  if (failed(affine::coalesceLoops(nest)))
+    return;
+  // Fold the floordiv/mod recovering each induction variable back into the
+  // access maps, which simplifies them to the linear index of the new loop.
+  MLIRContext *ctx = outer.getContext();
+  RewritePatternSet patterns(ctx);
+  affine::AffineApplyOp::getCanonicalizationPatterns(patterns, ctx);
+  affine::AffineLoadOp::getCanonicalizationPatterns(patterns, ctx);
+  affine::AffineStoreOp::getCanonicalizationPatterns(patterns, ctx);
+  (void)applyPatternsAndFoldGreedily(outer, std::move(patterns));
+}
+
 void RockVectorizeFusionsPass::runOnOperation() {
   func::FuncOp op = getOperation();
   IRRewriter b(op.getContext());
 
+  // Straighten out conditionals inside loops, innermost first.
+  SmallVector<scf::IfOp> ifs;
+  op.walk([&](scf::IfOp ifOp) {
+    if (ifOp->getParentOfType<affine::AffineForOp>())
+      ifs.push_back(ifOp);
+  });
+  for (scf::IfOp ifOp : ifs)
+    (void)ifConvert(b, ifOp);
+
+  SmallVector<affine::AffineForOp> outermostLoops;
+  op.walk([&](affine::AffineForOp loop) {
+    if (!isa<affine::AffineForOp>(loop->getParentOp()))
+      outermostLoops.push_back(loop);
+  });
+  for (affine::AffineForOp loop : outermostLoops)
+    collapseContiguousNest(loop);
+
   op.walk([&](affine::AffineForOp loop) -> WalkResult {
     // Collect data types and information about the vectorization feasibility
     SmallVector<Type> loopTypes;
@@ -77,9 +256,13 @@ void RockVectorizeFusionsPass::runOnOperation() {
       } else if (auto affineStore = dyn_cast<affine::AffineStoreOp>(bodyOp)) {
         if (getAddressSpace(affineStore.getMemref()) == AddressSpace::Private)
           loopTypes.push_back(affineStore.getMemRefType().getElementType());
-      } else if (!isa<affine::AffineYieldOp>(bodyOp) &&
-                 !isa<arith::ArithDialect>(bodyOp.getDialect()) &&
-                 !isa<math::MathDialect>(bodyOp.getDialect())) {
+      } else if (isElementwiseMath(bodyOp)) {
+        // Conversions in the body decide the vector width as much as the
+        // memory accesses do.
+        for (Type type : bodyOp.getResultTypes())
+          if (type.isIntOrFloat() && type.getIntOrFloatBitWidth() > 1)
+            loopTypes.push_back(type);
+      } else if (!isa<affine::AffineYieldOp>(bodyOp)) {
         canVectorize = false;
       }
     }
@@ -97,7 +280,10 @@ void RockVectorizeFusionsPass::runOnOperation() {
     if (step > 1)
       return WalkResult::advance();
     const int64_t loopTripCount = (ub - lb);
-    const int64_t maxVectorBitWidth = 64;
+    // Registers are read and written up to 128 bits at a time, and 16-bit
+    // math is done on packed pairs, so the widest type in the chain decides
+    // how many lanes fit.
+    const int64_t maxVectorBitWidth = 128;
 
     // Look for the vectorization factor
     int64_t vectorizationFactor = loopTripCount;
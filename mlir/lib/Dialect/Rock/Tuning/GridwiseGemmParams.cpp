@@ -11,6 +11,7 @@
 #include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Dialect/Rock/utility/loweringUtils.h"
 #include "mlir/Dialect/Rock/utility/math.h"
+#include "mlir/IR/TypeUtilities.h"
 #include "mlir/Support/LogicalResult.h"
 
 #include "llvm/Support/Debug.h"
@@ -81,6 +82,9 @@ PopulateParamsInfo PopulateParamsInfo::fromOp(RockGemmWrapperInterface op) {
     info.numCu = convOp.getNumCU();
     info.batchSize = convDims.n;
   }
+  if (auto convOp = dyn_cast<ConvOp>(*op))
+    info.smallChannelConv =
+        getConvGemmChannels(convOp) != ConvolutionDims::fromOp(op).c;
   return info;
 }
 
@@ -120,6 +124,7 @@ std::optional<GemmSize> mlir::rock::requiredPadding(Attribute params,
     kPerBlock = generalParams.getKPerBlock();
     mPerBlock = generalParams.getMPerBlock();
     nPerBlock = generalParams.getNPerBlock();
+    kPack = generalParams.getKpack();
   } else if (auto accelParams =
                  params.dyn_cast<RockAccelTuningParamAttrInterface>()) {
     kPerBlock = accelParams.getKpackPerBlock();
@@ -132,6 +137,29 @@ std::optional<GemmSize> mlir::rock::requiredPadding(Attribute params,
   return calculatePadding(kPerBlock, mPerBlock, nPerBlock, gemmSize, kPack);
 }
 
+int64_t mlir::rock::getSplitKWorkspaceBytes(const GemmSize &gemmSize,
+                                            int64_t mPerBlock,
+                                            int64_t nPerBlock,
+                                            int64_t splitKFactor) {
+  int64_t mBlocks = math_util::integer_divide_ceil(gemmSize.m, mPerBlock);
+  int64_t nBlocks = math_util::integer_divide_ceil(gemmSize.n, nPerBlock);
+  int64_t numTiles = gemmSize.g * mBlocks * nBlocks;
+  return 4 * (numTiles * mPerBlock * nPerBlock * splitKFactor + numTiles);
+}
+
+int64_t mlir::rock::getMaxSplitKWorkspaceBytes(const GemmSize &gemmSize) {
+  // Padding is largest for the largest tiles, and the counters are most
+  // numerous for the smallest.
+  constexpr int64_t maxMNPerBlock = 256, minMPerBlock = 4, minNPerBlock = 16;
+  int64_t partials = getSplitKWorkspaceBytes(gemmSize, maxMNPerBlock,
+                                             maxMNPerBlock,
+                                             splitKFactorUpperBound - 1);
+  int64_t counters = 4 * gemmSize.g *
+                     math_util::integer_divide_ceil(gemmSize.m, minMPerBlock) *
+                     math_util::integer_divide_ceil(gemmSize.n, minNPerBlock);
+  return partials + counters;
+}
+
 int64_t mlir::rock::obtainBlockSize(int64_t waveSize, int64_t mPerBlock,
                                     int64_t nPerBlock, int64_t mPerWave,
                                     int64_t nPerWave) {
@@ -140,8 +168,119 @@ int64_t mlir::rock::obtainBlockSize(int64_t waveSize, int64_t mPerBlock,
 
 int64_t mlir::rock::obtainBlockSize(int64_t waveSize,
                                     RockAccelTuningParamAttrInterface params) {
+  int64_t producerWaves = 0;
+  if (auto xdlopsParams = dyn_cast<XdlopsGemmDerivedParamsAttr>(params))
+    producerWaves = xdlopsParams.getProducerWaves();
   return obtainBlockSize(waveSize, params.getMPerBlock(), params.getNPerBlock(),
-                         params.getMPerWave(), params.getNPerWave());
+                         params.getMPerWave(), params.getNPerWave()) +
+         producerWaves * waveSize;
+}
+
+// Rough number of cycles each iteration of the gemm main loop spends on
+// the LDS barriers and address arithmetic that can't overlap with the math.
+static constexpr double kLoopOverheadCycles = 64.0;
+// LDS bandwidth per CU, which is the same across the accelerated chips.
+static constexpr double ldsBytesPerClock = 128.0;
+// Registers each thread needs besides the accumulators and the staged tiles.
+static constexpr int64_t baseRegsPerThread = 32;
+
+std::optional<double> mlir::rock::estimateAccelGemmCycles(
+    const AmdArchInfo &archInfo, uint32_t numCu, const GemmSize &gemmSize,
+    Type dataType, int64_t mPerBlock, int64_t nPerBlock, int64_t kPerBlock,
+    int64_t mPerWave, int64_t nPerWave, int64_t splitKFactor,
+    int64_t producerWaves) {
+  int64_t peakFlops = archInfo.getAccelFlopsPerClockPerCU(dataType);
+  if (peakFlops == 0 || numCu == 0 || mPerWave == 0 || nPerWave == 0)
+    return std::nullopt;
+  int64_t bitWidth = getElementTypeOrSelf(dataType).getIntOrFloatBitWidth();
+  int64_t elementBytes = std::max<int64_t>(1, bitWidth / 8);
+  int64_t wavesPerBlock = (mPerBlock / mPerWave) * (nPerBlock / nPerWave);
+  int64_t blockSize = wavesPerBlock * archInfo.waveSize;
+  if (blockSize == 0)
+    return std::nullopt;
+  // Producer waves take wave slots of their own and double-buffer LDS.
+  bool isWaveSpecialized = producerWaves > 0;
+  int64_t residentWavesPerBlock = wavesPerBlock + producerWaves;
+  int64_t copyBlockSize =
+      isWaveSpecialized ? producerWaves * archInfo.waveSize : blockSize;
+
+  // Padding waste shows up as the extra iterations and tiles computed here.
+  int64_t mTiles = math_util::integer_divide_ceil(gemmSize.m, mPerBlock);
+  int64_t nTiles = math_util::integer_divide_ceil(gemmSize.n, nPerBlock);
+  int64_t kPerSplit = math_util::integer_divide_ceil(gemmSize.k, splitKFactor);
+  int64_t kIters = math_util::integer_divide_ceil(kPerSplit, kPerBlock);
+  int64_t numTiles = gemmSize.g * mTiles * nTiles * splitKFactor;
+
+  // Occupancy, as limited by LDS, registers, and the wave slots per SIMD.
+  int64_t tileBytes = (mPerBlock + nPerBlock) * kPerBlock * elementBytes;
+  int64_t ldsBytes = (isWaveSpecialized ? 2 : 1) * tileBytes;
+  if (ldsBytes > archInfo.maxSharedMemPerWG)
+    return std::nullopt;
+  // The accumulators take one register each, or two for f64. Every wave is
+  // allocated as many registers as the hungriest one, so with producer waves
+  // that is the larger of the accumulators and the staged tiles.
+  int64_t regsPerAcc = std::max<int64_t>(1, bitWidth / 32);
+  int64_t accRegs =
+      regsPerAcc *
+      math_util::integer_divide_ceil(mPerBlock * nPerBlock, blockSize);
+  int64_t stageRegs =
+      math_util::integer_divide_ceil(tileBytes, 4 * copyBlockSize);
+  int64_t regsPerThread =
+      (isWaveSpecialized ? std::max(accRegs, stageRegs)
+                         : accRegs + stageRegs) +
+      baseRegsPerThread;
+  int64_t wavesPerEU = std::min(archInfo.maxWavesPerEU,
+                                archInfo.totalVGPRPerEU / regsPerThread);
+  int64_t blocksPerCu =
+      std::min((archInfo.numEUPerCU * wavesPerEU) / residentWavesPerBlock,
+               archInfo.totalSharedMemPerCU / ldsBytes);
+  if (blocksPerCu == 0)
+    return std::nullopt;
+
+  // One main loop iteration of `blocks` co-resident workgroups is bound by
+  // the matrix units, by LDS traffic (each wave re-reads its slices of the A
+  // and B tiles, so small wave tiles have low arithmetic intensity there), or
+  // by the fixed per-iteration overhead. A lone wave per SIMD can't hide the
+  // latency of its own loads, unless producer waves issue them instead.
+  double ldsBytesPerIter =
+      static_cast<double>(wavesPerBlock * (mPerWave + nPerWave) + mPerBlock +
+                          nPerBlock) *
+      kPerBlock * elementBytes;
+  auto cyclesPerIter = [&](int64_t blocks) {
+    double wavesPerSimd =
+        static_cast<double>(blocks * wavesPerBlock) / archInfo.numEUPerCU;
+    double utilization =
+        std::min(1.0, (isWaveSpecialized ? 0.75 : 0.5) + 0.25 * wavesPerSimd);
+    double flops = 2.0 * mPerBlock * nPerBlock * kPerBlock * blocks;
+    return std::max({flops / (peakFlops * utilization),
+                     blocks * ldsBytesPerIter / ldsBytesPerClock,
+                     kLoopOverheadCycles});
+  };
+
+  // Wave quantization: the busiest CU works through its share of the tiles,
+  // blocksPerCu at a time, with a partially occupied last round.
+  int64_t tilesPerCu = math_util::integer_divide_ceil(numTiles, numCu);
+  int64_t residentBlocks = std::min(tilesPerCu, blocksPerCu);
+  int64_t fullRounds = tilesPerCu / residentBlocks;
+  int64_t lastRoundBlocks = tilesPerCu % residentBlocks;
+  double computeCycles = kIters * fullRounds * cyclesPerIter(residentBlocks);
+  if (lastRoundBlocks != 0)
+    computeCycles += kIters * cyclesPerIter(lastRoundBlocks);
+
+  // Every tile streams its A and B panels through L2, while HBM at least has
+  // to supply the inputs once and take the output.
+  double outputBytes =
+      static_cast<double>(gemmSize.g) * gemmSize.m * gemmSize.n * elementBytes;
+  double l2Bytes = static_cast<double>(numTiles) * (mPerBlock + nPerBlock) *
+                       kIters * kPerBlock * elementBytes +
+                   outputBytes;
+  double hbmBytes = static_cast<double>(gemmSize.g) *
+                        (gemmSize.m * gemmSize.k + gemmSize.k * gemmSize.n) *
+                        elementBytes +
+                    outputBytes;
+  double l2Cycles = l2Bytes / archInfo.getL2BytesPerClock();
+  double hbmCycles = hbmBytes / archInfo.getHbmBytesPerClock();
+  return std::max({computeCycles, l2Cycles, hbmCycles});
 }
 
 LogicalResult PopulateParams::calculateBlockGemmPerformanceParameters(
@@ -163,6 +302,9 @@ LogicalResult PopulateParams::calculateBlockGemmPerformanceParameters(
         param.gemmNPerBlock % param.gemmNPerThread == 0))
     return failure();
 
+  if (param.gemmKPerBlock % param.gemmKPack != 0)
+    return failure();
+
   int64_t threadGemmMPerCluster = param.gemmMPerThread *
                                   derived.mThreadsPerCuwave *
                                   derived.mCuwavesPerBlock;
@@ -198,10 +340,27 @@ Attribute
 PopulateParams::getGemmParamsAttr(OpBuilder &b,
                                   const InitParamsNonAccel &params) const {
   return b.getAttr<GeneralGemmParamsAttr>(
-      params.blockSize, params.gemmKPerBlock, params.gemmMPerBlock,
-      params.gemmNPerBlock,
+      params.blockSize, params.gemmKPerBlock / params.gemmKPack,
+      params.gemmMPerBlock, params.gemmNPerBlock,
       /*kPerThread=*/1, params.gemmMPerThread, params.gemmNPerThread,
-      /*kpack=*/1, params.splitKFactor);
+      params.gemmKPack, params.splitKFactor);
+}
+
+void PopulateParams::populateKPack(const PopulateParamsInfo &info,
+                                   InitParamsNonAccel &params) const {
+  params.gemmKPack = 1;
+  if (!bitEnumContainsAll(info.gemmFeatures, GemmFeatures::dot) ||
+      info.gemmAType != info.gemmBType)
+    return;
+  // Match the accumulator type that the gemm lowering will pick.
+  MLIRContext *ctx = info.gemmAType.getContext();
+  Type accType = info.gemmAType.isa<IntegerType>()
+                     ? Type(IntegerType::get(ctx, 32))
+                     : Type(Float32Type::get(ctx));
+  int64_t dotWidth =
+      lookupArchInfo(info.arch).getDotProductWidth(info.gemmAType, accType);
+  if (params.gemmKPerBlock % dotWidth == 0)
+    params.gemmKPack = dotWidth;
 }
 
 LogicalResult
@@ -231,6 +390,7 @@ LogicalResult PopulateParams::obtainTuningParameters(
     bool isValidPerfConfig = validParams.deserialize(perfConfig.str());
     if (isValidPerfConfig) {
       LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams));
+      populateKPack(info, validParams);
       return populateDerived(validParams);
     }
     // Signal the client if perfCofnig is passed in but is invalid
@@ -248,6 +408,7 @@ LogicalResult PopulateParams::obtainTuningParameters(
     }
 
     validParams = params;
+    populateKPack(info, validParams);
     break;
   }
   LLVM_DEBUG(llvm::dbgs() << genDebugForParams(validParams) << "\n");
@@ -315,21 +476,48 @@ PopulateParamsAccel::calculatePaddingAmount(const InitParamsAccel &params,
   return 0;
 }
 
+RockAccelTuningParamAttrInterface
+PopulateParamsAccel::getDerivedParamsAttr(OpBuilder &b,
+                                          const InitParamsAccel &params) const {
+  Attribute params0 = getGemmParamsAttr(b, params);
+  if (auto xdlopsParams0 = params0.dyn_cast<XdlopsGemmParamsAttr>())
+    return XdlopsGemmDerivedParamsAttr::get(xdlopsParams0);
+  return params0.cast<RockAccelTuningParamAttrInterface>();
+}
+
 LogicalResult
 PopulateParamsAccel::paramsProbablyValid(OpBuilder &b,
                                          const PopulateParamsInfo &info,
                                          const InitParamsAccel &params) {
-  Attribute params0 = getGemmParamsAttr(b, params);
-  RockAccelTuningParamAttrInterface accelParams0;
-  if (auto xdlopsParams0 = params0.dyn_cast<XdlopsGemmParamsAttr>()) {
+  RockAccelTuningParamAttrInterface accelParams0 =
+      getDerivedParamsAttr(b, params);
+  if (isa<XdlopsGemmDerivedParamsAttr>(accelParams0)) {
     int64_t mWaves = params.gemmMPerBlock / params.gemmMPerWave;
     if (mWaves > maxWavesPerWG) {
       return failure();
     }
-    auto xdlopsDerivedParams0 = XdlopsGemmDerivedParamsAttr::get(xdlopsParams0);
-    accelParams0 = xdlopsDerivedParams0;
-  } else {
-    accelParams0 = params0.cast<RockAccelTuningParamAttrInterface>();
+  }
+  if (params.producerWaves > 0) {
+    // Producer waves can't take part in the split-K reduction, and each of
+    // their threads must copy a whole number of elements of both tiles.
+    int64_t producerThreads =
+        params.producerWaves * lookupArchInfo(info.arch).waveSize;
+    int64_t kPerBlock = params.gemmKPerBlock * params.gemmKPack;
+    if (!isa<XdlopsGemmDerivedParamsAttr>(accelParams0) ||
+        params.splitKFactor != 1 ||
+        (kPerBlock * params.gemmMPerBlock) % producerThreads != 0 ||
+        (kPerBlock * params.gemmNPerBlock) % producerThreads != 0)
+      return failure();
+    // The mainloop double-buffers both tiles in LDS.
+    int64_t ldsBytes =
+        2 * kPerBlock *
+        (params.gemmMPerBlock *
+             getElementTypeOrSelf(info.gemmAType).getIntOrFloatBitWidth() +
+         params.gemmNPerBlock *
+             getElementTypeOrSelf(info.gemmBType).getIntOrFloatBitWidth()) /
+        8;
+    if (ldsBytes > lookupArchInfo(info.arch).maxSharedMemPerWG)
+      return failure();
   }
   return isValidBlockwiseGemm(accelParams0, info.gemmAType, info.gemmBType,
                               info.arch, false, false);
@@ -360,16 +548,34 @@ LogicalResult PopulateParamsAccel::obtainTuningParameters(
   }
 
   LogicalResult res = failure();
-  auto paramSets = getTuningParameters(info.kernelType, info.gemmAType,
-                                       info.gemmBType, info.arch);
-
+  auto paramSets = getCandidateParameters(info);
+
+  // Rank the valid candidates with the performance model. Candidates come in
+  // order of increasing padding, so ties (and architectures the model knows
+  // nothing about) fall back to the least-padded, earliest listed one.
+  AmdArchInfo archInfo = lookupArchInfo(info.arch);
+  uint32_t numCu = info.numCu != 0 ? info.numCu : archInfo.minNumCU;
+  std::optional<double> bestCycles;
   for (const auto &params : orderInitParams(paramSets, info.gemmSize)) {
-    res = paramsProbablyValid(b, info, params);
-    if (failed(res)) {
+    if (failed(paramsProbablyValid(b, info, params)))
       continue;
+    RockAccelTuningParamAttrInterface derived =
+        getDerivedParamsAttr(b, params);
+    std::optional<double> cycles = estimateAccelGemmCycles(
+        archInfo, numCu, info.gemmSize, info.gemmAType, params.gemmMPerBlock,
+        params.gemmNPerBlock, params.gemmKPerBlock * params.gemmKPack,
+        derived.getMPerWave(), derived.getNPerWave(), params.splitKFactor,
+        params.producerWaves);
+    LLVM_DEBUG(llvm::dbgs() << "estimated cycles "
+                            << (cycles ? *cycles : -1.0) << " for "
+                            << genDebugForParams(params));
+    if (failed(res) || (cycles && (!bestCycles || *cycles < *bestCycles))) {
+      validParams = params;
+      bestCycles = cycles;
+      res = success();
     }
-    validParams = params;
-    break;
+    if (archInfo.accelFlopsPerClockPerCU == 0)
+      break;
   }
   LLVM_DEBUG(llvm::dbgs() << "perf config: " << genDebugForParams(validParams)
                           << "\n");
@@ -391,6 +597,32 @@ PopulateParamsAccel::obtainTuningParameters(RockGemmWrapperInterface op,
   return res;
 }
 
+// clang-format off
+const InitParamsAccel
+PopulateParamsAccel::initParametersSmallChannelConv[
+    PopulateParamsAccel::nInitParametersSmallChannelConv] = {
+  // M/block N/block K/block M/wave N/wave kPack splitKFactor forceUnroll bCopyMore
+  {64, 256, 4, 32, 32, 4, 1, true, true},
+  {32, 256, 4, 32, 32, 4, 1, true, true},
+  {64, 128, 8, 32, 32, 4, 1, true, true},
+  {32, 128, 8, 32, 32, 4, 1, true, true},
+  {16, 256, 4, 16, 16, 4, 1, true, true},
+  {128, 128, 4, 64, 32, 4, 1, true, true}
+};
+// clang-format on
+
+std::vector<InitParamsAccel>
+PopulateParamsAccel::getCandidateParameters(
+    const PopulateParamsInfo &info) const {
+  std::vector<InitParamsAccel> res;
+  if (info.smallChannelConv)
+    res.assign(std::begin(initParametersSmallChannelConv),
+               std::end(initParametersSmallChannelConv));
+  llvm::append_range(res, getTuningParameters(info.kernelType, info.gemmAType,
+                                              info.gemmBType, info.arch));
+  return res;
+}
+
 /// Xdlops acceleration
 // clang-format off
 const InitParamsAccel
@@ -527,6 +759,27 @@ PopulateParamsXDL::initParametersForward8Bit[
   {16, 16, 32, 16, 16, 4, 1, true, true},
   {16, 16, 16, 16, 16, 4, 1, true, true}
 };
+
+const InitParamsAccel
+PopulateParamsXDL::initParametersFp64[PopulateParamsXDL::nInitParametersFp64] = {
+  // M/block N/block K/block M/wave N/wave kPack splitKFactor forceUnroll bCopyMore
+  {128, 128, 4, 64, 16, 4, 1, true, true},
+  {128, 128, 4, 64, 16, 2, 1, true, true},
+  {128, 128, 8, 64, 16, 1, 1, true, true},
+  {128, 64, 4, 64, 16, 2, 1, true, true},
+  {128, 64, 8, 32, 16, 1, 1, true, true},
+  {64, 128, 4, 32, 16, 2, 1, true, true},
+  {64, 64, 4, 32, 16, 2, 1, true, true},
+  {64, 64, 8, 32, 16, 1, 1, true, true},
+  {64, 64, 4, 16, 16, 4, 1, true, true},
+  {64, 32, 4, 16, 16, 2, 1, true, true},
+  {64, 32, 8, 32, 16, 1, 1, true, true},
+  {32, 64, 4, 16, 16, 2, 1, true, true},
+  {32, 32, 4, 16, 16, 2, 1, true, true},
+  {32, 32, 8, 16, 16, 1, 1, true, true},
+  {16, 32, 4, 16, 16, 4, 1, true, true},
+  {16, 16, 4, 16, 16, 4, 1, true, true}
+};
 // clang-format on
 
 LogicalResult PopulateParamsXDL::isValidBlockwiseGemm(
@@ -667,6 +920,9 @@ PopulateParamsXDL::getTuningParameters(KernelType opType, Type dataTypeA,
   case 16:
     params = {initParametersFp16, nInitParametersFp16};
     break;
+  case 64:
+    params = {initParametersFp64, nInitParametersFp64};
+    break;
   default:
     params = {initParameters, nInitParameters};
   }
@@ -707,7 +963,8 @@ PopulateParamsXDL::getGemmParamsAttr(OpBuilder &builder,
       validParams.gemmKPerBlock, validParams.gemmMPerBlock,
       validParams.gemmNPerBlock, validParams.gemmKPack,
       validParams.gemmMPerWave, validParams.gemmNPerWaveOrMnPerXdl,
-      validParams.splitKFactor, validParams.gemmAThreadCopyMoreGemmK);
+      validParams.splitKFactor, validParams.gemmAThreadCopyMoreGemmK,
+      validParams.schedHint, validParams.producerWaves);
 }
 
 /// Wmma acceleration
@@ -857,8 +1114,9 @@ LogicalResult PopulateParamsWmma::isValidBlockwiseGemm(
   }
 
   // Reject invalid KPACK values.
-  auto maybeWmmaInsn = WmmaInsn::select(
-      dataTypeA, dataTypeB, waveSize, param.getMPerWave(), param.getNPerWave());
+  auto maybeWmmaInsn = WmmaInsn::select(dataTypeA, dataTypeB, arch,
+                                        param.getMPerWave(),
+                                        param.getNPerWave());
   if (failed(maybeWmmaInsn)) {
     LLVM_DEBUG(llvm::dbgs() << "Failed to select wmma instruction.\n");
     return failure();
@@ -889,12 +1147,11 @@ PopulateParamsWmma::getTuningParameters(KernelType opType, Type dataTypeA,
     return res;
   }
   // Only return valid Wmma params
-  const int64_t waveSize = mlir::rock::lookupArchInfo(arch).waveSize;
   std::copy_if(
       params.begin(), params.end(), std::back_inserter(res),
       [&](const InitParamsAccel &param) {
         auto maybeWmmaInsn =
-            WmmaInsn::select(dataTypeA, dataTypeB, waveSize, param.gemmMPerWave,
+            WmmaInsn::select(dataTypeA, dataTypeB, arch, param.gemmMPerWave,
                              param.gemmNPerWaveOrMnPerXdl);
         if (failed(maybeWmmaInsn)) {
           return false;
@@ -924,5 +1181,6 @@ Attribute PopulateParamsWmma::getGemmParamsAttr(
       validParams.gemmKPerBlock, validParams.gemmMPerBlock,
       validParams.gemmNPerBlock, validParams.gemmKPack,
       validParams.gemmMPerWave, validParams.gemmNPerWaveOrMnPerXdl,
-      validParams.splitKFactor, validParams.gemmAThreadCopyMoreGemmK);
+      validParams.splitKFactor, validParams.gemmAThreadCopyMoreGemmK,
+      validParams.schedHint);
 }
@@ -18,11 +18,15 @@
 #include "mlir/Dialect/Rock/utility/fusionUtils.h"
 #include "mlir/Dialect/Rock/utility/loweringUtils.h"
 #include "mlir/Dialect/Rock/utility/math.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/TypeUtilities.h"
+#include "mlir/Interfaces/ViewLikeInterface.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SmallString.h"
 #include <algorithm>
+#include <map>
 
 namespace mlir {
 namespace rock {
@@ -65,12 +69,15 @@ void createAttnTuningRangeBF(TuningParamSet *newSpace, AttentionOp attnOp,
                     gemm1MPerBlock >= gemmMPerWave &&
                     gemm1MPerBlock >= gemm0MPerBlock &&
                     gemm0NPerBlock >= gemmMnPerXdlOrNPerWave) {
-                  auto params = AttnPerfConfigAttr::get(
-                      attnOp.getContext(), gemm0MPerBlock, gemm1MPerBlock,
-                      gemm0NPerBlock, gemmKPerBlock, gemmMPerWave,
-                      gemmMnPerXdlOrNPerWave, gemmKPack, true);
-                  newSpace->tuningRange.push_back(
-                      cast<RockTuningParamAttrInterface>(params));
+                  for (bool pipelineKVLoop : {false, true}) {
+                    auto params = AttnPerfConfigAttr::get(
+                        attnOp.getContext(), gemm0MPerBlock, gemm1MPerBlock,
+                        gemm0NPerBlock, gemmKPerBlock, gemmMPerWave,
+                        gemmMnPerXdlOrNPerWave, gemmKPack, true,
+                        pipelineKVLoop);
+                    newSpace->tuningRange.push_back(
+                        cast<RockTuningParamAttrInterface>(params));
+                  }
                 }
               }
             }
@@ -124,8 +131,8 @@ computeOptimalSplitKFactors(GemmSize origGemmSize, int32_t gemmMPerBlock,
   // on purpose because the current heuristics does not consider the overheads
   // resulting from reducing partial solution along the split dimension.
   // This needs to be improved in the future.
-  constexpr int32_t upperBound = 32;
-  for (int32_t splitKFactor = 2; splitKFactor < upperBound; ++splitKFactor) {
+  for (int32_t splitKFactor = 2; splitKFactor < splitKFactorUpperBound;
+       ++splitKFactor) {
     const double imbalance =
         computeWorkImbalance(origGemmSize, gemmMPerBlock, gemmNPerBlock,
                              gemmKPerBlock, kPack, numCUs, splitKFactor);
@@ -159,14 +166,22 @@ computeOptimalSplitKFactors(RockGemmWrapperInterface gemmOp,
   auto info = PopulateParamsInfo::fromOp(gemmOp);
   SmallVector<int64_t> splitKValues = {1};
   GemmFeatures currentFeatures = gemmOp.getGemmFeatures();
+  // Gemms with a split-K workspace reduce their partial results without
+  // atomics, so neither the target nor the output type restrict them.
+  auto gemm = dyn_cast<GemmOp>(gemmOp.getOperation());
+  bool hasWorkspace = gemm && gemm.getWorkspace();
+  // The workspace only has room for 32-bit partial results.
+  if (gemmOp.getCType().getIntOrFloatBitWidth() > 32)
+    return splitKValues;
   // We dont enable split-k on Navi yet because they dont
   // still have atomic_add with packed_f16.
-  if (bitEnumContainsAll(currentFeatures, GemmFeatures::wmma)) {
+  if (!hasWorkspace &&
+      bitEnumContainsAll(currentFeatures, GemmFeatures::wmma)) {
     return splitKValues;
   }
   const bool isAllowedTypeC =
       gemmOp.getCType().isF32() || gemmOp.getCType().isF16();
-  if (!isAllowedTypeC) {
+  if (!hasWorkspace && !isAllowedTypeC) {
     return splitKValues;
   }
 
@@ -219,6 +234,18 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
                                                 {1, 4, 8, 16},
                                                 {0, 1}};
 
+  // f64 only has the 16x16x4 instruction, so larger mnPerXdl values would
+  // repeat the same configs, and its 8-byte elements fill LDS twice as fast.
+  // M/block N/block K/block M/wave N/wave kPack aCopyMore/forceUnroll
+  const std::vector<std::vector<uint32_t>> validRangeAccelGemmParamsF64 = {
+      {16, 32, 64, 128},
+      {16, 32, 64, 128},
+      {1, 2, 4, 8},
+      {16, 32, 64},
+      {16},
+      {1, 2, 4},
+      {0, 1}};
+
   // M/block N/block K/block M/wave N/wave kPack aCopyMore/forceUnroll
   const std::vector<std::vector<uint32_t>> validRangeWmmaGemmParams = {
       {4, 8, 16, 32, 64, 128, 256},
@@ -229,6 +256,30 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
       {4, 8, 16},
       {0, 1}};
 
+  // gfx12 splits k between the two halves of the wave, so a block needs at
+  // least two kpacks and each lane reads half of them.
+  const std::vector<std::vector<uint32_t>> validRangeWmmaGfx12GemmParams = {
+      {4, 8, 16, 32, 64, 128, 256},
+      {16, 32, 64, 128, 256},
+      {2, 4, 8, 16},
+      {4, 8, 16, 32, 64, 128},
+      {4, 8, 16, 32, 64, 128},
+      {4, 8, 16},
+      {0, 1}};
+
+  // Mainloop schedules, see RockSchedHintsPass. The iglp_opt strategies
+  // (2 and 3) are written for MFMA. A schedule only reorders the
+  // instructions of a config, so only the exhaustive search multiplies the
+  // space by them and the others keep the backend's own schedule.
+  const bool searchSchedHints = kind == TuningParamSetKind::Exhaustive;
+  const std::vector<int64_t> validRangeXdlopsSchedHints =
+      searchSchedHints ? std::vector<int64_t>{0, 1, 2, 3}
+                       : std::vector<int64_t>{0};
+  const std::vector<int64_t> validRangeWmmaSchedHints =
+      searchSchedHints ? std::vector<int64_t>{0, 1} : std::vector<int64_t>{0};
+  // Waves dedicated to the global to LDS copies, MFMA only.
+  const std::vector<int64_t> validRangeProducerWaves = {0, 1, 2};
+
   OpBuilder b(gemmOp.getContext());
   GemmFeatures currentFeatures = gemmOp.getGemmFeatures();
   if (bitEnumContainsAll(currentFeatures, GemmFeatures::mfma)) {
@@ -238,8 +289,9 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
     bool is8BitReduction = inTypeA.isInteger(8) || inTypeA.isFloat8E5M2FNUZ() ||
                            inTypeA.isFloat8E4M3FNUZ();
     const std::vector<std::vector<uint32_t>> &xdlopsParams =
-        is8BitReduction ? validRangeAccelGemmParams8BitReduction
-                        : validRangeAccelGemmParams;
+        is8BitReduction   ? validRangeAccelGemmParams8BitReduction
+        : inTypeA.isF64() ? validRangeAccelGemmParamsF64
+                          : validRangeAccelGemmParams;
     for (uint32_t gemmMPerBlock : xdlopsParams[0]) {
       for (uint32_t gemmNPerBlock : xdlopsParams[1]) {
         for (uint32_t gemmKPerBlock : xdlopsParams[2]) {
@@ -251,20 +303,26 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
                     gemmKPack);
                 for (int64_t splitKFactor : optimalSplitKFactors) {
                   for (uint32_t forceUnroll : xdlopsParams[6]) {
-                    InitParamsAccel gemmParams(gemmMPerBlock, gemmNPerBlock,
-                                               gemmKPerBlock, gemmMPerWave,
-                                               gemmMnPerXdl, gemmKPack,
-                                               splitKFactor, forceUnroll, true);
-                    if (gemmMPerBlock >= gemmMPerWave &&
-                        gemmNPerBlock >= gemmMnPerXdl) {
-                      if (kind == TuningParamSetKind::Exhaustive ||
-                          (succeeded(tuningInfo.paramsProbablyValid(
-                               b, info, gemmParams)) &&
-                           succeeded(
-                               tuningInfo.couldBePerformant(info, gemmParams))))
-                        newSpace->tuningRange.push_back(
-                            cast<RockTuningParamAttrInterface>(
-                                tuningInfo.getGemmParamsAttr(b, gemmParams)));
+                    for (int64_t schedHint : validRangeXdlopsSchedHints) {
+                      for (int64_t producerWaves : validRangeProducerWaves) {
+                        InitParamsAccel gemmParams(
+                            gemmMPerBlock, gemmNPerBlock, gemmKPerBlock,
+                            gemmMPerWave, gemmMnPerXdl, gemmKPack,
+                            splitKFactor, forceUnroll, true, schedHint,
+                            producerWaves);
+                        if (gemmMPerBlock < gemmMPerWave ||
+                            gemmNPerBlock < gemmMnPerXdl)
+                          continue;
+                        if (kind == TuningParamSetKind::Exhaustive ||
+                            (succeeded(tuningInfo.paramsProbablyValid(
+                                 b, info, gemmParams)) &&
+                             succeeded(tuningInfo.couldBePerformant(
+                                 info, gemmParams))))
+                          newSpace->tuningRange.push_back(
+                              cast<RockTuningParamAttrInterface>(
+                                  tuningInfo.getGemmParamsAttr(b,
+                                                               gemmParams)));
+                      }
                     }
                   }
                 }
@@ -277,7 +335,8 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
   } else if (bitEnumContainsAll(currentFeatures, GemmFeatures::wmma)) {
     // Wmma
     const std::vector<std::vector<uint32_t>> &wmmaParams =
-        validRangeWmmaGemmParams;
+        StringRef(info.arch).contains("gfx12") ? validRangeWmmaGfx12GemmParams
+                                                : validRangeWmmaGemmParams;
     PopulateParamsWmma tuningInfo;
     for (uint32_t gemmMPerBlock : wmmaParams[0]) {
       for (uint32_t gemmNPerBlock : wmmaParams[1]) {
@@ -290,18 +349,20 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
                     gemmKPack);
                 for (auto splitKFactor : optimalSplitKFactors) {
                   for (uint32_t forceUnroll : wmmaParams[6]) {
-                    InitParamsAccel gemmParams(gemmMPerBlock, gemmNPerBlock,
-                                               gemmKPerBlock, gemmMPerWave,
-                                               gemmNPerWave, gemmKPack,
-                                               splitKFactor, forceUnroll, true);
-                    if (succeeded(tuningInfo.paramsProbablyValid(b, info,
-                                                                 gemmParams)) &&
-                        (kind == TuningParamSetKind::Exhaustive ||
-                         succeeded(
-                             tuningInfo.couldBePerformant(info, gemmParams))))
-                      newSpace->tuningRange.push_back(
-                          cast<RockTuningParamAttrInterface>(
-                              tuningInfo.getGemmParamsAttr(b, gemmParams)));
+                    for (int64_t schedHint : validRangeWmmaSchedHints) {
+                      InitParamsAccel gemmParams(
+                          gemmMPerBlock, gemmNPerBlock, gemmKPerBlock,
+                          gemmMPerWave, gemmNPerWave, gemmKPack, splitKFactor,
+                          forceUnroll, true, schedHint);
+                      if (succeeded(tuningInfo.paramsProbablyValid(
+                              b, info, gemmParams)) &&
+                          (kind == TuningParamSetKind::Exhaustive ||
+                           succeeded(tuningInfo.couldBePerformant(
+                               info, gemmParams))))
+                        newSpace->tuningRange.push_back(
+                            cast<RockTuningParamAttrInterface>(
+                                tuningInfo.getGemmParamsAttr(b, gemmParams)));
+                    }
                   }
                 }
               }
@@ -325,6 +386,7 @@ void createGemmTuningRangeBF(TuningParamSet *newSpace,
                   InitParamsNonAccel gemmParams(
                       blockSize, gemmMPerBlock, gemmNPerBlock, gemmKPerBlock,
                       gemmMPerThread, gemmNPerThread, splitKFactor);
+                  tuningInfo.populateKPack(info, gemmParams);
                   if (succeeded(tuningInfo.paramsProbablyValid(b, info,
                                                                gemmParams)) &&
                       (kind == TuningParamSetKind::Exhaustive ||
@@ -352,9 +414,7 @@ void createQuickTuningRange(TuningParamSet *newSpace,
     PopulateParamsXDL tuningInfo;
 
     for (InitParamsAccel param : tuningInfo.orderInitParams(
-             tuningInfo.getTuningParameters(info.kernelType, info.gemmAType,
-                                            info.gemmBType, info.arch),
-             info.gemmSize)) {
+             tuningInfo.getCandidateParameters(info), info.gemmSize)) {
       if (succeeded(tuningInfo.paramsProbablyValid(b, info, param)))
         newSpace->tuningRange.push_back(cast<RockTuningParamAttrInterface>(
             tuningInfo.getGemmParamsAttr(b, param)));
@@ -363,9 +423,7 @@ void createQuickTuningRange(TuningParamSet *newSpace,
     // Wmma
     PopulateParamsWmma tuningInfo;
     for (InitParamsAccel param : tuningInfo.orderInitParams(
-             tuningInfo.getTuningParameters(info.kernelType, info.gemmAType,
-                                            info.gemmBType, info.arch),
-             info.gemmSize)) {
+             tuningInfo.getCandidateParameters(info), info.gemmSize)) {
       if (succeeded(tuningInfo.paramsProbablyValid(b, info, param)))
         newSpace->tuningRange.push_back(cast<RockTuningParamAttrInterface>(
             tuningInfo.getGemmParamsAttr(b, param)));
@@ -377,6 +435,7 @@ void createQuickTuningRange(TuningParamSet *newSpace,
              tuningInfo.getTuningParameters(info.kernelType, info.gemmAType,
                                             info.gemmBType),
              info.gemmSize)) {
+      tuningInfo.populateKPack(info, param);
       if (succeeded(tuningInfo.paramsProbablyValid(b, info, param)))
         newSpace->tuningRange.push_back(cast<RockTuningParamAttrInterface>(
             tuningInfo.getGemmParamsAttr(b, param)));
@@ -420,7 +479,8 @@ void createAttnTuningRangeQuick(TuningParamSet *newSpace, AttentionOp attnOp) {
                mnPerXdl, kPack] : attnQuickTuningListMFMA) {
       auto params = AttnPerfConfigAttr::get(
           attnOp.getContext(), mPerBlockG0, mPerBlockG1, nPerBlockG0,
-          kPackBerBlock, mPerWave, mnPerXdl, kPack, true);
+          kPackBerBlock, mPerWave, mnPerXdl, kPack, true,
+          /*pipelineKVLoop=*/false);
       newSpace->tuningRange.push_back(
           cast<RockTuningParamAttrInterface>(params));
     }
@@ -438,7 +498,8 @@ void createAttnTuningRangeQuick(TuningParamSet *newSpace, AttentionOp attnOp) {
                mnPerXdl, kPack] : attnQuickTuningListWMMA) {
       auto params = AttnPerfConfigAttr::get(
           attnOp.getContext(), mPerBlockG0, mPerBlockG1, nPerBlockG0,
-          kPackBerBlock, mPerWave, mnPerXdl, kPack, true);
+          kPackBerBlock, mPerWave, mnPerXdl, kPack, true,
+          /*pipelineKVLoop=*/false);
       newSpace->tuningRange.push_back(
           cast<RockTuningParamAttrInterface>(params));
     }
@@ -866,12 +927,109 @@ LogicalResult getTuningProblemStr(rock::RockGemmWrapperInterface gemmIF,
   return success();
 }
 
+/// Follows `v` through views to the value they view, setting `viewed` if
+/// there were any.
+static Value getViewRoot(Value v, bool &viewed) {
+  viewed = false;
+  while (auto view = v.getDefiningOp<ViewLikeOpInterface>()) {
+    v = view.getViewSource();
+    viewed = true;
+  }
+  return v;
+}
+
+static StringRef getIndexingKind(AffineMap map) {
+  if (map.isIdentity())
+    return "id";
+  if (map.isPermutation())
+    return "perm";
+  if (map.isProjectedPermutation())
+    return "bcast";
+  return "map";
+}
+
+/// Appends a whitespace-free signature of what is fused around `primary`,
+/// which writes `primaryOut`, or nothing if the kernel is unfused. Each
+/// `linalg.generic` in the kernel contributes the count of each op in its
+/// body, the type and indexing of its inputs other than the primary result
+/// ("+v" marks inputs read through a view), its output types and whether
+/// they're written through a view, and its reduction dimensions. Reductions
+/// and extra attention inputs are counted on their own.
+static void getFusionSignature(Operation *primary, Value primaryOut,
+                               raw_ostream &os) {
+  auto func = primary->getParentOfType<func::FuncOp>();
+  if (!func)
+    return;
+  bool viewed;
+  Value primaryRoot = getViewRoot(primaryOut, viewed);
+
+  SmallVector<std::string> parts;
+  func.walk([&](linalg::GenericOp generic) {
+    std::string part;
+    llvm::raw_string_ostream partOS(part);
+    std::map<std::string, int64_t> opCounts;
+    for (Operation &op : generic.getBody()->without_terminator())
+      ++opCounts[op.getName().getStringRef().str()];
+    partOS << "ops{";
+    llvm::interleave(
+        opCounts, partOS,
+        [&](const auto &entry) {
+          partOS << entry.first << "=" << entry.second;
+        },
+        ",");
+    partOS << "}in{";
+    SmallVector<std::string> inputs;
+    for (OpOperand *input : generic.getDpsInputOperands()) {
+      if (getViewRoot(input->get(), viewed) == primaryRoot)
+        continue;
+      std::string desc;
+      llvm::raw_string_ostream descOS(desc);
+      descOS << getElementTypeOrSelf(input->get().getType()) << ":"
+             << getIndexingKind(generic.getMatchingIndexingMap(input))
+             << (viewed ? "+v" : "");
+      inputs.push_back(descOS.str());
+    }
+    llvm::interleave(inputs, partOS, ",");
+    partOS << "}out{";
+    llvm::interleave(
+        generic.getDpsInits(), partOS,
+        [&](Value init) {
+          getViewRoot(init, viewed);
+          partOS << getElementTypeOrSelf(init.getType())
+                 << (viewed ? "+v" : "");
+        },
+        ",");
+    partOS << "}";
+    int64_t numReductions = generic.getNumReductionLoops();
+    if (numReductions > 0)
+      partOS << "red" << numReductions;
+    parts.push_back(partOS.str());
+  });
+  int64_t numReduceOps = 0;
+  func.walk([&](rock::ReduceOp) { ++numReduceOps; });
+  if (numReduceOps > 0)
+    parts.push_back("reduce=" + std::to_string(numReduceOps));
+  if (auto attnOp = dyn_cast<rock::AttentionOp>(primary))
+    if (!attnOp.getPreSoftmaxElemWiseInputs().empty())
+      parts.push_back(
+          "presoftmax=" +
+          std::to_string(attnOp.getPreSoftmaxElemWiseInputs().size()));
+
+  if (parts.empty())
+    return;
+  os << " -fusion ";
+  llvm::interleave(parts, os, ";");
+}
+
 // Suppose to return the structure of the given problem to tune, currently
 // combines the string representation of the selected field of the primary
 // operation. String format of the problem will not be required by the DB,
 // since it can store each field separately.
 // Currently serialize the problem in MIOpenDriver command friendly format
-LogicalResult getTuningProblemStr(ModuleOp mod, SmallVectorImpl<char> &out) {
+// When `withFusion` is set, a signature of the fused epilogue is appended, so
+// that a fused kernel can have a different config than its bare GEMM.
+LogicalResult getTuningProblemStr(ModuleOp mod, SmallVectorImpl<char> &out,
+                                  bool withFusion) {
   {
     rock::RockGemmWrapperInterface gemmIF;
     WalkResult findPrimary =
@@ -879,8 +1037,15 @@ LogicalResult getTuningProblemStr(ModuleOp mod, SmallVectorImpl<char> &out) {
           gemmIF = op;
           return WalkResult::interrupt();
         });
-    if (findPrimary.wasInterrupted())
-      return getTuningProblemStr(gemmIF, out);
+    if (findPrimary.wasInterrupted()) {
+      if (failed(getTuningProblemStr(gemmIF, out)))
+        return failure();
+      if (withFusion) {
+        llvm::raw_svector_ostream os(out);
+        getFusionSignature(gemmIF, gemmIF.getOutArgument()->get(), os);
+      }
+      return success();
+    }
   }
   {
     rock::AttentionOp attnOp;
@@ -889,8 +1054,15 @@ LogicalResult getTuningProblemStr(ModuleOp mod, SmallVectorImpl<char> &out) {
           attnOp = op;
           return WalkResult::interrupt();
         });
-    if (findAttention.wasInterrupted())
-      return getTuningProblemStr(attnOp, out);
+    if (findAttention.wasInterrupted()) {
+      if (failed(getTuningProblemStr(attnOp, out)))
+        return failure();
+      if (withFusion) {
+        llvm::raw_svector_ostream os(out);
+        getFusionSignature(attnOp, attnOp.getOut(), os);
+      }
+      return success();
+    }
   }
   return failure();
 }
@@ -913,15 +1085,20 @@ bool tuningTableUpdate(TuningTable *perfTable, StringRef problem,
 
 LogicalResult tuningTableLookup(TuningTable *perfTable, ModuleOp &mod,
                                 SmallVectorImpl<char> &out) {
+  // Prefer a config tuned for this fusion, and fall back to the one of the
+  // bare operation.
+  SmallString<2048> fusedProblem;
   SmallString<2048> problem;
-  if (failed(getTuningProblemStr(mod, problem)))
+  if (failed(getTuningProblemStr(mod, fusedProblem, /*withFusion=*/true)) ||
+      failed(getTuningProblemStr(mod, problem)))
     return failure();
   llvm::sys::SmartScopedReader<true> guard(perfTable->lock);
-  auto search = perfTable->tuningMap.find(problem);
-  if (search != perfTable->tuningMap.end()) {
-    auto entry = perfTable->tuningMap[problem];
-    out.assign(entry.first);
-    return success();
+  for (StringRef key : {fusedProblem.str(), problem.str()}) {
+    auto search = perfTable->tuningMap.find(key);
+    if (search != perfTable->tuningMap.end()) {
+      out.assign(search->second.first);
+      return success();
+    }
   }
   return failure();
 }
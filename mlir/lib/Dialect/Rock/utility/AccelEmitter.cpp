@@ -26,6 +26,7 @@
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Dialect/Rock/utility/loweringUtils.h"
+#include "mlir/Dialect/Rock/utility/math.h"
 #include "mlir/Dialect/Rock/utility/transformMapUtils.h"
 
 using namespace mlir;
@@ -560,6 +561,71 @@ Value MfmaEmitter::wrapLDSBufferForLoad(OpBuilder &b, Location loc,
     TransformMapAttr offsetAttr = offset.get();
     transformAttrs.push_back(offsetAttr);
 
+  } else if (doSplitKAcrossThreadsFirst) {
+    // Each thread reads the k rows it holds of the output of a k-reduction
+    // gemm, so that the output can be the other operand of this one straight
+    // from registers: rowGroupSize consecutive rows out of every
+    // kSpans * rowGroupSize, starting at blk_id * rowGroupSize. Those needn't
+    // line up with kpacks, so the buffer is read in vectors of the rows that
+    // are both in one row group and in one kpack (see
+    // getSplitKAcrossThreadsVectorLen()).
+    int64_t rowGroupSize = mfmaAttr.rowGroupSize;
+    int64_t kSpans = waveSize / inputSpanLen;
+    int64_t kPerThread = kpackPerThread * kPack;
+    int64_t vecLen = getSplitKAcrossThreadsVectorLen();
+    assert(kPerThread % rowGroupSize == 0 &&
+           "threads must hold whole row groups");
+    TopDownTMBuilder splitTid(b, {"tid", "d_iter", "k_iter"},
+                              {blockSize, dRepeats, kPerThread / vecLen});
+    splitTid.merge({"wave_id", "blk_id", "blk_td"}, {0, 1, 2}, "tid",
+                   {blockSize / waveSize, kSpans, inputSpanLen});
+    splitTid.passThrough({"d_iter"}, {3}, {"d_iter"});
+    splitTid.merge({"k_group", "k_item"}, {4, 5}, "k_iter",
+                   {kPerThread / rowGroupSize, rowGroupSize / vecLen});
+    TransformMapAttr splitTidAttr = splitTid.get();
+    transformAttrs.push_back(splitTidAttr);
+
+    TopDownTMBuilder splitWaveId =
+        TopDownTMBuilder::below(splitTid, splitTidAttr);
+    splitWaveId.merge({"wave_m", "wave_n"}, {0, 1}, "wave_id",
+                      {mWaves, nWaves});
+    splitWaveId.passThrough(
+        {"blk_id", "blk_td", "d_iter", "k_group", "k_item"}, {2, 3, 4, 5, 6},
+        {"blk_id", "blk_td", "d_iter", "k_group", "k_item"});
+    TransformMapAttr splitWaveIdAttr = splitWaveId.get();
+    transformAttrs.push_back(splitWaveIdAttr);
+
+    TopDownTMBuilder toLDSRowCol =
+        TopDownTMBuilder::below(splitWaveId, splitWaveIdAttr);
+    // d = blk_td + d_i * waveOffset
+    toLDSRowCol.unmerge("d", 0, {"d_iter", thisWaveDim, "blk_td"},
+                        {dRepeats, dWaves, inputSpanLen});
+    // k = (k_group * kSpans + blk_id) * rowGroupSize + k_item, in vectors
+    toLDSRowCol.unmerge(
+        "k", 1, {"k_group", "blk_id", "k_item"},
+        {kPerThread / rowGroupSize, kSpans, rowGroupSize / vecLen});
+    toLDSRowCol.ignore(otherWaveDim);
+    TransformMapAttr toLDSRowColAttr = toLDSRowCol.get();
+    transformAttrs.push_back(toLDSRowColAttr);
+
+    // The tile is stored as [kPerBlock][dPerBlock][kPack].
+    TopDownTMBuilder toKpacks =
+        TopDownTMBuilder::below(toLDSRowCol, toLDSRowColAttr);
+    toKpacks.passThrough({"d"}, {0}, {"d"});
+    toKpacks.merge({"k", "k_pack"}, {1, 2}, "k", {kPerBlock, kPack / vecLen});
+    TransformMapAttr toKpacksAttr = toKpacks.get();
+    transformAttrs.push_back(toKpacksAttr);
+
+    int64_t stride = (kPack == 1 ? dInCopyPerThread : 1);
+    auto offset = rotateIf(rotateDWithK, toKpacks, toKpacksAttr, stride, "d",
+                           dPerBlock, 0, "k", kPerBlock, {}, {"k", "k_pack"},
+                           transformAttrs);
+
+    offset.unmerge("source_offset", 0, {"k", "d", "k_pack"},
+                   {kPerBlock, dPerBlock, kPack / vecLen});
+
+    TransformMapAttr offsetAttr = offset.get();
+    transformAttrs.push_back(offsetAttr);
   } else {
     TopDownTMBuilder splitTid(b, {"tid", "d_iter", "k_iter"},
                               {blockSize, dRepeats, kpackPerThread});
@@ -587,15 +653,9 @@ Value MfmaEmitter::wrapLDSBufferForLoad(OpBuilder &b, Location loc,
     // d = blk_td + d_i * waveOffset
     toLDSRowCol.unmerge("d", 0, {"d_iter", thisWaveDim, "blk_td"},
                         {dRepeats, dWaves, inputSpanLen});
-    if (doSplitKAcrossThreadsFirst) {
-      // k = blk_id + (waveSize / inputSpanLen) * k_i
-      toLDSRowCol.unmerge("k", 1, {"k_iter", "blk_id"},
-                          {kpackPerThread, waveSize / inputSpanLen});
-    } else {
-      // k = k_i + kpackPerBlock * blk_id
-      toLDSRowCol.unmerge("k", 1, {"blk_id", "k_iter"},
-                          {waveSize / inputSpanLen, kpackPerThread});
-    }
+    // k = k_i + kpackPerBlock * blk_id
+    toLDSRowCol.unmerge("k", 1, {"blk_id", "k_iter"},
+                        {waveSize / inputSpanLen, kpackPerThread});
 
     toLDSRowCol.ignore(otherWaveDim);
 
@@ -627,6 +687,10 @@ int64_t MfmaEmitter::getRowGroupSize() const {
   return mfmaAttr.rowGroupSize;
 }
 
+int64_t MfmaEmitter::getSplitKAcrossThreadsVectorLen() const {
+  return math_util::gcd(getRowGroupSize(), tuningParams.getKpack());
+}
+
 RegsAsMatrixSubTiles MfmaEmitter::createAccelGemmOperandTransforms(
     OpBuilder &b, Location loc, int64_t kIters,
     ArrayRef<int64_t> bidGridLengths, int64_t blockSize,
@@ -936,14 +1000,18 @@ AccelEmitterParams WmmaEmitter::initAccelEmitterParams(
   int64_t kpackPerBlock = tuningParams.getKpackPerBlock();
   int64_t kPack = tuningParams.getKpack();
 
+  // On gfx12, the lanes sharing a row of the input each hold their own part
+  // of k, so each of them reads a slice of the kpacks.
+  int64_t kSplit = wmmaInsn.inputLen / wmmaInsn.kBase;
+
   params.mRepeats = wmmaInsn.mRepeats;
   params.nRepeats = wmmaInsn.nRepeats;
   params.nResultVectors = 1;
-  params.kpackPerThread = kpackPerBlock;
-  params.kBase = wmmaInsn.inputLen;
+  params.kpackPerThread = kpackPerBlock / kSplit;
+  params.kBase = wmmaInsn.kBase;
   params.mPerAccel = wmmaInsn.inputLen;
   params.nPerAccel = wmmaInsn.inputLen;
-  params.kBasePerThread = kpackPerBlock * kPack / params.kBase;
+  params.kBasePerThread = params.kpackPerThread * kPack / params.kBase;
 
   params.argTypeA = wmmaInsn.argTypeA;
   params.argTypeB = wmmaInsn.argTypeB;
@@ -952,6 +1020,20 @@ AccelEmitterParams WmmaEmitter::initAccelEmitterParams(
   return params;
 }
 
+/// Maps the `k_iter` of a lane and its `block_id`, the group of lanes it
+/// belongs to in the wave, to the `k` coordinate of the buffer. The groups
+/// either all read the whole of k or each read their slice of it.
+static void unmergeLaneK(TopDownTMBuilder &toLDSRowCol, uint32_t dim,
+                         int64_t kSplit, int64_t kpackPerThread) {
+  if (kSplit == 1) {
+    toLDSRowCol.passThrough({"k"}, {dim}, {"k_iter"});
+    toLDSRowCol.ignore("block_id");
+    return;
+  }
+  toLDSRowCol.unmerge("k", dim, {"block_id", "k_iter"},
+                      {kSplit, kpackPerThread});
+}
+
 Value WmmaEmitter::wrapLDSBufferForLoad(OpBuilder &b, Location loc,
                                         Value buffer, int64_t blockSize,
                                         int64_t dInCopyPerThread,
@@ -1016,8 +1098,7 @@ Value WmmaEmitter::wrapLDSBufferForLoad(OpBuilder &b, Location loc,
 
   TopDownTMBuilder toLDSRowCol =
       TopDownTMBuilder::below(replicateLanes, replicateLanesAttr);
-  toLDSRowCol.passThrough({"k"}, {1}, {"k_iter"});
-  toLDSRowCol.ignore("block_id");
+  unmergeLaneK(toLDSRowCol, 1, inputLen / wmmaInsn.kBase, kpackPerThread);
   toLDSRowCol.ignore(otherWaveDim);
   toLDSRowCol.unmerge("d", 0, {"d_iter", thisWaveDim, "block_td"},
                       {dRepeats, dWaves, dPerAccel});
@@ -1145,8 +1226,7 @@ RegsAsMatrixSubTiles WmmaEmitter::createAccelGemmOperandTransforms(
       toLDSRowCol.passThrough({"k_loop", "g_block"});
       toLDSRowCol.passThrough({thisBlockDim}, {2}, {thisBlockDim});
       toLDSRowCol.passThrough({"kpack"}, {3}, {"kpack"});
-      toLDSRowCol.passThrough({"k"}, {5}, {"k_iter"});
-      toLDSRowCol.ignore("block_id");
+      unmergeLaneK(toLDSRowCol, 5, inputLen / wmmaInsn.kBase, kpackPerThread);
       toLDSRowCol.ignore(otherWaveDim);
       toLDSRowCol.unmerge("d", 4, {"d_iter", thisWaveDim, "block_td"},
                           {dRepeats, dWaves, dPerAccel});
@@ -1232,8 +1312,7 @@ RegsAsMatrixSubTiles WmmaEmitter::createAccelGemmOperandTransforms(
         TopDownTMBuilder::below(replicateLanes, replicateLanesAttr);
     {
       toLDSRowCol.passThrough({"kpack"}, {0}, {"kpack"});
-      toLDSRowCol.passThrough({"k"}, {2}, {"k_iter"});
-      toLDSRowCol.ignore("block_id");
+      unmergeLaneK(toLDSRowCol, 2, inputLen / wmmaInsn.kBase, kpackPerThread);
       toLDSRowCol.ignore(otherWaveDim);
       toLDSRowCol.unmerge("d", 1, {"d_iter", thisWaveDim, "block_td"},
                           {dRepeats, dWaves, dPerAccel});
@@ -1341,19 +1420,25 @@ RegsAsMatrixSubTiles WmmaEmitter::computeOutputTransforms(
   // workitems 16 to 31 m_tid is 1 and they write at positions 1,3,5,..,15 .
   // This is outlined in https://gpuopen.com/learn/wmma_on_rdna3/
   //
+  // On gfx12 the items are contiguous instead: workitems 0 to 15 write rows
+  // 0 to 7 and workitems 16 to 31 write rows 8 to 15.
+  //
   // Note that `wave_m` and `wave_n` are strided by the inputLen, i.e., all the
   // waves will compute next to each other and then they will move to the next
   // subtile in the workgroup
-  SmallVector<StringRef, 5> dimNamesM{/*0=*/"m_block",
-                                      /*1=*/"rep_i",
-                                      /*2=*/"wave_m",
-                                      /*3=*/"item_i",
-                                      /*4=*/"m_tid"};
-  SmallVector<int64_t, 5> orderedDimStridesM{/*0=*/mPerBlock,
-                                             /*1=*/mWaves * wmmaInsn.inputLen,
-                                             /*2=*/wmmaInsn.inputLen,
-                                             /*3=*/wmmaInsn.outputStride,
-                                             /*4=*/1};
+  bool isItemContiguous = wmmaInsn.outputStride == 1;
+  size_t itemDim = isItemContiguous ? 4 : 3;
+  size_t mTidDim = isItemContiguous ? 3 : 4;
+  SmallVector<StringRef, 5> dimNamesM{"m_block", "rep_i", "wave_m"};
+  SmallVector<int64_t, 5> orderedDimStridesM{
+      mPerBlock, mWaves * wmmaInsn.inputLen, wmmaInsn.inputLen};
+  if (isItemContiguous) {
+    dimNamesM.append({"m_tid", "item_i"});
+    orderedDimStridesM.append({wmmaInsn.outputLen, 1});
+  } else {
+    dimNamesM.append({"item_i", "m_tid"});
+    orderedDimStridesM.append({wmmaInsn.outputStride, 1});
+  }
   SmallVector<int64_t, 7> dimSizesM;
   convertDimStridestoSizes(orderedDimStridesM, mLen, dimSizesM);
 
@@ -1439,8 +1524,8 @@ RegsAsMatrixSubTiles WmmaEmitter::computeOutputTransforms(
 
     auto toMatrixC =
         TopDownTMBuilder::below(splitMemoryCoords, splitMemoryCoordsAttr);
-    toMatrixC.unmerge("gemmM", 0, {dimNamesM[2], dimNamesM[4]},
-                      {dimSizesM[2], dimSizesM[4]});
+    toMatrixC.unmerge("gemmM", 0, {dimNamesM[2], dimNamesM[mTidDim]},
+                      {dimSizesM[2], dimSizesM[mTidDim]});
     toMatrixC.unmerge("gemmN", 1, {dimNamesN[2], dimNamesN[3]},
                       {dimSizesN[2], dimSizesN[3]});
     SmallVector<Attribute> transformAttrs{splitMemoryCoordsAttr,
@@ -1458,8 +1543,8 @@ RegsAsMatrixSubTiles WmmaEmitter::computeOutputTransforms(
 
     auto toMatrixC =
         TopDownTMBuilder::below(splitMemoryCoords, splitMemoryCoordsAttr);
-    toMatrixC.unmerge("gemmM", 0, {dimNamesM[1], dimNamesM[3]},
-                      {dimSizesM[1], dimSizesM[3]});
+    toMatrixC.unmerge("gemmM", 0, {dimNamesM[1], dimNamesM[itemDim]},
+                      {dimSizesM[1], dimSizesM[itemDim]});
     toMatrixC.unmerge("gemmN", 1, {dimNamesN[1]}, {dimSizesN[1]});
     TransformMapAttr toMatrixCAttr = toMatrixC.get();
     ret.threadSubTile = b.getArrayAttr({splitMemoryCoordsAttr, toMatrixCAttr});
@@ -1485,8 +1570,7 @@ AccelEmitter::select(GemmFeatures features, Type dataTypeA, Type dataTypeB,
     return std::make_unique<MfmaEmitter>(*maybeMfmaInsnGroup, arch,
                                          tuningParams);
   } else if (isWmma) {
-    int64_t waveSize = rock::lookupArchInfo(arch).waveSize;
-    auto maybeWmmaInsnGroup = WmmaInsn::select(dataTypeA, dataTypeB, waveSize,
+    auto maybeWmmaInsnGroup = WmmaInsn::select(dataTypeA, dataTypeB, arch,
                                                tuningParams.getMPerWave(),
                                                tuningParams.getNPerWave());
     if (failed(maybeWmmaInsnGroup)) {
@@ -1498,3 +1582,33 @@ AccelEmitter::select(GemmFeatures features, Type dataTypeA, Type dataTypeB,
     return nullptr;
   }
 }
+
+bool mlir::rock::accel::canBypassLDSForSecondGemm(
+    GemmFeatures features, Type elemTypeQ, Type elemTypeK, Type elemTypeV,
+    StringRef arch, RockAccelTuningParamAttrInterface params0,
+    RockAccelTuningParamAttrInterface params1) {
+  auto accelEmitterPtrGemm0 =
+      AccelEmitter::select(features, elemTypeQ, elemTypeK, arch, params0);
+  auto accelEmitterPtrGemm1 =
+      AccelEmitter::select(features, elemTypeV, elemTypeV, arch, params1);
+  auto mfmaEmitterGemm0 =
+      dyn_cast_or_null<MfmaEmitter>(accelEmitterPtrGemm0.get());
+  auto mfmaEmitterGemm1 =
+      dyn_cast_or_null<MfmaEmitter>(accelEmitterPtrGemm1.get());
+  if (!mfmaEmitterGemm0 || !mfmaEmitterGemm1)
+    return false;
+  // The values of V are read to match the rows of the gemm0 output each
+  // thread holds, which needs both gemms to split k across lane groups the
+  // same way. The kpack doesn't matter as V is read elementwise.
+  int64_t rowGroupSize = mfmaEmitterGemm1->getRowGroupSize();
+  if (!mfmaEmitterGemm0->isKReduction() || !mfmaEmitterGemm1->isKReduction() ||
+      mfmaEmitterGemm0->getRowGroupSize() != rowGroupSize)
+    return false;
+  // Each thread has to hold whole row groups of the k of gemm1.
+  int64_t kPerThread =
+      mfmaEmitterGemm1->getParams().kpackPerThread * params1.getKpack();
+  if (kPerThread % rowGroupSize != 0)
+    return false;
+  int64_t mWaves = params0.getMPerBlock() / params0.getMPerWave();
+  return mWaves == 1;
+}
@@ -19,47 +19,89 @@ using namespace mlir::rock;
 static constexpr AmdArchInfo
     gcnInfo(GemmFeatures::none, /*waveSize=*/64,
             /*maxWavesPerEU*/ 10, /*totalSGPRPerEU*/ 512,
-            /*totalVGPRPerEU*/ 256, /*totalSharedMemPerCU*/ 65536,
+            /*totalVGPRPerEU*/ 256,
+            /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 65536,
             /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/80,
-            /*hasFp8ConversionInstrs=*/false),
+            /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/1500,
+            /*accelFlopsPerClockPerCU=*/0,
+            /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/480,
+            /*l2BandwidthGBps=*/2000),
     cdna50Info(GemmFeatures::dot, /*waveSize=*/64, /*maxWavesPerEU*/ 8,
                /*totalSGPRPerEU*/ 512, /*totalVGPRPerEU*/ 256,
-               /*totalSharedMemPerCU*/ 65536, /*maxSharedMemPerWG*/ 65536,
-               /*numEUPerCU=*/4, /*minNumCU=*/10,
-               /*hasFp8ConversionInstrs=*/false),
+               /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 65536,
+               /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/10,
+               /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/1700,
+               /*accelFlopsPerClockPerCU=*/0,
+               /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/1024,
+               /*l2BandwidthGBps=*/2500),
     cdnaInfo(GemmFeatures::mfma | GemmFeatures::dot | GemmFeatures::atomic_add,
              /*waveSize=*/64, /*maxWavesPerEU*/ 8, /*totalSGPRPerEU*/ 512,
-             /*totalVGPRPerEU*/ 512, /*totalSharedMemPerCU*/ 65536,
+             /*totalVGPRPerEU*/ 512,
+             /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 65536,
              /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/120,
-             /*hasFp8ConversionInstrs=*/false),
+             /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/1500,
+             /*accelFlopsPerClockPerCU=*/1024,
+             /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/1228,
+             /*l2BandwidthGBps=*/3000),
     cdna2Info(GemmFeatures::mfma | GemmFeatures::dot | GemmFeatures::atomic_add,
               /*waveSize=*/64, /*maxWavesPerEU*/ 8, /*totalSGPRPerEU*/ 512,
-              /*totalVGPRPerEU*/ 512, /*totalSharedMemPerCU*/ 65536,
+              /*totalVGPRPerEU*/ 512,
+              /*maxLoadVGPRPerLane=*/512, /*totalSharedMemPerCU*/ 65536,
               /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/104,
-              /*hasFp8ConversionInstrs=*/false),
+              /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/1700,
+              /*accelFlopsPerClockPerCU=*/1024,
+              /*accelF64FlopsPerClockPerCU=*/256, /*hbmBandwidthGBps=*/1638,
+              /*l2BandwidthGBps=*/3400),
     cdna3Info(GemmFeatures::mfma | GemmFeatures::dot | GemmFeatures::atomic_add,
               /*waveSize=*/64, /*maxWavesPerEU*/ 10, /*totalSGPRPerEU*/ 512,
-              /*totalVGPRPerEU*/ 512, /*totalSharedMemPerCU*/ 65536,
+              /*totalVGPRPerEU*/ 512,
+              /*maxLoadVGPRPerLane=*/512, /*totalSharedMemPerCU*/ 65536,
               /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/228,
-              /*hasFp8ConversionInstrs=*/true),
+              /*hasFp8ConversionInstrs=*/true, /*clockMHz=*/2100,
+              /*accelFlopsPerClockPerCU=*/2048,
+              /*accelF64FlopsPerClockPerCU=*/256, /*hbmBandwidthGBps=*/5300,
+              /*l2BandwidthGBps=*/25000),
     // amdgpu target builds all RDNA in WGP Mode
     rdnaNoDotInfo(GemmFeatures::atomic_fmax_f32, /*waveSize=*/32,
                   /*maxWavesPerEU*/ 16, /*totalSGPRPerEU*/ 512,
-                  /*totalVGPRPerEU*/ 1024, /*totalSharedMemPerCU*/ 131072,
+                  /*totalVGPRPerEU*/ 1024,
+                  /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 131072,
                   /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4,
                   /*minNumCU=*/36,
-                  /*hasFp8ConversionInstrs=*/false),
+                  /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/1900,
+                  /*accelFlopsPerClockPerCU=*/0,
+                  /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/448,
+                  /*l2BandwidthGBps=*/1900),
     rdnaInfo(GemmFeatures::dot | GemmFeatures::atomic_fmax_f32,
              /*waveSize=*/32, /*maxWavesPerEU*/ 16, /*totalSGPRPerEU*/ 512,
-             /*totalVGPRPerEU*/ 1024, /*totalSharedMemPerCU*/ 131072,
+             /*totalVGPRPerEU*/ 1024,
+             /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 131072,
              /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/36,
-             /*hasFp8ConversionInstrs=*/false),
+             /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/2300,
+             /*accelFlopsPerClockPerCU=*/0,
+             /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/512,
+             /*l2BandwidthGBps=*/2300),
     gfx11Info(GemmFeatures::dot | GemmFeatures::atomic_add |
                   GemmFeatures::atomic_fmax_f32 | GemmFeatures::wmma,
               /*waveSize=*/32, /*maxWavesPerEU*/ 20, /*totalSGPRPerEU*/ 512,
-              /*totalVGPRPerEU*/ 1536, /*totalSharedMemPerCU*/ 131072,
+              /*totalVGPRPerEU*/ 1536,
+              /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 131072,
               /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/48,
-              /*hasFp8ConversionInstrs=*/false);
+              /*hasFp8ConversionInstrs=*/false, /*clockMHz=*/2400,
+              /*accelFlopsPerClockPerCU=*/512,
+              /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/624,
+              /*l2BandwidthGBps=*/2400),
+    // RDNA4 doubles the dense wmma rate and adds the OCP fp8 formats
+    gfx12Info(GemmFeatures::dot | GemmFeatures::atomic_add |
+                  GemmFeatures::atomic_fmax_f32 | GemmFeatures::wmma,
+              /*waveSize=*/32, /*maxWavesPerEU*/ 16, /*totalSGPRPerEU*/ 512,
+              /*totalVGPRPerEU*/ 1536,
+              /*maxLoadVGPRPerLane=*/256, /*totalSharedMemPerCU*/ 131072,
+              /*maxSharedMemPerWG*/ 65536, /*numEUPerCU=*/4, /*minNumCU=*/32,
+              /*hasFp8ConversionInstrs=*/true, /*clockMHz=*/2400,
+              /*accelFlopsPerClockPerCU=*/1024,
+              /*accelF64FlopsPerClockPerCU=*/0, /*hbmBandwidthGBps=*/640,
+              /*l2BandwidthGBps=*/2400);
 
 AmdArchInfo mlir::rock::lookupArchInfo(StringRef arch) {
   // Keep this implementation in sync with
@@ -94,6 +136,9 @@ AmdArchInfo mlir::rock::lookupArchInfo(StringRef arch) {
     // We know these chips have common features per backend
     return gfx11Info;
   }
+  if (major == "gfx12") {
+    return gfx12Info;
+  }
   llvm::errs() << "Warning: unknown architecture, falling back to defaults: "
                << arch << "\n";
   return gcnInfo;
@@ -104,8 +149,10 @@ GemmFeatures mlir::rock::AmdArchInfo::getDefaultFeatures(Type dataType) {
   bool isWmma = bitEnumContainsAll(theseFeatures, GemmFeatures::wmma);
   Type elementType = getElementTypeOrSelf(dataType);
   if (isWmma) {
+    bool isOcpFp8 =
+        elementType.isFloat8E4M3FN() || elementType.isFloat8E5M2();
     if (!elementType.isF16() && !elementType.isBF16() &&
-        !elementType.isInteger(8)) {
+        !elementType.isInteger(8) && !(isOcpFp8 && hasFp8ConversionInstrs)) {
       theseFeatures = bitEnumClear(theseFeatures, GemmFeatures::wmma);
     }
   }
@@ -114,5 +161,45 @@ GemmFeatures mlir::rock::AmdArchInfo::getDefaultFeatures(Type dataType) {
     if (dataType.isFloat8E4M3FNUZ() || dataType.isFloat8E5M2FNUZ())
       theseFeatures = bitEnumClear(theseFeatures, GemmFeatures::mfma);
   }
+  if (isMfma && elementType.isF64() && accelF64FlopsPerClockPerCU == 0)
+    theseFeatures = bitEnumClear(theseFeatures, GemmFeatures::mfma);
   return theseFeatures;
 }
+
+int64_t
+mlir::rock::AmdArchInfo::getAccelFlopsPerClockPerCU(Type dataType) const {
+  unsigned bitWidth = getElementTypeOrSelf(dataType).getIntOrFloatBitWidth();
+  if (bitWidth == 64)
+    return accelF64FlopsPerClockPerCU;
+  // 32-bit inputs run at a quarter of the 16-bit rate, and 8-bit inputs at
+  // twice that rate on the chips that have fp8 instructions.
+  if (bitWidth >= 32)
+    return accelFlopsPerClockPerCU / 4;
+  if (bitWidth <= 8 && hasFp8ConversionInstrs)
+    return accelFlopsPerClockPerCU * 2;
+  return accelFlopsPerClockPerCU;
+}
+
+int64_t mlir::rock::AmdArchInfo::getDotProductWidth(Type inputType,
+                                                    Type accType) const {
+  if (!bitEnumContainsAll(defaultFeatures, GemmFeatures::dot))
+    return 1;
+  // The bf16 dot product came with RDNA3, which is also where the wmma
+  // instructions first appeared.
+  bool hasBf16Dot = bitEnumContainsAll(defaultFeatures, GemmFeatures::wmma);
+  if ((inputType.isF16() || (inputType.isBF16() && hasBf16Dot)) &&
+      accType.isF32())
+    return 2;
+  if (inputType.isInteger(8) && accType.isInteger(32))
+    return 4;
+  // There are also 8-wide i4 dot products, but i4 isn't a gemm input type.
+  return 1;
+}
+
+double mlir::rock::AmdArchInfo::getHbmBytesPerClock() const {
+  return static_cast<double>(hbmBandwidthGBps) * 1000.0 / clockMHz;
+}
+
+double mlir::rock::AmdArchInfo::getL2BytesPerClock() const {
+  return static_cast<double>(l2BandwidthGBps) * 1000.0 / clockMHz;
+}
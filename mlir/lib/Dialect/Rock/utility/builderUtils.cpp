@@ -12,6 +12,7 @@
 #include "mlir/Dialect/Bufferization/IR/Bufferization.h"
 #include "mlir/Dialect/Linalg/IR/Linalg.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
 #include "mlir/IR/BuiltinAttributes.h"
 #include "mlir/IR/BuiltinTypes.h"
 #include "mlir/IR/TypeUtilities.h"
@@ -19,6 +20,8 @@
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/APInt.h"
 
+#include <algorithm>
+
 using mlir::arith::ConstantOp;
 
 namespace mlir {
@@ -44,6 +47,8 @@ Value createConstantFloatOp(OpBuilder &b, Location loc, Type type,
   auto semantics = static_cast<APFloat::Semantics>(-1);
   if (elementType.isF32()) {
     semantics = APFloat::S_IEEEsingle;
+  } else if (elementType.isF64()) {
+    semantics = APFloat::S_IEEEdouble;
   } else if (elementType.isF16()) {
     semantics = APFloat::S_IEEEhalf;
   } else if (elementType.isBF16()) {
@@ -52,6 +57,10 @@ Value createConstantFloatOp(OpBuilder &b, Location loc, Type type,
     semantics = APFloat::S_Float8E4M3FNUZ;
   } else if (elementType.isFloat8E5M2FNUZ()) {
     semantics = APFloat::S_Float8E5M2FNUZ;
+  } else if (elementType.isFloat8E4M3FN()) {
+    semantics = APFloat::S_Float8E4M3FN;
+  } else if (elementType.isFloat8E5M2()) {
+    semantics = APFloat::S_Float8E5M2;
   } else {
     llvm_unreachable("Unexpected float semantics");
   }
@@ -112,15 +121,19 @@ Value createTypeConversionOp(OpBuilder &b, Location loc, Value source,
       } else {
         result = b.create<arith::TruncIOp>(loc, destType, source);
       }
-    } else if (sourceElemType.getIntOrFloatBitWidth() < 32 &&
-               sourceElemType.isa<FloatType>() && destElemType.isF32()) {
+    } else if (sourceElemType.isa<FloatType>() &&
+               destElemType.isa<FloatType>() &&
+               sourceElemType.getIntOrFloatBitWidth() <
+                   destElemType.getIntOrFloatBitWidth()) {
       result = b.create<arith::ExtFOp>(loc, destType, source);
-    } else if (sourceElemType.isF32() && destElemType.isa<FloatType>() &&
-               destElemType.getIntOrFloatBitWidth() < 32) {
+    } else if (sourceElemType.isa<FloatType>() &&
+               destElemType.isa<FloatType>() &&
+               sourceElemType.getIntOrFloatBitWidth() >
+                   destElemType.getIntOrFloatBitWidth()) {
       result = b.create<arith::TruncFOp>(loc, destType, source);
     } else {
-      llvm_unreachable("Only float-to-float and int-to-int conversions "
-                       "allowed, and doubles are not supported");
+      llvm_unreachable("Only float-to-float conversions between widths and "
+                       "int-to-int conversions allowed");
     }
   }
   return result;
@@ -198,5 +211,186 @@ Value getAsTensor(OpBuilder &builder, Location loc, mlir::Value value,
   return origTensor;
 }
 
+// Multipliers and Weyl sequence key increments of Philox4x32, from Salmon et
+// al., "Parallel random numbers: as easy as 1, 2, 3".
+static constexpr uint32_t kPhiloxM0 = 0xD2511F53;
+static constexpr uint32_t kPhiloxM1 = 0xCD9E8D57;
+static constexpr uint32_t kPhiloxW0 = 0x9E3779B9;
+static constexpr uint32_t kPhiloxW1 = 0xBB67AE85;
+static constexpr int64_t kPhiloxRounds = 10;
+
+SmallVector<Value, 4> createPhilox4x32Op(OpBuilder &b, Location loc,
+                                         ArrayRef<Value> counter,
+                                         ArrayRef<Value> key) {
+  assert(counter.size() == 4 && key.size() == 2 &&
+         "Philox4x32 takes a 4-word counter and a 2-word key");
+  Type i32 = b.getI32Type();
+  auto constant = [&](uint32_t value) -> Value {
+    return b.createOrFold<arith::ConstantIntOp>(
+        loc, static_cast<int32_t>(value), i32);
+  };
+  Value m0 = constant(kPhiloxM0), m1 = constant(kPhiloxM1);
+  Value w0 = constant(kPhiloxW0), w1 = constant(kPhiloxW1);
+
+  SmallVector<Value, 4> c(counter);
+  Value k0 = key[0], k1 = key[1];
+  for (int64_t round = 0; round < kPhiloxRounds; ++round) {
+    if (round > 0) {
+      k0 = b.create<arith::AddIOp>(loc, k0, w0);
+      k1 = b.create<arith::AddIOp>(loc, k1, w1);
+    }
+    auto prod0 = b.create<arith::MulUIExtendedOp>(loc, m0, c[0]);
+    auto prod1 = b.create<arith::MulUIExtendedOp>(loc, m1, c[2]);
+    Value x0 = b.create<arith::XOrIOp>(
+        loc, b.create<arith::XOrIOp>(loc, prod1.getHigh(), c[1]), k0);
+    Value x2 = b.create<arith::XOrIOp>(
+        loc, b.create<arith::XOrIOp>(loc, prod0.getHigh(), c[3]), k1);
+    c = {x0, prod1.getLow(), x2, prod0.getLow()};
+  }
+  return c;
+}
+
+/// Splits the i64 `value` into its low and high i32 words.
+static std::pair<Value, Value> splitI64(OpBuilder &b, Location loc,
+                                        Value value) {
+  Type i32 = b.getI32Type();
+  Value shift = b.createOrFold<arith::ConstantIntOp>(loc, 32, b.getI64Type());
+  Value lo = b.create<arith::TruncIOp>(loc, i32, value);
+  Value hi = b.create<arith::TruncIOp>(
+      loc, i32, b.create<arith::ShRUIOp>(loc, value, shift));
+  return {lo, hi};
+}
+
+Value createDropoutKeepOp(OpBuilder &b, Location loc, Value seed,
+                          Value offset, Value linearIdx, double rate) {
+  Value idx =
+      b.create<arith::IndexCastUIOp>(loc, b.getI64Type(), linearIdx);
+  auto [idxLo, idxHi] = splitI64(b, loc, idx);
+  auto [offsetLo, offsetHi] = splitI64(b, loc, offset);
+  auto [seedLo, seedHi] = splitI64(b, loc, seed);
+  SmallVector<Value, 4> random = createPhilox4x32Op(
+      b, loc, {idxLo, idxHi, offsetLo, offsetHi}, {seedLo, seedHi});
+
+  // Keep the element if its uniform 32-bit draw is at or above rate * 2^32.
+  auto threshold = static_cast<uint32_t>(
+      std::min(rate * 4294967296.0, 4294967295.0));
+  Value thresholdVal = b.createOrFold<arith::ConstantIntOp>(
+      loc, static_cast<int32_t>(threshold), b.getI32Type());
+  return b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::uge, random[0],
+                                 thresholdVal);
+}
+
+Value createDropoutOp(OpBuilder &b, Location loc, Value value, Value seed,
+                      Value offset, Value linearIdx, double rate) {
+  Type elemType = value.getType();
+  Value keep = createDropoutKeepOp(b, loc, seed, offset, linearIdx, rate);
+  Value scale =
+      createConstantFloatOp(b, loc, elemType, elemType, 1.0 / (1.0 - rate));
+  Value scaled = b.create<arith::MulFOp>(loc, value, scale);
+  Value zero = createZeroConstantOp(b, loc, elemType);
+  return b.create<arith::SelectOp>(loc, keep, scaled, zero);
+}
+
+// Loads seqOffsets[idx] of a variable-length batch as an index.
+static Value loadSeqOffset(OpBuilder &b, Location loc, Value seqOffsets,
+                           Value idx) {
+  Value offset = b.create<memref::LoadOp>(loc, seqOffsets, ValueRange{idx});
+  return b.create<arith::IndexCastUIOp>(loc, b.getIndexType(), offset);
+}
+
+Value createFindSequenceOp(OpBuilder &b, Location loc, Value seqOffsets,
+                           Value pos, Value firstSeq, Value lastSeq) {
+  Value one = b.createOrFold<arith::ConstantIndexOp>(loc, 1);
+  Value lb = b.createOrFold<arith::AddIOp>(loc, firstSeq, one);
+  Value ub = b.createOrFold<arith::AddIOp>(loc, lastSeq, one);
+  auto loop = b.create<scf::ForOp>(
+      loc, lb, ub, one, ValueRange{firstSeq},
+      [&](OpBuilder &bodyb, Location loc, Value seq, ValueRange iterArgs) {
+        Value start = loadSeqOffset(bodyb, loc, seqOffsets, seq);
+        Value startsBefore = bodyb.create<arith::CmpIOp>(
+            loc, arith::CmpIPredicate::ule, start, pos);
+        Value found = bodyb.create<arith::SelectOp>(loc, startsBefore, seq,
+                                                    iterArgs[0]);
+        bodyb.create<scf::YieldOp>(loc, found);
+      });
+  return loop.getResult(0);
+}
+
+SmallVector<Value, 4> createLoadSeqBoundsOps(OpBuilder &b, Location loc,
+                                             Value seqOffsetsQ,
+                                             Value seqOffsetsK, Value seq) {
+  Value one = b.createOrFold<arith::ConstantIndexOp>(loc, 1);
+  Value next = b.create<arith::AddIOp>(loc, seq, one);
+  SmallVector<Value, 4> bounds;
+  for (Value seqOffsets : {seqOffsetsQ, seqOffsetsK})
+    for (Value idx : {seq, next})
+      bounds.push_back(loadSeqOffset(b, loc, seqOffsets, idx));
+  return bounds;
+}
+
+VarlenTileRange createVarlenTileRangeOps(OpBuilder &b, Location loc,
+                                         Value seqOffsetsQ, Value seqOffsetsK,
+                                         Value nBlock, int64_t nPerBlock,
+                                         int64_t mPerBlock, int64_t seqLenQ) {
+  int64_t numSeqs = cast<ShapedType>(seqOffsetsQ.getType()).getDimSize(0) - 1;
+  Value zero = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+  Value one = b.createOrFold<arith::ConstantIndexOp>(loc, 1);
+  Value lastSeqIdx = b.createOrFold<arith::ConstantIndexOp>(loc, numSeqs - 1);
+  Value nPerBlockVal = b.createOrFold<arith::ConstantIndexOp>(loc, nPerBlock);
+  Value mPerBlockVal = b.createOrFold<arith::ConstantIndexOp>(loc, mPerBlock);
+  Value seqLenQVal = b.createOrFold<arith::ConstantIndexOp>(loc, seqLenQ);
+
+  Value qBegin = b.create<arith::MulIOp>(loc, nBlock, nPerBlockVal);
+  Value qEnd = b.create<arith::MinUIOp>(
+      loc, b.create<arith::AddIOp>(loc, qBegin, nPerBlockVal), seqLenQVal);
+  Value qLast = b.create<arith::SubIOp>(loc, qEnd, one);
+
+  VarlenTileRange range;
+  range.firstSeq =
+      createFindSequenceOp(b, loc, seqOffsetsQ, qBegin, zero, lastSeqIdx);
+  range.lastSeq = createFindSequenceOp(b, loc, seqOffsetsQ, qLast,
+                                       range.firstSeq, lastSeqIdx);
+  range.firstSeqBounds =
+      createLoadSeqBoundsOps(b, loc, seqOffsetsQ, seqOffsetsK, range.firstSeq);
+  Value kBegin = range.firstSeqBounds[2];
+  Value kEnd = loadSeqOffset(b, loc, seqOffsetsK,
+                             b.create<arith::AddIOp>(loc, range.lastSeq, one));
+  range.mBegin = b.create<arith::DivUIOp>(loc, kBegin, mPerBlockVal);
+  range.mEnd = b.create<arith::CeilDivUIOp>(loc, kEnd, mPerBlockVal);
+  return range;
+}
+
+std::pair<Value, SmallVector<Value, 4>>
+createVarlenMaskOp(OpBuilder &b, Location loc, Value seqOffsetsQ,
+                   Value seqOffsetsK, const VarlenTileRange &range,
+                   ValueRange seqBounds, Value q, Value k) {
+  Value inSeq = b.create<arith::AndIOp>(
+      loc,
+      b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::uge, q,
+                              seqBounds[0]),
+      b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ult, q,
+                              seqBounds[1]));
+  auto lookup = b.create<scf::IfOp>(
+      loc, inSeq,
+      [&](OpBuilder &thenb, Location loc) {
+        thenb.create<scf::YieldOp>(loc, seqBounds);
+      },
+      [&](OpBuilder &elseb, Location loc) {
+        Value seq = createFindSequenceOp(elseb, loc, seqOffsetsQ, q,
+                                         range.firstSeq, range.lastSeq);
+        elseb.create<scf::YieldOp>(
+            loc, createLoadSeqBoundsOps(elseb, loc, seqOffsetsQ, seqOffsetsK,
+                                        seq));
+      });
+  Value kBegin = lookup.getResult(2);
+  Value kEnd = lookup.getResult(3);
+  Value beforeSeq =
+      b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::ult, k, kBegin);
+  Value afterSeq =
+      b.create<arith::CmpIOp>(loc, arith::CmpIPredicate::uge, k, kEnd);
+  Value outOfSeq = b.create<arith::OrIOp>(loc, beforeSeq, afterSeq);
+  return {outOfSeq, SmallVector<Value, 4>(lookup.getResults())};
+}
+
 } // namespace rock
 } // namespace mlir
@@ -1359,8 +1359,10 @@ mlir::rock::makeLinalgGenericWithIdentityAffMaps(PatternRewriter &b,
   return success();
 }
 
-TransformMapAttr mlir::rock::invertTransformMap(
-    OpBuilder &b, mlir::rock::TransformMapAttr transformMap, Location loc) {
+TransformMapAttr
+mlir::rock::invertTransformMap(OpBuilder &b,
+                               mlir::rock::TransformMapAttr transformMap,
+                               Location loc, bool padSlices) {
   ArrayRef<int64_t> lowShape = transformMap.getLowerBounds();
   llvm::IndexedMap<StringRef> lowNamesMap;
   if (!lowShape.empty())
@@ -1384,8 +1386,22 @@ TransformMapAttr mlir::rock::invertTransformMap(
       transform.passThrough(tattr.getUpperNames(), tattr.getUpperDims(),
                             tattr.getLowerNames());
       break;
+    case rock::TransformType::Slice: {
+      if (!padSlices)
+        return rock::TransformMapAttr();
+      // The params are begin1 end1 begin2 end2 ..., so the padding is
+      // begin1 (len1 - end1) ...
+      SmallVector<int64_t, 4> padParams;
+      ArrayRef<int64_t> params = tattr.getParams();
+      for (auto [i, dim] : llvm::enumerate(tattr.getLowerDims())) {
+        padParams.push_back(params[2 * i]);
+        padParams.push_back(lowShape[dim] - params[2 * i + 1]);
+      }
+      transform.pad(tattr.getUpperNames(), tattr.getUpperDims(),
+                    tattr.getLowerNames(), padParams);
+      break;
+    }
     case rock::TransformType::Pad:
-    case rock::TransformType::Slice:
     case rock::TransformType::Embed:
     case rock::TransformType::Broadcast: // Unsupported
       return rock::TransformMapAttr();
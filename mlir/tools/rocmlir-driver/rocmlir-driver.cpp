@@ -74,6 +74,11 @@ static cl::opt<bool> verifyPasses(
     "verify-passes", cl::init(false),
     cl::desc("Have the pass manager(s) run verification after each pass"));
 
+static cl::opt<std::string> mathPrecision(
+    "math-precision",
+    cl::desc("Precision of activation functions in fused kernels"),
+    cl::value_desc("exact, fast or fastest"), cl::init("exact"));
+
 static cl::opt<bool> dumpPipelines(
     "dump-pipelines", cl::init(false),
     cl::desc("Print out a textual form of the requested pipelines"));
@@ -171,7 +176,9 @@ runKernelPipeline(StringRef arch, ModuleOp kmod, bool isHighLevel,
   }
   if (kernelPipelineSet.contains("gpu")) {
     // Set up the default lowering pipeline which goes down to GPU dialect.
-    rock::buildKernelPipeline(pm);
+    rock::KernelOptions opts;
+    opts.mathPrecision = mathPrecision.getValue();
+    rock::buildKernelPipeline(pm, opts);
   }
   bool isRocdlOnly = kernelPipelineSet.contains("rocdl") &&
                      !kernelPipelineSet.contains("binary");
@@ -22,12 +22,14 @@
 #include "mlir/Dialect/Rock/IR/Rock.h"
 #include "mlir/Dialect/Rock/IR/RockTypes.h"
 #include "mlir/Dialect/Rock/Pipelines/Pipelines.h"
+#include "mlir/Dialect/Rock/Tuning/GridwiseGemmParams.h"
 #include "mlir/Dialect/Rock/Tuning/RockTuning.h"
 #include "mlir/Dialect/Rock/utility/AmdArchDb.h"
 #include "mlir/Dialect/Rock/utility/builderUtils.h"
 #include "mlir/Dialect/Rock/utility/loweringUtils.h"
 #include "mlir/Dialect/Rock/utility/transformMapUtils.h"
 #include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
 #include "mlir/Dialect/Tosa/IR/TosaOps.h"
 #include "mlir/Dialect/Utils/IndexingUtils.h"
 #include "mlir/Dialect/Utils/ReshapeOpsUtils.h"
@@ -63,6 +65,7 @@
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <limits>
 #include <tuple>
 
 using namespace mlir;
@@ -533,6 +536,71 @@ static llvm::cl::opt<bool> hasAttnBias(
     llvm::cl::desc("Generate an attention kernel that is using a bias"),
     llvm::cl::init(false));
 
+static llvm::cl::opt<float> attnDropout(
+    "attn-dropout",
+    llvm::cl::desc("Generate an attention kernel that applies dropout with "
+                   "the given rate to the softmax output, seeded by an extra "
+                   "2xi64 {seed, offset} argument"),
+    llvm::cl::value_desc("rate in [0, 1)"), llvm::cl::init(0.0f));
+
+static bool hasAttnDropout() { return attnDropout > 0.0f; }
+
+static llvm::cl::opt<uint64_t> attnDropoutSeed(
+    "attn-dropout-seed",
+    llvm::cl::desc("Seed (Philox key) that the host harness passes to an "
+                   "attention kernel with dropout"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<uint64_t> attnDropoutOffset(
+    "attn-dropout-offset",
+    llvm::cl::desc("Offset (upper half of the Philox counter) that the host "
+                   "harness passes to an attention kernel with dropout"),
+    llvm::cl::init(0));
+
+static llvm::cl::list<int64_t> attnVarlenSeqLensQ(
+    "attn-varlen-seq-q",
+    llvm::cl::desc("Generate a variable-length attention kernel whose "
+                   "queries are sequences of the given lengths, packed along "
+                   "seq_len_q (which becomes their sum)"),
+    llvm::cl::value_desc("comma-separated positive integers"),
+    llvm::cl::CommaSeparated);
+
+static llvm::cl::list<int64_t> attnVarlenSeqLensK(
+    "attn-varlen-seq-k",
+    llvm::cl::desc("Key lengths of the sequences of a variable-length "
+                   "attention kernel, packed along seq_len_k (which becomes "
+                   "their sum)"),
+    llvm::cl::value_desc("comma-separated positive integers"),
+    llvm::cl::CommaSeparated);
+
+static bool isAttnVarlen() { return !attnVarlenSeqLensQ.empty(); }
+
+/// Number of attention kernel arguments that aren't tensors of the problem's
+/// element types (the dropout seed and the varlen sequence offsets). They
+/// directly precede the output.
+static int64_t getNumAttentionAuxArgs() {
+  return (hasAttnDropout() ? 1 : 0) + (isAttnVarlen() ? 2 : 0);
+}
+
+enum class AttentionAuxArg { None, DropoutSeed, SeqOffsetsQ, SeqOffsetsK };
+
+/// Returns which auxiliary argument, if any, argument `idx` of an attention
+/// kernel whose output is argument `outIdx` is. They come in the order of the
+/// enum.
+static AttentionAuxArg getAttentionAuxArg(size_t idx, size_t outIdx) {
+  auto numAuxArgs = static_cast<size_t>(getNumAttentionAuxArgs());
+  if (idx >= outIdx || idx + numAuxArgs < outIdx)
+    return AttentionAuxArg::None;
+  size_t auxIdx = idx + numAuxArgs - outIdx;
+  if (hasAttnDropout()) {
+    if (auxIdx == 0)
+      return AttentionAuxArg::DropoutSeed;
+    --auxIdx;
+  }
+  return auxIdx == 0 ? AttentionAuxArg::SeqOffsetsQ
+                     : AttentionAuxArg::SeqOffsetsK;
+}
+
 static llvm::cl::opt<bool> transposeQ(
     "transQ",
     llvm::cl::desc("whether matrix Q of attention op is "
@@ -766,6 +834,12 @@ static llvm::cl::opt<bool> disableSplitKForTuning(
     llvm::cl::desc("disable split-K GEMM scheme for tuning"),
     llvm::cl::init(false));
 
+static llvm::cl::opt<bool> splitKWorkspace(
+    "split-k-workspace",
+    llvm::cl::desc("give GEMMs a workspace so that split-K reduces partial "
+                   "results in the kernel instead of with atomics"),
+    llvm::cl::init(false));
+
 ////////////////////////////////////////////////////////////////////////////////
 ////  Struct KernelIF
 ////  - Detected/capture kernel interface
@@ -1053,6 +1127,17 @@ static void populateDefaults() {
     }
   }
 
+  // A packed variable-length batch is as long as all its sequences.
+  if (isAttention && isAttnVarlen()) {
+    int64_t totalQ = 0, totalK = 0;
+    for (int64_t len : attnVarlenSeqLensQ)
+      totalQ += len;
+    for (int64_t len : attnVarlenSeqLensK)
+      totalK += len;
+    sequenceLengthQ = totalQ;
+    sequenceLengthK = totalK;
+  }
+
   if (isConv && outputHeight.getNumOccurrences() == 0) {
     outputHeight = rock::ConvGenerator::outputDim(
         inputHeight.getValue(), filterHeight.getValue(),
@@ -1110,6 +1195,21 @@ static LogicalResult detectMissingArguments() {
       llvm::errs() << "Type of the Attention operation is not specified\n";
       return failure();
     }
+    if (attnDropout < 0.0f || attnDropout >= 1.0f) {
+      llvm::errs() << "Attention dropout rate must be in [0, 1)\n";
+      return failure();
+    }
+    if (attnVarlenSeqLensQ.size() != attnVarlenSeqLensK.size()) {
+      llvm::errs() << "Variable-length attention needs as many key lengths "
+                      "as query lengths\n";
+      return failure();
+    }
+    auto isEmpty = [](int64_t len) { return len <= 0; };
+    if (llvm::any_of(attnVarlenSeqLensQ, isEmpty) ||
+        llvm::any_of(attnVarlenSeqLensK, isEmpty)) {
+      llvm::errs() << "Variable-length attention sequences can't be empty\n";
+      return failure();
+    }
   }
 
   return success();
@@ -1269,6 +1369,7 @@ static func::FuncOp createGPUWrapper(ModuleOp module, const KernelIF &kernel) {
 static Type typeFromString(StringRef name, MLIRContext *ctx) {
   std::optional<Type> result =
       llvm::StringSwitch<std::optional<Type>>(name)
+          .Case("f64", Float64Type::get(ctx))
           .Case("f32", Float32Type::get(ctx))
           .Case("f16", Float16Type::get(ctx))
           .Case("bf16", BFloat16Type::get(ctx))
@@ -1276,6 +1377,8 @@ static Type typeFromString(StringRef name, MLIRContext *ctx) {
           .Case("i32", IntegerType::get(ctx, 32))
           .Cases("bf8", "f8E5M2FNUZ", Float8E5M2FNUZType::get(ctx))
           .Cases("fp8", "f8E4M3FNUZ", Float8E4M3FNUZType::get(ctx))
+          .Case("f8E5M2", Float8E5M2Type::get(ctx))
+          .Case("f8E4M3FN", Float8E4M3FNType::get(ctx))
           .Default(std::nullopt);
   if (!result) {
     llvm::errs() << "Unknown data type: " << name << "\n";
@@ -1414,6 +1517,35 @@ static LogicalResult populateTensorFillLogic(OpBuilder &b, Location loc,
   return success();
 }
 
+/// Fills the 1-D `toFill` with the cumulative sums of `lengths`, starting at
+/// 0, which is the layout of variable-length attention sequence offsets.
+static void populateSeqOffsets(OpBuilder &b, Location loc,
+                               ArrayRef<int64_t> lengths, Value toFill) {
+  Type elemType = toFill.getType().cast<MemRefType>().getElementType();
+  int64_t offset = 0;
+  for (size_t i = 0; i <= lengths.size(); ++i) {
+    Value idx = b.createOrFold<arith::ConstantIndexOp>(loc, i);
+    Value offsetVal =
+        rock::createConstantIntOp(b, loc, elemType, elemType, offset);
+    b.create<memref::StoreOp>(loc, offsetVal, toFill, idx);
+    if (i < lengths.size())
+      offset += lengths[i];
+  }
+}
+
+/// Fills the 2xi64 `toFill` with the {seed, offset} of the Philox stream of
+/// attention dropout.
+static void populateDropoutSeed(OpBuilder &b, Location loc, Value toFill) {
+  Type i64 = b.getI64Type();
+  uint64_t values[] = {attnDropoutSeed, attnDropoutOffset};
+  for (auto [i, value] : llvm::enumerate(values)) {
+    Value idx = b.createOrFold<arith::ConstantIndexOp>(loc, i);
+    Value valueConst = b.createOrFold<arith::ConstantIntOp>(
+        loc, static_cast<int64_t>(value), i64);
+    b.create<memref::StoreOp>(loc, valueConst, toFill, idx);
+  }
+}
+
 static LogicalResult populateRandomTensorFillLogic(OpBuilder &b, Location loc,
                                                    ModuleOp module,
                                                    Type elemType, Value toFill,
@@ -1464,6 +1596,8 @@ static LogicalResult populateRandomTensorFillLogic(OpBuilder &b, Location loc,
         Value randVal;
         if (elemType.isIntOrIndex())
           randVal = b.create<arith::FPToSIOp>(loc, elemType, randFloat);
+        else if (elemType.isF64())
+          randVal = b.create<arith::ExtFOp>(loc, elemType, randFloat);
         else if (!elemType.isF32())
           randVal = b.create<arith::TruncFOp>(loc, elemType, randFloat);
         else
@@ -1677,13 +1811,15 @@ static void emitMemcpy(OpBuilder &b, Value src, Value dst) {
   }
 }
 
-// If the ref is float and not F32, make an F32 buffer and copy into it.
-// Used when a CPU kernel will have parameters that it can't handle natively.
+// If the ref is float and narrower than F32, make an F32 buffer and copy into
+// it. Used when a CPU kernel will have parameters that it can't handle
+// natively. F64 is kept so that it's verified at full precision.
 static Value ensureFloatIsF32(OpBuilder &b, Location loc, Value ref,
                               Type floatType) {
   auto refType = ref.getType().template dyn_cast<MemRefType>();
   Type refElemType = refType.getElementType();
-  if (!isa<FloatType>(refElemType) || refElemType.isF32())
+  if (!isa<FloatType>(refElemType) || refElemType.isF32() ||
+      refElemType.isF64())
     return ref;
   Value refFlat = makeNDMemRef(b, ref, 1);
   auto f32NewType = MemRefType::get(refType.getShape(), floatType);
@@ -2088,8 +2224,15 @@ static func::FuncOp createGpuGemmKernel(ModuleOp module,
   SmallVector<NamedAttribute, 2> funcAttrs = {
       b.getNamedAttr("kernel", b.getUnitAttr()),
       b.getNamedAttr("mhal.arch", archAttr)};
-  SmallVector<Type, 3> flatTypes =
+  SmallVector<Type, 4> flatTypes =
       llvm::map_to_vector(argTypes, rock::getFlattenedType);
+  // The verifier doesn't use split-K, so it doesn't need a workspace.
+  bool hasWorkspace = splitKWorkspace && !isVerifier;
+  if (hasWorkspace) {
+    int64_t workspaceBytes = rock::getMaxSplitKWorkspaceBytes(
+        rock::GemmSize(groupSize, gemmM, gemmK, gemmN));
+    flatTypes.push_back(MemRefType::get({workspaceBytes}, b.getI8Type()));
+  }
   auto func =
       b.create<func::FuncOp>(loc, isVerifier ? kernelNameVerifier : kernelName,
                              b.getFunctionType(flatTypes, {}), funcAttrs);
@@ -2113,11 +2256,12 @@ static func::FuncOp createGpuGemmKernel(ModuleOp module,
                                     expandedArgs);
 
   Value aVal = expandedArgs[0], bVal = expandedArgs[1], cVal = expandedArgs[2];
+  Value workspace = hasWorkspace ? func.getArgument(3) : nullptr;
 
   IntegerAttr numCUAttr =
       (num_cu.getNumOccurrences() > 0 ? b.getI32IntegerAttr(num_cu) : nullptr);
   auto gemm = b.create<rock::GemmOp>(
-      loc, /*resultTypes=*/TypeRange{}, aVal, bVal, cVal, transposeA,
+      loc, /*resultTypes=*/TypeRange{}, aVal, bVal, cVal, workspace, transposeA,
       transposeB, transposeC, archAttr.getValue(), numCUAttr, params.features,
       storeMethod,
       /*blockSize=*/nullptr, /*gridSize=*/nullptr, /*params=*/nullptr);
@@ -2184,6 +2328,20 @@ static void getAttentionTypes(SmallVectorImpl<Type> &result,
         MemRefType::get(biasDims, elemTypes[optionalArgsCounter++]);
     result.push_back(bType);
   }
+  if (hasAttnDropout()) {
+    // {seed, offset} of the Philox stream
+    MemRefType seedType =
+        MemRefType::get({2}, IntegerType::get(elemTypes[0].getContext(), 64));
+    result.push_back(seedType);
+  }
+  if (isAttnVarlen()) {
+    // Cumulative query and key lengths of the packed sequences
+    MemRefType offsetsType =
+        MemRefType::get({static_cast<int64_t>(attnVarlenSeqLensQ.size()) + 1},
+                        IntegerType::get(elemTypes[0].getContext(), 32));
+    result.push_back(offsetsType);
+    result.push_back(offsetsType);
+  }
   MemRefType outType =
       MemRefType::get(transposeO ? transposedODims : oDims, elemTypes.back());
   result.push_back(outType);
@@ -2216,6 +2374,12 @@ getAttentionDimNames(SmallVectorImpl<SmallVector<StringRef>> &result,
     result.emplace_back(SmallVector<StringRef>{gName, seqQName, seqKName});
   if (hasAttnBias)
     result.emplace_back(SmallVector<StringRef>{gName, seqQName, seqKName});
+  if (hasAttnDropout())
+    result.emplace_back(SmallVector<StringRef>{"seed_offset"});
+  if (isAttnVarlen()) {
+    result.emplace_back(SmallVector<StringRef>{"seq_offsets_q"});
+    result.emplace_back(SmallVector<StringRef>{"seq_offsets_k"});
+  }
 
   if (transposeO)
     result.emplace_back(SmallVector<StringRef>{gName, headVName, seqQName});
@@ -2315,16 +2479,27 @@ static func::FuncOp createGpuAttentionKernel(ModuleOp module,
     bias = unflattenedArgs[optionalArgsCounter++];
     elemwiseInputs.push_back(bias);
   }
+  Value dropoutSeed;
+  FloatAttr dropoutRateAttr;
+  if (hasAttnDropout()) {
+    dropoutSeed = unflattenedArgs[optionalArgsCounter++];
+    dropoutRateAttr = builder.getF32FloatAttr(attnDropout);
+  }
+  Value seqOffsetsQ, seqOffsetsK;
+  if (isAttnVarlen()) {
+    seqOffsetsQ = unflattenedArgs[optionalArgsCounter++];
+    seqOffsetsK = unflattenedArgs[optionalArgsCounter++];
+  }
   output = unflattenedArgs[optionalArgsCounter];
 
   IntegerAttr numCUAttr =
       (num_cu.getNumOccurrences() > 0 ? builder.getI32IntegerAttr(num_cu)
                                       : nullptr);
   auto attention = builder.create<rock::AttentionOp>(
-      loc, TypeRange{}, queries, keys, values, elemwiseInputs, output,
-      transposeQ, transposeK, transposeV, transposeO, archAttr, params.features,
-      numCUAttr,
-      /*params0=*/nullptr, /*params1=*/nullptr);
+      loc, TypeRange{}, queries, keys, values, elemwiseInputs, dropoutSeed,
+      seqOffsetsQ, seqOffsetsK, output, transposeQ, transposeK, transposeV,
+      transposeO, archAttr, params.features, numCUAttr, dropoutRateAttr,
+      /*params0=*/nullptr, /*params1=*/nullptr, /*pipelineKVLoop=*/nullptr);
   {
     Block *preSoftmaxElemwiseBlock =
         &attention.getPreSoftmaxBody().emplaceBlock();
@@ -2426,9 +2601,8 @@ static func::FuncOp createCpuGemmKernelWithMlir(ModuleOp module,
   auto expandArg = [&loc, &b](Value arg, Type rawLogicalType) -> Value {
     auto logicalType = cast<MemRefType>(rawLogicalType);
     // Replicate the effect of ensureFloatIsF32()
-    if (isa<FloatType>(logicalType.getElementType()))
-      logicalType = cast<MemRefType>(
-          logicalType.clone(Float32Type::get(arg.getContext())));
+    logicalType = cast<MemRefType>(
+        logicalType.clone(cast<MemRefType>(arg.getType()).getElementType()));
     ArrayRef<int64_t> logicalShape = logicalType.getShape();
     ReassociationIndices allDims = llvm::to_vector(
         llvm::iota_range<int64_t>(0, logicalShape.size(), false));
@@ -2583,6 +2757,65 @@ static func::FuncOp createCpuAttentionKernelWithMlir(ModuleOp module,
         qkTensor, biasTensor);
   }
 
+  if (isAttnVarlen()) {
+    // Only let queries attend to keys of their own sequence. The sequence
+    // of a token is the number of sequence starts (after the first) at or
+    // before it, which is computed from the lengths given on the command line
+    // rather than read back from the offset arguments.
+    SmallVector<int64_t> startsQ, startsK;
+    int64_t offsetQ = 0, offsetK = 0;
+    for (auto [lenQ, lenK] :
+         llvm::zip(attnVarlenSeqLensQ, attnVarlenSeqLensK)) {
+      offsetQ += lenQ;
+      offsetK += lenK;
+      startsQ.push_back(offsetQ);
+      startsK.push_back(offsetK);
+    }
+    startsQ.pop_back();
+    startsK.pop_back();
+
+    auto qkType = qkTensor.getType().cast<RankedTensorType>();
+    Type elemType = qkType.getElementType();
+    Value init =
+        builder.create<tensor::EmptyOp>(loc, qkType.getShape(), elemType);
+    SmallVector<AffineMap, 2> indexingMaps(
+        2, builder.getMultiDimIdentityMap(qkType.getRank()));
+    SmallVector<utils::IteratorType> iteratorTypes(
+        qkType.getRank(), utils::IteratorType::parallel);
+    qkTensor =
+        builder
+            .create<linalg::GenericOp>(
+                loc, qkType, qkTensor, init, indexingMaps, iteratorTypes,
+                [&](OpBuilder &b, Location loc, ValueRange args) {
+                  auto sequenceOf = [&](Value token, ArrayRef<int64_t> starts) {
+                    Value seq = b.createOrFold<arith::ConstantIndexOp>(loc, 0);
+                    Value one = b.createOrFold<arith::ConstantIndexOp>(loc, 1);
+                    for (int64_t start : starts) {
+                      Value startVal =
+                          b.createOrFold<arith::ConstantIndexOp>(loc, start);
+                      Value isAfter = b.create<arith::CmpIOp>(
+                          loc, arith::CmpIPredicate::uge, token, startVal);
+                      Value next = b.create<arith::AddIOp>(loc, seq, one);
+                      seq = b.create<arith::SelectOp>(loc, isAfter, next, seq);
+                    }
+                    return seq;
+                  };
+                  Value seqQ =
+                      sequenceOf(b.create<linalg::IndexOp>(loc, 1), startsQ);
+                  Value seqK =
+                      sequenceOf(b.create<linalg::IndexOp>(loc, 2), startsK);
+                  Value sameSeq = b.create<arith::CmpIOp>(
+                      loc, arith::CmpIPredicate::eq, seqQ, seqK);
+                  Value negInf = rock::createConstantFloatOp(
+                      b, loc, elemType, elemType,
+                      -std::numeric_limits<float>::infinity());
+                  Value masked =
+                      b.create<arith::SelectOp>(loc, sameSeq, args[0], negInf);
+                  b.create<linalg::YieldOp>(loc, masked);
+                })
+            .getResult(0);
+  }
+
   constexpr int64_t reductionAxis = 2;
   auto qkMaxs = createOpAndInfer<tosa::ReduceMaxOp>(
       builder, loc, qkTensor.getType().cast<ShapedType>().getElementType(),
@@ -2603,6 +2836,46 @@ static func::FuncOp createCpuAttentionKernelWithMlir(ModuleOp module,
   Value softmaxTensor = createOpAndInfer<tosa::MulOp>(
       builder, loc, expsSums.getType().cast<ShapedType>().getElementType(),
       expsTensor, invExpsSums, /*shift=*/0);
+  if (hasAttnDropout()) {
+    // Regenerate the kernel's dropout mask from the same Philox stream, so
+    // that the result can be checked exactly.
+    Value seedTensor = builder.create<bufferization::ToTensorOp>(
+        loc, block->getArgument(optionalArgsCounter++), /*restrict=*/true,
+        /*writable=*/false);
+    Value zeroIdx = builder.createOrFold<arith::ConstantIndexOp>(loc, 0);
+    Value oneIdx = builder.createOrFold<arith::ConstantIndexOp>(loc, 1);
+    Value seed = builder.create<tensor::ExtractOp>(loc, seedTensor, zeroIdx);
+    Value offset = builder.create<tensor::ExtractOp>(loc, seedTensor, oneIdx);
+
+    auto softmaxType = softmaxTensor.getType().cast<RankedTensorType>();
+    ArrayRef<int64_t> shape = softmaxType.getShape();
+    Type elemType = softmaxType.getElementType();
+    Value init = builder.create<tensor::EmptyOp>(loc, shape, elemType);
+    SmallVector<AffineMap, 2> indexingMaps(
+        2, builder.getMultiDimIdentityMap(shape.size()));
+    SmallVector<utils::IteratorType> iteratorTypes(
+        shape.size(), utils::IteratorType::parallel);
+    softmaxTensor =
+        builder
+            .create<linalg::GenericOp>(
+                loc, softmaxType, softmaxTensor, init, indexingMaps,
+                iteratorTypes,
+                [&](OpBuilder &b, Location loc, ValueRange args) {
+                  AffineExpr g, q, k;
+                  bindDims(b.getContext(), g, q, k);
+                  Value linearIdx = b.createOrFold<affine::AffineApplyOp>(
+                      loc,
+                      AffineMap::get(3, 0, (g * shape[1] + q) * shape[2] + k,
+                                     b.getContext()),
+                      ValueRange{b.create<linalg::IndexOp>(loc, 0),
+                                 b.create<linalg::IndexOp>(loc, 1),
+                                 b.create<linalg::IndexOp>(loc, 2)});
+                  Value dropped = rock::createDropoutOp(
+                      b, loc, args[0], seed, offset, linearIdx, attnDropout);
+                  b.create<linalg::YieldOp>(loc, dropped);
+                })
+            .getResult(0);
+  }
 #ifdef ROCK_DEBUG_ATTENTION_REMOVE_SOFTMAX
   softmaxTensor = qkTensor;
 #endif
@@ -2976,9 +3249,11 @@ static void insertValidationCalls(const GenParams &genParams, OpBuilder &b,
       if (hasAccel)
         convGenerator.flipAccel();
       if (!((hasAccel || heuristicValidation) &&
-            genConfig.inputDataTypeStr == "i8"))
+            genConfig.inputDataTypeStr == "i8") &&
+          genConfig.inputDataTypeStr != "f64")
         // use f32 data type to verify non-f32 or xdlops f32 kernels
-        // except that i8 xdlops or tuned is verified with i8 non-xdlops.
+        // except that i8 xdlops or tuned is verified with i8 non-xdlops
+        // and f64 is verified with f64 non-xdlops.
         convGenerator.setDataTypes("f32");
 
       int kernelStart = genConfig.kernelId;
@@ -3036,16 +3311,19 @@ static void insertValidationCalls(const GenParams &genParams, OpBuilder &b,
                                               mlir::rock::GemmFeatures::wmma);
 
       if (!((heuristicValidation || hasAccel) &&
-            genParams.types[0].isInteger(8)))
+            genParams.types[0].isInteger(8)) &&
+          !genParams.types[0].isF64())
         // use f32 data type to verify non-f32 or xdlops f32 kernels
         // except that i8 xdops is verified with i8 non-xdolps and tuned i8 is
-        // verified with itself in heuristic mode.
+        // verified with itself in heuristic mode. f64 is verified in f64.
         newParams.types = SmallVector<Type>(3, b.getF32Type());
 
       KernelIF kernel(
           createGpuGemmKernel(module, newParams, /*isVerifier=*/true));
       auto kernelWrapperFunc = createGPUWrapper(module, kernel);
-      b.create<func::CallOp>(loc, kernelWrapperFunc, valVars);
+      // Leave out the split-K workspace, which the verifier doesn't take.
+      b.create<func::CallOp>(loc, kernelWrapperFunc,
+                             ValueRange(valVars).take_front(3));
     }
   } else if (validationType != "clone") { // -pv_with_cpp or -pv_with_mlir (-pv)
     // Emit call to host_<conv>
@@ -3060,7 +3338,8 @@ static void insertValidationCalls(const GenParams &genParams, OpBuilder &b,
         exit(1);
       }
       auto cpuGemmFunc = createCpuGemmKernelWithMlir(module, genParams);
-      b.create<func::CallOp>(loc, cpuGemmFunc, valVars);
+      b.create<func::CallOp>(loc, cpuGemmFunc,
+                             ValueRange(valVars).take_front(3));
     } else if (genParams.operation == rock::KernelType::Attention) {
       if (validationType == "cpp") {
         llvm::errs() << "External attention validator is not available\n";
@@ -3173,12 +3452,28 @@ static LogicalResult populateHostHarnessLogic(
         ++optionalArgsCounter;
       if (hasAttnBias)
         ++optionalArgsCounter;
+      optionalArgsCounter += getNumAttentionAuxArgs();
       outIndices.push_back(optionalArgsCounter);
     }
   } else {
     outIndices = root0.outIndices;
   }
 
+  // The attention dropout seed and varlen sequence offsets have no entry in
+  // `types`, and are filled with the values given on the command line rather
+  // than with test data.
+  auto getAuxArg = [&](size_t idx) {
+    if (genParams.operation != rock::KernelType::Attention)
+      return AttentionAuxArg::None;
+    return getAttentionAuxArg(idx, static_cast<size_t>(outIndices.front()));
+  };
+
+  // The split-K workspace follows A, B and C in generated gemm kernels.
+  auto isSplitKWorkspace = [&](size_t idx) {
+    return splitKWorkspace && !isCPUKernel &&
+           genParams.operation == rock::KernelType::Gemm && idx == 3;
+  };
+
   SmallVector<Value, 5> localVars;
   SmallVector<Value, 5> valVars;
   for (auto [idx, paramType] : llvm::enumerate(root0.params)) {
@@ -3187,9 +3482,10 @@ static LogicalResult populateHostHarnessLogic(
     Type elemType = paramMRType.getElementType();
     bool isSmallFloat =
         isa<FloatType>(elemType) && elemType.getIntOrFloatBitWidth() < 32;
+    AttentionAuxArg auxArg = getAuxArg(idx);
     if (isCPUKernel) { // -prc
       if (genParams.operation.has_value()) {
-        if (idx < genParams.types.size())
+        if (idx < genParams.types.size() && auxArg == AttentionAuxArg::None)
           elemType = genParams.types[idx];
         if (isa<IntegerType>(elemType) && llvm::is_contained(outIndices, idx))
           elemType = b.getIntegerType(64);
@@ -3198,7 +3494,17 @@ static LogicalResult populateHostHarnessLogic(
     }
     auto lvar = b.create<memref::AllocOp>(loc, paramMRType);
     localVars.push_back(lvar);
-    if (!isRandom) {
+    if (auxArg == AttentionAuxArg::DropoutSeed) {
+      populateDropoutSeed(b, loc, lvar);
+    } else if (auxArg == AttentionAuxArg::SeqOffsetsQ) {
+      populateSeqOffsets(b, loc, attnVarlenSeqLensQ, lvar);
+    } else if (auxArg == AttentionAuxArg::SeqOffsetsK) {
+      populateSeqOffsets(b, loc, attnVarlenSeqLensK, lvar);
+    } else if (isSplitKWorkspace(idx)) {
+      // The arrival counters in the workspace must start out at zero.
+      if (failed(populateTensorFillLogic(b, loc, {0.0f}, elemType, lvar)))
+        return failure();
+    } else if (!isRandom) {
       SmallVector<float, 3> initPattern = getTensorInitPattern(elemType);
       if (failed(populateTensorFillLogic(b, loc, initPattern, elemType, lvar)))
         return failure();
@@ -3218,7 +3524,7 @@ static LogicalResult populateHostHarnessLogic(
           // validate in int64_t to detect overflow
           valElemType = b.getIntegerType(64);
       } else if ((genValidation == "clone") || elemType.isInteger(8) ||
-                 elemType.isInteger(32)) {
+                 elemType.isInteger(32) || elemType.isF64()) {
         valElemType = elemType;
       } else if (!gpuValidation && isSmallFloat &&
                  genParams.operation.has_value()) {
@@ -3754,7 +4060,8 @@ int main(int argc, char **argv) {
 
   if (emitTuningKey) {
     SmallString<2048> tuningKey;
-    if (failed(rock::getTuningProblemStr(*module, tuningKey))) {
+    if (failed(rock::getTuningProblemStr(*module, tuningKey,
+                                         /*withFusion=*/true))) {
       llvm::errs() << "Failed to get tuning key for module: " << *module
                    << "\n";
       return EXIT_FAILURE;
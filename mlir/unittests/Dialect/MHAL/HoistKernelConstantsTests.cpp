@@ -0,0 +1,142 @@
+//===- HoistKernelConstantsTests.cpp - Tests for kernel constant hoisting -===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/Func/Transforms/Passes.h"
+#include "mlir/Dialect/MHAL/Transforms/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+
+class HoistKernelConstantsTest : public ::testing::Test {
+protected:
+  HoistKernelConstantsTest() {
+    context.loadDialect<func::FuncDialect, tosa::TosaDialect>();
+  }
+
+  /// Runs mhal-hoist-kernel-constants with `maxInlineElements` followed by
+  /// duplicate-function-elimination on `source`, as the graph pipeline does.
+  void run(StringRef source, int64_t maxInlineElements = 1) {
+    module = parseSourceString<ModuleOp>(source, &context);
+    ASSERT_TRUE(module);
+    PassManager pm(&context);
+    mhal::MHALHoistKernelConstantsPassOptions options;
+    options.maxInlineElements = maxInlineElements;
+    pm.addPass(mhal::createMHALHoistKernelConstantsPass(options));
+    pm.addPass(func::createDuplicateFunctionEliminationPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+  }
+
+  SmallVector<func::FuncOp> getKernels() {
+    SmallVector<func::FuncOp> kernels;
+    module->walk([&](func::FuncOp func) {
+      if (func->hasAttr("kernel"))
+        kernels.push_back(func);
+    });
+    return kernels;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+/// Returns two layers that add the constants `firstBias` and `secondBias` of
+/// type `tensor<4xf32>` to their input, each in its own kernel.
+static std::string makeLayers(StringRef firstBias, StringRef secondBias) {
+  auto makeKernel = [](StringRef name, StringRef bias) {
+    return R"mlir(
+      func.func private @)mlir" +
+           name.str() + R"mlir((%x: !t) -> !t attributes {kernel} {
+        %bias = "tosa.const"() {value = dense<)mlir" +
+           bias.str() + R"mlir(> : !t} : () -> !t
+        %0 = tosa.add %x, %bias : (!t, !t) -> !t
+        return %0 : !t
+      }
+    )mlir";
+  };
+  return "!t = tensor<4xf32>\n" + makeKernel("layer0", firstBias) +
+         makeKernel("layer1", secondBias) + R"mlir(
+    func.func @main(%x: !t) -> !t {
+      %0 = call @layer0(%x) : (!t) -> !t
+      %1 = call @layer1(%0) : (!t) -> !t
+      return %1 : !t
+    }
+  )mlir";
+}
+
+TEST_F(HoistKernelConstantsTest, MergesLayersDifferingInBiases) {
+  run(makeLayers("[1.0, 2.0, 3.0, 4.0]", "[5.0, 6.0, 7.0, 8.0]"));
+  SmallVector<func::FuncOp> kernels = getKernels();
+  ASSERT_EQ(kernels.size(), 1u);
+  EXPECT_EQ(kernels[0].getNumArguments(), 2u);
+  EXPECT_TRUE(kernels[0].getOps<tosa::ConstOp>().empty());
+
+  // Both layers call the remaining kernel, each with its own bias.
+  SmallVector<func::CallOp> calls;
+  module->walk([&](func::CallOp call) { calls.push_back(call); });
+  ASSERT_EQ(calls.size(), 2u);
+  SmallVector<DenseElementsAttr> biases;
+  for (func::CallOp call : calls) {
+    EXPECT_EQ(call.getCallee(), kernels[0].getName());
+    ASSERT_EQ(call.getNumOperands(), 2u);
+    auto bias = call.getOperand(1).getDefiningOp<tosa::ConstOp>();
+    ASSERT_TRUE(bias);
+    biases.push_back(cast<DenseElementsAttr>(bias.getValue()));
+  }
+  EXPECT_NE(biases[0], biases[1]);
+}
+
+// Splats stay behind so that they can still be folded into the kernel.
+TEST_F(HoistKernelConstantsTest, KeepsSplats) {
+  run(makeLayers("1.0", "2.0"));
+  SmallVector<func::FuncOp> kernels = getKernels();
+  ASSERT_EQ(kernels.size(), 2u);
+  for (func::FuncOp kernel : kernels)
+    EXPECT_EQ(kernel.getNumArguments(), 1u);
+}
+
+TEST_F(HoistKernelConstantsTest, KeepsSmallConstants) {
+  run(makeLayers("[1.0, 2.0, 3.0, 4.0]", "[5.0, 6.0, 7.0, 8.0]"),
+      /*maxInlineElements=*/4);
+  EXPECT_EQ(getKernels().size(), 2u);
+}
+
+// The permutation of a transpose is needed at compile time, so only the bias
+// becomes an argument.
+TEST_F(HoistKernelConstantsTest, KeepsConfigurationOperands) {
+  run(R"mlir(
+    !t = tensor<2x4xf32>
+    !tt = tensor<4x2xf32>
+    func.func private @layer(%x: !t) -> !tt attributes {kernel} {
+      %perms = "tosa.const"() {value = dense<[1, 0]> : tensor<2xi32>}
+          : () -> tensor<2xi32>
+      %bias = "tosa.const"() {
+          value = dense<[[1.0, 2.0], [3.0, 4.0], [5.0, 6.0], [7.0, 8.0]]>
+          : !tt} : () -> !tt
+      %0 = tosa.transpose %x, %perms : (!t, tensor<2xi32>) -> !tt
+      %1 = tosa.add %0, %bias : (!tt, !tt) -> !tt
+      return %1 : !tt
+    }
+    func.func @main(%x: !t) -> !tt {
+      %0 = call @layer(%x) : (!t) -> !tt
+      return %0 : !tt
+    }
+  )mlir");
+  SmallVector<func::FuncOp> kernels = getKernels();
+  ASSERT_EQ(kernels.size(), 1u);
+  EXPECT_EQ(kernels[0].getNumArguments(), 2u);
+  kernels[0].walk([](tosa::TransposeOp transpose) {
+    EXPECT_TRUE(transpose.getPerms().getDefiningOp<tosa::ConstOp>());
+  });
+}
@@ -0,0 +1,96 @@
+//===- HorizontalFusionTests.cpp - Tests for sibling GEMM merging ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MHAL/Transforms/Passes.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+
+class HorizontalFusionTest : public ::testing::Test {
+protected:
+  HorizontalFusionTest() {
+    context.loadDialect<func::FuncDialect, tosa::TosaDialect>();
+  }
+
+  /// Runs mhal-horizontal-fusion on every function in `source`.
+  void run(StringRef source) {
+    module = parseSourceString<ModuleOp>(source, &context);
+    ASSERT_TRUE(module);
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(mhal::createMHALHorizontalFusionPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+  }
+
+  template <typename OpTy>
+  SmallVector<OpTy> collect() {
+    SmallVector<OpTy> ops;
+    module->walk([&](OpTy op) { ops.push_back(op); });
+    return ops;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+TEST_F(HorizontalFusionTest, MergesConstantWeightMatmuls) {
+  run(R"mlir(
+    func.func @qkv(%x: tensor<1x4x8xf32>)
+        -> (tensor<1x4x16xf32>, tensor<1x4x16xf32>, tensor<1x4x32xf32>) {
+      %wq = "tosa.const"() {value = dense<1.0> : tensor<1x8x16xf32>}
+          : () -> tensor<1x8x16xf32>
+      %wk = "tosa.const"() {value = dense<2.0> : tensor<1x8x16xf32>}
+          : () -> tensor<1x8x16xf32>
+      %wv = "tosa.const"() {value = dense<3.0> : tensor<1x8x32xf32>}
+          : () -> tensor<1x8x32xf32>
+      %q = tosa.matmul %x, %wq
+          : (tensor<1x4x8xf32>, tensor<1x8x16xf32>) -> tensor<1x4x16xf32>
+      %k = tosa.matmul %x, %wk
+          : (tensor<1x4x8xf32>, tensor<1x8x16xf32>) -> tensor<1x4x16xf32>
+      %v = tosa.matmul %x, %wv
+          : (tensor<1x4x8xf32>, tensor<1x8x32xf32>) -> tensor<1x4x32xf32>
+      return %q, %k, %v
+          : tensor<1x4x16xf32>, tensor<1x4x16xf32>, tensor<1x4x32xf32>
+    }
+  )mlir");
+  SmallVector<tosa::MatMulOp> matmuls = collect<tosa::MatMulOp>();
+  ASSERT_EQ(matmuls.size(), 1u);
+  auto wideType = matmuls[0].getType().cast<ShapedType>();
+  EXPECT_EQ(wideType.getShape(), ArrayRef<int64_t>({1, 4, 64}));
+
+  SmallVector<tosa::SliceOp> slices = collect<tosa::SliceOp>();
+  ASSERT_EQ(slices.size(), 3u);
+  int64_t expectedStart[] = {0, 16, 32};
+  for (auto [slice, start] : llvm::zip(slices, expectedStart)) {
+    EXPECT_TRUE(slice->hasAttr("mhal.horizontal_slice"));
+    EXPECT_EQ(slice.getInput(), matmuls[0].getResult());
+    EXPECT_EQ(slice.getStart()[2], start);
+  }
+}
+
+TEST_F(HorizontalFusionTest, KeepsArgumentWeightMatmuls) {
+  run(R"mlir(
+    func.func @gate_up(%x: tensor<1x4x8xf32>, %wg: tensor<1x8x16xf32>,
+                       %wu: tensor<1x8x16xf32>)
+        -> (tensor<1x4x16xf32>, tensor<1x4x16xf32>) {
+      %g = tosa.matmul %x, %wg
+          : (tensor<1x4x8xf32>, tensor<1x8x16xf32>) -> tensor<1x4x16xf32>
+      %u = tosa.matmul %x, %wu
+          : (tensor<1x4x8xf32>, tensor<1x8x16xf32>) -> tensor<1x4x16xf32>
+      return %g, %u : tensor<1x4x16xf32>, tensor<1x4x16xf32>
+    }
+  )mlir");
+  EXPECT_EQ(collect<tosa::MatMulOp>().size(), 2u);
+  EXPECT_TRUE(collect<tosa::SliceOp>().empty());
+}
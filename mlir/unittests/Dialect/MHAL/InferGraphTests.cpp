@@ -0,0 +1,221 @@
+//===- InferGraphTests.cpp - Tests for host graph inference ---------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Conversion/MHALToCPU/MHALToCPU.h"
+#include "mlir/Conversion/SCFToControlFlow/SCFToControlFlow.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/ControlFlow/IR/ControlFlowOps.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MHAL/IR/MHAL.h"
+#include "mlir/Dialect/MHAL/Transforms/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+
+class InferGraphTest : public ::testing::Test {
+protected:
+  InferGraphTest() {
+    context.loadDialect<mhal::MHALDialect, arith::ArithDialect,
+                        cf::ControlFlowDialect, func::FuncDialect,
+                        scf::SCFDialect>();
+  }
+
+  /// Runs mhal-infer-graph, and the CPU lowering if `lowerToCPU` is set, on
+  /// `source` together with a kernel `@kernel` that maps a `!t` tensor to
+  /// a `!t` tensor.
+  void run(StringRef source, bool lowerToCPU = false) {
+    std::string full = (R"mlir(
+      !t = tensor<4xf32>
+      func.func private @kernel(%arg0: !t) -> !t attributes {kernel} {
+        return %arg0 : !t
+      }
+    )mlir" + source)
+                           .str();
+    module = parseSourceString<ModuleOp>(full, &context);
+    ASSERT_TRUE(module);
+    PassManager pm(&context);
+    pm.addPass(mhal::createMHALInferGraphPass());
+    if (lowerToCPU) {
+      // Tokens reach the CPU lowering through CFG block arguments, as in the
+      // runner pipeline.
+      pm.addPass(createConvertSCFToCFPass());
+      pm.addPass(createConvertMHALToCPUPass());
+    }
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+  }
+
+  func::FuncOp lookup(StringRef name) {
+    return module->lookupSymbol<func::FuncOp>(name);
+  }
+
+  template <typename OpTy>
+  int64_t count(func::FuncOp func) {
+    int64_t n = 0;
+    func.walk([&](OpTy) { ++n; });
+    return n;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+TEST_F(InferGraphTest, AwaitsOnceBeforeReturn) {
+  run(R"mlir(
+    func.func @main(%arg0: !t) -> !t {
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      %1 = call @kernel(%0) : (!t) -> !t
+      return %1 : !t
+    }
+  )mlir");
+  func::FuncOp main = lookup("main");
+  EXPECT_EQ(count<mhal::LaunchOp>(main), 2);
+  EXPECT_EQ(count<mhal::AwaitOp>(main), 1);
+}
+
+TEST_F(InferGraphTest, ThreadsTokenThroughLoop) {
+  run(R"mlir(
+    func.func @main(%arg0: !t, %n: index) -> !t {
+      %c0 = arith.constant 0 : index
+      %c1 = arith.constant 1 : index
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      %1 = scf.for %i = %c0 to %n step %c1 iter_args(%acc = %0) -> (!t) {
+        %2 = func.call @kernel(%acc) : (!t) -> !t
+        scf.yield %2 : !t
+      }
+      return %1 : !t
+    }
+  )mlir");
+  func::FuncOp main = lookup("main");
+  EXPECT_EQ(count<mhal::AwaitOp>(main), 1);
+  main.walk([](scf::ForOp forOp) {
+    EXPECT_EQ(forOp.getNumResults(), 2u);
+    EXPECT_TRUE(forOp.getBody()->getOps<mhal::AwaitOp>().empty());
+  });
+}
+
+TEST_F(InferGraphTest, ReturnsPendingResultWithToken) {
+  run(R"mlir(
+    func.func private @helper(%arg0: !t) -> !t {
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      return %0 : !t
+    }
+    func.func @main(%arg0: !t) -> !t {
+      %0 = call @helper(%arg0) : (!t) -> !t
+      %1 = call @kernel(%0) : (!t) -> !t
+      return %1 : !t
+    }
+  )mlir");
+  func::FuncOp helper = lookup("helper");
+  ASSERT_TRUE(helper);
+  EXPECT_EQ(count<mhal::AwaitOp>(helper), 0);
+  ASSERT_EQ(helper.getNumResults(), 2u);
+  EXPECT_TRUE(helper.getResultTypes()[1].isa<mhal::TokenType>());
+
+  func::FuncOp main = lookup("main");
+  EXPECT_EQ(count<mhal::AwaitOp>(main), 1);
+  main.walk([](mhal::LaunchOp launch) {
+    EXPECT_EQ(launch.getDependencies().size(), 1u);
+  });
+}
+
+TEST_F(InferGraphTest, PassesPendingArgumentWithToken) {
+  run(R"mlir(
+    func.func private @helper(%arg0: !t) -> !t {
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      return %0 : !t
+    }
+    func.func @main(%arg0: !t) -> !t {
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      %1 = call @helper(%0) : (!t) -> !t
+      return %1 : !t
+    }
+  )mlir");
+  // The only caller passes a pending value, so the helper is replaced by its
+  // asynchronous specialization.
+  EXPECT_FALSE(lookup("helper"));
+  func::FuncOp helper = lookup("helper_async");
+  ASSERT_TRUE(helper);
+  ASSERT_EQ(helper.getNumArguments(), 2u);
+  EXPECT_TRUE(helper.getArgumentTypes()[1].isa<mhal::TokenType>());
+  EXPECT_EQ(count<mhal::AwaitOp>(helper), 0);
+  helper.walk([&](mhal::LaunchOp launch) {
+    EXPECT_EQ(launch.getDependencies().size(), 1u);
+    EXPECT_EQ(launch.getDependencies()[0], helper.getArgument(1));
+  });
+
+  // Awaiting the token returned by the helper covers the launch it was
+  // passed.
+  EXPECT_EQ(count<mhal::AwaitOp>(lookup("main")), 1);
+}
+
+TEST_F(InferGraphTest, ThreadsTokenThroughCallInLoop) {
+  run(R"mlir(
+    func.func private @helper(%arg0: !t) -> !t {
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      return %0 : !t
+    }
+    func.func @main(%arg0: !t, %n: index) -> !t {
+      %c0 = arith.constant 0 : index
+      %c1 = arith.constant 1 : index
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      %1 = scf.for %i = %c0 to %n step %c1 iter_args(%acc = %0) -> (!t) {
+        %2 = func.call @helper(%acc) : (!t) -> !t
+        scf.yield %2 : !t
+      }
+      return %1 : !t
+    }
+  )mlir");
+  func::FuncOp main = lookup("main");
+  EXPECT_EQ(count<mhal::AwaitOp>(main), 1);
+  main.walk([](scf::ForOp forOp) {
+    EXPECT_TRUE(forOp.getBody()->getOps<mhal::AwaitOp>().empty());
+  });
+}
+
+TEST_F(InferGraphTest, CPULoweringDropsTokens) {
+  run(R"mlir(
+    func.func private @helper(%arg0: !t) -> !t {
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      return %0 : !t
+    }
+    func.func @main(%arg0: !t, %n: index) -> !t {
+      %c0 = arith.constant 0 : index
+      %c1 = arith.constant 1 : index
+      %0 = call @kernel(%arg0) : (!t) -> !t
+      %1 = scf.for %i = %c0 to %n step %c1 iter_args(%acc = %0) -> (!t) {
+        %2 = func.call @helper(%acc) : (!t) -> !t
+        scf.yield %2 : !t
+      }
+      return %1 : !t
+    }
+  )mlir",
+      /*lowerToCPU=*/true);
+  // Tokens carried through block arguments, function arguments and function
+  // results are dropped rather than replaced by placeholders.
+  module->walk([](Operation *op) {
+    EXPECT_FALSE(isa<UnrealizedConversionCastOp>(op));
+    auto isToken = [](Type type) { return type.isa<mhal::TokenType>(); };
+    EXPECT_TRUE(llvm::none_of(op->getOperandTypes(), isToken));
+    EXPECT_TRUE(llvm::none_of(op->getResultTypes(), isToken));
+    for (Region &region : op->getRegions()) {
+      for (Block &block : region)
+        EXPECT_TRUE(llvm::none_of(block.getArgumentTypes(), isToken));
+    }
+  });
+  func::FuncOp helper = lookup("helper_async");
+  ASSERT_TRUE(helper);
+  EXPECT_EQ(helper.getNumArguments(), 1u);
+  EXPECT_EQ(helper.getNumResults(), 1u);
+  EXPECT_EQ(count<func::CallOp>(lookup("main")), 2);
+}
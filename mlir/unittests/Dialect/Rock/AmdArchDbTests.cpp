@@ -0,0 +1,58 @@
+//===- AmdArchDbTests.cpp - Tests for the AMD GPU feature database --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class AmdArchDbTest : public ::testing::Test {
+protected:
+  AmdArchDbTest() : b(&context) { context.getOrLoadDialect<RockDialect>(); }
+
+  int64_t dotWidth(StringRef arch, Type inputType, Type accType) {
+    return lookupArchInfo(arch).getDotProductWidth(inputType, accType);
+  }
+
+  MLIRContext context;
+  Builder b;
+};
+
+TEST_F(AmdArchDbTest, DotProductWidthF16) {
+  for (StringRef arch : {"gfx906", "gfx908", "gfx90a", "gfx1030", "gfx1100"})
+    EXPECT_EQ(dotWidth(arch, b.getF16Type(), b.getF32Type()), 2) << arch.str();
+  // The f16 dot products only accumulate into f32.
+  EXPECT_EQ(dotWidth("gfx906", b.getF16Type(), b.getF16Type()), 1);
+}
+
+TEST_F(AmdArchDbTest, DotProductWidthBf16) {
+  EXPECT_EQ(dotWidth("gfx1100", b.getBF16Type(), b.getF32Type()), 2);
+  EXPECT_EQ(dotWidth("gfx1201", b.getBF16Type(), b.getF32Type()), 2);
+  for (StringRef arch : {"gfx906", "gfx90a", "gfx1030"})
+    EXPECT_EQ(dotWidth(arch, b.getBF16Type(), b.getF32Type()), 1) << arch.str();
+}
+
+TEST_F(AmdArchDbTest, DotProductWidthI8) {
+  for (StringRef arch : {"gfx906", "gfx1030", "gfx1100"})
+    EXPECT_EQ(dotWidth(arch, b.getI8Type(), b.getI32Type()), 4) << arch.str();
+  EXPECT_EQ(dotWidth("gfx906", b.getI8Type(), b.getF32Type()), 1);
+}
+
+TEST_F(AmdArchDbTest, NoDotProducts) {
+  for (StringRef arch : {"gfx900", "gfx1011", "gfx1013"}) {
+    EXPECT_EQ(dotWidth(arch, b.getF16Type(), b.getF32Type()), 1) << arch.str();
+    EXPECT_EQ(dotWidth(arch, b.getI8Type(), b.getI32Type()), 1) << arch.str();
+  }
+  // f32 inputs always use scalar multiply-adds.
+  EXPECT_EQ(dotWidth("gfx1100", b.getF32Type(), b.getF32Type()), 1);
+}
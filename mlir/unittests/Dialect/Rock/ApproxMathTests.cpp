@@ -0,0 +1,173 @@
+//===- ApproxMathTests.cpp - Accuracy of the fast activation functions ----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/utility/approxMath.h"
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+using namespace mlir::rock;
+
+//===----------------------------------------------------------------------===//
+// Host emitter
+//===----------------------------------------------------------------------===//
+
+/// Evaluates the approximations on the host, rounding every intermediate to
+/// f32 or to f16 like the code the RockApproximateMath pass emits for that
+/// type. The hardware exp2 and reciprocal are taken to be exact, and ldexp
+/// builds the exponent bits of 2^n the way the emitted code does.
+class HostEmitter {
+public:
+  using Value = double;
+
+  explicit HostEmitter(bool isF16) : isF16(isF16) {}
+
+  bool hasNativeExp2() const { return !isF16; }
+
+  Value round(double v) const {
+    if (!isF16)
+      return static_cast<float>(v);
+    llvm::APFloat f(v);
+    bool losesInfo;
+    f.convert(llvm::APFloat::IEEEhalf(), llvm::APFloat::rmNearestTiesToEven,
+              &losesInfo);
+    return f.convertToDouble();
+  }
+
+  Value cst(double v) { return round(v); }
+  Value add(Value x, Value y) { return round(x + y); }
+  Value sub(Value x, Value y) { return round(x - y); }
+  Value mul(Value x, Value y) { return round(x * y); }
+  Value fma(Value x, Value y, Value z) { return round(std::fma(x, y, z)); }
+  Value neg(Value x) { return -x; }
+  Value abs(Value x) { return std::fabs(x); }
+  Value min(Value x, Value y) { return std::fmin(x, y); }
+  Value max(Value x, Value y) { return std::fmax(x, y); }
+  Value selectNeg(Value x, Value ifNeg, Value otherwise) {
+    return x < 0 ? ifNeg : otherwise;
+  }
+  Value rcp(Value x) { return round(1.0 / x); }
+  Value exp2(Value x) { return round(std::exp2(x)); }
+  Value floorNonNeg(Value x) { return std::floor(x); }
+  Value ldexp(Value p, Value n) {
+    const llvm::fltSemantics &sem =
+        isF16 ? llvm::APFloat::IEEEhalf() : llvm::APFloat::IEEEsingle();
+    unsigned bitWidth = llvm::APFloat::getSizeInBits(sem);
+    int mantissaBits = llvm::APFloat::semanticsPrecision(sem) - 1;
+    int exponentBias = -llvm::APFloat::semanticsMinExponent(sem) + 1;
+    llvm::APInt bits(bitWidth,
+                     static_cast<uint64_t>(static_cast<int64_t>(n) +
+                                           exponentBias)
+                         << mantissaBits);
+    return round(p * llvm::APFloat(sem, bits).convertToDouble());
+  }
+
+private:
+  bool isF16;
+};
+
+//===----------------------------------------------------------------------===//
+// Test Fixture
+//===----------------------------------------------------------------------===//
+
+class ApproxMathTest : public ::testing::TestWithParam<bool> {
+protected:
+  /// The largest error of `approx` against `exact` on inputs in [lo, hi],
+  /// measured as |approx - exact| / max(1, |exact|), or as the relative error
+  /// if `relative` is set.
+  double maxError(llvm::function_ref<double(HostEmitter &, double)> approx,
+                  llvm::function_ref<double(double)> exact, double lo,
+                  double hi, bool relative = false) {
+    HostEmitter e(GetParam());
+    double worst = 0.0;
+    constexpr int kSteps = 100000;
+    for (int i = 0; i <= kSteps; ++i) {
+      double x = e.round(lo + (hi - lo) * i / kSteps);
+      double want = exact(x);
+      double err = std::fabs(approx(e, x) - want);
+      err /= relative ? std::fabs(want) : std::fmax(1.0, std::fabs(want));
+      worst = std::fmax(worst, err);
+    }
+    return worst;
+  }
+
+  /// The documented bound for f32 or for f16.
+  double bound(double f32Bound, double f16Bound) {
+    return GetParam() ? f16Bound : f32Bound;
+  }
+};
+
+static double exactSigmoid(double x) { return 1.0 / (1.0 + std::exp(-x)); }
+
+//===----------------------------------------------------------------------===//
+// Accuracy
+//===----------------------------------------------------------------------===//
+
+TEST_P(ApproxMathTest, Exp) {
+  // In f16, stay where e^x is a normal number, up to where polyExp2 clamps
+  // x * log2(e) to 15.5.
+  double lo = GetParam() ? -9.5 : -80.0, hi = GetParam() ? 10.74 : 80.0;
+  EXPECT_LT(maxError([](HostEmitter &e, double x) { return approx::exp(e, x); },
+                     [](double x) { return std::exp(x); }, lo, hi,
+                     /*relative=*/true),
+            bound(5e-6, 6e-3));
+}
+
+TEST_P(ApproxMathTest, Sigmoid) {
+  EXPECT_LT(
+      maxError([](HostEmitter &e, double x) { return approx::sigmoid(e, x); },
+               exactSigmoid, -30.0, 30.0),
+      bound(1e-6, 2e-3));
+}
+
+TEST_P(ApproxMathTest, Silu) {
+  EXPECT_LT(
+      maxError([](HostEmitter &e, double x) { return approx::silu(e, x); },
+               [](double x) { return x * exactSigmoid(x); }, -30.0, 30.0),
+      bound(1e-6, 2e-3));
+}
+
+TEST_P(ApproxMathTest, Tanh) {
+  EXPECT_LT(
+      maxError([](HostEmitter &e, double x) { return approx::tanh(e, x); },
+               [](double x) { return std::tanh(x); }, -20.0, 20.0),
+      bound(1e-6, 2e-3));
+}
+
+TEST_P(ApproxMathTest, Erf) {
+  EXPECT_LT(
+      maxError([](HostEmitter &e, double x) { return approx::erf(e, x); },
+               [](double x) { return std::erf(x); }, -10.0, 10.0),
+      bound(1e-6, 4e-3));
+}
+
+TEST_P(ApproxMathTest, ErfAsTanh) {
+  EXPECT_LT(
+      maxError([](HostEmitter &e, double z) { return approx::erfAsTanh(e, z); },
+               [](double z) { return std::erf(z); }, -10.0, 10.0),
+      bound(4e-4, 2e-3));
+}
+
+TEST_P(ApproxMathTest, Saturation) {
+  HostEmitter e(GetParam());
+  EXPECT_EQ(approx::tanh(e, 1e4), 1.0);
+  EXPECT_EQ(approx::tanh(e, -1e4), -1.0);
+  // f16 clamps the exponential instead of overflowing.
+  EXPECT_LT(approx::sigmoid(e, -1e4), 1e-4);
+  if (GetParam())
+    EXPECT_TRUE(std::isfinite(approx::exp(e, 1e4)));
+  EXPECT_EQ(approx::erf(e, 1e4), 1.0);
+}
+
+INSTANTIATE_TEST_SUITE_P(F32AndF16, ApproxMathTest, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool> &info) {
+                           return info.param ? "f16" : "f32";
+                         });
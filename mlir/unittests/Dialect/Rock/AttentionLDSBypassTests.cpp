@@ -0,0 +1,92 @@
+//===- AttentionLDSBypassTests.cpp - Tests for the gemm1 LDS bypass -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/IR/AccelEmitter.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class AttentionLDSBypassTest : public ::testing::Test {
+protected:
+  AttentionLDSBypassTest() : b(&context) {
+    context.getOrLoadDialect<RockDialect>();
+  }
+
+  XdlopsGemmDerivedParamsAttr makeParams(int64_t kpackPerBlock,
+                                         int64_t mPerBlock, int64_t kpack,
+                                         int64_t mPerWave) {
+    return XdlopsGemmDerivedParamsAttr::get(
+        &context, kpackPerBlock, mPerBlock, /*nPerBlock=*/32, kpack, mPerWave,
+        /*nPerWave=*/32, /*mnPerXdl=*/32, /*splitKFactor=*/1,
+        /*forceUnroll=*/true, /*schedHint=*/0, /*producerWaves=*/0);
+  }
+
+  /// Whether an f16 attention on gfx942 whose gemms are tuned with `params0`
+  /// and `params1` bypasses LDS for the second gemm.
+  bool canBypass(RockAccelTuningParamAttrInterface params0,
+                 RockAccelTuningParamAttrInterface params1,
+                 GemmFeatures features = GemmFeatures::mfma,
+                 StringRef arch = "amdgcn-amd-amdhsa:gfx942") {
+    Type f16 = b.getF16Type();
+    return accel::canBypassLDSForSecondGemm(features, f16, f16, f16, arch,
+                                            params0, params1);
+  }
+
+  MLIRContext context;
+  Builder b;
+};
+
+// With the gemm1 parameters derived from a 32-row gemm0 tile as the tuning
+// does, each thread holds 16 of the k of gemm1 whatever the kpack.
+TEST_F(AttentionLDSBypassTest, ChosenForAnyKpackWithOneMWave) {
+  for (int64_t kpack : {1, 2, 4, 8, 16}) {
+    XdlopsGemmDerivedParamsAttr params0 =
+        makeParams(/*kpackPerBlock=*/8, /*mPerBlock=*/32, kpack,
+                   /*mPerWave=*/32);
+    XdlopsGemmDerivedParamsAttr params1 =
+        makeParams(/*kpackPerBlock=*/32 / kpack, /*mPerBlock=*/32, kpack,
+                   /*mPerWave=*/32);
+    EXPECT_TRUE(canBypass(params0, params1)) << "kpack = " << kpack;
+  }
+}
+
+// The 32x32x8 mfma splits k across two lane groups, so a kpack per block of 2
+// leaves one kpack per thread, which has to hold the 4 rows of a row group.
+TEST_F(AttentionLDSBypassTest, RejectedForPartialRowGroups) {
+  XdlopsGemmDerivedParamsAttr params0 = makeParams(8, 32, 4, 32);
+  EXPECT_FALSE(canBypass(params0, makeParams(2, 32, 1, 32)));
+  EXPECT_FALSE(canBypass(params0, makeParams(2, 32, 2, 32)));
+  EXPECT_TRUE(canBypass(params0, makeParams(2, 32, 4, 32)));
+  EXPECT_TRUE(canBypass(params0, makeParams(2, 32, 8, 32)));
+}
+
+TEST_F(AttentionLDSBypassTest, RejectedForSeveralMWaves) {
+  XdlopsGemmDerivedParamsAttr params1 = makeParams(8, 64, 4, 64);
+  EXPECT_TRUE(canBypass(makeParams(8, 32, 4, 32), params1));
+  EXPECT_FALSE(canBypass(makeParams(8, 64, 4, 32), params1));
+  EXPECT_FALSE(canBypass(makeParams(8, 128, 4, 32), params1));
+}
+
+TEST_F(AttentionLDSBypassTest, RejectedForWmma) {
+  auto makeWmmaParams = [&](int64_t kpackPerBlock, int64_t kpack) {
+    return WmmaGemmParamsAttr::get(&context, kpackPerBlock, /*mPerBlock=*/32,
+                                   /*nPerBlock=*/32, kpack, /*mPerWave=*/32,
+                                   /*nPerWave=*/32, /*splitKFactor=*/1,
+                                   /*forceUnroll=*/true, /*schedHint=*/0);
+  };
+  for (StringRef arch : {"amdgcn-amd-amdhsa:gfx1100",
+                         "amdgcn-amd-amdhsa:gfx1201"})
+    EXPECT_FALSE(canBypass(makeWmmaParams(8, 4), makeWmmaParams(8, 4),
+                           GemmFeatures::wmma, arch))
+        << arch.str();
+}
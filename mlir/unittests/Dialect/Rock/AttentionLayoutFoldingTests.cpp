@@ -0,0 +1,182 @@
+//===- AttentionLayoutFoldingTests.cpp - Tests for attention layouts ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Conversion/TosaToRock/TosaToRock.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Bufferization/IR/Bufferization.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class AttentionLayoutFoldingTest : public ::testing::Test {
+protected:
+  AttentionLayoutFoldingTest() {
+    context.loadDialect<RockDialect, arith::ArithDialect,
+                        bufferization::BufferizationDialect, func::FuncDialect,
+                        memref::MemRefDialect, tensor::TensorDialect,
+                        tosa::TosaDialect>();
+  }
+
+  /// Runs tosa-to-rock on a kernel with the arguments `args`, whose body
+  /// computes `%q`, `%k` and `%v` of types `!q`, `!k` and `!v` in
+  /// `prologue`, the attention `%o = softmax(%q * %k) * %v` and, in
+  /// `epilogue`, the result `%out` of type `outType` (or returns `%o` when
+  /// there is no epilogue). Returns the attention.
+  AttentionOp run(StringRef args, StringRef prologue, StringRef epilogue = "",
+                  StringRef outType = "tensor<2x64x32xf32>") {
+    std::string source = "!out = " + outType.str() + R"mlir(
+      !q = tensor<2x64x32xf32>
+      !k = tensor<2x32x64xf32>
+      !v = tensor<2x64x32xf32>
+      !o = tensor<2x64x32xf32>
+      !s = tensor<2x64x64xf32>
+      !r = tensor<2x64x1xf32>
+      func.func @attention()mlir" +
+                         args.str() + R"mlir() -> !out
+          attributes {kernel, arch = "amdgcn-amd-amdhsa:gfx942"} {
+      )mlir" + prologue.str() +
+                         R"mlir(
+        %qk = tosa.matmul %q, %k : (!q, !k) -> !s
+        %max = tosa.reduce_max %qk {axis = 2 : i32} : (!s) -> !r
+        %sub = tosa.sub %qk, %max : (!s, !r) -> !s
+        %exp = tosa.exp %sub : (!s) -> !s
+        %sum = tosa.reduce_sum %exp {axis = 2 : i32} : (!s) -> !r
+        %rcp = tosa.reciprocal %sum : (!r) -> !r
+        %p = tosa.mul %exp, %rcp {shift = 0 : i8} : (!s, !r) -> !s
+        %o = tosa.matmul %p, %v : (!s, !v) -> !o
+      )mlir" + epilogue.str() +
+                         "\nreturn " + (epilogue.empty() ? "%o" : "%out") +
+                         " : !out\n}";
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return AttentionOp();
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(createTosaToRockPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+
+    int64_t numTransposes = 0;
+    module->walk([&](tosa::TransposeOp) { ++numTransposes; });
+    EXPECT_EQ(numTransposes, 0);
+    SmallVector<AttentionOp> attentions;
+    module->walk([&](AttentionOp op) { attentions.push_back(op); });
+    EXPECT_EQ(attentions.size(), 1u);
+    return attentions.empty() ? AttentionOp() : attentions.front();
+  }
+
+  BlockArgument getArg(unsigned i) {
+    return module->lookupSymbol<func::FuncOp>("attention").getArgument(i);
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+/// Follows `v` through rock.transform views to the value they view.
+static Value getViewRoot(Value v) {
+  while (auto view = v.getDefiningOp<TransformOp>())
+    v = view.getInput();
+  return v;
+}
+
+// Keys stored as [G, seq_k, D] and transposed in the graph are read in
+// place.
+TEST_F(AttentionLayoutFoldingTest, FoldsKeyTransposeIntoFlag) {
+  AttentionOp attn = run("%q: !q, %kRaw: tensor<2x64x32xf32>, %v: !v",
+                         R"mlir(
+    %perms = "tosa.const"() {value = dense<[0, 2, 1]> : tensor<3xi32>}
+        : () -> tensor<3xi32>
+    %k = tosa.transpose %kRaw, %perms
+        : (tensor<2x64x32xf32>, tensor<3xi32>) -> !k
+  )mlir");
+  ASSERT_TRUE(attn);
+  EXPECT_EQ(attn.getKeys(), getArg(1));
+  EXPECT_TRUE(attn.getKTransposed());
+  EXPECT_FALSE(attn.getQTransposed());
+  EXPECT_FALSE(attn.getVTransposed());
+  EXPECT_FALSE(attn.getOTransposed());
+}
+
+// Values and the output transposed in the graph toggle their flags too.
+TEST_F(AttentionLayoutFoldingTest, FoldsValueAndOutputTransposesIntoFlags) {
+  AttentionOp attn = run("%q: !q, %k: !k, %vRaw: tensor<2x32x64xf32>",
+                         R"mlir(
+    %perms = "tosa.const"() {value = dense<[0, 2, 1]> : tensor<3xi32>}
+        : () -> tensor<3xi32>
+    %v = tosa.transpose %vRaw, %perms
+        : (tensor<2x32x64xf32>, tensor<3xi32>) -> !v
+  )mlir",
+                         R"mlir(
+    %outPerms = "tosa.const"() {value = dense<[0, 2, 1]> : tensor<3xi32>}
+        : () -> tensor<3xi32>
+    %out = tosa.transpose %o, %outPerms
+        : (!o, tensor<3xi32>) -> !out
+  )mlir",
+                         "tensor<2x32x64xf32>");
+  ASSERT_TRUE(attn);
+  EXPECT_EQ(attn.getValues(), getArg(2));
+  EXPECT_TRUE(attn.getVTransposed());
+  EXPECT_TRUE(attn.getOTransposed());
+  EXPECT_FALSE(attn.getKTransposed());
+}
+
+// The head split [B, S, H * D] -> [B, S, H, D] -> [B, H, S, D] -> [B * H, S,
+// D] of the queries and its inverse on the output become views, so that
+// neither is materialized.
+TEST_F(AttentionLayoutFoldingTest, FoldsHeadSplitsIntoViews) {
+  AttentionOp attn = run("%qRaw: tensor<1x64x64xf32>, %k: !k, %v: !v",
+                         R"mlir(
+    %perms = "tosa.const"() {value = dense<[0, 2, 1, 3]> : tensor<4xi32>}
+        : () -> tensor<4xi32>
+    %qSplit = tensor.expand_shape %qRaw [[0], [1], [2, 3]]
+        : tensor<1x64x64xf32> into tensor<1x64x2x32xf32>
+    %qHeads = tosa.transpose %qSplit, %perms
+        : (tensor<1x64x2x32xf32>, tensor<4xi32>) -> tensor<1x2x64x32xf32>
+    %q = tensor.collapse_shape %qHeads [[0, 1], [2], [3]]
+        : tensor<1x2x64x32xf32> into !q
+  )mlir",
+                         R"mlir(
+    %outPerms = "tosa.const"() {value = dense<[0, 2, 1, 3]> : tensor<4xi32>}
+        : () -> tensor<4xi32>
+    %oHeads = tensor.expand_shape %o [[0, 1], [2], [3]]
+        : !o into tensor<1x2x64x32xf32>
+    %oSplit = tosa.transpose %oHeads, %outPerms
+        : (tensor<1x2x64x32xf32>, tensor<4xi32>) -> tensor<1x64x2x32xf32>
+    %out = tensor.collapse_shape %oSplit [[0], [1], [2, 3]]
+        : tensor<1x64x2x32xf32> into !out
+  )mlir",
+                         "tensor<1x64x64xf32>");
+  ASSERT_TRUE(attn);
+  EXPECT_FALSE(attn.getQTransposed());
+  EXPECT_FALSE(attn.getOTransposed());
+  ASSERT_TRUE(attn.getQueries().getDefiningOp<TransformOp>());
+  EXPECT_EQ(getViewRoot(attn.getQueries()), getArg(0));
+  EXPECT_EQ(cast<ShapedType>(attn.getQueries().getType()).getShape(),
+            ArrayRef<int64_t>({2, 64, 32}));
+
+  // The attention writes through a view of a buffer in the final layout.
+  ASSERT_TRUE(attn.getOut().getDefiningOp<TransformOp>());
+  Value outBuffer = getViewRoot(attn.getOut());
+  EXPECT_EQ(cast<ShapedType>(outBuffer.getType()).getShape(),
+            ArrayRef<int64_t>({1, 64, 64}));
+  auto returnOp = cast<func::ReturnOp>(
+      module->lookupSymbol<func::FuncOp>("attention").front().getTerminator());
+  EXPECT_TRUE(
+      returnOp.getOperand(0).getDefiningOp<TensorUntransformCastOp>());
+}
@@ -0,0 +1,71 @@
+//===- AttnPerfConfigTests.cpp - Tests for attention perf configs ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class AttnPerfConfigTest : public ::testing::Test {
+protected:
+  AttnPerfConfigTest() : b(&context) {
+    context.getOrLoadDialect<RockDialect>();
+  }
+
+  AttnPerfConfigAttr makeConfig(bool pipelineKVLoop) {
+    return AttnPerfConfigAttr::get(
+        &context, /*mPerBlockG0=*/64, /*mPerBlockG1=*/64, /*nPerBlockG0=*/32,
+        /*kpackPerBlock=*/8, /*mPerWave=*/32, /*mnPerXdl=*/32, /*kpack=*/4,
+        /*forceUnroll=*/true, pipelineKVLoop);
+  }
+
+  AttnPerfConfigAttr parse(StringRef perfConfig) {
+    return AttnPerfConfigAttr::get(b.getStringAttr(perfConfig));
+  }
+
+  static std::string print(AttnPerfConfigAttr config) {
+    SmallString<64> perfConfig;
+    config.getPerfConfigStr(perfConfig);
+    return perfConfig.str().str();
+  }
+
+  MLIRContext context;
+  Builder b;
+};
+
+TEST_F(AttnPerfConfigTest, RoundTripsPipelinedConfigs) {
+  AttnPerfConfigAttr config = makeConfig(/*pipelineKVLoop=*/true);
+  EXPECT_EQ(print(config), "attn:v2:64,64,32,8,32,32,4,1,1");
+  EXPECT_EQ(parse(print(config)), config);
+}
+
+TEST_F(AttnPerfConfigTest, RoundTripsUnpipelinedConfigs) {
+  AttnPerfConfigAttr config = makeConfig(/*pipelineKVLoop=*/false);
+  EXPECT_EQ(print(config), "attn:v2:64,64,32,8,32,32,4,1,0");
+  EXPECT_EQ(parse(print(config)), config);
+}
+
+// Configs tuned before pipelining existed keep their meaning and are printed
+// in the v2 format from then on.
+TEST_F(AttnPerfConfigTest, ParsesV1WithoutPipelining) {
+  AttnPerfConfigAttr config = parse("attn:v1:64,64,32,8,32,32,4,1");
+  ASSERT_TRUE(config);
+  EXPECT_EQ(config, makeConfig(/*pipelineKVLoop=*/false));
+  EXPECT_EQ(print(config), "attn:v2:64,64,32,8,32,32,4,1,0");
+}
+
+TEST_F(AttnPerfConfigTest, RejectsMalformedConfigs) {
+  EXPECT_FALSE(parse("attn:v2:64,64,32,8,32,32,4,1"));
+  EXPECT_FALSE(parse("attn:v1:64,64,32,8,32,32,4,1,1"));
+  EXPECT_FALSE(parse("attn:v3:64,64,32,8,32,32,4,1,1"));
+  EXPECT_FALSE(parse("v2:64,64,32,8,32,32,4,1,1"));
+}
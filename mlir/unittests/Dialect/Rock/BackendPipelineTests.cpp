@@ -0,0 +1,96 @@
+//===- BackendPipelineTests.cpp - Tests for the rock backend pipeline -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/Pipelines/Pipelines.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+
+class BackendPipelineTest : public ::testing::Test {
+protected:
+  BackendPipelineTest() {
+    context.loadDialect<arith::ArithDialect, gpu::GPUDialect,
+                        LLVM::LLVMDialect, memref::MemRefDialect>();
+  }
+
+  /// Runs the backend pipeline for `chip`, without serializing, on a kernel
+  /// whose body is `body`, and returns whether it succeeded.
+  bool lower(StringRef chip, StringRef body) {
+    std::string source = (R"mlir(
+      module attributes {gpu.container_module} {
+        gpu.module @kernels {
+          gpu.func @kernel(%in: memref<4xf8E4M3FN>, %out: memref<4xf8E5M2>)
+              kernel {
+            %c0 = arith.constant 0 : index
+      )mlir" + body + R"mlir(
+            gpu.return
+          }
+        }
+      })mlir")
+                             .str();
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return false;
+    PassManager pm(&context);
+    rock::BackendOptions options;
+    options.triple = "amdgcn-amd-amdhsa";
+    options.chip = chip.str();
+    options.compile = false;
+    rock::buildBackendPipeline(pm, options);
+    return succeeded(pm.run(*module));
+  }
+
+  /// Whether the lowered module has a symbol whose name starts with `prefix`.
+  bool hasSymbol(StringRef prefix) {
+    bool found = false;
+    module->walk([&](Operation *op) {
+      auto name =
+          op->getAttrOfType<StringAttr>(SymbolTable::getSymbolAttrName());
+      if (name && name.getValue().starts_with(prefix))
+        found = true;
+    });
+    return found;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+TEST_F(BackendPipelineTest, EmulatesOcpFp8ConversionsOnGfx12) {
+  // ArithToAMDGPU leaves OCP fp8 alone, so extf becomes a table lookup and
+  // truncf a call.
+  ASSERT_TRUE(lower("gfx1200", R"mlir(
+    %x = memref.load %in[%c0] : memref<4xf8E4M3FN>
+    %f = arith.extf %x : f8E4M3FN to f32
+    %y = arith.truncf %f : f32 to f8E5M2
+    memref.store %y, %out[%c0] : memref<4xf8E5M2>
+  )mlir"));
+  EXPECT_TRUE(hasSymbol("__rocmlir_extf_tbl_f8E4M3FN"));
+  EXPECT_TRUE(hasSymbol("_rocmlir_trunc_f32_to_f8E5M2"));
+}
+
+TEST_F(BackendPipelineTest, EmulatesOcpFp8TruncToE4M3FN) {
+  ASSERT_TRUE(lower("gfx1201", R"mlir(
+    %x = memref.load %out[%c0] : memref<4xf8E5M2>
+    %f = arith.extf %x : f8E5M2 to f32
+    %y = arith.truncf %f : f32 to f8E4M3FN
+    memref.store %y, %in[%c0] : memref<4xf8E4M3FN>
+  )mlir"));
+  EXPECT_TRUE(hasSymbol("__rocmlir_extf_tbl_f8E5M2"));
+  EXPECT_TRUE(hasSymbol("_rocmlir_trunc_f32_to_f8E4M3FN"));
+}
@@ -0,0 +1,214 @@
+//===- BufferLoadMergeTests.cpp - Tests for access coalescing -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+/// The number of elements an access of `type` covers.
+static int64_t getWidth(Type type) {
+  if (auto vecType = dyn_cast<VectorType>(type))
+    return vecType.getNumElements();
+  return 1;
+}
+
+class BufferLoadMergeTest : public ::testing::Test {
+protected:
+  BufferLoadMergeTest() {
+    context.loadDialect<RockDialect, amdgpu::AMDGPUDialect,
+                        arith::ArithDialect, func::FuncDialect,
+                        gpu::GPUDialect, memref::MemRefDialect,
+                        vector::VectorDialect>();
+  }
+
+  /// Runs rock-buffer-load-merge on a kernel whose body is `body`, which has
+  /// the global buffer `%buf` of 64 f32, the LDS buffer `%lds` of 64 f16, the
+  /// i32 `%i` and the index `%j`.
+  void run(StringRef body) {
+    std::string source = (R"mlir(
+      !buf = memref<64xf32>
+      !lds = memref<64xf16, #gpu.address_space<workgroup>>
+      func.func @kernel(%buf: !buf, %lds: !lds, %i: i32, %j: index)
+          attributes {kernel} {
+        %c1_i32 = arith.constant 1 : i32
+        %c2_i32 = arith.constant 2 : i32
+        %c3_i32 = arith.constant 3 : i32
+        %c4_i32 = arith.constant 4 : i32
+        %c1 = arith.constant 1 : index
+        %c2 = arith.constant 2 : index
+        %c3 = arith.constant 3 : index
+        %c4 = arith.constant 4 : index
+        %c8 = arith.constant 8 : index
+        %v = arith.constant 0.0 : f16
+      )mlir" + body + R"mlir(
+        return
+      })mlir")
+                             .str();
+    module = parseSourceString<ModuleOp>(source, &context);
+    ASSERT_TRUE(module);
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(createRockBufferLoadMergePass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+  }
+
+  /// Returns the widths of the buffer loads left in the kernel.
+  SmallVector<int64_t> getBufferLoadWidths() {
+    SmallVector<int64_t> widths;
+    module->walk([&](amdgpu::RawBufferLoadOp load) {
+      widths.push_back(getWidth(load.getType()));
+    });
+    return widths;
+  }
+
+  /// Returns the widths of the LDS loads left in the kernel.
+  SmallVector<int64_t> getLDSLoadWidths() {
+    SmallVector<int64_t> widths;
+    module->walk([&](Operation *op) {
+      if (auto load = dyn_cast<vector::LoadOp>(op))
+        widths.push_back(getWidth(load.getType()));
+      else if (isa<memref::LoadOp>(op))
+        widths.push_back(1);
+    });
+    return widths;
+  }
+
+  /// Returns the widths of the LDS stores left in the kernel.
+  SmallVector<int64_t> getLDSStoreWidths() {
+    SmallVector<int64_t> widths;
+    module->walk([&](Operation *op) {
+      if (auto store = dyn_cast<vector::StoreOp>(op))
+        widths.push_back(getWidth(store.getValueToStore().getType()));
+      else if (isa<memref::StoreOp>(op))
+        widths.push_back(1);
+    });
+    return widths;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+/// Returns four scalar loads of `%buf` at `%base` plus 0 to 3, where `%base`
+/// is `%i` times `stride`.
+static std::string makeFourBufferLoads(int64_t stride) {
+  return "%base = arith.muli %i, %c" + std::to_string(stride) +
+         R"mlir(_i32 : i32
+    %o1 = arith.addi %base, %c1_i32 : i32
+    %o2 = arith.addi %base, %c2_i32 : i32
+    %o3 = arith.addi %base, %c3_i32 : i32
+    %l0 = amdgpu.raw_buffer_load %buf[%base] : !buf, i32 -> f32
+    %l1 = amdgpu.raw_buffer_load %buf[%o1] : !buf, i32 -> f32
+    %l2 = amdgpu.raw_buffer_load %buf[%o2] : !buf, i32 -> f32
+    %l3 = amdgpu.raw_buffer_load %buf[%o3] : !buf, i32 -> f32
+  )mlir";
+}
+
+TEST_F(BufferLoadMergeTest, MergesAlignedBufferLoads) {
+  run(makeFourBufferLoads(4));
+  EXPECT_EQ(getBufferLoadWidths(), SmallVector<int64_t>({4}));
+}
+
+// The run is only known to start at an even element, so the loads merge in
+// pairs.
+TEST_F(BufferLoadMergeTest, NarrowsToKnownAlignment) {
+  run(makeFourBufferLoads(2));
+  EXPECT_EQ(getBufferLoadWidths(), SmallVector<int64_t>({2, 2}));
+}
+
+TEST_F(BufferLoadMergeTest, KeepsLoadsFromWrittenBuffers) {
+  run(makeFourBufferLoads(4) +
+      "amdgpu.raw_buffer_store %l0 -> %buf[%i] : f32 -> !buf, i32\n");
+  EXPECT_EQ(getBufferLoadWidths(), SmallVector<int64_t>({1, 1, 1, 1}));
+}
+
+// A row of 6 elements can't hold aligned runs of 4.
+TEST_F(BufferLoadMergeTest, StaysWithinRows) {
+  run(R"mlir(
+    %rows = memref.alloca() : memref<4x6xf32>
+    %c0_i32 = arith.constant 0 : i32
+    %l0 = amdgpu.raw_buffer_load %rows[%i, %c0_i32]
+      : memref<4x6xf32>, i32, i32 -> f32
+    %l1 = amdgpu.raw_buffer_load %rows[%i, %c1_i32]
+      : memref<4x6xf32>, i32, i32 -> f32
+    %l2 = amdgpu.raw_buffer_load %rows[%i, %c2_i32]
+      : memref<4x6xf32>, i32, i32 -> f32
+    %l3 = amdgpu.raw_buffer_load %rows[%i, %c3_i32]
+      : memref<4x6xf32>, i32, i32 -> f32
+  )mlir");
+  EXPECT_EQ(getBufferLoadWidths(), SmallVector<int64_t>({2, 2}));
+}
+
+// Eight f16 stores fill one 16-byte store.
+TEST_F(BufferLoadMergeTest, MergesLDSStores) {
+  run(R"mlir(
+    %c5 = arith.constant 5 : index
+    %c6 = arith.constant 6 : index
+    %c7 = arith.constant 7 : index
+    %base = arith.muli %j, %c8 : index
+    %o1 = arith.addi %base, %c1 : index
+    %o2 = arith.addi %base, %c2 : index
+    %o3 = arith.addi %base, %c3 : index
+    %o4 = arith.addi %base, %c4 : index
+    %o5 = arith.addi %base, %c5 : index
+    %o6 = arith.addi %base, %c6 : index
+    %o7 = arith.addi %base, %c7 : index
+    memref.store %v, %lds[%base] : !lds
+    memref.store %v, %lds[%o1] : !lds
+    memref.store %v, %lds[%o2] : !lds
+    memref.store %v, %lds[%o3] : !lds
+    memref.store %v, %lds[%o4] : !lds
+    memref.store %v, %lds[%o5] : !lds
+    memref.store %v, %lds[%o6] : !lds
+    memref.store %v, %lds[%o7] : !lds
+  )mlir");
+  EXPECT_EQ(getLDSStoreWidths(), SmallVector<int64_t>({8}));
+}
+
+// Loads of LDS aren't moved across a barrier, since another thread may write
+// LDS between them.
+TEST_F(BufferLoadMergeTest, KeepsLDSLoadsOnTheirSideOfBarriers) {
+  run(R"mlir(
+    %base = arith.muli %j, %c4 : index
+    %o1 = arith.addi %base, %c1 : index
+    %o2 = arith.addi %base, %c2 : index
+    %o3 = arith.addi %base, %c3 : index
+    %l0 = memref.load %lds[%base] : !lds
+    %l1 = memref.load %lds[%o1] : !lds
+    rock.lds_barrier
+    %l2 = memref.load %lds[%o2] : !lds
+    %l3 = memref.load %lds[%o3] : !lds
+  )mlir");
+  EXPECT_EQ(getLDSLoadWidths(), SmallVector<int64_t>({2, 2}));
+}
+
+// Stores are sunk to the last store of their run, so a load of the same LDS
+// in between keeps them apart.
+TEST_F(BufferLoadMergeTest, KeepsLDSStoresAroundLoads) {
+  run(R"mlir(
+    %base = arith.muli %j, %c2 : index
+    %o1 = arith.addi %base, %c1 : index
+    memref.store %v, %lds[%base] : !lds
+    %l = memref.load %lds[%base] : !lds
+    memref.store %l, %lds[%o1] : !lds
+  )mlir");
+  EXPECT_EQ(getLDSStoreWidths(), SmallVector<int64_t>({1, 1}));
+}
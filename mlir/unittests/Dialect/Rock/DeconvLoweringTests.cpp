@@ -0,0 +1,219 @@
+//===- DeconvLoweringTests.cpp - Tests for transposed conv lowering -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Conversion/MIGraphXToTosa/MIGraphXToTosa.h"
+#include "mlir/Conversion/TosaToRock/TosaToRock.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Bufferization/IR/Bufferization.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MHAL/IR/MHAL.h"
+#include "mlir/Dialect/MIGraphX/IR/MIGraphX.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
+#include "mlir/Dialect/Tosa/IR/TosaOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+static SmallVector<int64_t> getInts(ArrayAttr attr) {
+  return llvm::to_vector(llvm::map_range(
+      attr.getAsRange<IntegerAttr>(),
+      [](IntegerAttr value) { return value.getInt(); }));
+}
+
+class DeconvLoweringTest : public ::testing::Test {
+protected:
+  DeconvLoweringTest() {
+    context.loadDialect<RockDialect, arith::ArithDialect,
+                        bufferization::BufferizationDialect, func::FuncDialect,
+                        memref::MemRefDialect, mhal::MHALDialect,
+                        migraphx::MIGraphXDialect, tensor::TensorDialect,
+                        tosa::TosaDialect>();
+  }
+
+  /// Parses `source` and runs the passes `addPasses` adds on its functions,
+  /// returning whether they succeeded.
+  bool run(StringRef source, function_ref<void(OpPassManager &)> addPasses) {
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return false;
+    PassManager pm(&context);
+    addPasses(pm.nest<func::FuncOp>());
+    return succeeded(pm.run(*module));
+  }
+
+  template <typename OpTy>
+  OpTy getOnly() {
+    SmallVector<OpTy> ops;
+    module->walk([&](OpTy op) { ops.push_back(op); });
+    EXPECT_EQ(ops.size(), 1u);
+    return ops.empty() ? OpTy() : ops.front();
+  }
+
+  /// Converts a stride 2 `migraphx.deconvolution` of a 5x5 image by a 3x3
+  /// filter with padding 1 into a `outSize`x`outSize` result.
+  tosa::TransposeConv2DOp convertMIGraphX(int64_t outSize) {
+    std::string n = std::to_string(outSize);
+    std::string outType =
+        "!migraphx.shaped<1x2x" + n + "x" + n + "xf32, " +
+        std::to_string(2 * outSize * outSize) + "x" +
+        std::to_string(outSize * outSize) + "x" + n + "x1>";
+    std::string source = R"mlir(
+      !in = !migraphx.shaped<1x4x5x5xf32, 100x25x5x1>
+      !filter = !migraphx.shaped<4x2x3x3xf32, 18x9x3x1>
+      !out = )mlir" + outType + R"mlir(
+      func.func @deconv(%in: !in, %filter: !filter) -> !out {
+        %0 = migraphx.deconvolution %in, %filter {
+          dilation = [1, 1], group = 1 : i64, padding = [1, 1, 1, 1],
+          stride = [2, 2]} : !in, !filter -> !out
+        return %0 : !out
+      }
+    )mlir";
+    EXPECT_TRUE(run(source, [](OpPassManager &pm) {
+      pm.addPass(createMIGraphXToTosaPass());
+    }));
+    return getOnly<tosa::TransposeConv2DOp>();
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+// The transposed convolution of a 5x5 image is 9x9 with stride 2, padding 1
+// and a 3x3 filter.
+TEST_F(DeconvLoweringTest, MIGraphXPadsWithoutOutputPadding) {
+  tosa::TransposeConv2DOp conv = convertMIGraphX(9);
+  ASSERT_TRUE(conv);
+  EXPECT_EQ(conv.getOutPad(), ArrayRef<int64_t>({-1, -1, -1, -1}));
+  EXPECT_EQ(conv.getStride(), ArrayRef<int64_t>({2, 2}));
+  EXPECT_EQ(conv.getOutShape(), ArrayRef<int64_t>({1, 9, 9, 2}));
+  EXPECT_FALSE(conv->hasAttr("dilation"));
+  EXPECT_FALSE(conv->hasAttr("group"));
+  EXPECT_EQ(conv.getFilter().getType().getShape(),
+            ArrayRef<int64_t>({2, 3, 3, 4}));
+}
+
+// The extra trailing row and column of a 10x10 result are output padding,
+// which cancels the high padding.
+TEST_F(DeconvLoweringTest, MIGraphXTakesOutputPaddingFromResultType) {
+  tosa::TransposeConv2DOp conv = convertMIGraphX(10);
+  ASSERT_TRUE(conv);
+  EXPECT_EQ(conv.getOutPad(), ArrayRef<int64_t>({-1, 0, -1, 0}));
+  EXPECT_EQ(conv.getOutShape(), ArrayRef<int64_t>({1, 10, 10, 2}));
+}
+
+/// Returns a kernel computing the stride 2 `tosa.transpose_conv2d` of a 5x5
+/// image by a 3x3 filter with output padding `outPad` into a
+/// `outSize`x`outSize` result, with the extra attributes `extraAttrs`.
+static std::string makeTransposeConv(int64_t outSize, StringRef outPad,
+                                     StringRef extraAttrs = "") {
+  std::string n = std::to_string(outSize);
+  return R"mlir(
+    !out = tensor<1x)mlir" +
+         n + "x" + n + R"mlir(x2xf32>
+    func.func @deconv(%in: tensor<1x5x5x4xf32>, %filter: tensor<2x3x3x4xf32>)
+        -> !out attributes {kernel, arch = "gfx942"} {
+      %bias = "tosa.const"() {value = dense<0.0> : tensor<2xf32>}
+        : () -> tensor<2xf32>
+      %0 = "tosa.transpose_conv2d"(%in, %filter, %bias) {
+        out_pad = array<i64: )mlir" +
+         outPad.str() + R"mlir(>,
+        out_shape = array<i64: 1, )mlir" +
+         n + ", " + n + R"mlir(, 2>,
+        stride = array<i64: 2, 2> )mlir" +
+         extraAttrs.str() + R"mlir(}
+        : (tensor<1x5x5x4xf32>, tensor<2x3x3x4xf32>, tensor<2xf32>) -> !out
+      return %0 : !out
+    }
+  )mlir";
+}
+
+TEST_F(DeconvLoweringTest, TosaLowersToBatchedBackwardData) {
+  ASSERT_TRUE(run(makeTransposeConv(10, "-1, 0, -1, 0"),
+                  [](OpPassManager &pm) {
+                    pm.addPass(createTosaToRockPass());
+                  }));
+  ConvBwdDataOp conv = getOnly<ConvBwdDataOp>();
+  ASSERT_TRUE(conv);
+  EXPECT_EQ(getInts(conv.getPadding()), SmallVector<int64_t>({1, 0, 1, 0}));
+  EXPECT_EQ(getInts(conv.getStrides()), SmallVector<int64_t>({2, 2}));
+  EXPECT_EQ(getInts(conv.getDilations()), SmallVector<int64_t>({1, 1}));
+  EXPECT_TRUE(conv.getBatchKernels());
+  EXPECT_EQ(conv.getKernelId().getSExtValue(), 0);
+  // The TOSA input is the output of the convolution being transposed, and
+  // the TOSA result is its input.
+  EXPECT_EQ(conv.getOutput().getType().getShape(),
+            ArrayRef<int64_t>({1, 5, 5, 1, 4}));
+  EXPECT_EQ(conv.getInput().getType().getShape(),
+            ArrayRef<int64_t>({1, 10, 10, 1, 2}));
+}
+
+// Output padding shorter than a stride past the last input row gets no
+// contribution, so it rounds away.
+TEST_F(DeconvLoweringTest, TosaRoundsAwayPartialStrideOfOutputPadding) {
+  ASSERT_TRUE(run(makeTransposeConv(11, "-1, 1, -1, 1"),
+                  [](OpPassManager &pm) {
+                    pm.addPass(createTosaToRockPass());
+                  }));
+  ConvBwdDataOp conv = getOnly<ConvBwdDataOp>();
+  ASSERT_TRUE(conv);
+  EXPECT_EQ(getInts(conv.getPadding()), SmallVector<int64_t>({1, 0, 1, 0}));
+}
+
+// Batching stride phases leaves outputs unwritten when the stride and the
+// dilation share a factor.
+TEST_F(DeconvLoweringTest, TosaRejectsNonCoprimeStrideAndDilation) {
+  EXPECT_FALSE(run(makeTransposeConv(10, "-1, 0, -1, 0",
+                                     ", dilation = array<i64: 2, 2>"),
+                   [](OpPassManager &pm) {
+                     pm.addPass(createTosaToRockPass());
+                   }));
+}
+
+// Batched kernels put the 2x2 stride phases in gemmG, and each one takes all
+// ceil(3 / 2) = 2 taps per spatial dimension.
+TEST_F(DeconvLoweringTest, BatchedKernelsGemmSizes) {
+  ASSERT_TRUE(run(R"mlir(
+    func.func @deconv(%filter: memref<2x3x3x1x4xf32>,
+                      %in: memref<1x10x10x1x2xf32>,
+                      %out: memref<1x5x5x1x4xf32>)
+        attributes {kernel, arch = "gfx942"} {
+      rock.conv_bwd_data(%filter, %in, %out) features = none {
+        arch = "gfx942", batchKernels,
+        dilations = [1 : index, 1 : index],
+        filter_layout = ["c", "y", "x", "g", "k"],
+        input_layout = ["ni", "hi", "wi", "gi", "ci"],
+        kernelId = 0 : index,
+        output_layout = ["no", "ho", "wo", "go", "ko"],
+        padding = [1 : index, 0 : index, 1 : index, 0 : index],
+        strides = [2 : index, 2 : index]}
+        : memref<2x3x3x1x4xf32>, memref<1x10x10x1x2xf32>,
+          memref<1x5x5x1x4xf32>
+      return
+    }
+  )mlir",
+                  [](OpPassManager &pm) {
+                    pm.addPass(createRockConvToGemmPass());
+                  }));
+  GemmOp gemm = getOnly<GemmOp>();
+  ASSERT_TRUE(gemm);
+  // gemmG = g * 2 * 2, gemmK = k * 2 * 2 and gemmM = c, while gemmN covers
+  // the 5 + ceil(2 / 2) = 6 positions of each phase in both dimensions.
+  EXPECT_EQ(gemm.getA().getType().getShape(), ArrayRef<int64_t>({4, 16, 2}));
+  EXPECT_EQ(gemm.getB().getType().getShape(), ArrayRef<int64_t>({4, 16, 36}));
+  EXPECT_EQ(gemm.getC().getType().getShape(), ArrayRef<int64_t>({4, 2, 36}));
+}
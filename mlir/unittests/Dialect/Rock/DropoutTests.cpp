@@ -0,0 +1,140 @@
+//===- DropoutTests.cpp - Tests for the Philox dropout builders -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/Rock/utility/builderUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class DropoutTest : public ::testing::Test {
+protected:
+  DropoutTest() : b(&context), loc(b.getUnknownLoc()) {
+    context.loadDialect<arith::ArithDialect, func::FuncDialect>();
+  }
+
+  /// Emits the values returned by `build` into a function with constant
+  /// inputs, folds it, and returns the constants the values fold to.
+  SmallVector<Attribute>
+  fold(function_ref<SmallVector<Value>(OpBuilder &)> build) {
+    module = ModuleOp::create(loc);
+    auto func = func::FuncOp::create(loc, "f", b.getFunctionType({}, {}));
+    module->push_back(func);
+    OpBuilder builder = OpBuilder::atBlockBegin(func.addEntryBlock());
+    SmallVector<Value> results = build(builder);
+    builder.create<func::ReturnOp>(loc, results);
+    func.setType(b.getFunctionType({}, ValueRange(results).getTypes()));
+    EXPECT_TRUE(succeeded(
+        applyPatternsAndFoldGreedily(func, RewritePatternSet(&context))));
+
+    SmallVector<Attribute> constants;
+    for (Value result : func.front().getTerminator()->getOperands()) {
+      Attribute constant;
+      EXPECT_TRUE(matchPattern(result, m_Constant(&constant)));
+      constants.push_back(constant);
+    }
+    return constants;
+  }
+
+  Value i32(OpBuilder &builder, uint32_t value) {
+    return builder.create<arith::ConstantIntOp>(
+        loc, static_cast<int32_t>(value), b.getI32Type());
+  }
+
+  Value i64(OpBuilder &builder, uint64_t value) {
+    return builder.create<arith::ConstantIntOp>(
+        loc, static_cast<int64_t>(value), b.getI64Type());
+  }
+
+  /// Checks that Philox4x32-10 maps `counter` and `key` to `expected`.
+  void checkPhilox(ArrayRef<uint32_t> counter, ArrayRef<uint32_t> key,
+                   ArrayRef<uint32_t> expected) {
+    SmallVector<Attribute> outputs = fold([&](OpBuilder &builder) {
+      SmallVector<Value> counterVals = llvm::map_to_vector(
+          counter, [&](uint32_t c) { return i32(builder, c); });
+      SmallVector<Value> keyVals =
+          llvm::map_to_vector(key, [&](uint32_t k) { return i32(builder, k); });
+      return SmallVector<Value>(
+          createPhilox4x32Op(builder, loc, counterVals, keyVals));
+    });
+    ASSERT_EQ(outputs.size(), expected.size());
+    for (auto [output, value] : llvm::zip(outputs, expected))
+      EXPECT_EQ(output.cast<IntegerAttr>().getValue().getZExtValue(), value);
+  }
+
+  MLIRContext context;
+  Builder b;
+  Location loc;
+  OwningOpRef<ModuleOp> module;
+};
+
+// Known-answer vectors of the Random123 reference implementation.
+TEST_F(DropoutTest, Philox4x32KnownAnswers) {
+  checkPhilox({0, 0, 0, 0}, {0, 0},
+              {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+  checkPhilox({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+              {0xffffffff, 0xffffffff},
+              {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+  checkPhilox({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+              {0xa4093822, 0x299f31d0},
+              {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+}
+
+// With seed 0x0123456789abcdef and offset 5, the first outputs of the stream
+// for elements 0 to 7 are b341ed12, d0460919, 644af2c9, c58f49d0, f1dc0b27,
+// 7e195e4b, 8ff6cbfa and 91b7d2e0, so a rate of 0.5 drops elements 2 and 5
+// and doubles the others.
+TEST_F(DropoutTest, MaskAndScale) {
+  const uint64_t seed = 0x0123456789abcdef, offset = 5;
+  const bool kept[] = {true, true, false, true, true, false, true, true};
+  SmallVector<Attribute> outputs = fold([&](OpBuilder &builder) {
+    SmallVector<Value> results;
+    Value seedVal = i64(builder, seed), offsetVal = i64(builder, offset);
+    Value value = builder.create<arith::ConstantFloatOp>(
+        loc, APFloat(1.5f), builder.getF32Type());
+    for (int64_t i = 0; i < 8; ++i) {
+      Value idx = builder.create<arith::ConstantIndexOp>(loc, i);
+      results.push_back(createDropoutKeepOp(builder, loc, seedVal, offsetVal,
+                                            idx, /*rate=*/0.5));
+      results.push_back(createDropoutOp(builder, loc, value, seedVal,
+                                        offsetVal, idx, /*rate=*/0.5));
+    }
+    return results;
+  });
+  ASSERT_EQ(outputs.size(), 16u);
+  for (int64_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(outputs[2 * i].cast<IntegerAttr>().getValue().getBoolValue(),
+              kept[i])
+        << "element " << i;
+    EXPECT_EQ(outputs[2 * i + 1].cast<FloatAttr>().getValueAsDouble(),
+              kept[i] ? 3.0 : 0.0)
+        << "element " << i;
+  }
+}
+
+TEST_F(DropoutTest, ScalesByInverseKeepRate) {
+  // Element 0 of the stream above is kept at a rate of 0.25 as well.
+  SmallVector<Attribute> outputs = fold([&](OpBuilder &builder) {
+    Value value = builder.create<arith::ConstantFloatOp>(
+        loc, APFloat(3.0f), builder.getF32Type());
+    Value idx = builder.create<arith::ConstantIndexOp>(loc, 0);
+    return SmallVector<Value>{createDropoutOp(
+        builder, loc, value, i64(builder, 0x0123456789abcdef),
+        i64(builder, 5), idx, /*rate=*/0.25)};
+  });
+  ASSERT_EQ(outputs.size(), 1u);
+  EXPECT_FLOAT_EQ(outputs[0].cast<FloatAttr>().getValueAsDouble(), 4.0);
+}
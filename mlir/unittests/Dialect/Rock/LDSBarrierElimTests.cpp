@@ -0,0 +1,122 @@
+//===- LDSBarrierElimTests.cpp - Tests for LDS barrier elimination --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class LDSBarrierElimTest : public ::testing::Test {
+protected:
+  LDSBarrierElimTest() {
+    context.loadDialect<RockDialect, affine::AffineDialect,
+                        arith::ArithDialect, func::FuncDialect,
+                        gpu::GPUDialect, memref::MemRefDialect,
+                        scf::SCFDialect>();
+  }
+
+  /// Runs rock-lds-barrier-elim on a kernel whose body is `body`, which has
+  /// the 1 KiB workgroup buffers `%a` and `%b`, and returns the number of
+  /// LDS barriers left afterwards.
+  int64_t countBarriers(StringRef body) {
+    std::string source = (R"mlir(
+      !lds = memref<1024xi8, #gpu.address_space<workgroup>>
+      func.func @kernel(%n: index) attributes {kernel} {
+        %c0 = arith.constant 0 : index
+        %c1 = arith.constant 1 : index
+        %v = arith.constant 0 : i8
+        %a = rock.alloc() : !lds
+        %b = rock.alloc() : !lds
+      )mlir" + body + R"mlir(
+        return
+      })mlir")
+                             .str();
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return -1;
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(createRockLDSBarrierElimPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+
+    int64_t count = 0;
+    module->walk([&](LDSBarrierOp) { ++count; });
+    return count;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+TEST_F(LDSBarrierElimTest, RemovesBarrierBetweenBuffers) {
+  EXPECT_EQ(countBarriers(R"mlir(
+    memref.store %v, %a[%c0] : !lds
+    rock.lds_barrier
+    memref.store %v, %b[%c0] : !lds
+  )mlir"),
+            0);
+}
+
+TEST_F(LDSBarrierElimTest, KeepsBarrierBetweenWriteAndRead) {
+  EXPECT_EQ(countBarriers(R"mlir(
+    memref.store %v, %a[%c0] : !lds
+    rock.lds_barrier
+    %x = memref.load %a[%c0] : !lds
+  )mlir"),
+            1);
+}
+
+TEST_F(LDSBarrierElimTest, RemovesBarriersAroundLoopOfReads) {
+  EXPECT_EQ(countBarriers(R"mlir(
+    scf.for %i = %c0 to %n step %c1 {
+      rock.lds_barrier
+      %x = memref.load %a[%c0] : !lds
+      rock.lds_barrier
+    }
+  )mlir"),
+            0);
+}
+
+TEST_F(LDSBarrierElimTest, FollowsLoopEntryAndExitPastWrapAround) {
+  // Walking around the back edge meets the other barrier straight away, but
+  // the first iteration follows the store before the loop and the last one
+  // precedes the store after it.
+  EXPECT_EQ(countBarriers(R"mlir(
+    memref.store %v, %a[%c0] : !lds
+    scf.for %i = %c0 to %n step %c1 {
+      rock.lds_barrier
+      %x = memref.load %a[%c0] : !lds
+      rock.lds_barrier
+    }
+    memref.store %v, %a[%c0] : !lds
+  )mlir"),
+            2);
+  EXPECT_EQ(countBarriers(R"mlir(
+    memref.store %v, %a[%c0] : !lds
+    affine.for %i = 0 to 4 {
+      rock.lds_barrier
+      %x = memref.load %a[%c0] : !lds
+      rock.lds_barrier
+    }
+    memref.store %v, %a[%c0] : !lds
+  )mlir"),
+            2);
+}
@@ -0,0 +1,70 @@
+//===- MfmaInsnGroupTests.cpp - Tests for mfma instruction selection ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/LLVMIR/ROCDLDialect.h"
+#include "mlir/Dialect/Rock/IR/MfmaInsnGroup.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class MfmaInsnGroupTest : public ::testing::Test {
+protected:
+  MfmaInsnGroupTest() : b(&context) { context.getOrLoadDialect<RockDialect>(); }
+
+  MLIRContext context;
+  Builder b;
+};
+
+TEST_F(MfmaInsnGroupTest, Fp64Layout) {
+  for (StringRef arch : {"gfx90a", "gfx942"}) {
+    FailureOr<MfmaInsnGroup> group =
+        MfmaInsnGroup::select(b.getF64Type(), b.getF64Type(), arch, 32);
+    ASSERT_TRUE(succeeded(group)) << arch.str();
+    EXPECT_EQ(group->getROCDLIntrinsicName().str(),
+              ROCDL::mfma_f64_16x16x4f64::getOperationName().str());
+    MfmaInsnAttr attr = group->getInsnAttr();
+    // One f64 per lane, and each lane holds four rows of one column.
+    EXPECT_EQ(attr.k_base, 1);
+    EXPECT_EQ(attr.rowGroupSize, 1);
+    EXPECT_EQ(attr.rowGroupsPerBlock, 4);
+    EXPECT_TRUE(attr.isKReduction);
+    EXPECT_EQ(group->getArgTypeA(), b.getF64Type());
+    EXPECT_EQ(group->getRetType(), VectorType::get({4}, b.getF64Type()));
+    EXPECT_EQ(group->getMRepeats(32), 2);
+    EXPECT_TRUE(group->isCoherentWithK(/*kpack=*/1, /*kPerBlock=*/4));
+    EXPECT_FALSE(group->isCoherentWithK(/*kpack=*/2, /*kPerBlock=*/2));
+  }
+}
+
+TEST_F(MfmaInsnGroupTest, Fp64NotOnGfx908) {
+  EXPECT_TRUE(failed(
+      MfmaInsnGroup::select(b.getF64Type(), b.getF64Type(), "gfx908", 16)));
+  EXPECT_FALSE(bitEnumContainsAll(
+      lookupArchInfo("gfx908").getDefaultFeatures(b.getF64Type()),
+      GemmFeatures::mfma));
+  EXPECT_TRUE(bitEnumContainsAll(
+      lookupArchInfo("gfx90a").getDefaultFeatures(b.getF64Type()),
+      GemmFeatures::mfma));
+  EXPECT_TRUE(bitEnumContainsAll(
+      lookupArchInfo("gfx942").getDefaultFeatures(b.getF64Type()),
+      GemmFeatures::mfma));
+}
+
+TEST_F(MfmaInsnGroupTest, Fp32Unchanged) {
+  FailureOr<MfmaInsnGroup> group =
+      MfmaInsnGroup::select(b.getF32Type(), b.getF32Type(), "gfx90a", 16);
+  ASSERT_TRUE(succeeded(group));
+  EXPECT_EQ(group->getInsnAttr().rowGroupSize, 4);
+  EXPECT_EQ(group->getRetType(), VectorType::get({4}, b.getF32Type()));
+}
@@ -0,0 +1,119 @@
+//===- PerfModelTests.cpp - Tests for the default tuning perf model -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+//===----------------------------------------------------------------------===//
+// Test Fixture
+//===----------------------------------------------------------------------===//
+
+class PerfModelTest : public ::testing::Test {
+protected:
+  PerfModelTest() : b(&context) { context.getOrLoadDialect<RockDialect>(); }
+
+  InitParamsAccel pickXdlops(StringRef arch, const GemmSize &gemmSize) {
+    PopulateParamsInfo info(gemmSize, arch,
+                            GemmFeatures::mfma | GemmFeatures::dot,
+                            b.getF16Type(), b.getF16Type(), KernelType::Gemm);
+    PopulateParamsXDL populate;
+    InitParamsAccel params;
+    EXPECT_TRUE(
+        succeeded(populate.obtainTuningParameters(b, info, "", params)));
+    return params;
+  }
+
+protected:
+  MLIRContext context;
+  OpBuilder b;
+};
+
+//===----------------------------------------------------------------------===//
+// Model
+//===----------------------------------------------------------------------===//
+
+TEST_F(PerfModelTest, NoEstimateWithoutAccelData) {
+  AmdArchInfo info = lookupArchInfo("gfx1030");
+  EXPECT_FALSE(estimateAccelGemmCycles(info, info.minNumCU,
+                                       GemmSize(1, 1024, 1024, 1024),
+                                       b.getF16Type(), 64, 64, 32, 32, 32));
+}
+
+TEST_F(PerfModelTest, NoEstimateWhenLdsOverflows) {
+  AmdArchInfo info = lookupArchInfo("gfx90a");
+  EXPECT_FALSE(estimateAccelGemmCycles(info, info.minNumCU,
+                                       GemmSize(1, 4096, 4096, 4096),
+                                       b.getF16Type(), 256, 256, 128, 64, 64));
+}
+
+TEST_F(PerfModelTest, ProducerWavesDoubleLds) {
+  // 256 x 256 tiles of 64 f16 fill all 64 KiB of LDS once, so there's no
+  // room for the second buffer producer waves need.
+  AmdArchInfo info = lookupArchInfo("gfx90a");
+  GemmSize gemmSize(1, 4096, 4096, 4096);
+  EXPECT_TRUE(estimateAccelGemmCycles(info, info.minNumCU, gemmSize,
+                                      b.getF16Type(), 256, 256, 64, 128, 128));
+  EXPECT_FALSE(estimateAccelGemmCycles(info, info.minNumCU, gemmSize,
+                                       b.getF16Type(), 256, 256, 64, 128, 128,
+                                       /*splitKFactor=*/1,
+                                       /*producerWaves=*/1));
+
+  PopulateParamsInfo populateInfo(gemmSize, "gfx90a",
+                                  GemmFeatures::mfma | GemmFeatures::dot,
+                                  b.getF16Type(), b.getF16Type(),
+                                  KernelType::Gemm);
+  PopulateParamsXDL populate;
+  EXPECT_TRUE(succeeded(populate.paramsProbablyValid(
+      b, populateInfo,
+      InitParamsAccel(256, 256, 8, 128, 32, 8, 1, true, true, 0, 0))));
+  EXPECT_TRUE(failed(populate.paramsProbablyValid(
+      b, populateInfo,
+      InitParamsAccel(256, 256, 8, 128, 32, 8, 1, true, true, 0, 1))));
+}
+
+TEST_F(PerfModelTest, WaveQuantization) {
+  AmdArchInfo info = lookupArchInfo("gfx90a");
+  ASSERT_EQ(info.minNumCU, 104);
+  // 8 x 13 tiles fill every CU exactly once, while 7 x 15 tiles leave one CU
+  // with two of them.
+  std::optional<double> even = estimateAccelGemmCycles(
+      info, info.minNumCU, GemmSize(1, 1024, 8192, 1664), b.getF16Type(), 128,
+      128, 32, 64, 64);
+  std::optional<double> uneven = estimateAccelGemmCycles(
+      info, info.minNumCU, GemmSize(1, 896, 8192, 1920), b.getF16Type(), 128,
+      128, 32, 64, 64);
+  ASSERT_TRUE(even && uneven);
+  EXPECT_GT(*uneven, 1.4 * *even);
+}
+
+//===----------------------------------------------------------------------===//
+// Default tuning parameter selection
+//===----------------------------------------------------------------------===//
+
+TEST_F(PerfModelTest, SmallGemmSpreadsOverCUs) {
+  InitParamsAccel params = pickXdlops("gfx90a", GemmSize(1, 256, 4096, 256));
+  EXPECT_LE(params.gemmMPerBlock * params.gemmNPerBlock, 64 * 64);
+}
+
+TEST_F(PerfModelTest, SkinnyGemmAvoidsPadding) {
+  InitParamsAccel params = pickXdlops("gfx942", GemmSize(1, 16, 4096, 4096));
+  EXPECT_EQ(params.gemmMPerBlock, 16);
+}
+
+TEST_F(PerfModelTest, LargeGemmUsesLargeTiles) {
+  InitParamsAccel params = pickXdlops("gfx90a", GemmSize(1, 4096, 4096, 4096));
+  EXPECT_GE(params.gemmMPerBlock * params.gemmNPerBlock, 128 * 128);
+}
@@ -0,0 +1,183 @@
+//===- PlanLDSTests.cpp - Tests for LDS arena planning --------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class PlanLDSTest : public ::testing::Test {
+protected:
+  PlanLDSTest() {
+    context.loadDialect<RockDialect, arith::ArithDialect, func::FuncDialect,
+                        gpu::GPUDialect, memref::MemRefDialect,
+                        scf::SCFDialect>();
+  }
+
+  /// Runs rock-plan-lds on a kernel whose body is `body`, in which `!lds` is a
+  /// 1 KiB workgroup buffer type, and returns the sizes in bytes of the
+  /// workgroup allocations left afterwards.
+  SmallVector<int64_t> plan(StringRef body) {
+    std::string source = (R"mlir(
+      !lds = memref<1024xi8, #gpu.address_space<workgroup>>
+      func.func @kernel(%cond: i1, %n: index) attributes {kernel} {
+        %c0 = arith.constant 0 : index
+        %c1 = arith.constant 1 : index
+        %v = arith.constant 0 : i8
+      )mlir" + body + R"mlir(
+        return
+      })mlir")
+                             .str();
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return {};
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(createRockPlanLDSPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+
+    SmallVector<int64_t> sizes;
+    module->walk([&](GpuAllocOp alloc) {
+      sizes.push_back(alloc.getOutput().getType().getNumElements());
+    });
+    return sizes;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+TEST_F(PlanLDSTest, SharesAcrossTopLevelBarrier) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    memref.store %v, %a[%c0] : !lds
+    rock.lds_barrier
+    %b = rock.alloc() : !lds
+    memref.store %v, %b[%c0] : !lds
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024}));
+}
+
+TEST_F(PlanLDSTest, KeepsBuffersWithoutBarrier) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    memref.store %v, %a[%c0] : !lds
+    %b = rock.alloc() : !lds
+    memref.store %v, %b[%c0] : !lds
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024, 1024}));
+}
+
+TEST_F(PlanLDSTest, KeepsBuffersWithOverlappingLiveRanges) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    memref.store %v, %a[%c0] : !lds
+    rock.lds_barrier
+    %b = rock.alloc() : !lds
+    memref.store %v, %b[%c0] : !lds
+    memref.store %v, %a[%c0] : !lds
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024, 1024}));
+}
+
+TEST_F(PlanLDSTest, ConditionalBarrierDoesNotSeparate) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    memref.store %v, %a[%c0] : !lds
+    scf.if %cond {
+      rock.lds_barrier
+    }
+    %b = rock.alloc() : !lds
+    memref.store %v, %b[%c0] : !lds
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024, 1024}));
+}
+
+TEST_F(PlanLDSTest, LoopBarrierDoesNotSeparate) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    memref.store %v, %a[%c0] : !lds
+    scf.for %i = %c0 to %n step %c1 {
+      rock.lds_barrier
+    }
+    %b = rock.alloc() : !lds
+    memref.store %v, %b[%c0] : !lds
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024, 1024}));
+}
+
+TEST_F(PlanLDSTest, SharesWithinLoopBody) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    %b = rock.alloc() : !lds
+    scf.for %i = %c0 to %n step %c1 {
+      memref.store %v, %a[%c0] : !lds
+      rock.lds_barrier
+      %x = memref.load %a[%c0] : !lds
+      rock.lds_barrier
+      memref.store %x, %b[%c0] : !lds
+      rock.lds_barrier
+      %y = memref.load %b[%c0] : !lds
+      rock.lds_barrier
+    }
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024}));
+  auto func = *module->getOps<func::FuncOp>().begin();
+  auto ldsBytes = func->getAttrOfType<IntegerAttr>("rock.lds_bytes");
+  ASSERT_TRUE(ldsBytes);
+  EXPECT_EQ(ldsBytes.getInt(), 1024);
+}
+
+TEST_F(PlanLDSTest, LoopBodyNeedsBarrierBeforeNextIteration) {
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    %b = rock.alloc() : !lds
+    scf.for %i = %c0 to %n step %c1 {
+      memref.store %v, %a[%c0] : !lds
+      rock.lds_barrier
+      %x = memref.load %a[%c0] : !lds
+      rock.lds_barrier
+      memref.store %x, %b[%c0] : !lds
+      rock.lds_barrier
+      %y = memref.load %b[%c0] : !lds
+    }
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024, 1024}));
+}
+
+TEST_F(PlanLDSTest, KeepsBufferCarriedAcrossIterations) {
+  // %a is read before it's written in each iteration, so it holds the
+  // previous iteration's data while %b is in use.
+  SmallVector<int64_t> sizes = plan(R"mlir(
+    %a = rock.alloc() : !lds
+    %b = rock.alloc() : !lds
+    scf.for %i = %c0 to %n step %c1 {
+      %x = memref.load %a[%c0] : !lds
+      rock.lds_barrier
+      memref.store %x, %a[%c0] : !lds
+      rock.lds_barrier
+      memref.store %x, %b[%c0] : !lds
+      rock.lds_barrier
+      %y = memref.load %b[%c0] : !lds
+      rock.lds_barrier
+    }
+  )mlir");
+  EXPECT_EQ(sizes, SmallVector<int64_t>({1024, 1024}));
+}
@@ -0,0 +1,111 @@
+//===- SchedHintPerfConfigTests.cpp - Tests for v3 perf configs -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Tuning/GridwiseGemmParams.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class SchedHintPerfConfigTest : public ::testing::Test {
+protected:
+  SchedHintPerfConfigTest() : b(&context) {
+    context.getOrLoadDialect<RockDialect>();
+  }
+
+  XdlopsGemmParamsAttr makeXdlops(int64_t schedHint) {
+    return XdlopsGemmParamsAttr::get(
+        &context, /*kpackPerBlock=*/8, /*mPerBlock=*/64, /*nPerBlock=*/64,
+        /*kpack=*/4, /*mPerWave=*/32, /*mnPerXdl=*/32, /*splitKFactor=*/1,
+        /*forceUnroll=*/true, schedHint, /*producerWaves=*/0);
+  }
+
+  WmmaGemmParamsAttr makeWmma(int64_t schedHint) {
+    return WmmaGemmParamsAttr::get(
+        &context, /*kpackPerBlock=*/8, /*mPerBlock=*/64, /*nPerBlock=*/64,
+        /*kpack=*/8, /*mPerWave=*/32, /*nPerWave=*/32, /*splitKFactor=*/1,
+        /*forceUnroll=*/true, schedHint);
+  }
+
+  template <typename ParamsAttr>
+  static std::string print(ParamsAttr params) {
+    SmallString<64> perfConfig;
+    params.getPerfConfigStr(perfConfig);
+    return perfConfig.str().str();
+  }
+
+  /// Parses `perfConfig` as the tuning flow does, failing the test if it
+  /// isn't valid.
+  static InitParamsAccel parse(StringRef perfConfig) {
+    InitParamsAccel params;
+    EXPECT_TRUE(params.deserialize(perfConfig.str())) << perfConfig.str();
+    return params;
+  }
+
+  static std::string serialize(const InitParamsAccel &params) {
+    std::ostringstream os;
+    os << params;
+    return os.str();
+  }
+
+  MLIRContext context;
+  OpBuilder b;
+};
+
+TEST_F(SchedHintPerfConfigTest, RoundTripsXdlopsHints) {
+  PopulateParamsXDL populate;
+  for (int64_t schedHint : {1, 2, 3}) {
+    XdlopsGemmParamsAttr attr = makeXdlops(schedHint);
+    std::string perfConfig = print(attr);
+    EXPECT_EQ(perfConfig,
+              "v3:64,64,8,32,32,4,1,1,1," + std::to_string(schedHint));
+    InitParamsAccel params = parse(perfConfig);
+    EXPECT_EQ(params.schedHint, schedHint);
+    EXPECT_EQ(serialize(params), perfConfig);
+    EXPECT_EQ(populate.getGemmParamsAttr(b, params), attr);
+  }
+}
+
+TEST_F(SchedHintPerfConfigTest, RoundTripsWmmaHints) {
+  PopulateParamsWmma populate;
+  for (int64_t schedHint : {1, 2, 3}) {
+    WmmaGemmParamsAttr attr = makeWmma(schedHint);
+    std::string perfConfig = print(attr);
+    EXPECT_EQ(perfConfig,
+              "v3:64,64,8,32,32,8,1,1,1," + std::to_string(schedHint));
+    InitParamsAccel params = parse(perfConfig);
+    EXPECT_EQ(params.schedHint, schedHint);
+    EXPECT_EQ(serialize(params), perfConfig);
+    EXPECT_EQ(populate.getGemmParamsAttr(b, params), attr);
+  }
+}
+
+// Parameters that keep the backend's schedule print in the v2 format, so
+// existing tuning databases still match them.
+TEST_F(SchedHintPerfConfigTest, HintlessParamsStayV2) {
+  XdlopsGemmParamsAttr xdlops = makeXdlops(/*schedHint=*/0);
+  EXPECT_EQ(print(xdlops), "v2:64,64,8,32,32,4,1,1,1");
+  EXPECT_EQ(PopulateParamsXDL().getGemmParamsAttr(b, parse(print(xdlops))),
+            xdlops);
+  WmmaGemmParamsAttr wmma = makeWmma(/*schedHint=*/0);
+  EXPECT_EQ(print(wmma), "v2:64,64,8,32,32,8,1,1,1");
+  EXPECT_EQ(PopulateParamsWmma().getGemmParamsAttr(b, parse(print(wmma))),
+            wmma);
+}
+
+TEST_F(SchedHintPerfConfigTest, RejectsExtraFields) {
+  InitParamsAccel params;
+  EXPECT_FALSE(params.deserialize("v3:64,64,8,32,32,4,1,1,1,2,0"));
+  EXPECT_FALSE(params.deserialize("v2:64,64,8,32,32,4,1,1,1,2"));
+}
@@ -0,0 +1,146 @@
+//===- SplitKWorkspaceTests.cpp - Tests for split-K without atomics -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/MHAL/IR/MHAL.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/Rock/Tuning/GridwiseGemmParams.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class SplitKWorkspaceTest : public ::testing::Test {
+protected:
+  SplitKWorkspaceTest() {
+    context.loadDialect<RockDialect, affine::AffineDialect, arith::ArithDialect,
+                        func::FuncDialect, gpu::GPUDialect, LLVM::LLVMDialect,
+                        linalg::LinalgDialect, mhal::MHALDialect,
+                        memref::MemRefDialect, scf::SCFDialect,
+                        vector::VectorDialect>();
+  }
+
+  /// Lowers a bf16 128x256x128 gemm split in two along K, with 64x64 tiles
+  /// and a workspace of `workspaceBytes` bytes, to blockwise operations.
+  bool lower(int64_t workspaceBytes) {
+    std::string ws = "memref<" + std::to_string(workspaceBytes) + "xi8>";
+    std::string source = R"mlir(
+      !a = memref<1x128x256xbf16>
+      !b = memref<1x256x128xbf16>
+      !c = memref<1x128x128xbf16>
+      !ws = )mlir" + ws + R"mlir(
+      func.func @gemm(%a: !a, %b: !b, %c: !c, %ws: !ws)
+          attributes {kernel, mhal.arch = "amdgcn-amd-amdhsa:gfx942"} {
+        rock.gemm %c = %a * %b workspace(%ws : !ws)
+          features = mfma|dot|atomic_add storeMethod = set {
+          arch = "amdgcn-amd-amdhsa:gfx942",
+          perf_config = "v2:64,64,4,32,32,8,2,1,1"} : !c = !a * !b
+        return
+      }
+    )mlir";
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return false;
+    PassManager pm(&context);
+    OpPassManager &funcPm = pm.nest<func::FuncOp>();
+    funcPm.addPass(createRockAffixTuningParametersPass());
+    funcPm.addPass(createRockGemmToGridwisePass());
+    funcPm.addPass(createRockRegularizePass());
+    funcPm.addPass(createRockGridwiseGemmToBlockwisePass());
+    return succeeded(pm.run(*module));
+  }
+
+  func::FuncOp getKernel() {
+    return module->lookupSymbol<func::FuncOp>("gemm");
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+/// Returns whether `op` is nested in an scf.if on `value == expected`.
+static bool isGuardedByEq(Operation *op, int64_t expected) {
+  for (auto ifOp = op->getParentOfType<scf::IfOp>(); ifOp;
+       ifOp = ifOp->getParentOfType<scf::IfOp>()) {
+    auto cmp = ifOp.getCondition().getDefiningOp<arith::CmpIOp>();
+    if (cmp && cmp.getPredicate() == arith::CmpIPredicate::eq &&
+        getConstantIntValue(cmp.getRhs()) == expected)
+      return true;
+  }
+  return false;
+}
+
+// Four 64x64 tiles, each with two 32-bit partial results per element and one
+// 32-bit arrival counter.
+static constexpr int64_t workspaceBytes = 4 * (4 * 64 * 64 * 2 + 4);
+
+TEST_F(SplitKWorkspaceTest, WorkspaceSize) {
+  EXPECT_EQ(getSplitKWorkspaceBytes(GemmSize(1, 128, 256, 128), 64, 64, 2),
+            workspaceBytes);
+  EXPECT_GE(getMaxSplitKWorkspaceBytes(GemmSize(1, 128, 256, 128)),
+            workspaceBytes);
+}
+
+TEST_F(SplitKWorkspaceTest, LastArrivingBlockFinalizes) {
+  ASSERT_TRUE(lower(workspaceBytes));
+  func::FuncOp kernel = getKernel();
+  ASSERT_TRUE(kernel);
+  // The counters must start at zero.
+  EXPECT_TRUE(kernel.getArgAttr(3, mhal::PrefillAttr::getMnemonic()));
+  EXPECT_FALSE(kernel.getArgAttr(2, mhal::PrefillAttr::getMnemonic()));
+
+  // Each workgroup's leader bumps its tile's counter once.
+  SmallVector<memref::AtomicRMWOp> increments;
+  kernel.walk([&](memref::AtomicRMWOp op) { increments.push_back(op); });
+  ASSERT_EQ(increments.size(), 1u);
+  EXPECT_EQ(increments[0].getKind(), arith::AtomicRMWKind::addi);
+  EXPECT_TRUE(increments[0].getType().isInteger(32));
+  EXPECT_EQ(getConstantIntValue(increments[0].getValue()), 1);
+  EXPECT_TRUE(isGuardedByEq(increments[0], 0));
+
+  // The partial results go to the workspace unguarded, and C is written only
+  // by the block that saw the other split arrive first.
+  SmallVector<ThreadwiseWriteAllOp> writes;
+  kernel.walk([&](ThreadwiseWriteAllOp op) { writes.push_back(op); });
+  ASSERT_EQ(writes.size(), 2u);
+  EXPECT_FALSE(isGuardedByEq(writes[0], 1));
+  EXPECT_TRUE(isGuardedByEq(writes[1], 1));
+  for (ThreadwiseWriteAllOp write : writes)
+    EXPECT_EQ(write.getStoreMethod(), StoreMethod::Set);
+  EXPECT_TRUE(writes[1].getDest().getType().getElementType().isBF16());
+
+  // That block then resets the counter for the next launch.
+  int64_t counterResets = 0;
+  kernel.walk([&](memref::StoreOp store) {
+    if (store.getMemRef().getType().getElementType().isInteger(32) &&
+        getConstantIntValue(store.getValue()) == 0 &&
+        isGuardedByEq(store, 1))
+      ++counterResets;
+  });
+  EXPECT_EQ(counterResets, 1);
+}
+
+TEST_F(SplitKWorkspaceTest, RejectsSmallWorkspace) {
+  EXPECT_FALSE(lower(workspaceBytes - 4));
+}
@@ -0,0 +1,136 @@
+//===- SugarToLoopsTests.cpp - Tests for register-aware unrolling ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/AMDGPU/IR/AMDGPUDialect.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class SugarToLoopsTest : public ::testing::Test {
+protected:
+  SugarToLoopsTest() {
+    context.loadDialect<RockDialect, affine::AffineDialect,
+                        amdgpu::AMDGPUDialect, arith::ArithDialect,
+                        func::FuncDialect, gpu::GPUDialect,
+                        memref::MemRefDialect, scf::SCFDialect,
+                        vector::VectorDialect>();
+  }
+
+  /// Runs rock-sugar-to-loops on a kernel for `arch` whose body is `body`, and
+  /// returns the steps of the affine loops left rolled afterwards. The kernel
+  /// has a global buffer `%in`, a global buffer `%out`, and a 64-dword
+  /// register tile `%regs`.
+  SmallVector<int64_t> unroll(StringRef arch, StringRef body) {
+    std::string source = (R"mlir(
+      !global = memref<65536xf32>
+      !regs = memref<64xf32, #gpu.address_space<private>>
+      func.func @kernel(%in: !global, %out: !global)
+          attributes {kernel, arch = ")mlir" +
+                          arch + R"mlir("} {
+        %c0 = arith.constant 0 : index
+        %v = arith.constant 0.0 : f32
+        %regs = rock.alloc() : !regs
+      )mlir" + body + R"mlir(
+        return
+      })mlir")
+                             .str();
+    module = parseSourceString<ModuleOp>(source, &context);
+    EXPECT_TRUE(module);
+    if (!module)
+      return {};
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(createRockSugarToLoopsPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+
+    SmallVector<int64_t> steps;
+    module->walk([&](affine::AffineForOp loop) {
+      steps.push_back(loop.getStepAsInt());
+    });
+    return steps;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+// 8 x 16 iterations that each load 4 dwords need 512 VGPRs once fully
+// unrolled, on top of the 64 taken by the register tile.
+static constexpr StringLiteral kLoadNest = R"mlir(
+  affine.for %i = 0 to 8 {
+    affine.for %j = 0 to 16 {
+      %idx = affine.apply affine_map<(d0, d1) -> (d0 * 64 + d1 * 4)>(%i, %j)
+      %x = vector.load %in[%idx] : !global, vector<4xf32>
+      vector.store %x, %out[%idx] : !global, vector<4xf32>
+    } {forceUnroll}
+  } {forceUnroll}
+  memref.store %v, %regs[%c0] : !regs
+)mlir";
+
+TEST_F(SugarToLoopsTest, UnrollsWithinUnifiedRegisterFile) {
+  // gfx90a can load into all 512 registers of a lane, leaving 448 once the
+  // register tile is placed: the outer loop is unrolled by 4.
+  EXPECT_EQ(unroll("amdgcn-amd-amdhsa:gfx90a", kLoadNest),
+            SmallVector<int64_t>({4}));
+  EXPECT_EQ(unroll("amdgcn-amd-amdhsa:gfx942", kLoadNest),
+            SmallVector<int64_t>({4}));
+}
+
+TEST_F(SugarToLoopsTest, AccumulationRegistersDoNotHoldLoads) {
+  // On gfx908 only the 256 VGPRs can be loaded into, leaving 192 once the
+  // register tile is placed: the outer loop is unrolled by 2.
+  EXPECT_EQ(unroll("amdgcn-amd-amdhsa:gfx908", kLoadNest),
+            SmallVector<int64_t>({2}));
+  EXPECT_EQ(unroll("amdgcn-amd-amdhsa:gfx1100", kLoadNest),
+            SmallVector<int64_t>({2}));
+}
+
+TEST_F(SugarToLoopsTest, UnrollsFullyWhenLoadsFit) {
+  EXPECT_EQ(unroll("amdgcn-amd-amdhsa:gfx90a", R"mlir(
+    affine.for %i = 0 to 4 {
+      affine.for %j = 0 to 16 {
+        %idx = affine.apply affine_map<(d0, d1) -> (d0 * 64 + d1 * 4)>(%i, %j)
+        %x = vector.load %in[%idx] : !global, vector<4xf32>
+        vector.store %x, %out[%idx] : !global, vector<4xf32>
+      } {forceUnroll}
+    } {forceUnroll}
+    memref.store %v, %regs[%c0] : !regs
+  )mlir"),
+            SmallVector<int64_t>());
+}
+
+TEST_F(SugarToLoopsTest, UnrollsRegisterIndexAroundRolledLoop) {
+  // The inner loop needs 512 VGPRs and is unrolled by 32 on gfx908, but the
+  // outer one indexes the register tile, so it's unrolled anyway, leaving two
+  // copies of the inner loop.
+  EXPECT_EQ(unroll("amdgcn-amd-amdhsa:gfx908", R"mlir(
+    affine.for %i = 0 to 2 {
+      affine.for %j = 0 to 128 {
+        %idx = affine.apply affine_map<(d0, d1) -> (d0 * 512 + d1 * 4)>(%i, %j)
+        %x = vector.load %in[%idx] : !global, vector<4xf32>
+        vector.store %x, %out[%idx] : !global, vector<4xf32>
+      } {forceUnroll}
+      memref.store %v, %regs[%i] : !regs
+    } {forceUnroll}
+  )mlir"),
+            SmallVector<int64_t>({32, 32}));
+}
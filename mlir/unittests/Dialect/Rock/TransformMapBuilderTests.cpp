@@ -9,6 +9,7 @@
 
 #include "mlir/Dialect/Rock/IR/Rock.h"
 #include "mlir/Dialect/Rock/IR/TransformMapBuilder.h"
+#include "mlir/Dialect/Rock/utility/transformMapUtils.h"
 #include "mlir/IR/MLIRContext.h"
 #include "llvm/ADT/SmallVector.h"
 
@@ -125,6 +126,25 @@ TEST_F(TMBuilderTest, Padding) {
   EXPECT_EQ(resUp, resDown);
 }
 
+TEST_F(TMBuilderTest, InvertSliceAsPadding) {
+  llvm::SmallVector<int64_t> fullBounds = {3, 16};
+  llvm::SmallVector<int64_t> slicedBounds = {3, 6};
+
+  auto buildUp = makeBottomUp({"m", "n"}, fullBounds);
+  buildUp.slice({"m_sliced", "n_sliced"}, {"m", "n"}, {0, 4}, {3, 10});
+  TransformMapAttr slice = buildUp.get();
+
+  OpBuilder ob(&context);
+  EXPECT_FALSE(invertTransformMap(ob, slice, ob.getUnknownLoc()));
+  TransformMapAttr inverse =
+      invertTransformMap(ob, slice, ob.getUnknownLoc(), /*padSlices=*/true);
+  ASSERT_TRUE(inverse);
+  EXPECT_ARRAY_EQ(int64_t, inverse.getUpperBounds(), fullBounds);
+  EXPECT_ARRAY_EQ(int64_t, inverse.getLowerBounds(), slicedBounds);
+  EXPECT_EQ(inverse.getMap().getAffineMap(),
+            AffineMap::get(2, 0, {affD(0), affD(1) - affC(4)}, &context));
+}
+
 TEST_F(TMBuilderTest, Embed) {
   auto buildDown = makeTopDown({"a", "b", "c"}, {2, 3, 4});
   auto buildUp = makeBottomUp({"a"}, {24});
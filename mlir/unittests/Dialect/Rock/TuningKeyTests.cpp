@@ -0,0 +1,138 @@
+//===- TuningKeyTests.cpp - Tests for tuning problem keys -----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/Linalg/IR/Linalg.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Tuning/RockTuning.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class TuningKeyTest : public ::testing::Test {
+protected:
+  TuningKeyTest() {
+    context.loadDialect<RockDialect, arith::ArithDialect, func::FuncDialect,
+                        linalg::LinalgDialect, memref::MemRefDialect>();
+  }
+
+  ~TuningKeyTest() override { delete table; }
+
+  /// Parses a kernel computing a 64x32x64 f32 gemm into `%c`, followed by
+  /// `epilogue`, which may read the f16 `%bias` of type `!bias` and write the
+  /// f16 `%out`.
+  void parse(StringRef epilogue, StringRef biasType = "memref<1x64x64xf16>") {
+    std::string source = "!bias = " + biasType.str() + R"mlir(
+      !a = memref<1x64x32xf32>
+      !b = memref<1x32x64xf32>
+      !c = memref<1x64x64xf32>
+      !out = memref<1x64x64xf16>
+      #id = affine_map<(d0, d1, d2) -> (d0, d1, d2)>
+      func.func @gemm(%a: !a, %b: !b, %bias: !bias, %out: !out)
+          attributes {kernel, arch = "amdgcn-amd-amdhsa:gfx942"} {
+        %c = memref.alloc() : !c
+        rock.gemm %c = %a * %b features = none storeMethod = set {
+          arch = "amdgcn-amd-amdhsa:gfx942"} : !c = !a * !b
+      )mlir" + epilogue.str() +
+                         R"mlir(
+        return
+      }
+    )mlir";
+    module = parseSourceString<ModuleOp>(source, &context);
+    ASSERT_TRUE(module);
+  }
+
+  std::string getKey(bool withFusion) {
+    SmallString<256> key;
+    EXPECT_TRUE(succeeded(getTuningProblemStr(*module, key, withFusion)));
+    return key.str().str();
+  }
+
+  /// Returns the perf config the table has for the module, or "" if none.
+  std::string lookup() {
+    SmallString<64> config;
+    ModuleOp mod = *module;
+    if (failed(tuningTableLookup(table, mod, config)))
+      return "";
+    return config.str().str();
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+  TuningTable *table = tuningTableCreate();
+};
+
+/// Converts the gemm result to f16 and adds `%bias`, which is indexed by
+/// `biasMap`.
+static std::string makeBiasEpilogue(StringRef biasMap = "#id") {
+  return R"mlir(
+    linalg.generic {indexing_maps = [#id, )mlir" +
+         biasMap.str() + R"mlir(, #id],
+        iterator_types = ["parallel", "parallel", "parallel"]}
+        ins(%c, %bias : !c, !bias) outs(%out : !out) {
+    ^bb0(%x: f32, %y: f16, %o: f16):
+      %t = arith.truncf %x : f32 to f16
+      %s = arith.addf %t, %y : f16
+      linalg.yield %s : f16
+    }
+  )mlir";
+}
+
+static constexpr StringLiteral biasSignature =
+    " -fusion ops{arith.addf=1,arith.truncf=1}in{f16:id}out{f16}";
+
+TEST_F(TuningKeyTest, UnfusedKeyHasNoSignature) {
+  parse("");
+  EXPECT_EQ(getKey(/*withFusion=*/true), getKey(/*withFusion=*/false));
+}
+
+// The primary result itself isn't listed among the epilogue inputs.
+TEST_F(TuningKeyTest, SignatureDescribesEpilogue) {
+  parse(makeBiasEpilogue());
+  std::string plain = getKey(/*withFusion=*/false);
+  EXPECT_EQ(plain.find("-fusion"), std::string::npos);
+  EXPECT_EQ(getKey(/*withFusion=*/true), plain + biasSignature.str());
+}
+
+TEST_F(TuningKeyTest, SignatureDistinguishesBroadcasts) {
+  parse(makeBiasEpilogue("affine_map<(d0, d1, d2) -> (d2)>"),
+        "memref<64xf16>");
+  std::string fused = getKey(/*withFusion=*/true);
+  EXPECT_NE(fused, getKey(/*withFusion=*/false) + biasSignature.str());
+  EXPECT_NE(fused.find("in{f16:bcast}"), std::string::npos);
+}
+
+// Tables tuned before fusion signatures existed still apply, but a config
+// tuned for the fusion wins.
+TEST_F(TuningKeyTest, LookupFallsBackToPlainKey) {
+  parse(makeBiasEpilogue());
+  EXPECT_EQ(lookup(), "");
+  ASSERT_TRUE(tuningTableUpdate(table, getKey(/*withFusion=*/false),
+                                "v2:plain", 2.0f));
+  EXPECT_EQ(lookup(), "v2:plain");
+  ASSERT_TRUE(tuningTableUpdate(table, getKey(/*withFusion=*/true),
+                                "v2:fused", 3.0f));
+  EXPECT_EQ(lookup(), "v2:fused");
+}
+
+// A config tuned for one fusion isn't used for another.
+TEST_F(TuningKeyTest, LookupIgnoresOtherFusions) {
+  parse(makeBiasEpilogue());
+  ASSERT_TRUE(tuningTableUpdate(table, getKey(/*withFusion=*/true),
+                                "v2:fused", 1.0f));
+  parse(makeBiasEpilogue("affine_map<(d0, d1, d2) -> (d2)>"),
+        "memref<64xf16>");
+  EXPECT_EQ(lookup(), "");
+}
@@ -0,0 +1,242 @@
+//===- VarlenAttentionTests.cpp - Tests for variable-length attention -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Bufferization/IR/Bufferization.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/utility/builderUtils.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/SCF/Utils/Utils.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/Diagnostics.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/IR/Matchers.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class VarlenAttentionTest : public ::testing::Test {
+protected:
+  VarlenAttentionTest() : b(&context), loc(b.getUnknownLoc()) {
+    context.loadDialect<RockDialect, arith::ArithDialect,
+                        bufferization::BufferizationDialect, func::FuncDialect,
+                        memref::MemRefDialect, scf::SCFDialect,
+                        tensor::TensorDialect>();
+  }
+
+  /// Emits the index or i1 values returned by `build`, which reads the
+  /// sequence offsets `offsetsQ` and `offsetsK` from memrefs, then unrolls
+  /// and folds the IR until every value is a constant, and returns those
+  /// constants.
+  SmallVector<int64_t>
+  evaluate(ArrayRef<int32_t> offsetsQ, ArrayRef<int32_t> offsetsK,
+           function_ref<SmallVector<Value>(OpBuilder &, Value, Value)> build) {
+    module = ModuleOp::create(loc);
+    auto func = func::FuncOp::create(loc, "f", b.getFunctionType({}, {}));
+    module->push_back(func);
+    OpBuilder builder = OpBuilder::atBlockBegin(func.addEntryBlock());
+    auto makeOffsets = [&](ArrayRef<int32_t> offsets) -> Value {
+      auto tensorType = RankedTensorType::get(
+          {static_cast<int64_t>(offsets.size())}, b.getI32Type());
+      Value tensor = builder.create<arith::ConstantOp>(
+          loc, DenseElementsAttr::get(tensorType, offsets));
+      return builder.create<bufferization::ToMemrefOp>(
+          loc, MemRefType::get(tensorType.getShape(), b.getI32Type()),
+          tensor);
+    };
+    Value offsetsQVal = makeOffsets(offsetsQ);
+    Value offsetsKVal = makeOffsets(offsetsK);
+    SmallVector<Value> results = build(builder, offsetsQVal, offsetsKVal);
+    builder.create<func::ReturnOp>(loc, results);
+    func.setType(b.getFunctionType({}, ValueRange(results).getTypes()));
+
+    RewritePatternSet patterns(&context);
+    for (Dialect *dialect : context.getLoadedDialects())
+      dialect->getCanonicalizationPatterns(patterns);
+    for (RegisteredOperationName op : context.getRegisteredOperations())
+      op.getCanonicalizationPatterns(patterns, &context);
+    FrozenRewritePatternSet frozenPatterns(std::move(patterns));
+    // The sequence searches are loops whose bounds only become constant once
+    // the loops before them are gone.
+    for (int i = 0; i < 8; ++i) {
+      EXPECT_TRUE(
+          succeeded(applyPatternsAndFoldGreedily(func, frozenPatterns)));
+      SmallVector<scf::ForOp> loops;
+      func.walk([&](scf::ForOp loop) { loops.push_back(loop); });
+      if (loops.empty())
+        break;
+      for (scf::ForOp loop : loops) {
+        std::optional<int64_t> tripCount = constantTripCount(
+            loop.getLowerBound(), loop.getUpperBound(), loop.getStep());
+        if (tripCount && *tripCount > 1)
+          EXPECT_TRUE(succeeded(loopUnrollByFactor(loop, *tripCount)));
+      }
+    }
+
+    SmallVector<int64_t> constants;
+    for (Value result : func.front().getTerminator()->getOperands()) {
+      IntegerAttr constant;
+      EXPECT_TRUE(matchPattern(result, m_Constant(&constant)));
+      constants.push_back(constant ? constant.getValue().getZExtValue() : -1);
+    }
+    return constants;
+  }
+
+  Value index(OpBuilder &builder, int64_t value) {
+    return builder.create<arith::ConstantIndexOp>(loc, value);
+  }
+
+  /// Parses a varlen attention whose sequence offsets have the types
+  /// `offsetsQType` and `offsetsKType`, and returns the verifier error, if
+  /// any.
+  std::string verify(StringRef offsetsQType, StringRef offsetsKType) {
+    std::string source = (R"mlir(
+      func.func @attn(%q: memref<1x8x4xf16>, %k: memref<1x4x8xf16>,
+                      %v: memref<1x8x4xf16>, %oq: )mlir" +
+                          offsetsQType + ", %ok: " + offsetsKType + R"mlir(,
+                      %o: memref<1x8x4xf16>) {
+        rock.attention {
+          qk = %q * %k : memref<1x8x4xf16>, memref<1x4x8xf16>
+          qk = varlen(%oq, %ok : )mlir" +
+                          offsetsQType + ", " + offsetsKType + R"mlir()
+          %o = softmax(qk) * %v : memref<1x8x4xf16> -> memref<1x8x4xf16>
+        } {arch = "gfx942", features = #rock<GemmFeatures none>}
+        return
+      })mlir")
+                             .str();
+    std::string error;
+    ScopedDiagnosticHandler handler(&context, [&](Diagnostic &diag) {
+      error = diag.str();
+      return success();
+    });
+    OwningOpRef<ModuleOp> parsed =
+        parseSourceString<ModuleOp>(source, &context);
+    EXPECT_EQ(static_cast<bool>(parsed), error.empty()) << error;
+    return error;
+  }
+
+  MLIRContext context;
+  Builder b;
+  Location loc;
+  OwningOpRef<ModuleOp> module;
+};
+
+// Three packed sequences with 3, 5 and 2 queries and 4, 2 and 6 keys.
+static constexpr int32_t kOffsetsQ[] = {0, 3, 8, 10};
+static constexpr int32_t kOffsetsK[] = {0, 4, 6, 12};
+
+TEST_F(VarlenAttentionTest, TileRange) {
+  // Query tiles of 4 rows and KV tiles of 4 keys: {firstSeq, lastSeq,
+  // qBegin, qEnd, kBegin, kEnd of firstSeq, mBegin, mEnd}.
+  SmallVector<SmallVector<int64_t>> expected = {
+      {0, 1, 0, 3, 0, 4, 0, 2},
+      {1, 1, 3, 8, 4, 6, 1, 2},
+      {2, 2, 8, 10, 6, 12, 1, 3},
+  };
+  for (int64_t nBlock = 0; nBlock < 3; ++nBlock) {
+    SmallVector<int64_t> range = evaluate(
+        kOffsetsQ, kOffsetsK,
+        [&](OpBuilder &builder, Value offsetsQ, Value offsetsK) {
+          VarlenTileRange r = createVarlenTileRangeOps(
+              builder, loc, offsetsQ, offsetsK, index(builder, nBlock),
+              /*nPerBlock=*/4, /*mPerBlock=*/4, /*seqLenQ=*/10);
+          SmallVector<Value> values = {r.firstSeq, r.lastSeq};
+          llvm::append_range(values, r.firstSeqBounds);
+          values.push_back(r.mBegin);
+          values.push_back(r.mEnd);
+          return values;
+        });
+    EXPECT_EQ(range, expected[nBlock]) << "in query tile " << nBlock;
+  }
+}
+
+TEST_F(VarlenAttentionTest, FindSequence) {
+  SmallVector<int64_t> seqs = evaluate(
+      kOffsetsQ, kOffsetsK,
+      [&](OpBuilder &builder, Value offsetsQ, Value) {
+        SmallVector<Value> values;
+        for (int64_t q = 0; q < 10; ++q)
+          values.push_back(createFindSequenceOp(builder, loc, offsetsQ,
+                                                index(builder, q),
+                                                index(builder, 0),
+                                                index(builder, 2)));
+        return values;
+      });
+  EXPECT_EQ(seqs, SmallVector<int64_t>({0, 0, 0, 1, 1, 1, 1, 1, 2, 2}));
+}
+
+TEST_F(VarlenAttentionTest, MaskFirstQueryTile) {
+  // The first query tile holds rows 0-2 of sequence 0 and row 3 of sequence
+  // 1, whose keys are 0-3 and 4-5.
+  constexpr int64_t numKeys = 12;
+  SmallVector<int64_t> values = evaluate(
+      kOffsetsQ, kOffsetsK,
+      [&](OpBuilder &builder, Value offsetsQ, Value offsetsK) {
+        VarlenTileRange range = createVarlenTileRangeOps(
+            builder, loc, offsetsQ, offsetsK, index(builder, 0),
+            /*nPerBlock=*/4, /*mPerBlock=*/4, /*seqLenQ=*/10);
+        SmallVector<Value> results;
+        for (int64_t q = 0; q < 4; ++q) {
+          SmallVector<Value, 4> bounds;
+          for (int64_t k = 0; k < numKeys; ++k) {
+            auto [outOfSeq, qBounds] = createVarlenMaskOp(
+                builder, loc, offsetsQ, offsetsK, range,
+                range.firstSeqBounds, index(builder, q), index(builder, k));
+            results.push_back(outOfSeq);
+            bounds = qBounds;
+          }
+          llvm::append_range(results, bounds);
+        }
+        return results;
+      });
+  ASSERT_EQ(values.size(), 4u * (numKeys + 4));
+  for (int64_t q = 0; q < 4; ++q) {
+    ArrayRef<int64_t> row = ArrayRef<int64_t>(values).slice(
+        q * (numKeys + 4), numKeys + 4);
+    int64_t seq = q < 3 ? 0 : 1;
+    for (int64_t k = 0; k < numKeys; ++k) {
+      bool inSeq = kOffsetsK[seq] <= k && k < kOffsetsK[seq + 1];
+      EXPECT_EQ(row[k], inSeq ? 0 : 1) << "at q = " << q << ", k = " << k;
+    }
+    EXPECT_EQ(row.take_back(4),
+              ArrayRef<int64_t>({kOffsetsQ[seq], kOffsetsQ[seq + 1],
+                                 kOffsetsK[seq], kOffsetsK[seq + 1]}))
+        << "at q = " << q;
+  }
+}
+
+TEST_F(VarlenAttentionTest, VerifierAcceptsMatchingOffsets) {
+  EXPECT_EQ(verify("memref<4xi32>", "memref<4xi32>"), "");
+}
+
+TEST_F(VarlenAttentionTest, VerifierRejectsMismatchedOffsets) {
+  EXPECT_NE(verify("memref<4xi32>", "memref<3xi32>")
+                .find("same number of sequences"),
+            std::string::npos);
+}
+
+TEST_F(VarlenAttentionTest, VerifierRejectsMultiDimensionalOffsets) {
+  EXPECT_NE(verify("memref<2x2xi32>", "memref<2x2xi32>")
+                .find("one-dimensional"),
+            std::string::npos);
+}
+
+TEST_F(VarlenAttentionTest, VerifierRejectsEmptyBatch) {
+  EXPECT_NE(
+      verify("memref<1xi32>", "memref<1xi32>").find("at least one sequence"),
+      std::string::npos);
+}
@@ -0,0 +1,176 @@
+//===- VectorizeFusionsTests.cpp - Tests for fusion vectorization ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/GPU/IR/GPUDialect.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/Passes.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/Dialect/Vector/IR/VectorOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class VectorizeFusionsTest : public ::testing::Test {
+protected:
+  VectorizeFusionsTest() {
+    context.loadDialect<RockDialect, affine::AffineDialect, arith::ArithDialect,
+                        func::FuncDialect, gpu::GPUDialect,
+                        memref::MemRefDialect, scf::SCFDialect,
+                        vector::VectorDialect>();
+  }
+
+  /// Runs rock-vectorize-fusions on a kernel whose body is `body`, which has
+  /// the register buffers `%in` and `%out` of type `!reg`, holding 8 elements
+  /// of `elemType`, and the `elemType` constants `%zero` and `%slope`.
+  void run(StringRef body, StringRef elemType = "f32") {
+    std::string source = ("!reg = memref<8x" + elemType +
+                          R"mlir(, #gpu.address_space<private>>
+      func.func @kernel(%in: !reg, %out: !reg) attributes {kernel} {
+        %zero = arith.constant 0.0 : )mlir" +
+                          elemType + R"mlir(
+        %slope = arith.constant 0.5 : )mlir" +
+                          elemType + "\n" + body + R"mlir(
+        return
+      })mlir")
+                             .str();
+    module = parseSourceString<ModuleOp>(source, &context);
+    ASSERT_TRUE(module);
+    PassManager pm(&context);
+    pm.addNestedPass<func::FuncOp>(createRockVectorizeFusionsPass());
+    EXPECT_TRUE(succeeded(pm.run(*module)));
+  }
+
+  template <typename OpTy>
+  int64_t count() {
+    int64_t n = 0;
+    module->walk([&](OpTy) { ++n; });
+    return n;
+  }
+
+  /// Returns the widths of the register reads left in the kernel.
+  SmallVector<int64_t> getReadWidths() {
+    SmallVector<int64_t> widths;
+    module->walk([&](vector::TransferReadOp read) {
+      widths.push_back(read.getVectorType().getNumElements());
+    });
+    return widths;
+  }
+
+  MLIRContext context;
+  OwningOpRef<ModuleOp> module;
+};
+
+// A leaky ReLU written as a branch computes both sides and selects between
+// them four lanes at a time.
+TEST_F(VectorizeFusionsTest, VectorizesIfConvertedValues) {
+  run(R"mlir(
+    affine.for %i = 0 to 8 {
+      %x = affine.load %in[%i] : !reg
+      %pos = arith.cmpf ogt, %x, %zero : f32
+      %y = scf.if %pos -> f32 {
+        scf.yield %x : f32
+      } else {
+        %scaled = arith.mulf %x, %slope : f32
+        scf.yield %scaled : f32
+      }
+      affine.store %y, %out[%i] : !reg
+    }
+  )mlir");
+  EXPECT_EQ(count<scf::IfOp>(), 0);
+  EXPECT_EQ(getReadWidths(), SmallVector<int64_t>({4}));
+  SmallVector<arith::SelectOp> selects;
+  module->walk([&](arith::SelectOp op) { selects.push_back(op); });
+  ASSERT_EQ(selects.size(), 1u);
+  EXPECT_EQ(selects[0].getType(),
+            VectorType::get({4}, Float32Type::get(&context)));
+}
+
+// A store to registers guarded by a branch becomes a store of either the new
+// value or the one already there.
+TEST_F(VectorizeFusionsTest, VectorizesGuardedRegisterStores) {
+  run(R"mlir(
+    affine.for %i = 0 to 8 {
+      %x = affine.load %in[%i] : !reg
+      %neg = arith.cmpf olt, %x, %zero : f32
+      scf.if %neg {
+        %abs = arith.negf %x : f32
+        affine.store %abs, %out[%i] : !reg
+      }
+    }
+  )mlir");
+  EXPECT_EQ(count<scf::IfOp>(), 0);
+  // The loop reads both %in and the old value of %out.
+  EXPECT_EQ(getReadWidths(), SmallVector<int64_t>({4, 4}));
+  EXPECT_EQ(count<vector::TransferWriteOp>(), 1);
+  EXPECT_EQ(count<affine::AffineStoreOp>(), 0);
+}
+
+// A division by a loaded value may trap when the branch that guarded it isn't
+// taken, so the branch and its loop stay scalar.
+TEST_F(VectorizeFusionsTest, KeepsBranchesThatCantBeSpeculated) {
+  run(R"mlir(
+    %c0_i32 = arith.constant 0 : i32
+    %one = arith.constant 1 : i32
+    %num = memref.alloca() : memref<8xi32, #gpu.address_space<private>>
+    affine.for %i = 0 to 8 {
+      %d = affine.load %num[%i] : memref<8xi32, #gpu.address_space<private>>
+      %nonzero = arith.cmpi ne, %d, %c0_i32 : i32
+      %y = scf.if %nonzero -> i32 {
+        %q = arith.divsi %one, %d : i32
+        scf.yield %q : i32
+      } else {
+        scf.yield %one : i32
+      }
+      affine.store %y, %num[%i] : memref<8xi32, #gpu.address_space<private>>
+    }
+  )mlir");
+  EXPECT_EQ(count<scf::IfOp>(), 1);
+  EXPECT_TRUE(getReadWidths().empty());
+}
+
+// A row-major 2x4 register sub-tile is walked as one loop of 8, and the f16
+// values then fill one 128-bit register read.
+TEST_F(VectorizeFusionsTest, CollapsesContiguousNests) {
+  run(R"mlir(
+    affine.for %i = 0 to 2 {
+      affine.for %j = 0 to 4 {
+        %x = affine.load %in[%i * 4 + %j] : !reg
+        %y = arith.maximumf %x, %zero : f16
+        affine.store %y, %out[%i * 4 + %j] : !reg
+      }
+    }
+  )mlir",
+      "f16");
+  EXPECT_EQ(getReadWidths(), SmallVector<int64_t>({8}));
+}
+
+// Accesses that stride across the nest aren't contiguous, so the loops aren't
+// collapsed.
+TEST_F(VectorizeFusionsTest, KeepsTransposedNests) {
+  run(R"mlir(
+    affine.for %i = 0 to 2 {
+      affine.for %j = 0 to 4 {
+        %x = affine.load %in[%j * 2 + %i] : !reg
+        %y = arith.maximumf %x, %zero : f16
+        affine.store %y, %out[%i * 4 + %j] : !reg
+      }
+    }
+  )mlir",
+      "f16");
+  EXPECT_EQ(count<affine::AffineForOp>(), 2);
+}
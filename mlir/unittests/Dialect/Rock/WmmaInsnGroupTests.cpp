@@ -0,0 +1,68 @@
+//===- WmmaInsnGroupTests.cpp - Tests for wmma instruction selection ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/Dialect/Rock/IR/Rock.h"
+#include "mlir/Dialect/Rock/IR/WmmaInsnGroup.h"
+#include "mlir/Dialect/Rock/utility/AmdArchDb.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "gtest/gtest.h"
+
+using namespace mlir;
+using namespace mlir::rock;
+
+class WmmaInsnGroupTest : public ::testing::Test {
+protected:
+  WmmaInsnGroupTest() : b(&context) { context.getOrLoadDialect<RockDialect>(); }
+
+  MLIRContext context;
+  Builder b;
+};
+
+TEST_F(WmmaInsnGroupTest, Gfx12ArchInfo) {
+  AmdArchInfo info = lookupArchInfo("gfx1201");
+  EXPECT_EQ(info.waveSize, 32);
+  EXPECT_TRUE(bitEnumContainsAll(info.defaultFeatures, GemmFeatures::wmma));
+  EXPECT_TRUE(bitEnumContainsAll(
+      info.getDefaultFeatures(b.getFloat8E4M3FNType()), GemmFeatures::wmma));
+  EXPECT_FALSE(bitEnumContainsAll(
+      lookupArchInfo("gfx1100").getDefaultFeatures(b.getFloat8E4M3FNType()),
+      GemmFeatures::wmma));
+}
+
+TEST_F(WmmaInsnGroupTest, Gfx11DuplicatesK) {
+  FailureOr<WmmaInsn> insn =
+      WmmaInsn::select(b.getF16Type(), b.getF16Type(), "gfx1100", 32, 32);
+  ASSERT_TRUE(succeeded(insn));
+  EXPECT_EQ(insn->kBase, 16);
+  EXPECT_EQ(insn->outputStride, 2);
+  EXPECT_EQ(insn->argTypeA.getNumElements(), 16);
+  EXPECT_TRUE(insn->isCoherentWithK(/*kpack=*/4, /*kPerBlock=*/4));
+}
+
+TEST_F(WmmaInsnGroupTest, Gfx12SplitsK) {
+  FailureOr<WmmaInsn> insn =
+      WmmaInsn::select(b.getF16Type(), b.getF16Type(), "gfx1201", 32, 32);
+  ASSERT_TRUE(succeeded(insn));
+  EXPECT_EQ(insn->kBase, 8);
+  EXPECT_EQ(insn->outputStride, 1);
+  EXPECT_EQ(insn->argTypeA.getNumElements(), 8);
+  EXPECT_TRUE(insn->isCoherentWithK(/*kpack=*/4, /*kPerBlock=*/4));
+  // Each half of the wave needs whole kBase-long slices of k.
+  EXPECT_FALSE(insn->isCoherentWithK(/*kpack=*/8, /*kPerBlock=*/3));
+  EXPECT_FALSE(insn->isCoherentWithK(/*kpack=*/16, /*kPerBlock=*/1));
+}
+
+TEST_F(WmmaInsnGroupTest, OcpFp8OnlyOnGfx12) {
+  Type fp8 = b.getFloat8E4M3FNType(), bf8 = b.getFloat8E5M2Type();
+  EXPECT_TRUE(succeeded(WmmaInsn::select(fp8, fp8, "gfx1200", 16, 16)));
+  EXPECT_TRUE(succeeded(WmmaInsn::select(bf8, bf8, "gfx1200", 16, 16)));
+  EXPECT_TRUE(failed(WmmaInsn::select(fp8, fp8, "gfx1100", 16, 16)));
+  EXPECT_TRUE(failed(WmmaInsn::select(fp8, fp8, "gfx942", 16, 16)));
+}